@@ -9,7 +9,7 @@ ROOTLIBS = $$system( root-config --glibs )
 
 QMAKE_CXXFLAGS = $$ROOTFLAGS -Wall -W -std=c++11 -fPIC -m64 -O3 -march=native
 QMAKE_CFLAGS += -Wall -W -fPIC -m64 -O3 -march=native
-LIBS += $$ROOTLIBS
+LIBS += $$ROOTLIBS -lrt
 
 SCRIPTDIR = $$PWD/scripts
 
@@ -24,19 +24,37 @@ INCLUDEPATH +=  source \
 SOURCES += source/main.cpp \
         source/export/src/RootWriter.cpp \
         source/export/src/MamaWriter.cpp \
+        source/export/src/LiveServer.cpp \
+        source/export/src/ShmPublisher.cpp \
+        source/export/src/SnapshotWriter.cpp \
+        source/export/src/BinaryWriter.cpp \
+        source/export/src/BinaryReader.cpp \
+        source/export/src/Checkpoint.cpp \
+        source/export/src/SortCache.cpp \
+        source/export/src/SkimWriter.cpp \
+        source/export/src/EventWriter.cpp \
         source/core/src/OfflineSorting.cpp \
         source/core/src/TDRRoutine.cpp \
         source/core/src/Unpacker.cpp \
         source/system/src/aptr.ipp \
         source/system/src/RateMeter.cpp \
+        source/system/src/RunParallel.cpp \
+        source/system/src/JobQueue.cpp \
+        source/system/src/SortStats.cpp \
         source/system/src/FileReader.cpp \
         source/system/src/IOPrintf.cpp \
         source/system/src/MTFileBufferFetcher.cpp \
         source/system/src/STFileBufferFetcher.cpp \
+        source/system/src/HitBufferFetcher.cpp \
+        source/system/src/HitReader.cpp \
+        source/system/src/HitWriter.cpp \
         source/types/src/Histograms.cpp \
         source/types/src/Histogram1D.cpp \
         source/types/src/Histogram2D.cpp \
         source/types/src/Histogram3D.cpp \
+        source/types/src/FillPlan.cpp \
+        source/types/src/FillStage.cpp \
+        source/types/src/EventColumns.cpp \
     	source/types/src/Parameters.cpp \
         source/types/src/ParticleRange.cpp \
         source/userroutine/src/UserSort.cpp \
@@ -47,11 +65,26 @@ SOURCES += source/main.cpp \
 HEADERS += source/DefineFile.h \
         source/export/include/RootWriter.h \
         source/export/include/MamaWriter.h \
+        source/export/include/LiveServer.h \
+        source/export/include/ShmFormat.h \
+        source/export/include/ShmPublisher.h \
+        source/export/include/SnapshotWriter.h \
+        source/export/include/BinaryFormat.h \
+        source/export/include/BinaryWriter.h \
+        source/export/include/BinaryReader.h \
+        source/export/include/Checkpoint.h \
+        source/export/include/SortCache.h \
+        source/export/include/SkimWriter.h \
+        source/export/include/EventFormat.h \
+        source/export/include/EventWriter.h \
         source/core/include/TDRRoutine.h \
         source/core/include/OfflineSorting.h \
         source/core/include/UserRoutine.h \
         source/core/include/Unpacker.h \
         source/system/include/RateMeter.h \
+        source/system/include/RunParallel.h \
+        source/system/include/JobQueue.h \
+        source/system/include/SortStats.h \
         source/system/include/FileReader.h \
         source/system/include/aptr.h \
         source/system/include/IOPrintf.h \
@@ -59,11 +92,19 @@ HEADERS += source/DefineFile.h \
         source/system/include/FileBufferFetcher.h \
         source/system/include/MTFileBufferFetcher.h \
         source/system/include/STFileBufferFetcher.h \
+        source/system/include/HitBufferFetcher.h \
+        source/system/include/HitFormat.h \
+        source/system/include/HitReader.h \
+        source/system/include/HitWriter.h \
         source/types/include/Event.h \
         source/types/include/Histograms.h \
         source/types/include/Histogram1D.h \
         source/types/include/Histogram2D.h \
         source/types/include/Histogram3D.h \
+        source/types/include/BinContent.h \
+        source/types/include/FillPlan.h \
+        source/types/include/FillStage.h \
+        source/types/include/EventColumns.h \
         source/types/include/Parameters.h \
         source/types/include/ParticleRange.h \
         source/userroutine/include/UserSort.h \
@@ -0,0 +1,22 @@
+TEMPLATE = app
+TARGET = evtool
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+
+ROOTFLAGS = $$system( root-config --cflags )
+ROOTLIBS = $$system( root-config --glibs )
+
+QMAKE_CXXFLAGS = $$ROOTFLAGS -Wall -W -std=c++11 -fPIC -m64 -O3 -march=native
+LIBS += $$ROOTLIBS
+
+INCLUDEPATH +=  source \
+                source/export/include
+
+
+SOURCES += source/evtool.cpp \
+        source/export/src/EventReader.cpp
+
+HEADERS += source/export/include/EventFormat.h \
+        source/export/include/EventReader.h
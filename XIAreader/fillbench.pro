@@ -0,0 +1,30 @@
+TEMPLATE = app
+TARGET = fillbench
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+
+QMAKE_CXXFLAGS = -Wall -W -std=c++11 -fPIC -m64 -O3 -march=native
+LIBS += -pthread
+
+INCLUDEPATH +=  source \
+                source/system/include \
+                source/types/include
+
+
+SOURCES += source/fillbench.cpp \
+        source/system/src/SortStats.cpp \
+        source/types/src/Histograms.cpp \
+        source/types/src/Histogram1D.cpp \
+        source/types/src/Histogram2D.cpp \
+        source/types/src/Histogram3D.cpp \
+        source/types/src/FillStage.cpp
+
+HEADERS += source/system/include/SortStats.h \
+        source/types/include/Histograms.h \
+        source/types/include/Histogram1D.h \
+        source/types/include/Histogram2D.h \
+        source/types/include/Histogram3D.h \
+        source/types/include/BinContent.h \
+        source/types/include/FillStage.h
@@ -0,0 +1,52 @@
+TEMPLATE = app
+TARGET = histtool
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+
+ROOTFLAGS = $$system( root-config --cflags )
+ROOTLIBS = $$system( root-config --glibs )
+
+QMAKE_CXXFLAGS = $$ROOTFLAGS -Wall -W -std=c++11 -fPIC -m64 -O3 -march=native
+LIBS += $$ROOTLIBS -lrt
+
+INCLUDEPATH +=  source \
+                source/export/include \
+                source/system/include \
+                source/types/include
+
+
+SOURCES += source/histtool.cpp \
+        source/export/src/BinaryReader.cpp \
+        source/export/src/BinaryWriter.cpp \
+        source/export/src/RootWriter.cpp \
+        source/export/src/MamaWriter.cpp \
+        source/export/src/LiveServer.cpp \
+        source/export/src/ShmPublisher.cpp \
+        source/system/src/IOPrintf.cpp \
+        source/system/src/RunParallel.cpp \
+        source/system/src/SortStats.cpp \
+        source/types/src/Histograms.cpp \
+        source/types/src/Histogram1D.cpp \
+        source/types/src/Histogram2D.cpp \
+        source/types/src/Histogram3D.cpp \
+        source/types/src/FillStage.cpp
+
+HEADERS += source/export/include/BinaryFormat.h \
+        source/export/include/BinaryReader.h \
+        source/export/include/BinaryWriter.h \
+        source/export/include/RootWriter.h \
+        source/export/include/MamaWriter.h \
+        source/export/include/LiveServer.h \
+        source/export/include/ShmFormat.h \
+        source/export/include/ShmPublisher.h \
+        source/system/include/IOPrintf.h \
+        source/system/include/RunParallel.h \
+        source/system/include/SortStats.h \
+        source/types/include/Histograms.h \
+        source/types/include/Histogram1D.h \
+        source/types/include/Histogram2D.h \
+        source/types/include/Histogram3D.h \
+        source/types/include/BinContent.h \
+        source/types/include/FillStage.h
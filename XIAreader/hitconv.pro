@@ -0,0 +1,27 @@
+TEMPLATE = app
+TARGET = hitconv
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+
+QMAKE_CXXFLAGS = -Wall -W -std=c++11 -fPIC -m64 -O3 -march=native
+QMAKE_CFLAGS += -Wall -W -fPIC -m64 -O3 -march=native
+
+INCLUDEPATH +=  source \
+                source/system/include \
+                source/types/include
+
+
+SOURCES += source/hitconv.cpp \
+        source/system/src/FileReader.cpp \
+        source/system/src/HitWriter.cpp \
+        source/types/src/XIA_CFD.c \
+        experimentsetup.c
+
+HEADERS += experimentsetup.h \
+        source/system/include/FileReader.h \
+        source/system/include/HitFormat.h \
+        source/system/include/HitWriter.h \
+        source/system/include/WordBuffer.h \
+        source/types/include/XIA_CFD.h
@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = listgen
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+
+QMAKE_CXXFLAGS = -Wall -W -std=c++11 -fPIC -m64 -O3 -march=native
+QMAKE_CFLAGS += -Wall -W -fPIC -m64 -O3 -march=native
+
+INCLUDEPATH +=  source \
+                source/system/include
+
+
+SOURCES += source/listgen.cpp \
+        experimentsetup.c
+
+HEADERS += experimentsetup.h
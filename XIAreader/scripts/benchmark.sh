@@ -0,0 +1,50 @@
+#!/bin/bash
+# Measure the sorting throughput on synthetic list mode data.
+#
+# Run like:
+#   scripts/benchmark.sh [listgen options]
+#
+# A data file is written with listgen and the given options, then sorted
+# REPEAT times by XIAreader. The stage times of each run are printed, and
+# the hits/s and events/s of the fastest run at the end. Settings are
+# taken from the environment:
+#   XIAREADER  the sorting program   (default ./XIAreader)
+#   LISTGEN    the generator         (default ./listgen)
+#   REPEAT     runs to make          (default 3)
+#   THREADS    sorting threads       (default 1)
+#   BATCH      batch file with histograms and parameters, read before the data
+#   WORKDIR    where to put the data (default a new directory in /tmp)
+
+XIAREADER=${XIAREADER:-./XIAreader}
+LISTGEN=${LISTGEN:-./listgen}
+REPEAT=${REPEAT:-3}
+THREADS=${THREADS:-1}
+WORKDIR=${WORKDIR:-$(mktemp -d /tmp/xiabench.XXXXXX)}
+
+mkdir -p "$WORKDIR" || exit 1
+"$LISTGEN" "$@" "$WORKDIR/bench.data" || exit 1
+
+best=""
+for (( r = 1 ; r <= REPEAT ; ++r )); do
+    json="$WORKDIR/run$r.json"
+    {
+        [ -n "$BATCH" ] && cat "$BATCH"
+        [ "$THREADS" -gt 1 ] && echo "routine threads $THREADS"
+        echo "stats json $json"
+        echo "data file $WORKDIR/bench.data"
+    } > "$WORKDIR/bench.batch"
+
+    echo "Run $r of $REPEAT"
+    "$XIAREADER" "$WORKDIR/bench.batch" | sed -n "/^stats '/,/^[^ ]/p" | sed '$d'
+
+    # The first numbers in the file are those of the data file.
+    line=$(awk -F'[:,]' '/"seconds"/ && !s { s = $2 } /"events"/ && !e { e = $2 } /"hits"/ && !h { h = $2 }
+                         END { if ( s > 0 ) printf "%.3f %.4g %.4g\n", s, h/s, e/s }' "$json")
+    if [ -n "$line" ] && { [ -z "$best" ] || awk -v a="${line%% *}" -v b="${best%% *}" 'BEGIN { exit !(a < b) }'; }; then
+        best=$line
+    fi
+done
+
+read seconds hits events <<< "$best"
+echo "Fastest of $REPEAT runs: $seconds s, $hits hits/s, $events events/s end to end"
+echo "Data and stats are in $WORKDIR"
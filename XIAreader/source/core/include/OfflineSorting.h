@@ -24,8 +24,12 @@
 #include <string>
 #include <memory>
 #include <atomic>
+#include <chrono>
+#include <vector>
 
 #include "RateMeter.h"
+#include "SortStats.h"
+#include "Checkpoint.h"
 #include "Event.h"
 
 //#define MTSORTING
@@ -34,6 +38,14 @@ class FileBufferFetcher;
 class Unpacker;
 class UserRoutine;
 class WordBuffer;
+class SortWorker;
+class SnapshotWriter;
+class LiveServer;
+class ShmPublisher;
+class SortCache;
+class SkimWriter;
+class EventWriter;
+class HitWriter;
 
 
 struct FormatStr {
@@ -54,6 +66,12 @@ struct FormatStr {
 class OfflineSorting {
 public:
 
+    //! Function creating a new sorting routine.
+    /*! Used by the 'routine add' command to register additional routines
+     *  that are fed from the same data pass.
+     */
+    typedef UserRoutine* (*RoutineFactory)();
+
     //! Initialize sorting session.
     /*! By default, no maximum buffer number is set and the files are
      *  read using MTFileBufferFetcher.
@@ -67,14 +85,28 @@ public:
     OfflineSorting(UserRoutine& us,		/*!< Sorting routine		*/
                    FormatStr *fs		/*!< Buffer fetcher type	*/);
 
+    //! Initialize sorting session with a routine factory.
+    /*! A first routine named "default" is created and started. Further
+     *  routines can be added from the batch file with 'routine add'.
+     */
+    OfflineSorting(RoutineFactory factory   /*!< Function creating new sorting routines. */);
+
     //! Destructor.
     ~OfflineSorting();
 
     //! Run all the commands in the batch file.
-    void Run(const std::string &batchfilename	/*!< Filename of the batch file to read.	*/);
+    /*! When resuming, the commands before the position saved by the
+     *  'checkpoint' command of the batch file are run, except 'data',
+     *  'export' and 'reset_histograms', so histograms, gates and
+     *  parameters are declared again. Then the histograms of the
+     *  checkpoint are added, and the sorting continues from the data
+     *  file and buffer where the checkpoint was written.
+     */
+    void Run(const std::string &batchfilename,	/*!< Filename of the batch file to read.	*/
+             bool resume=false                  /*!< Continue from the checkpoint of an earlier run. */);
 
     // Convinient helper for a short main() routine.
-    /*! Can be use as following:
+    /*! The command line is '[--resume] <batchfile>'. Can be use as following:
      *  \code
      *  int main(int argc, char* argv[])
      *  {
@@ -100,6 +132,32 @@ public:
                    int argc,                /*!< No. of command line arguments.                             				*/
                    char *argv[]             /*!< The command line arguments.                                				*/);
 
+    //! Overload of Run.
+    /*! Allows the batch file to register several instances of the sorting
+     *  routine, each fed with every event of a single data pass:
+     *  \code
+     *  static UserRoutine* NewUserSort() { return new UserSort(); }
+     *
+     *  int main(int argc, char* argv[])
+     *  {
+     *      return OfflineSorting::Run(NewUserSort, argc, argv);
+     *  }
+     *  \endcode
+     */
+    static int Run(RoutineFactory factory,  /*!< Function creating new sorting routines.   */
+                   int argc,                /*!< No. of command line arguments.             */
+                   char *argv[]             /*!< The command line arguments.                */);
+
+    //! Register an additional sorting routine.
+    /*! The session takes ownership of the routine. Start() is not called.
+     *  \return true if added, false if the name is already in use.
+     */
+    bool AddRoutine(const std::string& name,    /*!< Name used in 'routine' commands.   */
+                    UserRoutine* ur             /*!< The routine to add.                */);
+
+    //! Call End() on all routines owned by the session.
+    void End();
+
     //! Set the maximum number of buffers to read per file.
     void SetMaxBuffers(int maxBuffers	/*!< The maximum buffer count.	*/);
 
@@ -111,7 +169,8 @@ public:
      */
     bool SortFile(const std::string filename,   /*!< The name of the file to read.  */
                   int begin,              		/*!< Where to begin.                */
-                  int end                		/*!< Where to end.                  */);
+                  int end,               		/*!< Where to end.                  */
+                  bool decoded=false            /*!< Whether the file is a decoded hit file. */);
 
 protected:
     //! Sort one buffer.
@@ -120,8 +179,45 @@ protected:
     bool SortBuffer(const WordBuffer* buffer /*!< The buffer to sort. */);
 
 private:
-    //! Variable to contain user routine.
-    UserRoutine& userSort;
+    //! A sorting routine fed by this session.
+    struct Routine {
+        std::string name;       //!< Name used to address the routine in the batch file.
+        UserRoutine* routine;   //!< The routine itself.
+        bool owned;             //!< Whether the session deletes the routine.
+        bool selected;          //!< Whether batch commands are passed to the routine.
+        std::vector<UserRoutine*> helpers;  //!< Instances sorting in the other threads, owned.
+        std::vector<std::string> commands;  //!< Commands given to the routine, for new helpers.
+    };
+
+    //! The routines receiving every event.
+    std::vector<Routine> routines;
+
+    //! Function used to create routines in 'routine add'.
+    RoutineFactory factory;
+
+    //! Sort the routines in parallel, one thread per routine.
+    bool parallel;
+
+    //! Number of threads sorting each routine, each taking every n-th buffer.
+    int threads;
+
+    //! Bytes left for copies of histograms for the extra threads.
+    size_t copy_budget;
+
+    //! Copy of the buffer being sorted by each thread.
+    std::vector<std::unique_ptr<WordBuffer> > slot_buffers;
+
+    //! Whether each thread is sorting a buffer.
+    std::vector<bool> slot_busy;
+
+    //! The thread to be given the next buffer.
+    int next_slot;
+
+    //! Worker threads used when sorting in parallel.
+    /*! With several threads per routine, the workers of thread t are
+     *  at t*routines.size().
+     */
+    std::vector<std::unique_ptr<SortWorker> > workers;
 
     //! Write to command line.
     bool is_tty;
@@ -132,6 +228,15 @@ private:
     //! Filereader object.
     std::unique_ptr<FileBufferFetcher> bufferFetcher;
 
+    //! Reader of decoded hit files, created when first used.
+    std::unique_ptr<FileBufferFetcher> hitFetcher;
+
+    //! The directory to write decoded hit files into, empty if none.
+    std::string decode_directory;
+
+    //! Writer of the decoded hits of the file being sorted, 0 if none.
+    std::unique_ptr<HitWriter> hitWriter;
+
     //! Object performing unpacking of the data.
     std::unique_ptr<Unpacker> unpacker;
 
@@ -144,6 +249,262 @@ private:
     //! Number of events unpacked.
     int nEvents;
 
+    //! Time spent in each stage for the file being sorted.
+    SortStats file_stats;
+
+    //! Time spent in each stage for all files since the start or 'stats reset'.
+    SortStats run_stats;
+
+    //! When run_stats were started.
+    std::chrono::steady_clock::time_point run_start;
+
+    //! Name and stats of each file sorted since the start or 'stats reset'.
+    std::vector<std::pair<std::string, SortStats> > file_history;
+
+    //! File to write the stats into at the end, empty if none.
+    std::string stats_json;
+
+    //! Writer for background exports, created when first used.
+    std::unique_ptr<SnapshotWriter> snapshots;
+
+    //! Routines and file names for periodic exports while sorting.
+    std::vector<std::pair<size_t, std::string> > periodic;
+
+    //! Time between periodic exports.
+    std::chrono::steady_clock::duration periodic_interval;
+
+    //! When the next periodic export is due.
+    std::chrono::steady_clock::time_point periodic_next;
+
+    //! Routines and their servers for live histograms while sorting.
+    std::vector<std::pair<size_t, std::unique_ptr<LiveServer> > > live;
+
+    //! Time between snapshots for the live servers.
+    std::chrono::steady_clock::duration live_interval;
+
+    //! When the next snapshot for the live servers is due.
+    std::chrono::steady_clock::time_point live_next;
+
+    //! Routines and their publishers of histograms in shared memory.
+    std::vector<std::pair<size_t, std::unique_ptr<ShmPublisher> > > shm;
+
+    //! Writer of checkpoints, 0 if none.
+    std::unique_ptr<Checkpoint> checkpoint;
+
+    //! Time between checkpoints while sorting.
+    std::chrono::steady_clock::duration checkpoint_interval;
+
+    //! When the next checkpoint is due.
+    std::chrono::steady_clock::time_point checkpoint_next;
+
+    //! Cache of the histograms sorted from each data file, 0 if none.
+    std::unique_ptr<SortCache> cache;
+
+    //! The histograms of each routine before the data file being sorted
+    //! for the cache, which is sorted into emptied histograms; else empty.
+    std::vector<std::unique_ptr<Histograms> > cache_aside;
+
+    //! Writer of the skim, 0 if none.
+    std::unique_ptr<SkimWriter> skim;
+
+    //! The routine selecting the events of the skim, -1 to select by trigger.
+    int skim_routine;
+
+    //! The detector type of the trigger hits when skimming by trigger.
+    DetectorType skim_trigger;
+
+    //! Largest time difference to a trigger hit when skimming by trigger, in ns.
+    int64_t skim_window;
+
+    //! The hits of the buffer kept in the skim.
+    std::vector<char> skim_keep;
+
+    //! Writer of the event columns, 0 if none.
+    std::unique_ptr<EventWriter> events;
+
+    //! The routine whose event columns are written.
+    int events_routine;
+
+    //! The batch file being run.
+    std::string batch_name;
+
+    //! The number of the batch command being run, counting from 1.
+    int batch_number;
+
+    //! Whether --resume was given and no 'checkpoint' command was seen yet.
+    bool resume_requested;
+
+    //! Whether commands are skipped until the position of resume_at.
+    bool resuming;
+
+    //! The checkpoint to continue from.
+    Checkpoint::State resume_at;
+
+    //! The buffer the next 'data' command starts at, -1 if as given.
+    int resume_buffer;
+
+    //! Get the writer for background exports.
+    /*! \return the writer, started if needed.
+     */
+    SnapshotWriter& Snapshots();
+
+    //! Write snapshots for the periodic exports, if due.
+    /*! Skipped while the previous snapshots are still being written.
+     *  \return the number of buffers with errors.
+     */
+    int PeriodicExport();
+
+    //! Copy the histograms of a routine, with those set aside for the cache.
+    /*! \return the copy.
+     */
+    std::unique_ptr<Histograms> Snapshot(size_t routine,  /*!< The routine. */
+                                         bool filled_only /*!< Leave out histograms without entries. */);
+
+    //! Give the live servers new snapshots, if due.
+    /*! After a snapshot, the next is due after the interval, or after 50
+     *  times the time the snapshot took if that is longer.
+     *  \return the number of buffers with errors.
+     */
+    int PublishLive();
+
+    //! Copy histograms into shared memory, if due.
+    /*! \return the number of buffers with errors.
+     */
+    int PublishShm(bool all /*!< Copy also the histograms not due yet, e.g. at the end of a file. */);
+
+    //! Write a checkpoint in the background.
+    /*! \return the number of buffers with errors.
+     */
+    int WriteCheckpoint(int line,                   /*!< The batch command to continue with. */
+                        const std::string& data,    /*!< The data file being sorted, if buffer is not -1. */
+                        int buffer                  /*!< The buffer to continue with, or -1 to run the command. */);
+
+    //! Write a checkpoint, if due.
+    /*! After a checkpoint, the next is due after the interval, or after
+     *  50 times the time the snapshot took if that is longer.
+     *  \return the number of buffers with errors.
+     */
+    int PeriodicCheckpoint(int line,                /*!< The batch command to continue with. */
+                           const std::string& data, /*!< The data file being sorted, if buffer is not -1. */
+                           int buffer               /*!< The buffer to continue with, or -1 to run the command. */);
+
+    //! Get the cache key of sorting a data file.
+    /*! The key covers the data file, the buffers sorted, the commands
+     *  given to each routine with the files they name, e.g. gain files,
+     *  and the program itself.
+     *  \return true if the data file could be identified.
+     */
+    bool CacheKey(const std::string& filename,  /*!< The data file. */
+                  int buf_start,                /*!< The first buffer sorted. */
+                  int buf_end,                  /*!< The end of the buffers sorted, -1 for all. */
+                  uint64_t& key                 /*!< Set to the key. */) const;
+
+    //! Check if a command is skipped while resuming, and restore the checkpoint when reaching its position.
+    /*! \return 1 to skip the command, 0 to run it, or -1 if the checkpoint could not be restored.
+     */
+    int Resume(const std::string& cmd /*!< The command. */);
+
+    //! Complete and print the stats of a file, and add them to the run.
+    void FinishFileStats(const std::string& filename,  /*!< The file sorted. */
+                         FileBufferFetcher* fetcher,    /*!< The fetcher that read the file. */
+                         const std::chrono::steady_clock::time_point& start, /*!< When sorting the file began. */
+                         int buffer_count,              /*!< Buffers sorted. */
+                         int bad_buffer_count           /*!< Buffers with errors. */);
+
+    //! Write the stats of all files as JSON.
+    /*! \return true if the file was written.
+     */
+    bool WriteStatsJSON(const std::string& filename /*!< The file to write. */);
+
+    //! Get the stats of all files, with the wall time since they were started.
+    /*! \return run_stats, updated.
+     */
+    SortStats& RunStats();
+
+    //! Start or stop the parallel sorting threads as needed.
+    void UpdateWorkers();
+
+    //! Create the instances of a routine for the extra threads.
+    void AddHelpers(Routine& r /*!< The routine to add instances for. */);
+
+    //! Wait until a thread has sorted its buffer.
+    /*! The hits kept by the routine of the skim and the event columns
+     *  are written.
+     *  \return true if the buffer was sorted without errors.
+     */
+    bool WaitSlot(int slot /*!< The thread to wait for. */);
+
+    //! Wait for all threads, and add the copies of the extra instances.
+    /*! \return the number of buffers with errors.
+     */
+    int FinishBuffers();
+
+    //! Name of an export file for one routine.
+    /*! If more than one routine is selected, the routine name is appended
+     *  to the file name before the extension.
+     *  \return the name of the file to write.
+     */
+    std::string ExportName(const std::string& filename,    /*!< File name from the batch file. */
+                           const Routine& r                 /*!< Routine to export.             */) const;
+
+    //! Number of routines currently receiving commands.
+    int SelectedCount() const;
+
+    //! Handles 'routine' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool routine_command(std::istream& icmd);
+
+    //! Handles 'stats' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool stats_command(std::istream& icmd);
+
+    //! Handles 'live' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool live_command(std::istream& icmd);
+
+    //! Handles 'shm' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool shm_command(std::istream& icmd);
+
+    //! Handles 'checkpoint' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool checkpoint_command(std::istream& icmd);
+
+    //! Write the rest of the skim and close it, if any.
+    void CloseSkim();
+
+    //! Handles 'skim' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool skim_command(std::istream& icmd);
+
+    //! Set whether all instances of a routine add rows to their event columns.
+    void EnableColumns(Routine& r,  /*!< The routine. */
+                       bool on      /*!< Whether rows are added. */);
+
+    //! Write the rest of the event columns and close the file, if any.
+    void CloseEvents();
+
+    //! Handles 'events' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool events_command(std::istream& icmd);
+
+    //! Handles 'decode' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool decode_command(std::istream& icmd);
+
+    //! Handles 'cache' commands.
+    /*! \return true if everything is okey; else false.
+     */
+    bool cache_command(std::istream& icmd);
+
     //! Handles 'export' commands.
     /*!
      *  \return true if everything is okey; else false.
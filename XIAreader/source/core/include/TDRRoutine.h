@@ -24,6 +24,7 @@
 #include "UserRoutine.h"
 #include "Histograms.h"
 #include "ParticleRange.h"
+#include "FillPlan.h"
 
 
 #include <string>
@@ -76,6 +77,12 @@ protected:
     //! Range curve
     ParticleRange range;
 
+    //! Histograms and event columns declared in the batch file.
+    /*! The implementation registers its variables with plan.Define(),
+     *  sets them for each event and calls plan.Fill().
+     */
+    FillPlan plan;
+
 
 	//! Create all spectra.
 	/*! This method must be implemented in a class deriving from TDRRoutine.
@@ -95,6 +102,20 @@ protected:
         return GetHistograms().Create1D(name, title, channels, left, right, xtitle);
     }
 
+	//! Create a 1D histogram counting with bins of type T, e.g. Spec<uint32_t>(...).
+    /*! \return a pointer to a new 1D histogram.
+     */
+	template<typename T>
+	Histogram1Dp Spec( const std::string& name,		/*!< The name of the new histogram.		*/
+					   const std::string& title,	/*!< The title of the new histogram.	*/
+					   int channels,				/*!< The number of regular bins.		*/
+					   Axis::bin_t left,			/*!< The lower edge of the lowest bin.	*/
+					   Axis::bin_t right,			/*!< The upper edge of the highest bin.	*/
+                       const std::string& xtitle	/*!< The title of the x axis.			*/)
+    {
+        return GetHistograms().Create1D(name, title, channels, left, right, xtitle, BinTypeOf<T>::value);
+    }
+
 	//! Create a 2D histogram.
     /*! \return a pointer to a new 2D histogram.
      */
@@ -107,9 +128,74 @@ protected:
 					  int ch2,						/*!< The number of regular bins of the y axis.			*/
                       Axis::bin_t l2,				/*!< The lower edge of the lowest bin on the y axis.	*/
                       Axis::bin_t r2,				/*!< The upper edge of the highest bin on the y axis.	*/
-                      const std::string& ytitle		/*!< The title of the y axis.							*/)
+                      const std::string& ytitle,	/*!< The title of the y axis.							*/
+                      HistogramStorage storage=DenseStorage /*!< How to store the bin contents.		*/)
+    {
+        return GetHistograms().Create2D(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, storage);
+    }
+
+	//! Create a 2D histogram counting with bins of type T, e.g. Mat<double>(...).
+    /*! \return a pointer to a new 2D histogram.
+     */
+	template<typename T>
+	Histogram2Dp Mat( const std::string& name,		/*!< The name of the new histogram.						*/
+					  const std::string& title,		/*!< The title of the new histogram.					*/
+					  int ch1,						/*!< The number of regular bins of the x axis.			*/
+                      Axis::bin_t l1,				/*!< The lower edge of the lowest bin on the x axis.	*/
+                      Axis::bin_t r1,				/*!< The upper edge of the highest bin on the x axis.	*/
+					  const std::string& xtitle,	/*!< The title of the x axis.							*/
+					  int ch2,						/*!< The number of regular bins of the y axis.			*/
+                      Axis::bin_t l2,				/*!< The lower edge of the lowest bin on the y axis.	*/
+                      Axis::bin_t r2,				/*!< The upper edge of the highest bin on the y axis.	*/
+                      const std::string& ytitle,	/*!< The title of the y axis.							*/
+                      HistogramStorage storage=DenseStorage /*!< How to store the bin contents.		*/)
+    {
+        return GetHistograms().Create2D(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, storage, BinTypeOf<T>::value);
+    }
+
+	//! Create a 3D histogram.
+    /*! \return a pointer to a new 3D histogram.
+     */
+	Histogram3Dp Cube( const std::string& name,		/*!< The name of the new histogram.						*/
+					   const std::string& title,	/*!< The title of the new histogram.					*/
+					   int ch1,						/*!< The number of regular bins of the x axis.			*/
+                       Axis::bin_t l1,				/*!< The lower edge of the lowest bin on the x axis.	*/
+                       Axis::bin_t r1,				/*!< The upper edge of the highest bin on the x axis.	*/
+					   const std::string& xtitle,	/*!< The title of the x axis.							*/
+					   int ch2,						/*!< The number of regular bins of the y axis.			*/
+                       Axis::bin_t l2,				/*!< The lower edge of the lowest bin on the y axis.	*/
+                       Axis::bin_t r2,				/*!< The upper edge of the highest bin on the y axis.	*/
+                       const std::string& ytitle,	/*!< The title of the y axis.							*/
+					   int ch3,						/*!< The number of regular bins of the z axis.			*/
+                       Axis::bin_t l3,				/*!< The lower edge of the lowest bin on the z axis.	*/
+                       Axis::bin_t r3,				/*!< The upper edge of the highest bin on the z axis.	*/
+                       const std::string& ztitle,	/*!< The title of the z axis.							*/
+                       HistogramStorage storage=DenseStorage /*!< How to store the bin contents.		*/)
+    {
+        return GetHistograms().Create3D(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle, storage);
+    }
+
+	//! Create a 3D histogram counting with bins of type T, e.g. Cube<uint32_t>(...).
+    /*! \return a pointer to a new 3D histogram.
+     */
+	template<typename T>
+	Histogram3Dp Cube( const std::string& name,		/*!< The name of the new histogram.						*/
+					   const std::string& title,	/*!< The title of the new histogram.					*/
+					   int ch1,						/*!< The number of regular bins of the x axis.			*/
+                       Axis::bin_t l1,				/*!< The lower edge of the lowest bin on the x axis.	*/
+                       Axis::bin_t r1,				/*!< The upper edge of the highest bin on the x axis.	*/
+					   const std::string& xtitle,	/*!< The title of the x axis.							*/
+					   int ch2,						/*!< The number of regular bins of the y axis.			*/
+                       Axis::bin_t l2,				/*!< The lower edge of the lowest bin on the y axis.	*/
+                       Axis::bin_t r2,				/*!< The upper edge of the highest bin on the y axis.	*/
+                       const std::string& ytitle,	/*!< The title of the y axis.							*/
+					   int ch3,						/*!< The number of regular bins of the z axis.			*/
+                       Axis::bin_t l3,				/*!< The lower edge of the lowest bin on the z axis.	*/
+                       Axis::bin_t r3,				/*!< The upper edge of the highest bin on the z axis.	*/
+                       const std::string& ztitle,	/*!< The title of the z axis.							*/
+                       HistogramStorage storage=DenseStorage /*!< How to store the bin contents.		*/)
     {
-        return GetHistograms().Create2D(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle);
+        return GetHistograms().Create3D(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle, storage, BinTypeOf<T>::value);
     }
 };
 
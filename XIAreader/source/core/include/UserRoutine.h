@@ -24,6 +24,7 @@
 
 #include <string>
 
+#include "EventColumns.h"
 #include "Histograms.h"
 #include "Parameters.h"
 
@@ -53,6 +54,11 @@ public:
 	//! Called to sort an event.
     virtual bool Sort(const Event& event /*!< The event structure filled with data. */) = 0;
 
+	//! Called after Sort() when skimming by this routine.
+	/*! \return true if the hits of the event sorted last shall be kept in the skim.
+	 */
+    virtual bool Skim() const { return false; }
+
 	//! Called after all sorting is finished.
     virtual bool End() = 0;
 
@@ -66,12 +72,20 @@ public:
      */
     inline Histograms& GetHistograms() { return histograms; }
 
+    //! Get the event columns.
+    /*! \return The columns written for each event.
+     */
+    inline EventColumns& GetColumns() { return columns; }
+
 private:
     //! The list of parameters.
     Parameters parameters;
 
     //! The list of histograms.
     Histograms histograms;
+
+    //! The columns written for each event.
+    EventColumns columns;
 };
 
 #endif //USERROUTINE_H
@@ -34,25 +34,54 @@
 #include "FileBufferFetcher.h"
 #include "STFileBufferFetcher.h"
 #include "MTFileBufferFetcher.h"
+#include "HitBufferFetcher.h"
+#include "HitWriter.h"
 
 #include "WordBuffer.h"
 #include "Event.h"
 
 #include "Unpacker.h"
+#include "SortStats.h"
 
 #include "RootWriter.h"
 #include "MamaWriter.h"
+#include "LiveServer.h"
+#include "ShmPublisher.h"
+#include "SnapshotWriter.h"
+#include "BinaryWriter.h"
+#include "BinaryReader.h"
+#include "SortCache.h"
+#include "SkimWriter.h"
+#include "EventWriter.h"
 
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <fnmatch.h>
 #include <signal.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 
 //! Global variable signaling if the sorting has been interrupted.
 static char leaveprog = 'n';
 
+//! Whether buffers are sorted to the end when interrupted, as needed for checkpoints.
+static bool whole_buffers = false;
+
+//! Default memory for histogram copies with 'routine threads', in MiB.
+static const size_t default_copy_budget = 1024;
+
 //! Signal handler for Ctrl-C.
 static void keyb_int(int sig_num)
 {
@@ -77,17 +106,192 @@ static std::string trim_whitespace( const std::string& text /*!< Text to be clea
     return text.substr(start, end-start+1);
 }
 
+// ########################################################################
+// ########################################################################
+
+//! Thread feeding one routine when several routines are sorted in parallel.
+/*! Each worker runs its own Unpacker over the shared buffer, so the file
+ *  is read and decoded only once for all routines.
+ */
+class SortWorker {
+public:
+    //! Start the thread.
+    SortWorker(UserRoutine& ur /*!< Routine to feed. */);
+
+    //! Stop the thread.
+    ~SortWorker();
+
+    //! Start sorting a buffer.
+    void Post(const WordBuffer* buffer, /*!< Buffer to sort. Must stay valid until Wait() returns. */
+              bool skim=false           /*!< Whether to mark the hits of the events the routine keeps for a skim. */);
+
+    //! Wait until the posted buffer has been sorted.
+    /*! \return true if the buffer was sorted without errors.
+     */
+    bool Wait();
+
+    //! Number of events in the last buffer sorted.
+    int GetEvents() const { return nEvents; }
+
+    //! The unpacker used by the worker.
+    const Unpacker& GetUnpacker() const { return unpacker; }
+
+    //! Time spent unpacking and sorting, only to be used between Wait() and Post().
+    SortStats& GetStats() { return stats; }
+
+    //! Hits of the last buffer kept for a skim, only to be used between Wait() and Post().
+    const std::vector<char>& GetKeep() const { return keep; }
+
+private:
+    //! The main loop of the thread.
+    void Loop();
+
+    //! Routine to feed.
+    UserRoutine& routine;
+
+    //! Event builder for this worker.
+    Unpacker unpacker;
+
+    //! Event structure, kept to avoid a large stack object per buffer.
+    Event event;
+
+    //! Buffer to sort, 0 if idle.
+    const WordBuffer* buffer;
+
+    //! Whether to mark the hits kept for a skim in the buffer.
+    bool skim;
+
+    //! Non-zero for the hits of the last buffer kept for a skim.
+    std::vector<char> keep;
+
+    //! Result of the last buffer.
+    bool ok;
+
+    //! Number of events in the last buffer.
+    int nEvents;
+
+    //! Time spent unpacking and sorting.
+    SortStats stats;
+
+    //! Flag set to stop the thread.
+    bool cancel;
+
+    //! Synchronizes access to buffer and cancel.
+    std::mutex mutex;
+
+    //! Signals that a buffer has been posted or finished.
+    std::condition_variable cond;
+
+    //! The thread object.
+    std::thread thread;
+};
+
+SortWorker::SortWorker(UserRoutine& ur)
+    : routine( ur )
+    , buffer( 0 )
+    , skim( false )
+    , ok( true )
+    , nEvents( 0 )
+    , cancel( false )
+    , thread( &SortWorker::Loop, this )
+{
+}
+
+SortWorker::~SortWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        cancel = true;
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+void SortWorker::Post(const WordBuffer* buf, bool sk)
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        buffer = buf;
+        skim = sk;
+    }
+    cond.notify_all();
+}
+
+bool SortWorker::Wait()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( buffer )
+        cond.wait( lock );
+    return ok;
+}
+
+void SortWorker::Loop()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( true ){
+        while ( !cancel && !buffer )
+            cond.wait( lock );
+        if ( cancel )
+            return;
+
+        // Sorting is performed while the lock is released.
+        const WordBuffer* buf = buffer;
+        lock.unlock();
+
+        int n = 0;
+        unpacker.SetBuffer(buf);
+        if ( skim )
+            keep.assign(buf->GetSize(), 0);
+        Unpacker::Status ustat = Unpacker::END;
+        SortStats::tick_t t0 = SortStats::Now();
+        while ( leaveprog == 'n' || whole_buffers ){
+            ustat = unpacker.Next(event);
+            const SortStats::tick_t t1 = SortStats::Now();
+            stats.Add(SortStats::Unpack, t1 - t0);
+            if ( ustat != Unpacker::OKAY )
+                break;
+            routine.Sort(event);
+            if ( skim && routine.Skim() )
+                std::fill(keep.begin() + event.start, keep.begin() + event.start + event.length, 1);
+            t0 = SortStats::Now();
+            stats.Add(SortStats::Sort, t0 - t1);
+            n += 1;
+        }
+        stats.TakeFlushes();
+
+        lock.lock();
+        nEvents = n;
+        ok = ( ustat == Unpacker::END );
+        buffer = 0;
+        cond.notify_all();
+    }
+}
+
 // ########################################################################
 // ########################################################################
 // ########################################################################
 
 OfflineSorting::OfflineSorting(UserRoutine& us)
-    : userSort( us )
+    : routines( 1, Routine{ "default", &us, false, true, {}, {} } )
+    , factory( 0 )
+    , parallel( false )
+    , threads( 1 )
+    , copy_budget( 0 )
+    , next_slot( 0 )
     , is_tty( isatty(STDOUT_FILENO) )
     , maxBuffers( -1 )
     , bufferFetcher( new MTFileBufferFetcher )
     , unpacker( new Unpacker )
     , rateMeter( 500, !is_tty )
+    , run_start( std::chrono::steady_clock::now() )
+    , skim_routine( -1 )
+    , skim_trigger( eDet )
+    , skim_window( 1500 )
+    , events_routine( 0 )
+    , batch_number( 0 )
+    , resume_requested( false )
+    , resuming( false )
+    , resume_buffer( -1 )
     {
         signal(SIGINT, keyb_int); // Setting up interrupt handler (Ctrl-C)
         signal(SIGPIPE, SIG_IGN);
@@ -96,22 +300,290 @@ OfflineSorting::OfflineSorting(UserRoutine& us)
 // ########################################################################
 
 OfflineSorting::OfflineSorting(UserRoutine &us, FormatStr *fs)
-    : userSort( us )
+    : routines( 1, Routine{ "default", &us, false, true, {}, {} } )
+    , factory( 0 )
+    , parallel( false )
+    , threads( 1 )
+    , copy_budget( 0 )
+    , next_slot( 0 )
     , is_tty( isatty(STDOUT_FILENO) )
     , maxBuffers( -1 )
     , bufferFetcher( fs->bf )
     , unpacker( fs->up )
     , rateMeter( 500, !is_tty )
+    , run_start( std::chrono::steady_clock::now() )
+    , skim_routine( -1 )
+    , skim_trigger( eDet )
+    , skim_window( 1500 )
+    , events_routine( 0 )
+    , batch_number( 0 )
+    , resume_requested( false )
+    , resuming( false )
+    , resume_buffer( -1 )
+{
+    signal(SIGINT, keyb_int); // Setting up interrupt handler (Ctrl-C)
+    signal(SIGPIPE, SIG_IGN);
+}
+
+// ########################################################################
+
+OfflineSorting::OfflineSorting(RoutineFactory fct)
+    : factory( fct )
+    , parallel( false )
+    , threads( 1 )
+    , copy_budget( 0 )
+    , next_slot( 0 )
+    , is_tty( isatty(STDOUT_FILENO) )
+    , maxBuffers( -1 )
+    , bufferFetcher( new MTFileBufferFetcher )
+    , unpacker( new Unpacker )
+    , rateMeter( 500, !is_tty )
+    , run_start( std::chrono::steady_clock::now() )
+    , skim_routine( -1 )
+    , skim_trigger( eDet )
+    , skim_window( 1500 )
+    , events_routine( 0 )
+    , batch_number( 0 )
+    , resume_requested( false )
+    , resuming( false )
+    , resume_buffer( -1 )
 {
     signal(SIGINT, keyb_int); // Setting up interrupt handler (Ctrl-C)
     signal(SIGPIPE, SIG_IGN);
+
+    UserRoutine* ur = factory();
+    ur->Start();
+    AddRoutine("default", ur);
 }
 
 // ########################################################################
 
 OfflineSorting::~OfflineSorting()
 {
+    workers.clear();
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        for (size_t h = 0 ; h < routines[i].helpers.size() ; ++h)
+            delete routines[i].helpers[h];
+        if ( routines[i].owned )
+            delete routines[i].routine;
+    }
+}
+
+// ########################################################################
+
+bool OfflineSorting::AddRoutine(const std::string& name, UserRoutine* ur)
+{
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        if ( routines[i].name == name )
+            return false;
+    }
+    routines.push_back( Routine{ name, ur, true, true, {}, {} } );
+    if ( threads > 1 )
+        AddHelpers( routines.back() );
+    UpdateWorkers();
+    return true;
+}
+
+// ########################################################################
+
+void OfflineSorting::End()
+{
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        if ( !routines[i].owned )
+            continue;
+        if ( routines.size() > 1 )
+            std::cout << "Routine '" << routines[i].name << "':" << std::endl;
+        routines[i].routine->End();
+    }
+}
+
+// ########################################################################
 
+void OfflineSorting::UpdateWorkers()
+{
+    workers.clear();
+    slot_buffers.clear();
+    slot_busy.clear();
+    next_slot = 0;
+    if ( threads > 1 ){
+        for (int t = 0 ; t < threads ; ++t){
+            for (size_t i = 0 ; i < routines.size() ; ++i){
+                UserRoutine* ur = ( t == 0 ) ? routines[i].routine : routines[i].helpers[t-1];
+                workers.push_back( std::unique_ptr<SortWorker>( new SortWorker(*ur) ) );
+            }
+            slot_buffers.push_back( std::unique_ptr<WordBuffer>() );
+            slot_busy.push_back( false );
+        }
+        return;
+    }
+    if ( !parallel || routines.size() < 2 )
+        return;
+    for (size_t i = 0 ; i < routines.size() ; ++i)
+        workers.push_back( std::unique_ptr<SortWorker>( new SortWorker(*routines[i].routine) ) );
+}
+
+// ########################################################################
+
+void OfflineSorting::AddHelpers(Routine& r)
+{
+    Histograms& primary = r.routine->GetHistograms();
+    primary.PlanSharing(threads-1, &copy_budget);
+    for (int t = 1 ; t < threads ; ++t){
+        UserRoutine* ur = factory();
+        ur->GetHistograms().Share( primary );
+        ur->Start();
+        for (size_t c = 0 ; c < r.commands.size() ; ++c)
+            ur->Command( r.commands[c] );
+        ur->GetColumns().SetEnabled( r.routine->GetColumns().IsEnabled() );
+        r.helpers.push_back( ur );
+    }
+}
+
+// ########################################################################
+
+bool OfflineSorting::WaitSlot(int slot)
+{
+    if ( !slot_busy[slot] )
+        return true;
+    const size_t n = routines.size();
+    bool ok = true;
+    for (size_t i = 0 ; i < n ; ++i)
+        ok = workers[slot*n+i]->Wait() && ok;
+    nEvents += workers[slot*n]->GetEvents();
+    if ( skim && skim_routine >= 0 )
+        skim->Write(*slot_buffers[slot], workers[slot*n+skim_routine]->GetKeep());
+    if ( events ){
+        const Routine& r = routines[events_routine];
+        events->Write( ( slot == 0 ? r.routine : r.helpers[slot-1] )->GetColumns() );
+    }
+    slot_busy[slot] = false;
+    return ok;
+}
+
+// ########################################################################
+
+int OfflineSorting::FinishBuffers()
+{
+    if ( threads < 2 )
+        return 0;
+
+    const SortStats::tick_t t0 = SortStats::Now();
+    int bad = 0;
+    // Oldest buffer first, so the skim and the event columns keep the
+    // order of the file.
+    for (int t = 0 ; t < threads ; ++t)
+        bad += WaitSlot( ( next_slot + t ) % threads ) ? 0 : 1;
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        for (size_t h = 0 ; h < routines[i].helpers.size() ; ++h)
+            routines[i].helpers[h]->GetHistograms().Collect();
+    }
+    file_stats.Add(SortStats::Threads, SortStats::Now() - t0);
+    return bad;
+}
+
+// ########################################################################
+
+SnapshotWriter& OfflineSorting::Snapshots()
+{
+    if ( !snapshots )
+        snapshots.reset( new SnapshotWriter );
+    return *snapshots;
+}
+
+// ########################################################################
+
+int OfflineSorting::PeriodicExport()
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ( now < periodic_next || Snapshots().Busy() )
+        return 0;
+
+    // The copies of the other threads are added first.
+    const int bad = FinishBuffers();
+    const SortStats::tick_t t0 = SortStats::Now();
+    for (size_t p = 0 ; p < periodic.size() ; ++p){
+        Snapshots().Post( Snapshot(periodic[p].first, false), periodic[p].second );
+    }
+    file_stats.Add(SortStats::Export, SortStats::Now() - t0);
+    periodic_next = now + periodic_interval;
+    return bad;
+}
+
+// ########################################################################
+
+std::unique_ptr<Histograms> OfflineSorting::Snapshot(size_t routine, bool filled_only)
+{
+    Histograms& histograms = routines[routine].routine->GetHistograms();
+    if ( cache_aside.empty() )
+        return histograms.Snapshot(filled_only);
+
+    // All histograms are copied, as some may only be filled in the set aside.
+    std::unique_ptr<Histograms> copy = histograms.Snapshot(false);
+    copy->Merge(*cache_aside[routine]);
+    return copy;
+}
+
+// ########################################################################
+
+int OfflineSorting::PublishLive()
+{
+    const std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    if ( t < live_next )
+        return 0;
+
+    const int bad = FinishBuffers();
+    const SortStats::tick_t t0 = SortStats::Now();
+    for (size_t l = 0 ; l < live.size() ; ++l)
+        live[l].second->Publish( Snapshot(live[l].first, false) );
+    file_stats.Add(SortStats::Export, SortStats::Now() - t0);
+
+    // Large histograms take long to copy; keep the copying below 2% of the time.
+    const std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+    live_next = done + std::max( live_interval, 50*( done - t ) );
+    return bad;
+}
+
+// ########################################################################
+
+int OfflineSorting::PublishShm(bool all)
+{
+    bool due = all;
+    for (size_t p = 0 ; p < shm.size() && !due ; ++p)
+        due = shm[p].second->Due();
+    if ( !due )
+        return 0;
+
+    // The copies of the other threads are added first.
+    const int bad = FinishBuffers();
+    const SortStats::tick_t t0 = SortStats::Now();
+    for (size_t p = 0 ; p < shm.size() ; ++p)
+        shm[p].second->Update(all);
+    file_stats.Add(SortStats::Export, SortStats::Now() - t0);
+    return bad;
+}
+
+// ########################################################################
+
+int OfflineSorting::SelectedCount() const
+{
+    int n = 0;
+    for (size_t i = 0 ; i < routines.size() ; ++i)
+        n += routines[i].selected ? 1 : 0;
+    return n;
+}
+
+// ########################################################################
+
+std::string OfflineSorting::ExportName(const std::string& filename, const Routine& r) const
+{
+    if ( SelectedCount() < 2 )
+        return filename;
+
+    size_t dot = filename.find_last_of('.');
+    size_t slash = filename.find_last_of('/');
+    if ( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+        return filename + "_" + r.name;
+    return filename.substr(0, dot) + "_" + r.name + filename.substr(dot);
 }
 
 // ########################################################################
@@ -132,35 +604,97 @@ void OfflineSorting::SetMaxBuffers(int mb)
 
 bool OfflineSorting::SortBuffer(const WordBuffer* buffer) // This will run in the main Thread
 {
+    if ( skim && skim_routine < 0 ){
+        SkimWriter::SelectTrigger(*buffer, skim_trigger, skim_window, skim_keep);
+        skim->Write(*buffer, skim_keep);
+    }
+
+    if ( threads > 1 ){
+        const SortStats::tick_t t0 = SortStats::Now();
+        // The threads take the buffers in turn; the buffer is copied, as
+        // the fetcher may reuse it before the thread is done. The result
+        // returned is that of the previous buffer sorted by this thread.
+        const int slot = next_slot;
+        next_slot = ( next_slot + 1 ) % threads;
+        bool ok = WaitSlot(slot);
+
+        std::unique_ptr<WordBuffer>& copy = slot_buffers[slot];
+        const int size = buffer->GetSize();
+        if ( !copy || copy->GetSize() != size )
+            copy.reset( new WordBuffer(size, new word_t[size]) );
+        std::copy(buffer->GetBuffer(), buffer->GetBuffer() + size, copy->GetBuffer());
+
+        const size_t n = routines.size();
+        for (size_t i = 0 ; i < n ; ++i)
+            workers[slot*n+i]->Post(copy.get(), skim && skim_routine == int(i));
+        slot_busy[slot] = true;
+        file_stats.Add(SortStats::Threads, SortStats::Now() - t0);
+        return ok;
+    }
+
+    if ( !workers.empty() ){
+        const SortStats::tick_t t0 = SortStats::Now();
+        for (size_t i = 0 ; i < workers.size() ; ++i)
+            workers[i]->Post(buffer, skim && skim_routine == int(i));
+        bool ok = true;
+        for (size_t i = 0 ; i < workers.size() ; ++i)
+            ok = workers[i]->Wait() && ok;
+        nEvents += workers[0]->GetEvents();
+        if ( skim && skim_routine >= 0 )
+            skim->Write(*buffer, workers[skim_routine]->GetKeep());
+        if ( events )
+            events->Write(routines[events_routine].routine->GetColumns());
+        file_stats.Add(SortStats::Threads, SortStats::Now() - t0);
+        return ok;
+    }
+
     Event event;
     unpacker->SetBuffer(buffer);
     Unpacker::Status ustat = Unpacker::END;
-    // We start the sorter thread...
-    // Command start thread.
-
+    UserRoutine* skimmer = ( skim && skim_routine >= 0 ) ? routines[skim_routine].routine : 0;
+    if ( skimmer )
+        skim_keep.assign(buffer->GetSize(), 0);
 
-    while (leaveprog == 'n'){
+    SortStats::tick_t t0 = SortStats::Now();
+    while (leaveprog == 'n' || whole_buffers){
         ustat = unpacker->Next(event);
+        const SortStats::tick_t t1 = SortStats::Now();
+        file_stats.Add(SortStats::Unpack, t1 - t0);
         if ( ustat != Unpacker::OKAY )
             break;
-        userSort.Sort(event);
+        for (size_t i = 0 ; i < routines.size() ; ++i)
+            routines[i].routine->Sort(event);
+        if ( skimmer && skimmer->Skim() )
+            std::fill(skim_keep.begin() + event.start, skim_keep.begin() + event.start + event.length, 1);
+        t0 = SortStats::Now();
+        file_stats.Add(SortStats::Sort, t0 - t1);
         nEvents += 1;
     }
+    if ( skimmer )
+        skim->Write(*buffer, skim_keep);
+    if ( events )
+        events->Write(routines[events_routine].routine->GetColumns());
     return ustat == Unpacker::END;
 }
 
 // ########################################################################
 
-bool OfflineSorting::SortFile(const std::string filename, int buf_start, int buf_end)
+bool OfflineSorting::SortFile(const std::string filename, int buf_start, int buf_end, bool decoded)
 {
+    if ( decoded && !hitFetcher )
+        hitFetcher.reset( new HitBufferFetcher );
+    FileBufferFetcher* fetcher = decoded ? hitFetcher.get() : bufferFetcher.get();
+
     // Open data file.
-    if (bufferFetcher->Open(filename, buf_start) != BufferFetcher::OKAY){
+    if (fetcher->Open(filename, buf_start) != BufferFetcher::OKAY){
         std::cerr << "Data: Could not open '" << filename << "'" << std::endl;
         return false;
     }
 
     int buffer_count = 0, bad_buffer_count = 0;
     rateMeter.Reset();
+    file_stats.Reset();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
     //unpacker->Reset();
 
     // Fetch next buffer.
@@ -169,33 +703,55 @@ bool OfflineSorting::SortFile(const std::string filename, int buf_start, int buf
     nEvents = 0;
 
     // Loop over all buffers
+    int next_buffer = buf_start;
     for (int b = buf_start ; buf_end < 0 || b < buf_end ; ++b){
         // Stop if Ctrl-C has been passed
         if (leaveprog != 'n'){
             break;
         }
 
-        const WordBuffer* buf = bufferFetcher->Next(fstate);
+        const SortStats::tick_t t0 = SortStats::Now();
+        const WordBuffer* buf = fetcher->Next(fstate);
+        file_stats.Add(SortStats::Read, SortStats::Now() - t0);
         if ( fstate == BufferFetcher::END ){
             break;
         } else if ( fstate == BufferFetcher::ERROR) {
             std::cerr << "\ndata: error reading buffer " << b << " in file '" << filename << "'" << std::endl;
+            bad_buffer_count += FinishBuffers();
+            FinishFileStats(filename, fetcher, start, buffer_count, bad_buffer_count);
             return false;
         }
 
+        if ( hitWriter ){
+            const SortStats::tick_t t1 = SortStats::Now();
+            hitWriter->Write(*buf);
+            file_stats.Add(SortStats::Export, SortStats::Now() - t1);
+        }
+
         // Sort buffer
         buffer_count += 1;
+        file_stats.words += buf->GetSize();
         bool sort_ok = SortBuffer(buf);
         if ( !sort_ok )
             bad_buffer_count += 1;
+        if ( !periodic.empty() )
+            bad_buffer_count += PeriodicExport();
+        if ( !live.empty() )
+            bad_buffer_count += PublishLive();
+        if ( !shm.empty() )
+            bad_buffer_count += PublishShm(false);
+        next_buffer = b + 1;
+        if ( checkpoint )
+            bad_buffer_count += PeriodicCheckpoint(batch_number, filename, next_buffer);
 
 
         bufs_per_sec = rateMeter.Rate();
         if ( bufs_per_sec > 0 ){
             if ( is_tty ){
+                const Unpacker& up = workers.empty() ? *unpacker : workers[0]->GetUnpacker();
                 std::cout << "      " << std::flush << '\r' // Clear the line
                           << buffer_count << '/' << bad_buffer_count
-                          << ' ' << unpacker->GetAverageLength() << " hits/event"
+                          << ' ' << up.GetAverageLength() << " hits/event"
                           << ' ' << double(nEvents)/buffer_count << " event/bufs"
                           << ' ' << bufs_per_sec*buf->GetSize() << " hits/s " << std::flush;
             } else {
@@ -204,18 +760,144 @@ bool OfflineSorting::SortFile(const std::string filename, int buf_start, int buf
         }
     }
 
+    bad_buffer_count += FinishBuffers();
+    if ( skim )
+        skim->Flush();
+    if ( events )
+        events->Flush();
+    if ( !shm.empty() )
+        PublishShm(true);
+    if ( checkpoint && leaveprog != 'n' ){
+        WriteCheckpoint(batch_number, filename, next_buffer);
+        checkpoint->Wait();
+        std::cout << "\ncheckpoint: Wrote '" << checkpoint->GetFilename() << "', continue with --resume" << std::endl;
+    }
+
     // Print counter and rate at the end
+    const Unpacker& up = workers.empty() ? *unpacker : workers[0]->GetUnpacker();
     std::cout << '\r' << buffer_count << '/' << bad_buffer_count
-              << ' ' << unpacker->GetAverageLength() << " hits/event"
+              << ' ' << up.GetAverageLength() << " hits/event"
               << ' ' << double(nEvents)/buffer_count << " event/bufs"
               << ' ' << rateMeter.TotalRate()*WordBuffer::BUFSIZE
               << " hits/s " << std::endl;
+    FinishFileStats(filename, fetcher, start, buffer_count, bad_buffer_count);
     return true;
 
 }
 
 // ########################################################################
 
+int OfflineSorting::WriteCheckpoint(int line, const std::string& data, int buffer)
+{
+    // The copies of the other threads are added first.
+    const int bad = FinishBuffers();
+    const SortStats::tick_t t0 = SortStats::Now();
+    Checkpoint::State state;
+    state.generation = 0;
+    state.batch = batch_name;
+    state.line = line;
+    state.buffer = buffer;
+    state.data = data;
+    Checkpoint::snapshots_t snapshots;
+    for (size_t i = 0 ; i < routines.size() ; ++i)
+        snapshots.push_back( std::make_pair( routines[i].name, Snapshot(i, true) ) );
+    checkpoint->Post(state, std::move(snapshots));
+    file_stats.Add(SortStats::Export, SortStats::Now() - t0);
+    return bad;
+}
+
+// ########################################################################
+
+int OfflineSorting::PeriodicCheckpoint(int line, const std::string& data, int buffer)
+{
+    const std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    if ( t < checkpoint_next || checkpoint->Busy() )
+        return 0;
+
+    const int bad = WriteCheckpoint(line, data, buffer);
+
+    // Keep the copying below 2% of the time, as for the live histograms.
+    const std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+    checkpoint_next = done + std::max( checkpoint_interval, 50*( done - t ) );
+    return bad;
+}
+
+// ########################################################################
+
+int OfflineSorting::Resume(const std::string& cmd)
+{
+    if ( batch_number < resume_at.line ){
+        // Only the commands that sort, export or reset histograms are
+        // skipped; 'data directory' and 'export periodic' are settings.
+        std::istringstream icmd( cmd );
+        std::string name, what;
+        icmd >> name >> what;
+        if ( name == "data" )
+            return ( what == "directory" ) ? 0 : 1;
+        if ( name == "export" )
+            return ( what == "periodic" ) ? 0 : 1;
+        return ( name == "reset_histograms" ) ? 1 : 0;
+    }
+
+    resuming = false;
+    for (size_t c = 0 ; c < resume_at.routines.size() ; ++c){
+        const std::string& name = resume_at.routines[c].first;
+        size_t i = 0;
+        while ( i < routines.size() && routines[i].name != name )
+            ++i;
+        if ( i == routines.size() ){
+            std::cerr << "resume: No routine named '" << name << "'" << std::endl;
+            return -1;
+        }
+        BinaryReader reader;
+        if ( !reader.Open( resume_at.routines[c].second ) || !reader.AddTo( routines[i].routine->GetHistograms() ) ){
+            std::cerr << "resume: Could not restore the histograms of routine '" << name << "'" << std::endl;
+            return -1;
+        }
+    }
+    resume_buffer = resume_at.buffer;
+    std::cout << "resume: Restored the histograms, continuing at batch line " << resume_at.line;
+    if ( resume_buffer >= 0 )
+        std::cout << ", buffer " << resume_buffer << " of '" << resume_at.data << "'";
+    std::cout << std::endl;
+    return 0;
+}
+
+// ########################################################################
+
+void OfflineSorting::FinishFileStats(const std::string& filename,
+                                     FileBufferFetcher* fetcher,
+                                     const std::chrono::steady_clock::time_point& start,
+                                     int buffer_count, int bad_buffer_count)
+{
+    for (size_t w = 0 ; w < workers.size() ; ++w){
+        file_stats += workers[w]->GetStats();
+        workers[w]->GetStats().Reset();
+    }
+    file_stats.TakeFlushes();
+
+    MTFileBufferFetcher* mt = dynamic_cast<MTFileBufferFetcher*>( fetcher );
+    if ( mt ){
+        unsigned long empty = 0, full = 0;
+        mt->GetWaits(empty, full);
+        file_stats.read_waits = empty;
+        file_stats.reader_waits = full;
+    }
+
+    file_stats.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    file_stats.buffers = buffer_count;
+    file_stats.bad_buffers = bad_buffer_count;
+    file_stats.events = nEvents;
+    file_stats.Print(std::cout, "stats '" + filename + "'");
+
+    run_stats += file_stats;
+    file_history.push_back( std::make_pair( filename, file_stats ) );
+}
+
+// ########################################################################
+
+// ########################################################################
+
 bool OfflineSorting::data_command(std::istream& icmd)
 {
     int buf_start=0, buf_end=maxBuffers;
@@ -240,8 +922,9 @@ bool OfflineSorting::data_command(std::istream& icmd)
             buf_end = std::min(buf_end, buf_start+maxBuffers);
     }
 
-    if ( tmp != "file" ){
-        std::cerr << "data: Expected 'data [buffers <from> <to>] file <filename>'\n";
+    const bool decoded = ( tmp == "decoded" );
+    if ( tmp != "file" && !decoded ){
+        std::cerr << "data: Expected 'data [buffers <from> <to>] file|decoded <filename>'\n";
         return false;
     }
 
@@ -258,6 +941,42 @@ bool OfflineSorting::data_command(std::istream& icmd)
     if ( !data_directory.empty() && filename[0] != '/')
         filename = data_directory + "/" + filename;
 
+    if ( resume_requested ){
+        std::cerr << "data: --resume needs a 'checkpoint' command before the first 'data' command" << std::endl;
+        return false;
+    }
+    const int resume_start = buf_start;
+    if ( resume_buffer >= 0 ){
+        if ( filename != resume_at.data ){
+            std::cerr << "data: The checkpoint was written while sorting '" << resume_at.data
+                      << "', not '" << filename << "'" << std::endl;
+            return false;
+        }
+        buf_start = resume_buffer;
+        resume_buffer = -1;
+    }
+
+    // A file continued from a checkpoint is partly sorted, and not cached;
+    // skims, event columns and decoded hit files need the file sorted.
+    uint64_t key = 0;
+    const bool cached = cache && !skim && !events && decode_directory.empty() && buf_start == resume_start
+        && CacheKey(filename, buf_start, buf_end, key);
+    if ( cached ){
+        const SortStats::tick_t t0 = SortStats::Now();
+        std::vector<std::pair<std::string, Histograms*> > sets;
+        for (size_t i = 0 ; i < routines.size() ; ++i)
+            sets.push_back( std::make_pair( routines[i].name, &routines[i].routine->GetHistograms() ) );
+        if ( cache->Load(key, sets) ){
+            run_stats.Add(SortStats::Export, SortStats::Now() - t0);
+            std::cout << "data: Added '" << filename << "' from the cache" << std::endl;
+            if ( !shm.empty() )
+                PublishShm(true);
+            if ( checkpoint )
+                PeriodicCheckpoint(batch_number + 1, "", -1);
+            return true;
+        }
+    }
+
     // Write to screen that we will read file.
     std::cout << "data: Reading file '" << filename
               << "' buffers [" << buf_start << ',';
@@ -267,7 +986,173 @@ bool OfflineSorting::data_command(std::istream& icmd)
         std::cout << buf_end;
     std::cout << "]" << std::endl;
 
-    return SortFile(filename, buf_start, buf_end);
+    // The file is sorted into emptied histograms, which are stored before
+    // the histograms set aside are added back. The shared memory segments
+    // show the histograms in place, so files are not stored while in use.
+    const bool store = cached && shm.empty();
+    if ( store ){
+        const SortStats::tick_t t0 = SortStats::Now();
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            Histograms& histograms = routines[i].routine->GetHistograms();
+            cache_aside.push_back( histograms.Snapshot(true) );
+            histograms.ResetAll();
+        }
+        run_stats.Add(SortStats::Export, SortStats::Now() - t0);
+    }
+
+    if ( !decode_directory.empty() && !decoded ){
+        const size_t slash = filename.find_last_of('/');
+        const std::string hitfile = decode_directory + "/"
+            + ( slash == std::string::npos ? filename : filename.substr(slash+1) ) + ".hits";
+        if ( buf_start != resume_start ){
+            std::cout << "decode: '" << filename << "' is continued from a checkpoint, '"
+                      << hitfile << "' is not written" << std::endl;
+        } else {
+            hitWriter.reset( new HitWriter );
+            if ( !hitWriter->Open( hitfile ) ){
+                hitWriter.reset();
+                return false;
+            }
+        }
+    }
+
+    const bool sorted = SortFile(filename, buf_start, buf_end, decoded);
+    if ( hitWriter ){
+        // An interrupted file is not complete, and is removed.
+        if ( sorted && leaveprog == 'n' && hitWriter->Close() )
+            std::cout << "decode: Wrote '" << hitWriter->GetFilename() << "'" << std::endl;
+        hitWriter.reset();
+    }
+    if ( store ){
+        const SortStats::tick_t t0 = SortStats::Now();
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            Histograms& histograms = routines[i].routine->GetHistograms();
+            if ( sorted && leaveprog == 'n' )
+                cache->Store(key, routines[i].name, histograms);
+            histograms.Merge(*cache_aside[i]);
+        }
+        cache_aside.clear();
+        run_stats.Add(SortStats::Export, SortStats::Now() - t0);
+    }
+    if ( !sorted )
+        return false;
+
+    if ( checkpoint && leaveprog == 'n' )
+        PeriodicCheckpoint(batch_number + 1, "", -1);
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::CacheKey(const std::string& filename, int buf_start, int buf_end, uint64_t& key) const
+{
+    // Increase when the cache files change meaning.
+    static const int cache_version = 1;
+
+    SortCache::hash_t h = SortCache::Hash(&cache_version, sizeof(cache_version));
+    if ( !SortCache::HashFile(filename, h) )
+        return false;
+    h = SortCache::Hash(&buf_start, sizeof(buf_start), h);
+    h = SortCache::Hash(&buf_end, sizeof(buf_end), h);
+
+    // A new build of the program may sort differently.
+    SortCache::HashFile("/proc/self/exe", h);
+
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        h = SortCache::Hash(routines[i].name, h);
+        for (size_t c = 0 ; c < routines[i].commands.size() ; ++c){
+            const std::string& cmd = routines[i].commands[c];
+            h = SortCache::Hash(cmd, h);
+            // Any word naming a file, e.g. a gain or range file, adds the file.
+            std::istringstream icmd( cmd );
+            std::string word;
+            while ( icmd >> word )
+                SortCache::HashFile(word, h);
+        }
+    }
+    key = h;
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::routine_command(std::istream& icmd)
+{
+    std::string tmp, name;
+    icmd >> tmp >> name;
+    if ( tmp == "add" ){
+        if ( name.empty() ){
+            std::cerr << "routine add: Expected 'routine add <name>'" << std::endl;
+            return false;
+        }
+        if ( !factory ){
+            std::cerr << "routine add: No routine factory given to this session" << std::endl;
+            return false;
+        }
+        UserRoutine* ur = factory();
+        ur->Start();
+        if ( !AddRoutine(name, ur) ){
+            std::cerr << "routine add: Routine '" << name << "' already exists" << std::endl;
+            delete ur;
+            return false;
+        }
+        // Following commands will go to the new routine only.
+        for (size_t i = 0 ; i < routines.size() ; ++i)
+            routines[i].selected = ( routines[i].name == name );
+        std::cout << "Added routine '" << name << "'" << std::endl;
+        return true;
+    } else if ( tmp == "select" ){
+        bool found = false;
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            routines[i].selected = ( name == "all" || routines[i].name == name );
+            found = found || routines[i].selected;
+        }
+        if ( !found ){
+            std::cerr << "routine select: No routine named '" << name << "'" << std::endl;
+            for (size_t i = 0 ; i < routines.size() ; ++i)
+                routines[i].selected = true;
+            return false;
+        }
+        return true;
+    } else if ( tmp == "parallel" ){
+        if ( name != "on" && name != "off" ){
+            std::cerr << "routine parallel: Expected 'on' or 'off'" << std::endl;
+            return false;
+        }
+        parallel = ( name == "on" );
+        UpdateWorkers();
+        return true;
+    } else if ( tmp == "threads" ){
+        const int n = std::atoi( name.c_str() );
+        double budget = default_copy_budget;
+        if ( !( icmd >> budget ) )
+            budget = default_copy_budget;
+        if ( n < 1 || budget < 0 ){
+            std::cerr << "routine threads: Expected 'routine threads <n> [<MiB for histogram copies>]'" << std::endl;
+            return false;
+        }
+        if ( threads > 1 ){
+            std::cerr << "routine threads: The number of threads can only be set once" << std::endl;
+            return false;
+        }
+        if ( n == 1 )
+            return true;
+        if ( !factory ){
+            std::cerr << "routine threads: No routine factory given to this session" << std::endl;
+            return false;
+        }
+        threads = n;
+        copy_budget = size_t( budget*1024*1024 );
+        for (size_t i = 0 ; i < routines.size() ; ++i)
+            AddHelpers( routines[i] );
+        UpdateWorkers();
+        std::cout << "Sorting with " << threads << " threads per routine, "
+                  << copy_budget/(1024*1024) << " MiB left for histogram copies" << std::endl;
+        return true;
+    }
+    std::cerr << "routine: Expected 'routine add <name>', 'routine select <name>|all', "
+              << "'routine parallel on|off' or 'routine threads <n> [<MiB>]'" << std::endl;
+    return false;
 }
 
 // ########################################################################
@@ -283,10 +1168,93 @@ bool OfflineSorting::export_command(std::istream& icmd)
             std::cerr << "Export root: Do not understand ROOT filename: '" << tmp << "'" << std::endl;
             return false;
         }
-        RootWriter::Write( userSort.GetHistograms(), rootfile );
-        std::cout << "export as ROOT file into '" << tmp << "'" << std::endl;
-        std::cout << "Resetting all histograms" << std::endl;
-        userSort.GetHistograms().ResetAll();
+        bool keep = false, background = false;
+        while ( icmd >> tmp ){
+            if ( tmp == "keep" ){
+                keep = true;
+            } else if ( tmp == "background" ){
+                background = true;
+            } else {
+                std::cerr << "export root: Expected 'export root <filename> [keep] [background]'" << std::endl;
+                return false;
+            }
+        }
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            if ( !routines[i].selected )
+                continue;
+            std::string filename = ExportName(rootfile, routines[i]);
+            Histograms& histograms = routines[i].routine->GetHistograms();
+            if ( background ){
+                std::cout << "export snapshot as ROOT file into '" << filename << "' in the background" << std::endl;
+                Snapshots().Post( histograms.Snapshot(), filename );
+            } else {
+                // Earlier snapshots may go to the same file.
+                if ( snapshots )
+                    snapshots->Wait();
+                RootWriter::Write( histograms, filename );
+                std::cout << "export as ROOT file into '" << filename << "'" << std::endl;
+            }
+            if ( !keep ){
+                std::cout << "Resetting all histograms" << std::endl;
+                histograms.ResetAll();
+            }
+        }
+        return true;
+    } else if (tmp == "binary"){
+        icmd >> tmp;
+        std::string binfile = trim_whitespace( tmp );
+        if (binfile.empty()){
+            std::cerr << "export binary: Do not understand filename '" << tmp << "'" << std::endl;
+            return false;
+        }
+        bool keep = false, compress = true;
+        while ( icmd >> tmp ){
+            if ( tmp == "keep" ){
+                keep = true;
+            } else if ( tmp == "raw" ){
+                compress = false;
+            } else {
+                std::cerr << "export binary: Expected 'export binary <filename> [keep] [raw]'" << std::endl;
+                return false;
+            }
+        }
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            if ( !routines[i].selected )
+                continue;
+            std::string filename = ExportName(binfile, routines[i]);
+            Histograms& histograms = routines[i].routine->GetHistograms();
+            if ( !BinaryWriter::Write( histograms, filename, compress ) )
+                return false;
+            std::cout << "export as binary file into '" << filename << "'" << std::endl;
+            if ( !keep ){
+                std::cout << "Resetting all histograms" << std::endl;
+                histograms.ResetAll();
+            }
+        }
+        return true;
+    } else if (tmp == "periodic"){
+        icmd >> tmp;
+        if ( tmp == "off" ){
+            periodic.clear();
+            std::cout << "export: Periodic exports stopped" << std::endl;
+            return true;
+        }
+        const double seconds = std::atof( tmp.c_str() );
+        std::string rootfile;
+        icmd >> tmp >> rootfile;
+        rootfile = trim_whitespace( rootfile );
+        if ( seconds <= 0 || tmp != "root" || rootfile.empty() ){
+            std::cerr << "export periodic: Expected 'export periodic <seconds> root <filename>' or 'export periodic off'" << std::endl;
+            return false;
+        }
+        periodic.clear();
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            if ( routines[i].selected )
+                periodic.push_back( std::make_pair( i, ExportName(rootfile, routines[i]) ) );
+        }
+        periodic_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( seconds ) );
+        periodic_next = std::chrono::steady_clock::now() + periodic_interval;
+        std::cout << "export: Snapshot into '" << rootfile << "' every " << seconds << " s while sorting" << std::endl;
         return true;
     } else if (tmp == "mama"){
         icmd >> tmp;
@@ -295,13 +1263,6 @@ bool OfflineSorting::export_command(std::istream& icmd)
             std::cerr << "export mama: Do not understand histogram name '" << histname << "'" << std::endl;
             return false;
         }
-        Histogram1Dp h = userSort.GetHistograms().Find1D(histname);
-        Histogram2Dp m = userSort.GetHistograms().Find2D(histname);
-        if (!h && !m){
-            std::cerr << "export mama: No histogram named '"
-                      << histname << "'" << std::endl;
-            return false;
-        }
 
         icmd >> tmp;
         std::string mamafile = trim_whitespace(tmp);
@@ -310,27 +1271,515 @@ bool OfflineSorting::export_command(std::istream& icmd)
                       << mamafile << "'" << std::endl;
             return false;
         }
-        std::ofstream mama_out( mamafile.c_str() );
-        if ( !mama_out ){
-            std::cerr << "export mama: problem opening '"
-                      << mamafile << "'" << std::endl;
+
+        // 'all' or a pattern writes one file per histogram into a directory.
+        if ( histname == "all" || histname.find_first_of("*?[") != std::string::npos ){
+            const char* pattern = ( histname == "all" ) ? "*" : histname.c_str();
+            for (size_t i = 0 ; i < routines.size() ; ++i){
+                if ( !routines[i].selected )
+                    continue;
+                Histograms& histograms = routines[i].routine->GetHistograms();
+                std::vector<Histogram1Dp> list1d;
+                std::vector<Histogram2Dp> list2d;
+                for (Histograms::list1d_t::const_iterator it = histograms.GetAll1D().begin() ; it != histograms.GetAll1D().end() ; ++it){
+                    if ( fnmatch(pattern, (*it)->GetName().c_str(), 0) == 0 )
+                        list1d.push_back( *it );
+                }
+                for (Histograms::list2d_t::const_iterator it = histograms.GetAll2D().begin() ; it != histograms.GetAll2D().end() ; ++it){
+                    if ( fnmatch(pattern, (*it)->GetName().c_str(), 0) == 0 )
+                        list2d.push_back( *it );
+                }
+                if ( list1d.empty() && list2d.empty() ){
+                    std::cerr << "export mama: No 1D or 2D histogram matches '"
+                              << histname << "'" << std::endl;
+                    return false;
+                }
+
+                std::string directory = ExportName(mamafile, routines[i]);
+                if ( mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST ){
+                    std::cerr << "export mama: Could not create directory '"
+                              << directory << "'" << std::endl;
+                    return false;
+                }
+                std::cout << "Export " << list1d.size() + list2d.size()
+                          << " histograms as MAMA files into '" << directory << "'" << std::endl;
+                if ( MamaWriter::WriteAll(list1d, list2d, directory) != 0 ){
+                    std::cerr << "export mama: Problem writing into '"
+                              << directory << "'." << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            if ( !routines[i].selected )
+                continue;
+            Histogram1Dp h = routines[i].routine->GetHistograms().Find1D(histname);
+            Histogram2Dp m = routines[i].routine->GetHistograms().Find2D(histname);
+            if (!h && !m){
+                std::cerr << "export mama: No histogram named '"
+                          << histname << "'" << std::endl;
+                return false;
+            }
+
+            std::string filename = ExportName(mamafile, routines[i]);
+            std::ofstream mama_out( filename.c_str() );
+            if ( !mama_out ){
+                std::cerr << "export mama: problem opening '"
+                          << filename << "'" << std::endl;
+                return false;
+            }
+
+            std::cout << "Export '" << histname << "' as MAMA file into '"
+                      << filename << "'" << std::endl;
+            if ( h )
+                MamaWriter::Write(mama_out, h);
+            else if ( m )
+                MamaWriter::Write(mama_out, m);
+            if ( !mama_out ){
+                std::cerr << "export mama: Problem writing '"
+                          << filename << "'." << std::endl;
+                return false;
+            }
+            mama_out.close();
+        }
+        return true;
+    }
+    return false;
+}
+
+// ########################################################################
+
+//! Quote a string for JSON.
+/*! \return the string in double quotes.
+ */
+static std::string json_string(const std::string& s)
+{
+    std::string q = "\"";
+    for (size_t i = 0 ; i < s.size() ; ++i){
+        const unsigned char c = s[i];
+        if ( c == '"' || c == '\\' ){
+            q += '\\';
+            q += c;
+        } else if ( c < 0x20 ){
+            char tmp[8];
+            snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+            q += tmp;
+        } else {
+            q += c;
+        }
+    }
+    return q + '"';
+}
+
+// ########################################################################
+
+SortStats& OfflineSorting::RunStats()
+{
+    run_stats.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - run_start ).count();
+    return run_stats;
+}
+
+// ########################################################################
+
+bool OfflineSorting::WriteStatsJSON(const std::string& filename)
+{
+    std::ofstream out( filename.c_str() );
+    out << "{\n  \"files\": [";
+    for (size_t f = 0 ; f < file_history.size() ; ++f){
+        out << ( f == 0 ? "\n" : ",\n" )
+            << "    { \"file\": " << json_string(file_history[f].first) << ", \"stats\": ";
+        file_history[f].second.WriteJSON(out, "    ");
+        out << " }";
+    }
+    out << "\n  ],\n  \"total\": ";
+    RunStats().WriteJSON(out, "  ");
+    out << "\n}\n";
+    out.close();
+    if ( !out ){
+        std::cerr << "stats: Problem writing '" << filename << "'" << std::endl;
+        return false;
+    }
+    std::cout << "stats: Written into '" << filename << "'" << std::endl;
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::live_command(std::istream& icmd)
+{
+    std::string tmp;
+    icmd >> tmp;
+    std::string socket = trim_whitespace( tmp );
+    if ( socket == "off" ){
+        live.clear();
+        std::cout << "live: Stopped serving histograms" << std::endl;
+        return true;
+    }
+    tmp.clear();
+    icmd >> tmp;
+    const double seconds = tmp.empty() ? 5 : std::atof( tmp.c_str() );
+    if ( socket.empty() || seconds <= 0 ){
+        std::cerr << "live: Expected 'live <socket> [<seconds>]' or 'live off'" << std::endl;
+        return false;
+    }
+
+    live.clear();
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        if ( !routines[i].selected )
+            continue;
+        std::unique_ptr<LiveServer> server( new LiveServer( ExportName(socket, routines[i]) ) );
+        if ( !server->IsListening() )
+            return false;
+        live.push_back( std::make_pair( i, std::move(server) ) );
+    }
+    live_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( seconds ) );
+    live_next = std::chrono::steady_clock::now() + live_interval;
+    std::cout << "live: Serving histograms on '" << socket << "', updated every " << seconds << " s while sorting" << std::endl;
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::checkpoint_command(std::istream& icmd)
+{
+    std::string tmp;
+    icmd >> tmp;
+    std::string filename = trim_whitespace( tmp );
+    if ( filename == "off" ){
+        checkpoint.reset();
+        whole_buffers = false;
+        std::cout << "checkpoint: Stopped writing checkpoints" << std::endl;
+        return true;
+    }
+    tmp.clear();
+    icmd >> tmp;
+    const double seconds = tmp.empty() ? 600 : std::atof( tmp.c_str() );
+    if ( filename.empty() || seconds <= 0 ){
+        std::cerr << "checkpoint: Expected 'checkpoint <filename> [<seconds>]' or 'checkpoint off'" << std::endl;
+        return false;
+    }
+
+    if ( resume_requested ){
+        resume_requested = false;
+        if ( !Checkpoint::Read(filename, resume_at) ){
+            std::cout << "checkpoint: No checkpoint in '" << filename << "', sorting from the beginning" << std::endl;
+        } else if ( resume_at.batch != batch_name ){
+            std::cerr << "checkpoint: '" << filename << "' was written for batch file '" << resume_at.batch << "'" << std::endl;
+            return false;
+        } else {
+            resuming = true;
+        }
+    }
+
+    // Replace an old writer only when it has written its last checkpoint.
+    checkpoint.reset();
+    checkpoint.reset( new Checkpoint( filename ) );
+    // The sorting must stop between buffers to be continued from the next one.
+    whole_buffers = true;
+    checkpoint_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( seconds ) );
+    checkpoint_next = std::chrono::steady_clock::now() + checkpoint_interval;
+    std::cout << "checkpoint: Writing '" << filename << "' every " << seconds << " s while sorting, and after each data file" << std::endl;
+    return true;
+}
+
+// ########################################################################
+
+void OfflineSorting::CloseSkim()
+{
+    if ( !skim )
+        return;
+    skim->Flush();
+    std::cout << "skim: Kept " << skim->GetKept() << " of " << skim->GetSeen()
+              << " hits in '" << skim->GetFilename() << "'" << std::endl;
+    skim.reset();
+}
+
+// ########################################################################
+
+bool OfflineSorting::skim_command(std::istream& icmd)
+{
+    static const struct { const char* name; DetectorType type; } trigger_types[] = {
+        { "labr", labr }, { "de", deDet }, { "e", eDet }, { "eguard", eGuard }, { "ppac", ppac }, { "rf", rfchan }
+    };
+
+    std::string tmp, mode, name;
+    icmd >> tmp >> mode >> name;
+    const std::string filename = trim_whitespace( tmp );
+    if ( filename == "off" ){
+        CloseSkim();
+        return true;
+    }
+    if ( resuming ){
+        std::cerr << "skim: A skim cannot be continued from a checkpoint, sort again without --resume" << std::endl;
+        return false;
+    }
+
+    int routine = -1;
+    DetectorType trigger = eDet;
+    int64_t window = 1500;
+    bool ok = !filename.empty();
+    if ( ok && mode == "trigger" ){
+        ok = false;
+        for (size_t t = 0 ; t < sizeof(trigger_types)/sizeof(trigger_types[0]) ; ++t){
+            if ( name == trigger_types[t].name ){
+                trigger = trigger_types[t].type;
+                ok = true;
+            }
+        }
+        tmp.clear();
+        icmd >> tmp;
+        if ( !tmp.empty() )
+            window = std::atoll( tmp.c_str() );
+        ok = ok && window >= 0;
+    } else if ( ok && mode == "routine" ){
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            if ( routines[i].name == name )
+                routine = i;
+        }
+        if ( routine < 0 ){
+            std::cerr << "skim: No routine named '" << name << "'" << std::endl;
             return false;
         }
+    } else {
+        ok = false;
+    }
+    if ( !ok ){
+        std::cerr << "skim: Expected 'skim <filename> trigger labr|de|e|eguard|ppac|rf [<window ns>]',"
+                     " 'skim <filename> routine <name>' or 'skim off'" << std::endl;
+        return false;
+    }
+
+    CloseSkim();
+    skim.reset( new SkimWriter );
+    if ( !skim->Open( filename ) ){
+        skim.reset();
+        return false;
+    }
+    skim_routine = routine;
+    skim_trigger = trigger;
+    skim_window = window;
+    if ( routine >= 0 )
+        std::cout << "skim: Writing the events kept by routine '" << name << "' into '" << filename << "'" << std::endl;
+    else
+        std::cout << "skim: Writing the hits within " << window << " ns of '" << name << "' hits into '" << filename << "'" << std::endl;
+    return true;
+}
+
+// ########################################################################
+
+void OfflineSorting::EnableColumns(Routine& r, bool on)
+{
+    r.routine->GetColumns().SetEnabled( on );
+    for (size_t h = 0 ; h < r.helpers.size() ; ++h)
+        r.helpers[h]->GetColumns().SetEnabled( on );
+}
+
+// ########################################################################
 
-        std::cout << "Export '" << histname << "' as MAMA file into '"
-                  << mamafile << "'" << std::endl;
-        if ( h )
-            MamaWriter::Write(mama_out, h);
-        else if ( m )
-            MamaWriter::Write(mama_out, m);
-        if ( !mama_out ){
-            std::cerr << "export mama: Problem writing '"
-                      << mamafile << "'." << std::endl;
+void OfflineSorting::CloseEvents()
+{
+    if ( !events )
+        return;
+    events->Flush();
+    EnableColumns(routines[events_routine], false);
+    std::cout << "events: Wrote " << events->GetRows() << " events into '" << events->GetFilename() << "'" << std::endl;
+    events.reset();
+}
+
+// ########################################################################
+
+bool OfflineSorting::events_command(std::istream& icmd)
+{
+    std::string tmp, name = "default";
+    icmd >> tmp >> name;
+    const std::string filename = trim_whitespace( tmp );
+    if ( filename.empty() ){
+        std::cerr << "events: Expected 'events <filename> [<routine>]' or 'events off'" << std::endl;
+        return false;
+    }
+    if ( filename == "off" ){
+        CloseEvents();
+        return true;
+    }
+    if ( resuming ){
+        std::cerr << "events: Event columns cannot be continued from a checkpoint, sort again without --resume" << std::endl;
+        return false;
+    }
+
+    int routine = -1;
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        if ( routines[i].name == name )
+            routine = i;
+    }
+    if ( routine < 0 ){
+        std::cerr << "events: No routine named '" << name << "'" << std::endl;
+        return false;
+    }
+    const EventColumns& columns = routines[routine].routine->GetColumns();
+    if ( columns.Empty() ){
+        std::cerr << "events: Routine '" << name << "' has no columns, select them with 'columns'" << std::endl;
+        return false;
+    }
+
+    CloseEvents();
+    events.reset( new EventWriter );
+    if ( !events->Open(filename, columns) ){
+        events.reset();
+        return false;
+    }
+    events_routine = routine;
+    EnableColumns(routines[routine], true);
+    std::cout << "events: Writing " << columns.GetNames().size() << " columns of routine '"
+              << name << "' into '" << filename << "'" << std::endl;
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::decode_command(std::istream& icmd)
+{
+    std::string tmp;
+    icmd >> tmp;
+    const std::string directory = trim_whitespace( tmp );
+    if ( directory.empty() ){
+        std::cerr << "decode: Expected 'decode <directory>' or 'decode off'" << std::endl;
+        return false;
+    }
+    if ( directory == "off" ){
+        decode_directory.clear();
+        std::cout << "decode: Stopped writing decoded hit files" << std::endl;
+        return true;
+    }
+
+    struct stat st;
+    if ( stat(directory.c_str(), &st) != 0 && mkdir(directory.c_str(), 0755) != 0 ){
+        std::cerr << "decode: Could not create directory '" << directory << "'" << std::endl;
+        return false;
+    } else if ( stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ){
+        std::cerr << "decode: '" << directory << "' is not a directory" << std::endl;
+        return false;
+    }
+    decode_directory = directory;
+    std::cout << "decode: Writing the hits of each data file into '" << directory << "'" << std::endl;
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::cache_command(std::istream& icmd)
+{
+    std::string tmp;
+    icmd >> tmp;
+    const std::string directory = trim_whitespace( tmp );
+    if ( directory.empty() ){
+        std::cerr << "cache: Expected 'cache <directory>' or 'cache off'" << std::endl;
+        return false;
+    }
+    if ( directory == "off" ){
+        cache.reset();
+        std::cout << "cache: Stopped using the cache" << std::endl;
+        return true;
+    }
+
+    struct stat st;
+    if ( stat(directory.c_str(), &st) != 0 && mkdir(directory.c_str(), 0755) != 0 ){
+        std::cerr << "cache: Could not create directory '" << directory << "'" << std::endl;
+        return false;
+    } else if ( stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ){
+        std::cerr << "cache: '" << directory << "' is not a directory" << std::endl;
+        return false;
+    }
+    cache.reset( new SortCache( directory ) );
+    std::cout << "cache: Keeping the histograms of each data file in '" << directory << "'" << std::endl;
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::shm_command(std::istream& icmd)
+{
+    std::string tmp;
+    icmd >> tmp;
+    std::string prefix = trim_whitespace( tmp );
+    if ( prefix == "off" ){
+        for (size_t p = 0 ; p < shm.size() ; ++p)
+            shm[p].second->Unlink();
+        shm.clear();
+        std::cout << "shm: Removed the shared memory segments" << std::endl;
+        return true;
+    }
+    double seconds = -1;
+    icmd >> seconds;
+    std::vector<std::string> patterns;
+    while ( icmd >> tmp )
+        patterns.push_back( trim_whitespace( tmp ) );
+    if ( prefix.empty() || prefix.find('/') != std::string::npos || seconds < 0 || patterns.empty() ){
+        std::cerr << "shm: Expected 'shm <prefix> <seconds> <histogram>...' or 'shm off'" << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0 ; i < routines.size() ; ++i){
+        if ( !routines[i].selected )
+            continue;
+        std::unique_ptr<ShmPublisher> publisher( new ShmPublisher( ExportName(prefix, routines[i]), seconds ) );
+        Histograms& histograms = routines[i].routine->GetHistograms();
+        for (size_t p = 0 ; p < patterns.size() ; ++p){
+            const char* pattern = ( patterns[p] == "all" ) ? "*" : patterns[p].c_str();
+            bool found = false;
+            for (Histograms::list1d_t::const_iterator it = histograms.GetAll1D().begin() ; it != histograms.GetAll1D().end() ; ++it){
+                if ( fnmatch(pattern, (*it)->GetName().c_str(), 0) != 0 )
+                    continue;
+                if ( !publisher->Add( *it ) )
+                    return false;
+                found = true;
+            }
+            for (Histograms::list2d_t::const_iterator it = histograms.GetAll2D().begin() ; it != histograms.GetAll2D().end() ; ++it){
+                if ( fnmatch(pattern, (*it)->GetName().c_str(), 0) != 0 )
+                    continue;
+                if ( !publisher->Add( *it ) )
+                    return false;
+                found = true;
+            }
+            if ( !found ){
+                std::cerr << "shm: No 1D or 2D histogram matches '" << patterns[p] << "'" << std::endl;
+                return false;
+            }
+        }
+        std::cout << "shm: Publishing " << publisher->GetCount() << " histograms as '/"
+                  << ExportName(prefix, routines[i]) << "<name>'" << std::endl;
+        publisher->Update(true);
+        shm.push_back( std::make_pair( i, std::move(publisher) ) );
+    }
+    return true;
+}
+
+// ########################################################################
+
+bool OfflineSorting::stats_command(std::istream& icmd)
+{
+    std::string tmp;
+    if ( !( icmd >> tmp ) ){
+        RunStats().Print(std::cout, "stats for all files");
+        return true;
+    } else if ( tmp == "reset" ){
+        run_stats.Reset();
+        run_start = std::chrono::steady_clock::now();
+        file_history.clear();
+        return true;
+    } else if ( tmp == "json" ){
+        icmd >> tmp;
+        std::string filename = trim_whitespace( tmp );
+        if ( filename.empty() ){
+            std::cerr << "stats json: Expected 'stats json <filename>'" << std::endl;
             return false;
         }
-        mama_out.close();
+        stats_json = filename;
+        std::cout << "stats: Will write JSON into '" << stats_json << "' at the end" << std::endl;
         return true;
     }
+    std::cerr << "stats: Expected 'stats', 'stats reset' or 'stats json <filename>'" << std::endl;
     return false;
 }
 
@@ -349,12 +1798,46 @@ bool OfflineSorting::next_command(const std::string& cmd)
     } else if ( name == "data" ){
         return data_command(icmd);
     } else if ( name == "export" ){
-        return export_command(icmd);
+        const SortStats::tick_t t0 = SortStats::Now();
+        const bool ok = export_command(icmd);
+        run_stats.Add(SortStats::Export, SortStats::Now() - t0);
+        run_stats.TakeFlushes();
+        return ok;
+    } else if ( name == "stats" ){
+        return stats_command(icmd);
+    } else if ( name == "live" ){
+        return live_command(icmd);
+    } else if ( name == "shm" ){
+        return shm_command(icmd);
+    } else if ( name == "checkpoint" ){
+        return checkpoint_command(icmd);
+    } else if ( name == "cache" ){
+        return cache_command(icmd);
+    } else if ( name == "skim" ){
+        return skim_command(icmd);
+    } else if ( name == "events" ){
+        return events_command(icmd);
+    } else if ( name == "decode" ){
+        return decode_command(icmd);
+    } else if ( name == "routine" ){
+        return routine_command(icmd);
     } else if ( name == "reset_histograms"){
-        userSort.GetHistograms().ResetAll();
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            if ( routines[i].selected )
+                routines[i].routine->GetHistograms().ResetAll();
+        }
         return true;
     } else {
-        return userSort.Command(cmd);
+        bool ok = true;
+        for (size_t i = 0 ; i < routines.size() ; ++i){
+            if ( !routines[i].selected )
+                continue;
+            ok = routines[i].routine->Command(cmd) && ok;
+            for (size_t h = 0 ; h < routines[i].helpers.size() ; ++h)
+                routines[i].helpers[h]->Command(cmd);
+            routines[i].commands.push_back(cmd);
+        }
+        return ok;
     }
 }
 
@@ -376,11 +1859,22 @@ bool OfflineSorting::next_commandline(std::istream& in, std::string& cmd_line)
     return in || !cmd_line.empty();
 }
 
-void OfflineSorting::Run(const std::string& batchfilename)
+void OfflineSorting::Run(const std::string& batchfilename, bool resume)
 {
     std::ifstream batch_file(batchfilename.c_str());
     std::string batch_line;
+    batch_name = batchfilename;
+    batch_number = 0;
+    resume_requested = resume;
     while ( leaveprog == 'n' && next_commandline(batch_file, batch_line) ){
+        batch_number += 1;
+        if ( resuming ){
+            const int skip = Resume(batch_line);
+            if ( skip < 0 )
+                break;
+            else if ( skip > 0 )
+                continue;
+        }
         if ( batch_line.size() == 0 || batch_line[0] == '#' )
             continue;
         if ( !next_command(batch_line) ) {
@@ -388,18 +1882,43 @@ void OfflineSorting::Run(const std::string& batchfilename)
             break;
         }
     }
+    if ( checkpoint )
+        checkpoint->Wait();
+    if ( snapshots )
+        snapshots->Wait();
+    CloseSkim();
+    CloseEvents();
+
+    if ( !file_history.empty() ){
+        RunStats().Print(std::cout, "stats for all files");
+        if ( !stats_json.empty() )
+            WriteStatsJSON(stats_json);
+    }
+}
+
+//! Get the batch file from the command line '[--resume] <batchfile>'.
+/*! \return the batch file, or 0 after printing the usage.
+ */
+static const char* BatchArgument(int argc, char* argv[], bool& resume)
+{
+    resume = ( argc == 3 && std::string(argv[1]) == "--resume" );
+    if ( argc != 2 && !resume ){
+        std::cerr << "Run like: " << argv[0] << " [--resume] <batchfile>" << std::endl;
+        return 0;
+    }
+    return argv[argc-1];
 }
 
 int OfflineSorting::Run(UserRoutine* ur, int argc, char* argv[])
 {
-    if (argc != 2){
-        std::cerr << "Run like: " << argv[0] << " <batchfile>" << std::endl;
+    bool resume = false;
+    const char* batch = BatchArgument(argc, argv, resume);
+    if ( !batch )
         return -1;
-    }
 
     ur->Start();
     OfflineSorting offline( *ur );
-    offline.Run( argv[1] );
+    offline.Run( batch, resume );
     ur->End();
     delete ur;
     return 0;
@@ -407,15 +1926,28 @@ int OfflineSorting::Run(UserRoutine* ur, int argc, char* argv[])
 
 int OfflineSorting::Run(UserRoutine* ur, FormatStr* fs, int argc, char* argv[])
 {
-    if (argc != 2){
-        std::cerr << "Run like: " << argv[0] << " <batchfile>" << std::endl;
+    bool resume = false;
+    const char* batch = BatchArgument(argc, argv, resume);
+    if ( !batch )
         return -1;
-    }
 
     ur->Start();
     OfflineSorting offline(*ur, fs);
-    offline.Run( argv[1] );
+    offline.Run( batch, resume );
     ur->End();
     delete ur;
     return 0;
 }
+
+int OfflineSorting::Run(RoutineFactory factory, int argc, char* argv[])
+{
+    bool resume = false;
+    const char* batch = BatchArgument(argc, argv, resume);
+    if ( !batch )
+        return -1;
+
+    OfflineSorting offline( factory );
+    offline.Run( batch, resume );
+    offline.End();
+    return 0;
+}
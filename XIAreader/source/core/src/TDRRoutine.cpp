@@ -39,6 +39,7 @@
 
 
 TDRRoutine::TDRRoutine()
+    : plan( GetHistograms(), GetColumns() )
 { }
 
 bool TDRRoutine::Start()
@@ -65,6 +66,8 @@ bool TDRRoutine::Command(const std::string& cmd)
         icmd >> fname;
         range.Read(fname);
         return true;
+    } else if ( FillPlan::IsCommand(name) ) {
+        return plan.Command(name, icmd);
     } else {
         //std::cerr << "TDRRoutine: Unknown command '" << cmd << "'\n";
         return UserCommand(cmd);
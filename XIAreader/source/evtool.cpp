@@ -0,0 +1,239 @@
+/*!
+ * \file evtool.cpp
+ * \brief List and convert event column files.
+ * \details Run like
+ *  <pre>
+ *  evtool list &lt;file&gt;...
+ *  evtool text &lt;file&gt; [&lt;column&gt;...]
+ *  evtool root &lt;output.root&gt; &lt;file&gt;...
+ *  </pre>
+ *  'text' writes one line per event with the values of the columns
+ *  given, or of all columns, separated by tabs; the values of per-hit
+ *  columns are separated by commas. 'root' writes the events of all
+ *  files, which must have the same columns, into a TTree named "events".
+ * \copyright GNU Public License v. 3
+ */
+
+#include "EventReader.h"
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+// ########################################################################
+
+//! Print the columns and the number of events in a file.
+/*! \return true if the file could be read.
+ */
+static bool List(const std::string& filename)
+{
+    EventReader reader;
+    if ( !reader.Open(filename) )
+        return false;
+
+    const std::vector<std::string>& names = reader.GetNames();
+    for (size_t c = 0 ; c < names.size() ; ++c)
+        reader.Select(c, false);
+
+    uint64_t events = 0, chunks = 0;
+    std::vector<uint64_t> hits( reader.GetGroups().size(), 0 );
+    int r;
+    while ( ( r = reader.Next() ) > 0 ){
+        events += reader.GetEvents();
+        chunks += 1;
+        for (size_t g = 0 ; g < hits.size() ; ++g){
+            const std::vector<uint32_t>& counts = reader.GetCounts(g);
+            for (size_t i = 0 ; i < counts.size() ; ++i)
+                hits[g] += counts[i];
+        }
+    }
+
+    std::cout << filename << ": " << events << " events in " << chunks << " chunks" << std::endl;
+    for (size_t c = 0 ; c < names.size() ; ++c){
+        const int g = reader.GetColumnGroups()[c];
+        std::cout << "  " << names[c];
+        if ( g >= 0 )
+            std::cout << " per hit of '" << reader.GetGroups()[g] << "', " << hits[g] << " hits";
+        std::cout << std::endl;
+    }
+    return r == 0;
+}
+
+// ########################################################################
+
+//! Print the values of each event.
+/*! \return true if the file could be read and the columns were found.
+ */
+static bool Text(const std::string& filename, int ncolumns, char* columns[])
+{
+    EventReader reader;
+    if ( !reader.Open(filename) )
+        return false;
+
+    std::vector<int> shown;
+    for (int a = 0 ; a < ncolumns ; ++a){
+        const int c = reader.FindColumn(columns[a]);
+        if ( c < 0 ){
+            std::cerr << "evtool text: No column named '" << columns[a] << "' in '" << filename << "'" << std::endl;
+            return false;
+        }
+        shown.push_back( c );
+    }
+    if ( shown.empty() ){
+        for (size_t c = 0 ; c < reader.GetNames().size() ; ++c)
+            shown.push_back( c );
+    }
+    for (size_t c = 0 ; c < reader.GetNames().size() ; ++c)
+        reader.Select(c, false);
+    for (size_t s = 0 ; s < shown.size() ; ++s)
+        reader.Select(shown[s], true);
+
+    std::cout.precision( std::numeric_limits<float>::digits10 + 2 );
+    std::cout << '#';
+    for (size_t s = 0 ; s < shown.size() ; ++s)
+        std::cout << ( s == 0 ? "" : "\t" ) << reader.GetNames()[shown[s]];
+    std::cout << '\n';
+
+    const std::vector<int>& column_groups = reader.GetColumnGroups();
+    int r;
+    while ( ( r = reader.Next() ) > 0 ){
+        std::vector<size_t> next( shown.size(), 0 );
+        for (uint32_t e = 0 ; e < reader.GetEvents() ; ++e){
+            for (size_t s = 0 ; s < shown.size() ; ++s){
+                const int c = shown[s];
+                const std::vector<float>& data = reader.GetData(c);
+                if ( s > 0 )
+                    std::cout << '\t';
+                const uint32_t n = ( column_groups[c] < 0 ) ? 1 : reader.GetCounts(column_groups[c])[e];
+                for (uint32_t i = 0 ; i < n ; ++i)
+                    std::cout << ( i == 0 ? "" : "," ) << data[next[s]++];
+            }
+            std::cout << '\n';
+        }
+    }
+    return std::cout.flush() && r == 0;
+}
+
+// ########################################################################
+
+//! Get a ROOT branch name for a column, with '.' replaced by '_'.
+/*! \return the branch name.
+ */
+static std::string BranchName(std::string name)
+{
+    for (size_t i = 0 ; i < name.size() ; ++i){
+        if ( name[i] == '.' )
+            name[i] = '_';
+    }
+    return name;
+}
+
+// ########################################################################
+
+//! Write the events of several files into a ROOT tree.
+/*! \return true if all files could be read and written.
+ */
+static bool Root(const std::string& output, int nfiles, char* files[])
+{
+    EventReader reader;
+    if ( !reader.Open(files[0]) )
+        return false;
+    const std::vector<std::string> groups = reader.GetGroups();
+    const std::vector<std::string> names = reader.GetNames();
+    const std::vector<int> column_groups = reader.GetColumnGroups();
+
+    TFile outfile( output.c_str(), "recreate" );
+    if ( outfile.IsZombie() ){
+        std::cerr << "evtool root: Could not create '" << output << "'" << std::endl;
+        return false;
+    }
+    // The tree belongs to the file, which deletes it when closed.
+    TTree* tree = new TTree( "events", "Event columns" );
+
+    // Few, long columns of small values: baskets of 256 kB rather than
+    // the default 32 kB, which ROOT adjusts at the first flush.
+    const int basket_size = 256*1024;
+    std::vector<Int_t> count( groups.size(), 0 );
+    std::vector<Float_t> value( names.size(), 0 );
+    std::vector<std::vector<Float_t> > array( names.size(), std::vector<Float_t>(1, 0) );
+    std::vector<TBranch*> branches( names.size(), 0 );
+    for (size_t g = 0 ; g < groups.size() ; ++g){
+        const std::string n = "n_" + BranchName(groups[g]);
+        tree->Branch(n.c_str(), &count[g], ( n + "/I" ).c_str(), basket_size);
+    }
+    for (size_t c = 0 ; c < names.size() ; ++c){
+        const std::string b = BranchName(names[c]);
+        if ( column_groups[c] < 0 ){
+            branches[c] = tree->Branch(b.c_str(), &value[c], ( b + "/F" ).c_str(), basket_size);
+        } else {
+            const std::string leaf = b + "[n_" + BranchName(groups[column_groups[c]]) + "]/F";
+            branches[c] = tree->Branch(b.c_str(), &array[c][0], leaf.c_str(), basket_size);
+        }
+    }
+
+    for (int f = 0 ; f < nfiles ; ++f){
+        if ( f > 0 && !reader.Open(files[f]) )
+            return false;
+        if ( reader.GetGroups() != groups || reader.GetNames() != names || reader.GetColumnGroups() != column_groups ){
+            std::cerr << "evtool root: '" << files[f] << "' has other columns than '" << files[0] << "'" << std::endl;
+            return false;
+        }
+        int r;
+        while ( ( r = reader.Next() ) > 0 ){
+            std::vector<size_t> next( names.size(), 0 );
+            for (uint32_t e = 0 ; e < reader.GetEvents() ; ++e){
+                for (size_t g = 0 ; g < groups.size() ; ++g)
+                    count[g] = reader.GetCounts(g)[e];
+                for (size_t c = 0 ; c < names.size() ; ++c){
+                    const std::vector<float>& data = reader.GetData(c);
+                    if ( column_groups[c] < 0 ){
+                        value[c] = data[next[c]++];
+                        continue;
+                    }
+                    const size_t n = count[column_groups[c]];
+                    if ( n > array[c].size() ){
+                        array[c].resize( n );
+                        branches[c]->SetAddress( &array[c][0] );
+                    }
+                    std::copy(data.begin() + next[c], data.begin() + next[c] + n, array[c].begin());
+                    next[c] += n;
+                }
+                tree->Fill();
+            }
+        }
+        if ( r < 0 )
+            return false;
+    }
+
+    tree->Write();
+    std::cout << "evtool root: Wrote " << tree->GetEntries() << " events into '" << output << "'" << std::endl;
+    outfile.Close();
+    return true;
+}
+
+// ########################################################################
+
+int main(int argc, char* argv[])
+{
+    const std::string cmd = ( argc > 1 ) ? argv[1] : "";
+
+    if ( cmd == "list" && argc > 2 ){
+        bool ok = true;
+        for (int f = 2 ; f < argc ; ++f)
+            ok = List(argv[f]) && ok;
+        return ok ? 0 : 1;
+    } else if ( cmd == "text" && argc > 2 ){
+        return Text(argv[2], argc-3, argv+3) ? 0 : 1;
+    } else if ( cmd == "root" && argc > 3 ){
+        return Root(argv[2], argc-3, argv+3) ? 0 : 1;
+    }
+
+    std::cerr << "Run like:\n"
+              << "  " << argv[0] << " list <file>...\n"
+              << "  " << argv[0] << " text <file> [<column>...]\n"
+              << "  " << argv[0] << " root <output.root> <file>..." << std::endl;
+    return 1;
+}
@@ -0,0 +1,79 @@
+// -*- c++ -*-
+
+#ifndef BinaryFormat_H_
+#define BinaryFormat_H_ 1
+
+#include <stdint.h>
+
+/*! \file BinaryFormat.h
+ *  \brief Layout of the native binary histogram files.
+ *
+ *  A file starts with a BinaryFileHeader, followed by one chunk for each
+ *  histogram. A chunk is a BinaryChunkHeader, the names and titles of
+ *  the histogram and its axes as zero terminated strings, and the
+ *  encoded bins. All parts start at a multiple of 8 bytes from the
+ *  start of the file, so the file can be mapped into memory and the
+ *  bins used in place. Numbers are stored in the byte order of the
+ *  machine writing the file, which is checked with the byte_order
+ *  field.
+ *
+ *  The bins of 1D and 2D histograms are stored in the order of ROOT
+ *  histograms, including the under- and overflow bins, with the x bin
+ *  changing fastest. 3D histograms are stored as pairs of linear bin
+ *  number and content, for the bins with a content only.
+ */
+
+//! The version written into new files.
+enum { binary_version = 1 };
+
+//! The value of BinaryFileHeader::byte_order as written.
+enum { binary_byte_order = 0x01020304 };
+
+//! How the bins of a chunk are encoded.
+enum BinaryEncoding {
+    BinaryRaw,      //!< All bins, as values of the element type.
+    BinaryZeroRuns, //!< Runs of zero bins, each followed by a run of values, see BinaryRun.
+    BinaryPairs     //!< Pairs of uint64_t linear bin number and double content, see BinaryPair.
+};
+
+//! The start of a binary histogram file.
+struct BinaryFileHeader {
+    char magic[8];          //!< "OCLHIST" and a zero byte.
+    uint32_t version;       //!< The file format version.
+    uint32_t byte_order;    //!< binary_byte_order, as written.
+    uint64_t count;         //!< The number of chunks following.
+};
+
+//! The start of the chunk for one histogram.
+struct BinaryChunkHeader {
+    uint64_t size;          //!< Bytes in the chunk including this header, a multiple of 8.
+    uint32_t dimension;     //!< 1, 2 or 3.
+    uint32_t bin_type;      //!< The BinType of the histogram.
+    uint32_t element;       //!< The BinType of the stored values, not BinUInt16.
+    uint32_t encoding;      //!< The BinaryEncoding of the bins.
+    uint32_t storage;       //!< The HistogramStorage of the histogram.
+    uint32_t text_size;     //!< Bytes of names and titles after this header, a multiple of 8.
+    int64_t entries;        //!< The number of entries.
+    uint64_t bins[3];       //!< Bins on each axis including under- and overflow, 1 if unused.
+    double left[3];         //!< Lower edge of the lowest regular bin on each axis.
+    double right[3];        //!< Upper edge of the highest regular bin on each axis.
+    uint64_t data_size;     //!< Bytes of encoded bins after the names.
+    uint64_t count;         //!< Values stored; the number of pairs for BinaryPairs.
+};
+
+//! The start of a run in the BinaryZeroRuns encoding.
+/*! The run header is followed by 'values' values of the element type,
+ *  padded to a multiple of 8 bytes.
+ */
+struct BinaryRun {
+    uint32_t zeros;         //!< Bins with content zero before the values.
+    uint32_t values;        //!< Bins stored after the run header.
+};
+
+//! One bin in the BinaryPairs encoding.
+struct BinaryPair {
+    uint64_t bin;           //!< Linear bin number, x + bins[0]*(y + bins[1]*z).
+    double content;         //!< The bin content.
+};
+
+#endif /* BinaryFormat_H_ */
@@ -0,0 +1,125 @@
+// -*- c++ -*-
+
+#ifndef BinaryReader_H_
+#define BinaryReader_H_ 1
+
+#include "BinaryFormat.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Histograms;
+
+/*!
+ * \class BinaryReader
+ * \brief Reads histograms from native binary files.
+ * \details The file is mapped into memory and only the chunk headers
+ *  are looked at when opening it; raw bins can be used in place with
+ *  GetData().
+ * \copyright GNU Public License v. 3
+ */
+class BinaryReader {
+public:
+    //! Called with the linear bin number and the content of a bin.
+    typedef std::function<void(uint64_t, double)> BinVisitor;
+
+    //! Create a reader without a file.
+    BinaryReader();
+
+    //! Unmap the file.
+    ~BinaryReader();
+
+    //! Map a file and check its chunk headers.
+    /*! \return true if the file is a valid binary histogram file.
+     */
+    bool Open(const std::string& filename /*!< The file to read. */);
+
+    //! Unmap the file, if any.
+    void Close();
+
+    //! Get the number of histograms in the file.
+    /*! \return the number of chunks.
+     */
+    size_t GetCount() const
+        { return chunks.size(); }
+
+    //! Get the header of a chunk.
+    /*! \return the header, in the mapped file.
+     */
+    const BinaryChunkHeader& GetHeader(size_t i /*!< The chunk number. */) const
+        { return *chunks[i].header; }
+
+    //! Get the name of a histogram.
+    /*! \return the name.
+     */
+    const char* GetName(size_t i /*!< The chunk number. */) const
+        { return chunks[i].text[0]; }
+
+    //! Get the title of a histogram.
+    /*! \return the title.
+     */
+    const char* GetTitle(size_t i /*!< The chunk number. */) const
+        { return chunks[i].text[1]; }
+
+    //! Get the title of an axis of a histogram.
+    /*! \return the axis title.
+     */
+    const char* GetAxisTitle(size_t i, /*!< The chunk number. */
+                             int d     /*!< The axis, 0 for x. */) const
+        { return chunks[i].text[2+d]; }
+
+    //! Get the encoded bins of a chunk.
+    /*! \return the bins, in the mapped file.
+     */
+    const void* GetData(size_t i /*!< The chunk number. */) const
+        { return chunks[i].data; }
+
+    //! Call a function for each bin with a content other than zero.
+    /*! The bins are visited in order.
+     */
+    void ForEachFilled(size_t i,                /*!< The chunk number. */
+                       const BinVisitor& visit  /*!< Called for each bin. */) const;
+
+    //! Check that all histograms of the file can be added to a set.
+    /*! \return true if each histogram of the file that is in the set
+     *  has the same axes there.
+     */
+    bool Fits(const Histograms& histograms /*!< The set to add to. */) const;
+
+    //! Add all histograms of the file to a set of histograms.
+    /*! Histograms not in the set are created like those written. The
+     *  others must have the same axes.
+     *
+     * \return true if all histograms could be added.
+     */
+    bool AddTo(Histograms& histograms /*!< The set to add to. */) const;
+
+private:
+    //! Where to find one chunk in the mapped file.
+    struct Chunk {
+        const BinaryChunkHeader* header;    //!< The header.
+        const char* text[5];                //!< Names and titles.
+        const char* data;                   //!< The encoded bins.
+    };
+
+    //! Check a chunk header and find its names and bins.
+    /*! \return true if the chunk is valid.
+     */
+    bool AddChunk(const char* start,    /*!< Start of the chunk. */
+                  uint64_t space        /*!< Bytes left in the file. */);
+
+    //! The chunks in the file.
+    std::vector<Chunk> chunks;
+
+    //! The mapped file, 0 if none.
+    void* map;
+
+    //! Bytes mapped.
+    size_t map_size;
+
+    //! The name of the file, for messages.
+    std::string filename;
+};
+
+#endif /* BinaryReader_H_ */
@@ -0,0 +1,41 @@
+// -*- c++ -*-
+
+#ifndef BinaryWriter_H_
+#define BinaryWriter_H_ 1
+
+#include <iosfwd>
+#include <string>
+
+class Histograms;
+
+/*!
+ * \class BinaryWriter
+ * \brief Writes histograms into native binary files.
+ * \details The file layout is described in BinaryFormat.h. The files
+ *  are read back with BinaryReader, e.g. by histtool to add up the
+ *  results of several sorting jobs.
+ * \copyright GNU Public License v. 3
+ */
+class BinaryWriter {
+public:
+    //! Write all histograms into a binary file.
+    /*! The output file is overwritten if it exists. With compression,
+     *  the bins of each 1D and 2D histogram are stored as runs of zero
+     *  and other bins if that is smaller than storing all bins.
+     *
+     * \return true if the file was written.
+     */
+    static bool Write( Histograms& histograms,      /*!< The histograms to write. */
+                       const std::string& filename, /*!< The output filename. */
+                       bool compress=true           /*!< Whether to leave out runs of empty bins. */);
+
+    //! Write histograms in the binary file format into a stream.
+    /*! \return true if written without errors.
+     */
+    static bool Write( Histograms& histograms,      /*!< The histograms to write. */
+                       std::ostream& out,           /*!< Where to write, opened in binary mode. */
+                       bool compress=true,          /*!< Whether to leave out runs of empty bins. */
+                       const std::string& only=""   /*!< Write only the histogram of this name, all if empty. */);
+};
+
+#endif /* BinaryWriter_H_ */
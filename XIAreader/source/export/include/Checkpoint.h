@@ -0,0 +1,102 @@
+// -*- c++ -*-
+
+#ifndef Checkpoint_H_
+#define Checkpoint_H_ 1
+
+#include "JobQueue.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Histograms;
+
+/*!
+ * \class Checkpoint
+ * \brief Writes checkpoints of a sorting on a background thread.
+ * \details A checkpoint is a small text file with the position in the
+ *  batch file and in the data file being sorted, and one binary
+ *  histogram file (see BinaryWriter) per sorting routine. The histogram
+ *  files of each checkpoint get new names, and the text file is replaced
+ *  only when they are complete, so a crash while writing leaves the
+ *  previous checkpoint usable. The files of the previous checkpoint are
+ *  then removed.
+ *
+ *  Only the newest checkpoint posted waits while another is written;
+ *  older ones are dropped, so Post() never blocks the sorting.
+ * \copyright GNU Public License v. 3
+ */
+class Checkpoint {
+public:
+    //! Where a sorting can be continued.
+    struct State {
+        int generation;     //!< Counts the checkpoints written to the file.
+        std::string batch;  //!< The batch file.
+        int line;           //!< The batch command to continue with, counting from 1; continued lines count once.
+        int buffer;         //!< The buffer to continue with in the data file of that command, or -1 to run the command.
+        std::string data;   //!< The data file, if buffer is not -1.
+        std::vector<std::pair<std::string, std::string> > routines; //!< Routine names and their histogram files.
+    };
+
+    //! A snapshot of the histograms of each routine.
+    typedef std::vector<std::pair<std::string, std::unique_ptr<Histograms> > > snapshots_t;
+
+    //! Start the writer thread.
+    /*! If a checkpoint exists already, the new checkpoints replace it.
+     */
+    Checkpoint(const std::string& filename /*!< The text file of the checkpoint. */);
+
+    //! Get the name of the text file.
+    /*! \return the filename.
+     */
+    const std::string& GetFilename() const
+        { return filename; }
+
+    //! Write a checkpoint in the background.
+    /*! The writer takes ownership of the snapshots. The generation and
+     *  the histogram files of the state are filled in by the writer.
+     */
+    void Post(const State& state,      /*!< Where to continue. */
+              snapshots_t snapshots    /*!< The histograms of each routine. */);
+
+    //! Check if a checkpoint is waiting or being written.
+    /*! \return true if a checkpoint posted now might be dropped.
+     */
+    bool Busy();
+
+    //! Wait until the checkpoint posted last is written.
+    void Wait();
+
+    //! Read the text file of a checkpoint.
+    /*! \return true if the file exists and is a valid checkpoint.
+     */
+    static bool Read(const std::string& filename,   /*!< The text file. */
+                     State& state                   /*!< Set to the checkpoint read. */);
+
+private:
+    //! A checkpoint to write.
+    struct Job {
+        State state;            //!< Where to continue.
+        snapshots_t snapshots;  //!< The histograms.
+    };
+
+    //! Write the files of a checkpoint.
+    /*! \return true if all files were written.
+     */
+    bool Write(Job& job /*!< The checkpoint, its state is completed. */);
+
+    //! The text file of the checkpoint.
+    const std::string filename;
+
+    //! The generation of the last checkpoint written.
+    int generation;
+
+    //! The histogram files of the last checkpoint written.
+    std::vector<std::string> files;
+
+    //! Runs the writing; only the newest checkpoint posted waits.
+    JobQueue queue;
+};
+
+#endif /* Checkpoint_H_ */
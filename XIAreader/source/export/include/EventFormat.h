@@ -0,0 +1,54 @@
+// -*- c++ -*-
+
+#ifndef EventFormat_H_
+#define EventFormat_H_ 1
+
+#include <stdint.h>
+
+/*! \file EventFormat.h
+ *  \brief Layout of the event column files.
+ *
+ *  An event column file holds selected values of each event, see
+ *  EventColumns. It starts with an EventFileHeader, followed by
+ *  - the hit group of each column as int32_t, -1 for per-event columns,
+ *    padded with zeros to a multiple of 8 bytes;
+ *  - the names of the hit groups and then of the columns, as zero
+ *    terminated strings, padded with zeros to text_size bytes.
+ *
+ *  Then follow chunks of events. Each chunk is an EventChunkHeader and
+ *  the arrays of the chunk, one after the other:
+ *  - for each hit group, the number of hits of each event as uint32_t;
+ *  - for each column, its values as float: one per event for per-event
+ *    columns, else one per hit of the group, i.e. the sum of its counts.
+ *
+ *  The size of each array follows from the counts, so a reader may skip
+ *  the columns it does not need. Numbers are stored in the byte order of
+ *  the machine writing the file, which is checked with the byte_order
+ *  field.
+ */
+
+//! The version written into new files.
+enum { event_version = 1 };
+
+//! The value of EventFileHeader::byte_order as written.
+enum { event_byte_order = 0x01020304 };
+
+//! The start of an event column file.
+struct EventFileHeader {
+    char magic[8];          //!< "OCLEVTS" and a zero byte.
+    uint32_t version;       //!< The file format version.
+    uint32_t byte_order;    //!< event_byte_order, as written.
+    uint32_t groups;        //!< The number of hit groups.
+    uint32_t columns;       //!< The number of columns.
+    uint32_t text_size;     //!< Bytes of names after the column groups, a multiple of 8.
+    uint32_t reserved;      //!< Zero.
+};
+
+//! The start of a chunk of events.
+struct EventChunkHeader {
+    uint64_t size;          //!< Bytes of arrays after this header.
+    uint32_t events;        //!< The number of events in the chunk.
+    uint32_t reserved;      //!< Zero.
+};
+
+#endif /* EventFormat_H_ */
@@ -0,0 +1,121 @@
+// -*- c++ -*-
+
+#ifndef EventReader_H_
+#define EventReader_H_ 1
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct EventChunkHeader;
+
+/*!
+ * \class EventReader
+ * \brief Reads event column files chunk by chunk.
+ * \details See EventFormat.h for the layout. Only the columns selected
+ *  are read; the others are skipped with a seek.
+ * \copyright GNU Public License v. 3
+ */
+class EventReader {
+public:
+    //! Create a reader without a file.
+    EventReader();
+
+    //! Close the file, if open.
+    ~EventReader();
+
+    //! Open a file and read its columns; all are selected.
+    /*! \return true if the file is an event column file.
+     */
+    bool Open(const std::string& filename /*!< The file to read. */);
+
+    //! Close the file, if open.
+    void Close();
+
+    //! Get the names of the hit groups.
+    /*! \return the names.
+     */
+    const std::vector<std::string>& GetGroups() const
+        { return groups; }
+
+    //! Get the names of the columns.
+    /*! \return the names.
+     */
+    const std::vector<std::string>& GetNames() const
+        { return names; }
+
+    //! Get the hit group of each column.
+    /*! \return the group of each column, -1 for per-event columns.
+     */
+    const std::vector<int>& GetColumnGroups() const
+        { return column_groups; }
+
+    //! Find a column by name.
+    /*! \return the column, or -1 if not found.
+     */
+    int FindColumn(const std::string& name /*!< The name. */) const;
+
+    //! Select whether a column is read.
+    void Select(int column, /*!< The column. */
+                bool read   /*!< Whether to read it. */)
+        { selected[column] = read; }
+
+    //! Read the next chunk.
+    /*! \return 1 if a chunk was read, 0 at the end of the file and -1 on errors.
+     */
+    int Next();
+
+    //! Get the number of events in the chunk.
+    /*! \return the number of events.
+     */
+    uint32_t GetEvents() const
+        { return events; }
+
+    //! Get the number of hits of a group in each event of the chunk.
+    /*! \return the counts.
+     */
+    const std::vector<uint32_t>& GetCounts(int group /*!< The hit group. */) const
+        { return counts[group]; }
+
+    //! Get the values of a column in the chunk.
+    /*! \return the values, empty if the column is not selected.
+     */
+    const std::vector<float>& GetData(int column /*!< The column. */) const
+        { return data[column]; }
+
+private:
+    //! Read the counts and the selected columns of a chunk.
+    /*! \return true if the chunk is complete and has the size given.
+     */
+    bool ReadArrays(const EventChunkHeader& header /*!< The header of the chunk. */);
+
+    //! The open file, or 0.
+    std::FILE* file;
+
+    //! The name of the file.
+    std::string filename;
+
+    //! Names of the hit groups.
+    std::vector<std::string> groups;
+
+    //! Names of the columns.
+    std::vector<std::string> names;
+
+    //! Hit group of each column.
+    std::vector<int> column_groups;
+
+    //! Whether each column is read.
+    std::vector<bool> selected;
+
+    //! The number of events in the chunk.
+    uint32_t events;
+
+    //! Hits of each group in each event of the chunk.
+    std::vector<std::vector<uint32_t> > counts;
+
+    //! Values of each column in the chunk.
+    std::vector<std::vector<float> > data;
+};
+
+#endif /* EventReader_H_ */
@@ -0,0 +1,110 @@
+// -*- c++ -*-
+
+#ifndef EventWriter_H_
+#define EventWriter_H_ 1
+
+#include "JobQueue.h"
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class EventColumns;
+
+/*!
+ * \class EventWriter
+ * \brief Writes event columns into a file on a background thread.
+ * \details See EventFormat.h for the layout. The rows taken from the
+ *  routines are collected into chunks, and each full chunk is written by
+ *  the thread. At most two chunks wait while another is written, so
+ *  Write() blocks if the disk falls behind.
+ * \copyright GNU Public License v. 3
+ */
+class EventWriter {
+public:
+    //! Start the writer thread.
+    EventWriter();
+
+    //! Write all rows and stop the thread.
+    ~EventWriter();
+
+    //! Create the output file for the columns declared.
+    /*! \return true if the file could be created.
+     */
+    bool Open(const std::string& filename,  /*!< The output file, overwritten if it exists. */
+              const EventColumns& columns   /*!< The columns to write. */);
+
+    //! Get the name of the output file.
+    /*! \return the filename.
+     */
+    const std::string& GetFilename() const
+        { return filename; }
+
+    //! Take the rows of a routine, which are cleared.
+    /*! The columns must be those given to Open().
+     */
+    void Write(EventColumns& columns /*!< The rows to add. */);
+
+    //! Write the rows added so far and wait until they are on disk.
+    /*! \return true if all rows were written without errors.
+     */
+    bool Flush();
+
+    //! Get the number of rows added.
+    /*! \return the number of events in the file.
+     */
+    uint64_t GetRows() const
+        { return rows; }
+
+private:
+    //! Events and arrays of a chunk.
+    struct Chunk {
+        uint32_t events;                                //!< The number of events.
+        std::vector<std::vector<uint32_t> > counts;     //!< Hits of each group in each event.
+        std::vector<std::vector<float> > data;          //!< Values of each column.
+    };
+
+    //! Give the current chunk to the thread.
+    void Post();
+
+    //! Write a chunk into the file.
+    /*! \return true if written.
+     */
+    bool WriteChunk(const Chunk& job);
+
+    //! The number of events in a chunk.
+    enum { chunk_events = 64*1024 };
+
+    //! The number of chunks that may wait while another is written.
+    enum { max_waiting = 2 };
+
+    //! The output file.
+    std::string filename;
+
+    //! The open output file, or 0.
+    std::FILE* file;
+
+    //! Names of the columns written.
+    std::vector<std::string> names;
+
+    //! Hit group of each column written.
+    std::vector<int> column_groups;
+
+    //! The chunk being filled.
+    Chunk chunk;
+
+    //! Whether writing has failed, set by the thread.
+    bool error;
+
+    //! Whether rows with other columns have been given.
+    bool mismatch;
+
+    //! The number of rows added.
+    uint64_t rows;
+
+    //! Runs the writing of the chunks.
+    JobQueue queue;
+};
+
+#endif /* EventWriter_H_ */
@@ -0,0 +1,113 @@
+// -*- c++ -*-
+
+#ifndef LiveServer_H_
+#define LiveServer_H_ 1
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+class Histograms;
+
+//! Serves snapshots of histograms on a local socket while sorting.
+/*!
+ * \class LiveServer
+ * \brief Read-only live histogram endpoint.
+ * \details Listens on a Unix domain socket. A client connects, sends
+ *  one request line, and gets back a line "ok <bytes>" followed by that
+ *  many bytes, or a line "error <message>". The requests are
+ *  <pre>
+ *  list                          one line per histogram: name, dimension, bins, entries
+ *  get &lt;name&gt;                    the histogram as native binary histogram file
+ *  all                           all histograms as native binary histogram file
+ *  px &lt;name&gt; [&lt;low&gt; &lt;high&gt;]    projection of a 2D histogram on x, as binary file
+ *  py &lt;name&gt; [&lt;low&gt; &lt;high&gt;]    projection of a 2D histogram on y, as binary file
+ *  </pre>
+ *  A projection adds up the bins of the other axis within [low, high),
+ *  or the regular bins of that axis if no range is given.
+ *
+ *  The requests are answered from the last snapshot given to Publish(),
+ *  never from the histograms being filled, so the sorting threads do not
+ *  wait for the server; publishing only swaps a pointer, and the
+ *  snapshot replaced is deleted by the server thread.
+ * \copyright GNU Public License v. 3
+ */
+class LiveServer {
+public:
+    //! Create the socket and start the server thread.
+    /*! An existing socket file at the path is replaced. If the socket
+     *  cannot be created, an error is printed and IsListening() is false.
+     */
+    LiveServer(const std::string& path /*!< The path of the socket. */);
+
+    //! Stop the thread and remove the socket.
+    ~LiveServer();
+
+    //! Check whether the socket could be created.
+    /*! \return true if requests are served.
+     */
+    bool IsListening() const
+        { return listen_fd >= 0; }
+
+    //! Get the path of the socket.
+    /*! \return the path.
+     */
+    const std::string& GetPath() const
+        { return path; }
+
+    //! Replace the histograms served.
+    /*! The server takes ownership of the snapshot.
+     */
+    void Publish(std::unique_ptr<Histograms> snapshot /*!< The histograms to serve. */);
+
+    //! Send a request to a server and read the answer.
+    /*! \return true if the server answered "ok"; reply is then the data,
+     *  otherwise the error message.
+     */
+    static bool Request(const std::string& path,    /*!< The path of the socket. */
+                        const std::string& request, /*!< The request, without newline. */
+                        std::string& reply          /*!< Set to the answer. */);
+
+private:
+    //! A published snapshot.
+    struct Snapshot {
+        std::unique_ptr<Histograms> histograms;         //!< The histograms.
+        std::chrono::steady_clock::time_point time;     //!< When published.
+    };
+
+    //! The main loop of the thread.
+    void Loop();
+
+    //! Read a request from a client and send the answer.
+    void Serve(int fd /*!< The connection to the client. */);
+
+    //! Answer a request from a snapshot.
+    /*! \return true if answered; reply is then the data, otherwise the
+     *  error message.
+     */
+    static bool Answer(Snapshot& snapshot,          /*!< The histograms to answer from. */
+                       const std::string& request,  /*!< The request line. */
+                       std::string& reply           /*!< Set to the answer. */);
+
+    //! The path of the socket.
+    const std::string path;
+
+    //! The listening socket, or -1.
+    int listen_fd;
+
+    //! The last snapshot published, accessed with std::atomic_load and std::atomic_store.
+    std::shared_ptr<Snapshot> current;
+
+    //! The snapshot replaced by the last Publish(), for the server thread to delete.
+    std::shared_ptr<Snapshot> retired;
+
+    //! Flag set to stop the thread.
+    std::atomic<bool> cancel;
+
+    //! The thread object.
+    std::thread thread;
+};
+
+#endif /* LiveServer_H_ */
@@ -5,6 +5,8 @@
 
 #include <iosfwd>
 #include <memory>
+#include <string>
+#include <vector>
 
 class Histogram1D;
 class Histogram2D;
@@ -34,6 +36,14 @@ public:
     static int Write(std::ofstream& out, /*!< The output stream to write to. */
                      Histogram2Dp h      /*!< The histogram to write. */);
 
+    //! Write many histograms into one MAMA file each.
+    /*! The files are named like the histograms and written in parallel.
+     *  \return the number of files that could not be written.
+     */
+    static int WriteAll(const std::vector<Histogram1Dp>& list1d, /*!< The 1D histograms to write. */
+                        const std::vector<Histogram2Dp>& list2d, /*!< The 2D histograms to write. */
+                        const std::string& directory             /*!< The directory to write into. */);
+
 };
 
 #endif /* MamaWriter_H_ */
@@ -8,15 +8,20 @@
 
 class TH1;
 class TH2;
+class TH3;
+class THnSparse;
 
 typedef TH1* TH1p;
 typedef TH2* TH2p;
+typedef TH3* TH3p;
 
 class Histogram1D;
 class Histogram2D;
+class Histogram3D;
 
 typedef std::shared_ptr<Histogram1D> Histogram1Dp;
 typedef std::shared_ptr<Histogram2D> Histogram2Dp;
+typedef std::shared_ptr<Histogram3D> Histogram3Dp;
 
 class Histograms;
 
@@ -35,7 +40,12 @@ class RootWriter {
 public:
     //! Write many histograms at once.
     /*! All of the histograms in the list will be written. The output
-     *  file will be overwritten if it exists.
+     *  file will be overwritten if it exists. 3D histograms with
+     *  SparseStorage are written as THnSparse, as a TH3 of their size
+     *  would not fit in memory.
+     *
+     *  The ROOT histograms are created first; their bins are then
+     *  copied on several threads, one histogram at a time per thread.
      */
     static void Write( Histograms& histograms,     /*!< The histogram list. */
                        const std::string& filename /*!< The output filename. */);
@@ -49,6 +59,47 @@ public:
     /*! \return the ROOT 2D histogram.
      */
     static TH2p CreateTH2(Histogram2Dp h /*!< The Histogram2D to be cpoied. */);
+
+    //! Create a ROOT histogram from a Histogram3D.
+    /*! \return the ROOT 3D histogram.
+     */
+    static TH3p CreateTH3(Histogram3Dp h /*!< The Histogram3D to be copied. */);
+
+    //! Create a ROOT sparse histogram from a Histogram3D.
+    /*! Only the bins with a content are set. The sparse histogram is
+     *  not added to the current directory.
+     *
+     * \return the ROOT sparse histogram.
+     */
+    static THnSparse* CreateTHnSparse(Histogram3Dp h /*!< The Histogram3D to be copied. */);
+
+private:
+    //! Create an empty ROOT histogram like a Histogram1D.
+    /*! \return the ROOT 1D histogram.
+     */
+    static TH1p NewTH1(const Histogram1Dp& h /*!< The Histogram1D to be copied. */);
+
+    //! Create an empty ROOT histogram like a Histogram2D.
+    /*! \return the ROOT 2D histogram.
+     */
+    static TH2p NewTH2(const Histogram2Dp& h /*!< The Histogram2D to be copied. */);
+
+    //! Create an empty ROOT histogram like a Histogram3D.
+    /*! \return the ROOT 3D histogram.
+     */
+    static TH3p NewTH3(const Histogram3Dp& h /*!< The Histogram3D to be copied. */);
+
+    //! Copy the bins and entries of a Histogram1D into its ROOT histogram.
+    static void CopyTH1(const Histogram1Dp& h, /*!< The Histogram1D to be copied. */
+                        TH1p r                 /*!< The histogram from NewTH1(). */);
+
+    //! Copy the bins and entries of a Histogram2D into its ROOT histogram.
+    static void CopyTH2(const Histogram2Dp& h, /*!< The Histogram2D to be copied. */
+                        TH2p r                 /*!< The histogram from NewTH2(). */);
+
+    //! Copy the bins and entries of a Histogram3D into its ROOT histogram.
+    static void CopyTH3(const Histogram3Dp& h, /*!< The Histogram3D to be copied. */
+                        TH3p r                 /*!< The histogram from NewTH3(). */);
 };
 
 #endif /* RootWriter_H_ */
@@ -0,0 +1,60 @@
+// -*- c++ -*-
+
+#ifndef ShmFormat_H_
+#define ShmFormat_H_ 1
+
+#include <stdint.h>
+
+/*! \file ShmFormat.h
+ *  \brief Layout of the shared memory segments written by ShmPublisher.
+ *
+ *  Each published histogram has its own POSIX shared memory segment,
+ *  named by the prefix given to the 'shm' command and the histogram
+ *  name, e.g. "/ocl_ede_all" (/dev/shm/ocl_ede_all on Linux). A segment
+ *  is a ShmHeader followed by the bins, starting at header_size bytes.
+ *  The bins are stored like in the binary histogram files: in the order
+ *  of ROOT histograms, including the under- and overflow bins, with the
+ *  x bin changing fastest, as values of the element type.
+ *
+ *  The sorting updates the bins in place. To read a consistent copy, a
+ *  viewer reads 'sequence', copies what it needs, and reads 'sequence'
+ *  again; if the value was odd or has changed, the bins were being
+ *  written and the copy is repeated:
+ *  <pre>
+ *  do {
+ *      s = header->sequence;   // with acquire ordering
+ *      copy bins and entries;
+ *  } while( (s & 1) || s != header->sequence );
+ *  </pre>
+ *  A segment is not valid before the magic is set. When the sorting is
+ *  started again, the segments are created anew; a viewer that has an
+ *  old segment mapped sees no more updates and should open it again.
+ *
+ *  Numbers are in the byte order of the machine; the segments are only
+ *  meant to be read on the same machine.
+ */
+
+//! The version written into new segments.
+enum { shm_version = 1 };
+
+//! The start of a shared memory segment for one histogram.
+struct ShmHeader {
+    char magic[8];          //!< "OCLSHM" and two zero bytes.
+    uint32_t version;       //!< The segment format version.
+    uint32_t header_size;   //!< Bytes before the bins, a multiple of 64.
+    uint64_t sequence;      //!< Incremented before and after each update; odd while the bins are written.
+    int64_t entries;        //!< The number of entries.
+    uint32_t dimension;     //!< 1 or 2.
+    uint32_t bin_type;      //!< The BinType of the histogram.
+    uint32_t element;       //!< The BinType of the stored values, not BinUInt16.
+    uint32_t reserved;      //!< Zero.
+    uint64_t bins[2];       //!< Bins on each axis including under- and overflow, 1 if unused.
+    double left[2];         //!< Lower edge of the lowest regular bin on each axis.
+    double right[2];        //!< Upper edge of the highest regular bin on each axis.
+    double update_time;     //!< When the bins were last updated, in seconds since 1970.
+    char name[64];          //!< The histogram name, zero terminated, possibly cut.
+    char title[128];        //!< The histogram title, zero terminated, possibly cut.
+    char axis_title[2][64]; //!< The axis titles, zero terminated, possibly cut.
+};
+
+#endif /* ShmFormat_H_ */
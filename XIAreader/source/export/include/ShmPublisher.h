@@ -0,0 +1,118 @@
+// -*- c++ -*-
+
+#ifndef ShmPublisher_H_
+#define ShmPublisher_H_ 1
+
+#include "Histograms.h"
+#include "SortStats.h"
+
+#include <string>
+#include <vector>
+
+struct ShmHeader;
+
+/*!
+ * \class ShmPublisher
+ * \brief Publishes histograms in POSIX shared memory for a viewer.
+ * \details Each histogram added gets a shared memory segment with the
+ *  layout described in ShmFormat.h. Update() copies the bins of the
+ *  histograms that are due into their segments; a viewer maps the
+ *  segments and reads the bins in place.
+ *
+ *  Copying a large matrix takes longer than sorting a buffer, so each
+ *  histogram is only copied again after 50 times as long as its last
+ *  copy took, and not before the minimum interval. Small histograms are
+ *  then updated after every buffer, and the copying stays below 2% of
+ *  the sorting time.
+ *
+ *  The segments are left in place when the publisher is deleted, so a
+ *  viewer can still show the last contents; Unlink() removes them.
+ * \copyright GNU Public License v. 3
+ */
+class ShmPublisher {
+public:
+    //! Create a publisher without histograms.
+    ShmPublisher(const std::string& prefix, /*!< Put before the histogram names to name the segments. */
+                 double min_interval        /*!< Minimum time between updates of a histogram, in seconds. */);
+
+    //! Unmap the segments.
+    ~ShmPublisher();
+
+    //! Publish a 1D histogram.
+    /*! Histograms published already are skipped. A segment with the same
+     *  name, e.g. from an earlier run, is replaced.
+     *  \return true if the segment could be created.
+     */
+    bool Add(Histogram1Dp h /*!< The histogram to publish. */);
+
+    //! Publish a 2D histogram.
+    /*! Histograms published already are skipped. A segment with the same
+     *  name, e.g. from an earlier run, is replaced.
+     *  \return true if the segment could be created.
+     */
+    bool Add(Histogram2Dp h /*!< The histogram to publish. */);
+
+    //! Get the number of histograms published.
+    /*! \return the number of segments.
+     */
+    size_t GetCount() const
+        { return segments.size(); }
+
+    //! Check if any histogram may be copied.
+    /*! \return true if Update() would look at the histograms.
+     */
+    bool Due() const
+        { return !segments.empty() && SortStats::Now() >= next_due; }
+
+    //! Copy the histograms that are due into their segments.
+    void Update(bool all /*!< Copy also those not due yet, e.g. at the end of a file. */);
+
+    //! Remove all segments.
+    void Unlink();
+
+    //! Read a published histogram, e.g. in a viewer.
+    /*! Creates the histogram in histograms with the name from the segment
+     *  and a consistent copy of its bins.
+     *  \return true if the segment could be read.
+     */
+    static bool Read(const std::string& name, /*!< The name of the segment, e.g. "/ocl_ede_all". */
+                     Histograms& histograms   /*!< Where to create the histogram. */);
+
+private:
+    //! A published histogram and its segment.
+    struct Segment {
+        std::string name;       //!< The name of the segment.
+        Histogram1Dp h1;        //!< The 1D histogram, or 0.
+        Histogram2Dp h2;        //!< The 2D histogram, or 0.
+        ShmHeader* header;      //!< The mapped segment.
+        size_t size;            //!< Bytes mapped.
+        SortStats::tick_t next; //!< When the histogram may be copied again.
+    };
+
+    //! Create and map a segment.
+    /*! \return true if created.
+     */
+    bool Create(Segment& s,           /*!< Segment with name and histogram, mapped on return. */
+                const Named& h,       /*!< The histogram. */
+                int dimension,        /*!< 1 or 2. */
+                BinType type,         /*!< The bin type of the histogram. */
+                const Axis& xaxis,    /*!< The x axis. */
+                const Axis* yaxis     /*!< The y axis, 0 for 1D. */);
+
+    //! Copy the bins of a histogram into its segment.
+    void Copy(Segment& s);
+
+    //! Put before the histogram names.
+    const std::string prefix;
+
+    //! Minimum ticks between updates of a histogram.
+    const SortStats::tick_t min_ticks;
+
+    //! The published histograms.
+    std::vector<Segment> segments;
+
+    //! The earliest time any histogram may be copied.
+    SortStats::tick_t next_due;
+};
+
+#endif /* ShmPublisher_H_ */
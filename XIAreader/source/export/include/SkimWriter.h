@@ -0,0 +1,109 @@
+// -*- c++ -*-
+
+#ifndef SkimWriter_H_
+#define SkimWriter_H_ 1
+
+#include "JobQueue.h"
+#include "WordBuffer.h"
+#include "experimentsetup.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*!
+ * \class SkimWriter
+ * \brief Writes selected hits into a list mode file on a background thread.
+ * \details The hits are written in the XIA list mode format read by
+ *  FileReader, as 4 word headers without traces; FileReader reads them
+ *  back as the same hits. The hits are collected in chunks, and each full
+ *  chunk is written by the thread. At most two chunks wait while another
+ *  is written, so Write() blocks if the disk falls behind.
+ * \copyright GNU Public License v. 3
+ */
+class SkimWriter {
+public:
+    //! Start the writer thread.
+    SkimWriter();
+
+    //! Write all hits and stop the thread.
+    ~SkimWriter();
+
+    //! Create the output file.
+    /*! \return true if the file could be created.
+     */
+    bool Open(const std::string& filename /*!< The output file, overwritten if it exists. */);
+
+    //! Get the name of the output file.
+    /*! \return the filename.
+     */
+    const std::string& GetFilename() const
+        { return filename; }
+
+    //! Add the selected hits of a buffer.
+    void Write(const WordBuffer& buffer,       /*!< The buffer sorted. */
+               const std::vector<char>& keep   /*!< Non-zero for each hit to write, may be shorter than the buffer. */);
+
+    //! Write the hits added so far and wait until they are on disk.
+    /*! \return true if all hits were written without errors.
+     */
+    bool Flush();
+
+    //! Get the number of hits added.
+    /*! \return the number of hits in the skim.
+     */
+    uint64_t GetKept() const
+        { return kept; }
+
+    //! Get the number of hits looked at.
+    /*! \return the number of hits in the buffers given to Write().
+     */
+    uint64_t GetSeen() const
+        { return seen; }
+
+    //! Select the hits near trigger hits, as the event builder does.
+    /*! A hit is selected if it is at most window ns from a hit of the
+     *  trigger detector type in the same buffer.
+     */
+    static void SelectTrigger(const WordBuffer& buffer,     /*!< The buffer. */
+                              DetectorType trigger,         /*!< The type of the trigger detectors. */
+                              int64_t window,               /*!< The largest time difference, in ns. */
+                              std::vector<char>& keep       /*!< Set to 1 for each hit selected. */);
+
+    //! Encode a hit as the 4 header words of the list mode format.
+    static void Encode(const word_t& hit,      /*!< The hit. */
+                       uint32_t* words         /*!< Set to the 4 words. */);
+
+private:
+    //! Give the current chunk to the thread.
+    void Post();
+
+    //! The number of hits in a chunk.
+    enum { chunk_hits = 64*1024 };
+
+    //! The number of chunks that may wait while another is written.
+    enum { max_waiting = 2 };
+
+    //! The output file.
+    std::string filename;
+
+    //! The open output file, or 0.
+    std::FILE* file;
+
+    //! The chunk being filled.
+    std::vector<uint32_t> chunk;
+
+    //! Whether writing has failed, set by the thread.
+    bool error;
+
+    //! The number of hits added.
+    uint64_t kept;
+
+    //! The number of hits looked at.
+    uint64_t seen;
+
+    //! Runs the writing of the chunks.
+    JobQueue queue;
+};
+
+#endif /* SkimWriter_H_ */
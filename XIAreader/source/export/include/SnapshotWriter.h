@@ -0,0 +1,48 @@
+// -*- c++ -*-
+
+#ifndef SnapshotWriter_H_
+#define SnapshotWriter_H_ 1
+
+#include "JobQueue.h"
+
+#include <memory>
+#include <string>
+
+class Histograms;
+
+//! Writes snapshots of histograms into ROOT files on a background thread.
+/*!
+ * \class SnapshotWriter
+ * \brief Background ROOT export.
+ * \details Snapshots are written one at a time in the order they are
+ *  posted. At most one snapshot waits while another is written, so
+ *  Post() blocks if the writer falls behind; this limits the memory
+ *  held by snapshots to two copies of the histograms.
+ * \copyright GNU Public License v. 3
+ */
+class SnapshotWriter {
+public:
+    //! Start the writer thread.
+    SnapshotWriter();
+
+    //! Write a snapshot in the background.
+    /*! The writer takes ownership of the snapshot and deletes it when
+     *  written.
+     */
+    void Post(std::unique_ptr<Histograms> snapshot, /*!< The histograms to write. */
+              const std::string& filename            /*!< The output filename. */);
+
+    //! Check if snapshots are waiting or being written.
+    /*! \return true if Post() might block.
+     */
+    bool Busy();
+
+    //! Wait until all posted snapshots are written.
+    void Wait();
+
+private:
+    //! Runs the writing; at most one snapshot waits while another is written.
+    JobQueue queue;
+};
+
+#endif /* SnapshotWriter_H_ */
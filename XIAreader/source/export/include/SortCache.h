@@ -0,0 +1,89 @@
+// -*- c++ -*-
+
+#ifndef SortCache_H_
+#define SortCache_H_ 1
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Histograms;
+
+/*!
+ * \class SortCache
+ * \brief Keeps the histograms sorted from each data file in a directory.
+ * \details The histograms one data file added to each routine are stored
+ *  as binary histogram files (see BinaryWriter) named by a key, one file
+ *  per routine. The key is a hash of the identity of the data file and of
+ *  everything else that affects the result, so a file sorted again with
+ *  the same key can be added from the cache instead.
+ *
+ *  The identity of a file is its size, modification time and a hash of
+ *  its first and last MiB; hashing all of a data file would take as long
+ *  as reading it for sorting.
+ * \copyright GNU Public License v. 3
+ */
+class SortCache {
+public:
+    //! A 64-bit FNV-1a hash.
+    typedef uint64_t hash_t;
+
+    //! The hash of nothing.
+    static const hash_t empty_hash = 14695981039346656037ULL;
+
+    //! Use a directory for the cache.
+    SortCache(const std::string& directory /*!< The directory, must exist. */);
+
+    //! Get the directory.
+    /*! \return the directory of the cache files.
+     */
+    const std::string& GetDirectory() const
+        { return directory; }
+
+    //! Add bytes to a hash.
+    /*! \return the new hash.
+     */
+    static hash_t Hash(const void* data,      /*!< The bytes to add. */
+                       size_t size,           /*!< The number of bytes. */
+                       hash_t h=empty_hash    /*!< The hash to add to. */);
+
+    //! Add a string and its length to a hash.
+    /*! \return the new hash.
+     */
+    static hash_t Hash(const std::string& text,   /*!< The text to add. */
+                       hash_t h=empty_hash        /*!< The hash to add to. */);
+
+    //! Add the identity of a file to a hash.
+    /*! \return true if the file is a regular file that could be read.
+     */
+    static bool HashFile(const std::string& filename,    /*!< The file. */
+                         hash_t& h                       /*!< The hash to add to. */);
+
+    //! Add the stored histograms of each routine.
+    /*! Nothing is added unless the cache has the histograms of all
+     *  routines for the key, with the same axes as the routines have.
+     *  \return true if the histograms were added.
+     */
+    bool Load(hash_t key,  /*!< The key of the data file. */
+              const std::vector<std::pair<std::string, Histograms*> >& routines /*!< Routine names and their histograms. */) const;
+
+    //! Store the histograms a data file added to a routine.
+    /*! \return true if the histograms were written.
+     */
+    bool Store(hash_t key,                   /*!< The key of the data file. */
+               const std::string& routine,   /*!< The name of the routine. */
+               Histograms& histograms        /*!< The histograms to store. */) const;
+
+private:
+    //! Get the cache file of a routine.
+    /*! \return the filename.
+     */
+    std::string Filename(hash_t key, const std::string& routine) const;
+
+    //! The directory of the cache files.
+    const std::string directory;
+};
+
+#endif /* SortCache_H_ */
@@ -0,0 +1,333 @@
+/*!
+ * \file BinaryReader.cpp
+ * \brief Implementation of BinaryReader.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "BinaryReader.h"
+
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+#include "Histogram3D.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ########################################################################
+
+//! Get the size of a stored value.
+/*! \return the size in bytes, 0 if the type cannot be stored.
+ */
+static size_t ElementSize(uint32_t element)
+{
+    return ( element == BinUInt32 || element == BinFloat ) ? 4
+        : ( element == BinInt64 || element == BinDouble ) ? 8 : 0;
+}
+
+// ########################################################################
+
+//! Visit the bins of a chunk stored as values of type E.
+template<typename E>
+static void VisitValues(const BinaryChunkHeader& h, const char* data,
+                        const BinaryReader::BinVisitor& visit)
+{
+    if ( h.encoding == BinaryRaw ){
+        const E* bins = reinterpret_cast<const E*>(data);
+        for (uint64_t i = 0 ; i < h.count ; ++i){
+            if ( bins[i] != 0 )
+                visit(i, double(bins[i]));
+        }
+        return;
+    }
+
+    const char* p = data;
+    const char* end = data + h.data_size;
+    uint64_t bin = 0;
+    while ( p < end ){
+        const BinaryRun* run = reinterpret_cast<const BinaryRun*>(p);
+        const E* values = reinterpret_cast<const E*>(p + sizeof(BinaryRun));
+        bin += run->zeros;
+        for (uint32_t i = 0 ; i < run->values ; ++i, ++bin){
+            if ( values[i] != 0 )
+                visit(bin, double(values[i]));
+        }
+        p += ( sizeof(BinaryRun) + run->values*sizeof(E) + 7 ) & ~size_t(7);
+    }
+}
+
+// ########################################################################
+
+BinaryReader::BinaryReader()
+    : map( 0 )
+    , map_size( 0 )
+{
+}
+
+// ########################################################################
+
+BinaryReader::~BinaryReader()
+{
+    Close();
+}
+
+// ########################################################################
+
+void BinaryReader::Close()
+{
+    if ( map )
+        munmap(map, map_size);
+    map = 0;
+    map_size = 0;
+    chunks.clear();
+}
+
+// ########################################################################
+
+bool BinaryReader::Open(const std::string& fname)
+{
+    Close();
+    filename = fname;
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if ( fd < 0 ){
+        std::cerr << "BinaryReader: Could not open '" << filename << "'" << std::endl;
+        return false;
+    }
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(BinaryFileHeader) ){
+        std::cerr << "BinaryReader: '" << filename << "' is too short" << std::endl;
+        close(fd);
+        return false;
+    }
+    map_size = st.st_size;
+    map = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ){
+        std::cerr << "BinaryReader: Could not map '" << filename << "'" << std::endl;
+        map = 0;
+        return false;
+    }
+
+    const char* start = static_cast<const char*>(map);
+    const BinaryFileHeader* fh = static_cast<const BinaryFileHeader*>(map);
+    if ( std::memcmp(fh->magic, "OCLHIST", 8) != 0 || fh->byte_order != binary_byte_order
+         || fh->version < 1 || fh->version > binary_version )
+    {
+        std::cerr << "BinaryReader: '" << filename << "' is not a binary histogram file of version "
+                  << int(binary_version) << " or lower in this byte order" << std::endl;
+        Close();
+        return false;
+    }
+
+    uint64_t pos = sizeof(BinaryFileHeader);
+    for (uint64_t c = 0 ; c < fh->count ; ++c){
+        if ( !AddChunk(start + pos, map_size - pos) ){
+            std::cerr << "BinaryReader: Chunk " << c << " in '" << filename << "' is damaged" << std::endl;
+            Close();
+            return false;
+        }
+        pos += chunks.back().header->size;
+    }
+    return true;
+}
+
+// ########################################################################
+
+bool BinaryReader::AddChunk(const char* start, uint64_t space)
+{
+    if ( space < sizeof(BinaryChunkHeader) )
+        return false;
+    const BinaryChunkHeader* h = reinterpret_cast<const BinaryChunkHeader*>(start);
+    if ( h->size > space || h->size % 8 != 0 || h->text_size % 8 != 0
+         || sizeof(BinaryChunkHeader) + h->text_size + h->data_size > h->size
+         || h->dimension < 1 || h->dimension > 3 || h->bin_type > BinDouble )
+        return false;
+
+    Chunk chunk;
+    chunk.header = h;
+    const char* text = start + sizeof(BinaryChunkHeader);
+    const char* text_end = text + h->text_size;
+    for (int t = 0 ; t < 5 ; ++t){
+        const char* z = static_cast<const char*>(std::memchr(text, 0, text_end - text));
+        if ( !z )
+            return false;
+        chunk.text[t] = text;
+        text = z + 1;
+    }
+    chunk.data = text_end;
+
+    uint64_t bins = 1;
+    for (int d = 0 ; d < 3 ; ++d){
+        if ( h->bins[d] < ( d < int(h->dimension) ? 3u : 1u ) )
+            return false;
+        bins *= h->bins[d];
+    }
+    if ( h->encoding == BinaryPairs ){
+        if ( h->data_size != h->count*sizeof(BinaryPair) )
+            return false;
+        const BinaryPair* pairs = reinterpret_cast<const BinaryPair*>(chunk.data);
+        for (uint64_t p = 0 ; p < h->count ; ++p){
+            if ( pairs[p].bin >= bins )
+                return false;
+        }
+    } else if ( h->encoding == BinaryRaw || h->encoding == BinaryZeroRuns ){
+        const size_t esize = ElementSize(h->element);
+        if ( esize == 0 || h->dimension == 3 || h->count != bins )
+            return false;
+        if ( h->encoding == BinaryRaw && h->data_size != bins*esize )
+            return false;
+        if ( h->encoding == BinaryZeroRuns ){
+            // Check that the runs cover the bins without leaving the chunk.
+            uint64_t pos = 0, covered = 0;
+            while ( pos < h->data_size ){
+                if ( h->data_size - pos < sizeof(BinaryRun) )
+                    return false;
+                const BinaryRun* run = reinterpret_cast<const BinaryRun*>(chunk.data + pos);
+                covered += uint64_t(run->zeros) + run->values;
+                pos += ( sizeof(BinaryRun) + run->values*esize + 7 ) & ~uint64_t(7);
+            }
+            if ( pos != h->data_size || covered > bins )
+                return false;
+        }
+    } else {
+        return false;
+    }
+
+    chunks.push_back( chunk );
+    return true;
+}
+
+// ########################################################################
+
+void BinaryReader::ForEachFilled(size_t i, const BinVisitor& visit) const
+{
+    const BinaryChunkHeader& h = *chunks[i].header;
+    const char* data = chunks[i].data;
+    if ( h.encoding == BinaryPairs ){
+        const BinaryPair* pairs = reinterpret_cast<const BinaryPair*>(data);
+        for (uint64_t p = 0 ; p < h.count ; ++p){
+            if ( pairs[p].content != 0 )
+                visit(pairs[p].bin, pairs[p].content);
+        }
+        return;
+    }
+    switch ( h.element ){
+    case BinUInt32: VisitValues<uint32_t>(h, data, visit);  break;
+    case BinInt64:  VisitValues<long long>(h, data, visit); break;
+    case BinFloat:  VisitValues<float>(h, data, visit);     break;
+    case BinDouble: VisitValues<double>(h, data, visit);    break;
+    }
+}
+
+// ########################################################################
+
+//! Check that an axis is like one stored in a chunk.
+/*! \return true if the axes have the same bins.
+ */
+static bool SameAxis(const Axis& axis, const BinaryChunkHeader& h, int d)
+{
+    return uint64_t(axis.GetBinCountAll()) == h.bins[d]
+        && axis.GetLeft() == h.left[d] && axis.GetRight() == h.right[d];
+}
+
+// ########################################################################
+
+bool BinaryReader::Fits(const Histograms& histograms) const
+{
+    bool ok = true;
+    for (size_t i = 0 ; i < chunks.size() ; ++i){
+        const BinaryChunkHeader& h = *chunks[i].header;
+        const std::string name = GetName(i);
+        bool same = true;
+        if ( h.dimension == 1 ){
+            Histogram1Dp h1 = histograms.Find1D(name);
+            same = !h1 || SameAxis(h1->GetAxisX(), h, 0);
+        } else if ( h.dimension == 2 ){
+            Histogram2Dp h2 = histograms.Find2D(name);
+            same = !h2 || ( SameAxis(h2->GetAxisX(), h, 0) && SameAxis(h2->GetAxisY(), h, 1) );
+        } else {
+            Histogram3Dp h3 = histograms.Find3D(name);
+            same = !h3 || ( SameAxis(h3->GetAxisX(), h, 0) && SameAxis(h3->GetAxisY(), h, 1)
+                            && SameAxis(h3->GetAxisZ(), h, 2) );
+        }
+        if ( !same ){
+            std::cerr << "BinaryReader: '" << name << "' in '" << filename << "' has other axes" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// ########################################################################
+
+bool BinaryReader::AddTo(Histograms& histograms) const
+{
+    bool ok = true;
+    for (size_t i = 0 ; i < chunks.size() ; ++i){
+        const BinaryChunkHeader& h = *chunks[i].header;
+        const std::string name = GetName(i);
+        const uint64_t nx = h.bins[0], ny = h.bins[1];
+
+        if ( h.dimension == 1 ){
+            Histogram1Dp h1 = histograms.Find1D(name);
+            if ( !h1 )
+                h1 = histograms.Create1D(name, GetTitle(i), nx-2, h.left[0], h.right[0], GetAxisTitle(i, 0),
+                                         BinType(h.bin_type));
+            else if ( !SameAxis(h1->GetAxisX(), h, 0) ){
+                std::cerr << "BinaryReader: '" << name << "' in '" << filename << "' has other axes" << std::endl;
+                ok = false;
+                continue;
+            }
+            const int entries = h1->GetEntries();
+            ForEachFilled(i, [&h1](uint64_t bin, double c) { h1->FillBin(bin, c); });
+            h1->SetEntries( entries + h.entries );
+        } else if ( h.dimension == 2 ){
+            Histogram2Dp h2 = histograms.Find2D(name);
+            if ( !h2 )
+                h2 = histograms.Create2D(name, GetTitle(i), nx-2, h.left[0], h.right[0], GetAxisTitle(i, 0),
+                                         ny-2, h.left[1], h.right[1], GetAxisTitle(i, 1),
+                                         HistogramStorage(h.storage), BinType(h.bin_type));
+            else if ( !SameAxis(h2->GetAxisX(), h, 0) || !SameAxis(h2->GetAxisY(), h, 1) ){
+                std::cerr << "BinaryReader: '" << name << "' in '" << filename << "' has other axes" << std::endl;
+                ok = false;
+                continue;
+            }
+            // A symmetric matrix holds (x, y) and (y, x) in one bin.
+            const bool symmetric = ( h2->GetStorage() == SymmetricStorage );
+            const int entries = h2->GetEntries();
+            ForEachFilled(i, [&h2, nx, symmetric](uint64_t bin, double c)
+                          {
+                              const Axis::index_t x = bin % nx, y = bin / nx;
+                              if ( !symmetric || x <= y )
+                                  h2->SetBinContent(x, y, h2->GetBinContent(x, y) + c);
+                          });
+            h2->SetEntries( entries + h.entries );
+        } else {
+            Histogram3Dp h3 = histograms.Find3D(name);
+            if ( !h3 )
+                h3 = histograms.Create3D(name, GetTitle(i), nx-2, h.left[0], h.right[0], GetAxisTitle(i, 0),
+                                         ny-2, h.left[1], h.right[1], GetAxisTitle(i, 1),
+                                         h.bins[2]-2, h.left[2], h.right[2], GetAxisTitle(i, 2),
+                                         HistogramStorage(h.storage), BinType(h.bin_type));
+            else if ( !SameAxis(h3->GetAxisX(), h, 0) || !SameAxis(h3->GetAxisY(), h, 1)
+                      || !SameAxis(h3->GetAxisZ(), h, 2) ){
+                std::cerr << "BinaryReader: '" << name << "' in '" << filename << "' has other axes" << std::endl;
+                ok = false;
+                continue;
+            }
+            const int entries = h3->GetEntries();
+            ForEachFilled(i, [&h3, nx, ny](uint64_t bin, double c)
+                          {
+                              const Axis::index_t x = bin % nx, y = ( bin / nx ) % ny, z = bin / ( nx*ny );
+                              h3->SetBinContent(x, y, z, h3->GetBinContent(x, y, z) + c);
+                          });
+            h3->SetEntries( entries + h.entries );
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,269 @@
+/*!
+ * \file BinaryWriter.cpp
+ * \brief Implementation of BinaryWriter.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "BinaryWriter.h"
+
+#include "BinaryFormat.h"
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+#include "Histogram3D.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// ########################################################################
+
+//! Round a size up to a multiple of 8 bytes.
+/*! \return the padded size.
+ */
+static uint64_t Pad8(uint64_t size)
+{
+    return ( size + 7 ) & ~uint64_t(7);
+}
+
+// ########################################################################
+
+//! Append raw bytes to a buffer.
+static void Append(std::vector<char>& buf, const void* data, size_t size)
+{
+    const char* c = static_cast<const char*>(data);
+    buf.insert(buf.end(), c, c + size);
+}
+
+// ########################################################################
+
+//! Encode bins as runs of zeros, each followed by a run of values.
+/*! Gaps of a few zeros are kept within the values, as a new run would
+ *  take more space than the zeros.
+ */
+template<typename E>
+static void EncodeZeroRuns(const std::vector<E>& bins, std::vector<char>& out)
+{
+    const size_t n = bins.size(), max_run = 0xFFFFFFFFu;
+    const size_t min_gap = 2*sizeof(BinaryRun)/sizeof(E);
+    size_t i = 0;
+    while ( i < n ){
+        size_t z = i;
+        while ( z < n && bins[z] == 0 && z - i < max_run )
+            ++z;
+        size_t v = z;
+        while ( v < n && v - z < max_run ){
+            if ( bins[v] != 0 ){
+                ++v;
+                continue;
+            }
+            size_t g = v;
+            while ( g < n && bins[g] == 0 && g - v < min_gap )
+                ++g;
+            if ( g == n || g - v >= min_gap || g - z > max_run )
+                break;
+            v = g;
+        }
+        const BinaryRun run = { uint32_t(z - i), uint32_t(v - z) };
+        Append(out, &run, sizeof(run));
+        if ( v > z )
+            Append(out, &bins[z], (v - z)*sizeof(E));
+        out.resize( Pad8(out.size()), 0 );
+        i = v;
+    }
+}
+
+// ########################################################################
+
+//! Collects the header, names and bins of one chunk and writes it.
+class ChunkWriter {
+public:
+    //! Start a chunk with the names of a histogram and its axes.
+    ChunkWriter(int dimension, BinType type, const std::string& name, const std::string& title)
+        {
+            std::memset(&header, 0, sizeof(header));
+            header.dimension = dimension;
+            header.bin_type = type;
+            header.element = ( type == BinUInt16 ) ? BinUInt32 : type;
+            for (int d = 0 ; d < 3 ; ++d)
+                header.bins[d] = 1;
+            AddText(name);
+            AddText(title);
+        }
+
+    //! Set up an axis and add its title.
+    void SetAxis(int d, const Axis& axis)
+        {
+            header.bins[d] = axis.GetBinCountAll();
+            header.left[d] = axis.GetLeft();
+            header.right[d] = axis.GetRight();
+            AddText(axis.GetTitle());
+        }
+
+    //! Write the chunk.
+    /*! \return true if written without errors.
+     */
+    bool Write(std::ostream& out)
+        {
+            for (unsigned int d = header.dimension ; d < 3 ; ++d)
+                AddText("");
+            text.resize( Pad8(text.size()), 0 );
+            header.text_size = text.size();
+            header.data_size = data.size();
+            header.size = sizeof(header) + text.size() + Pad8(data.size());
+            data.resize( Pad8(data.size()), 0 );
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(&text[0], text.size());
+            if ( !data.empty() )
+                out.write(&data[0], data.size());
+            return bool(out);
+        }
+
+    //! The chunk header.
+    BinaryChunkHeader header;
+
+    //! The encoded bins.
+    std::vector<char> data;
+
+private:
+    //! Add a zero terminated string to the names.
+    void AddText(const std::string& s)
+        { text.insert(text.end(), s.c_str(), s.c_str() + s.size() + 1); }
+
+    //! The names and titles.
+    std::vector<char> text;
+};
+
+// ########################################################################
+
+//! Copy the bins of a 1D or 2D histogram and encode them into a chunk.
+template<typename E, class H>
+static void EncodeBins(H& h, ChunkWriter& chunk, bool compress)
+{
+    std::vector<E> bins( chunk.header.bins[0]*chunk.header.bins[1] );
+    h.CopyBins( &bins[0] );
+    chunk.header.count = bins.size();
+
+    if ( compress ){
+        EncodeZeroRuns(bins, chunk.data);
+        if ( chunk.data.size() < bins.size()*sizeof(E) ){
+            chunk.header.encoding = BinaryZeroRuns;
+            return;
+        }
+        chunk.data.clear();
+    }
+    chunk.header.encoding = BinaryRaw;
+    Append(chunk.data, &bins[0], bins.size()*sizeof(E));
+}
+
+// ########################################################################
+
+//! Encode the bins of a 1D or 2D histogram with the element type of the chunk.
+template<class H>
+static void EncodeBins(H& h, ChunkWriter& chunk, bool compress)
+{
+    switch ( chunk.header.element ){
+    case BinUInt32: EncodeBins<uint32_t>(h, chunk, compress);  break;
+    case BinInt64:  EncodeBins<long long>(h, chunk, compress); break;
+    case BinFloat:  EncodeBins<float>(h, chunk, compress);     break;
+    default:        EncodeBins<double>(h, chunk, compress);    break;
+    }
+}
+
+// ########################################################################
+
+bool BinaryWriter::Write( Histograms& histograms, const std::string& filename, bool compress )
+{
+    std::ofstream out( filename.c_str(), std::ios::binary | std::ios::trunc );
+    if ( !out ){
+        std::cerr << "BinaryWriter: Could not open '" << filename << "'" << std::endl;
+        return false;
+    }
+
+    Write( histograms, out, compress );
+    out.close();
+    if ( !out ){
+        std::cerr << "BinaryWriter: Problem writing '" << filename << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ########################################################################
+
+bool BinaryWriter::Write( Histograms& histograms, std::ostream& out, bool compress, const std::string& only )
+{
+    const Histograms::list1d_t& list1d = histograms.GetAll1D();
+    const Histograms::list2d_t& list2d = histograms.GetAll2D();
+    const Histograms::list3d_t& list3d = histograms.GetAll3D();
+
+    auto selected = [&only](const Named& h) { return only.empty() || h.GetName() == only; };
+
+    BinaryFileHeader fh;
+    std::memset(&fh, 0, sizeof(fh));
+    std::memcpy(fh.magic, "OCLHIST", 8);
+    fh.version = binary_version;
+    fh.byte_order = binary_byte_order;
+    fh.count = 0;
+    for (size_t i = 0 ; i < list1d.size() ; ++i)
+        fh.count += selected(*list1d[i]) ? 1 : 0;
+    for (size_t i = 0 ; i < list2d.size() ; ++i)
+        fh.count += selected(*list2d[i]) ? 1 : 0;
+    for (size_t i = 0 ; i < list3d.size() ; ++i)
+        fh.count += selected(*list3d[i]) ? 1 : 0;
+    out.write(reinterpret_cast<const char*>(&fh), sizeof(fh));
+
+    for (size_t i = 0 ; i < list1d.size() ; ++i){
+        Histogram1D& h = *list1d[i];
+        if ( !selected(h) )
+            continue;
+        ChunkWriter chunk(1, h.GetBinType(), h.GetName(), h.GetTitle());
+        chunk.SetAxis(0, h.GetAxisX());
+        EncodeBins(h, chunk, compress);
+        chunk.header.entries = h.GetEntries();
+        chunk.Write(out);
+    }
+
+    for (size_t i = 0 ; i < list2d.size() ; ++i){
+        Histogram2D& h = *list2d[i];
+        if ( !selected(h) )
+            continue;
+        ChunkWriter chunk(2, h.GetBinType(), h.GetName(), h.GetTitle());
+        chunk.SetAxis(0, h.GetAxisX());
+        chunk.SetAxis(1, h.GetAxisY());
+        chunk.header.storage = h.GetStorage();
+        EncodeBins(h, chunk, compress);
+        chunk.header.entries = h.GetEntries();
+        chunk.Write(out);
+    }
+
+    for (size_t i = 0 ; i < list3d.size() ; ++i){
+        Histogram3D& h = *list3d[i];
+        if ( !selected(h) )
+            continue;
+        ChunkWriter chunk(3, h.GetBinType(), h.GetName(), h.GetTitle());
+        chunk.SetAxis(0, h.GetAxisX());
+        chunk.SetAxis(1, h.GetAxisY());
+        chunk.SetAxis(2, h.GetAxisZ());
+        chunk.header.storage = h.GetStorage();
+        chunk.header.element = BinDouble;
+        chunk.header.encoding = BinaryPairs;
+
+        const uint64_t nx = chunk.header.bins[0], ny = chunk.header.bins[1];
+        std::vector<BinaryPair> pairs;
+        h.ForEachFilled([&pairs, nx, ny](Axis::index_t x, Axis::index_t y, Axis::index_t z, double c)
+                        {
+                            const BinaryPair p = { uint64_t(x) + nx*( uint64_t(y) + ny*uint64_t(z) ), c };
+                            pairs.push_back( p );
+                        });
+        std::sort(pairs.begin(), pairs.end(),
+                  [](const BinaryPair& a, const BinaryPair& b) { return a.bin < b.bin; });
+        chunk.header.count = pairs.size();
+        if ( !pairs.empty() )
+            Append(chunk.data, &pairs[0], pairs.size()*sizeof(BinaryPair));
+        chunk.header.entries = h.GetEntries();
+        chunk.Write(out);
+    }
+    return bool(out);
+}
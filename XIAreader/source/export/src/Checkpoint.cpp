@@ -0,0 +1,172 @@
+/*!
+ * \file Checkpoint.cpp
+ * \brief Implementation of Checkpoint.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "Checkpoint.h"
+
+#include "BinaryWriter.h"
+#include "Histograms.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+//! The version of the checkpoint text file.
+static const int checkpoint_version = 1;
+
+// ########################################################################
+
+//! Remove whitespace at the beginning and end.
+/*! \return the text without leading and trailing whitespace.
+ */
+static std::string Trim(const std::string& text)
+{
+    const size_t start = text.find_first_not_of(" \t");
+    if ( start == std::string::npos )
+        return "";
+    const size_t end = text.find_last_not_of(" \t");
+    return text.substr(start, end-start+1);
+}
+
+// ########################################################################
+
+Checkpoint::Checkpoint(const std::string& f)
+    : filename( f )
+    , generation( 0 )
+    , queue( 1 )
+{
+    // Continue the numbering of an existing checkpoint, so its files are
+    // not overwritten before the new text file is in place.
+    State old;
+    if ( Read(filename, old) ){
+        generation = old.generation;
+        for (size_t r = 0 ; r < old.routines.size() ; ++r)
+            files.push_back( old.routines[r].second );
+    }
+}
+
+// ########################################################################
+
+void Checkpoint::Post(const State& state, snapshots_t snapshots)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->state = state;
+    job->snapshots = std::move(snapshots);
+    // A newer checkpoint replaces one still waiting.
+    queue.Replace( [this, job]() { Write( *job ); } );
+}
+
+// ########################################################################
+
+bool Checkpoint::Busy()
+{
+    return queue.Busy();
+}
+
+// ########################################################################
+
+void Checkpoint::Wait()
+{
+    queue.Wait();
+}
+
+// ########################################################################
+
+bool Checkpoint::Write(Job& job)
+{
+    State& state = job.state;
+    state.generation = generation + 1;
+    state.routines.clear();
+
+    std::vector<std::string> written;
+    for (size_t r = 0 ; r < job.snapshots.size() ; ++r){
+        std::ostringstream name;
+        name << filename << '.' << state.generation << '.' << job.snapshots[r].first;
+        written.push_back( name.str() );
+        state.routines.push_back( std::make_pair( job.snapshots[r].first, name.str() ) );
+        if ( !BinaryWriter::Write( *job.snapshots[r].second, name.str() ) ){
+            std::cerr << "\ncheckpoint: Could not write '" << name.str() << "'" << std::endl;
+            for (size_t w = 0 ; w < written.size() ; ++w)
+                std::remove( written[w].c_str() );
+            return false;
+        }
+    }
+
+    const std::string tmp = filename + ".tmp";
+    std::ofstream out( tmp.c_str() );
+    out << "# Checkpoint of a sorting, continued with --resume\n"
+        << "version " << checkpoint_version << '\n'
+        << "generation " << state.generation << '\n'
+        << "batch " << state.batch << '\n'
+        << "line " << state.line << '\n'
+        << "data " << state.buffer;
+    if ( state.buffer >= 0 )
+        out << ' ' << state.data;
+    out << '\n';
+    for (size_t r = 0 ; r < state.routines.size() ; ++r)
+        out << "routine " << state.routines[r].first << ' ' << state.routines[r].second << '\n';
+    out.close();
+    if ( !out || std::rename( tmp.c_str(), filename.c_str() ) != 0 ){
+        std::cerr << "\ncheckpoint: Could not write '" << filename << "'" << std::endl;
+        std::remove( tmp.c_str() );
+        for (size_t w = 0 ; w < written.size() ; ++w)
+            std::remove( written[w].c_str() );
+        return false;
+    }
+
+    for (size_t f = 0 ; f < files.size() ; ++f)
+        std::remove( files[f].c_str() );
+    files = written;
+    generation = state.generation;
+    return true;
+}
+
+// ########################################################################
+
+bool Checkpoint::Read(const std::string& filename, State& state)
+{
+    std::ifstream in( filename.c_str() );
+    if ( !in )
+        return false;
+
+    state = State();
+    state.generation = 0;
+    state.line = 0;
+    state.buffer = -1;
+    int version = 0;
+    std::string line;
+    while ( std::getline(in, line) ){
+        if ( line.empty() || line[0] == '#' )
+            continue;
+        std::istringstream iline( line );
+        std::string key;
+        iline >> key;
+        if ( key == "version" ){
+            iline >> version;
+        } else if ( key == "generation" ){
+            iline >> state.generation;
+        } else if ( key == "batch" ){
+            std::getline(iline, state.batch);
+            state.batch = Trim( state.batch );
+        } else if ( key == "line" ){
+            iline >> state.line;
+        } else if ( key == "data" ){
+            iline >> state.buffer;
+            std::getline(iline, state.data);
+            state.data = Trim( state.data );
+        } else if ( key == "routine" ){
+            std::string name, file;
+            iline >> name;
+            std::getline(iline, file);
+            state.routines.push_back( std::make_pair( name, Trim( file ) ) );
+        }
+    }
+    if ( version != checkpoint_version || state.line <= 0 || ( state.buffer >= 0 && state.data.empty() ) ){
+        std::cerr << "checkpoint: '" << filename << "' is not a valid checkpoint" << std::endl;
+        return false;
+    }
+    return true;
+}
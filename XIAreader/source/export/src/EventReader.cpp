@@ -0,0 +1,173 @@
+/*!
+ * \file EventReader.cpp
+ * \brief Implementation of EventReader.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "EventReader.h"
+
+#include "EventFormat.h"
+
+#include <cstring>
+#include <iostream>
+
+// ########################################################################
+
+EventReader::EventReader()
+    : file( 0 )
+    , events( 0 )
+{
+}
+
+// ########################################################################
+
+EventReader::~EventReader()
+{
+    Close();
+}
+
+// ########################################################################
+
+void EventReader::Close()
+{
+    if ( file ){
+        std::fclose( file );
+        file = 0;
+    }
+    events = 0;
+}
+
+// ########################################################################
+
+bool EventReader::Open(const std::string& f)
+{
+    Close();
+    filename = f;
+    file = std::fopen(filename.c_str(), "rb");
+    if ( !file ){
+        std::cerr << "EventReader: Could not open '" << filename << "'" << std::endl;
+        return false;
+    }
+
+    EventFileHeader header;
+    if ( std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, "OCLEVTS", 8) != 0
+         || header.version != event_version || header.byte_order != event_byte_order
+         || header.columns > 0x10000 || header.groups > header.columns || header.text_size > 0x1000000 )
+    {
+        std::cerr << "EventReader: '" << filename << "' is not an event column file" << std::endl;
+        Close();
+        return false;
+    }
+
+    std::vector<int32_t> table( ( header.columns + 1 ) & ~1u );
+    std::vector<char> text( header.text_size + 1, 0 );
+    if ( ( !table.empty() && std::fread(&table[0], sizeof(int32_t), table.size(), file) != table.size() )
+         || std::fread(&text[0], 1, header.text_size, file) != header.text_size )
+    {
+        std::cerr << "EventReader: '" << filename << "' is truncated" << std::endl;
+        Close();
+        return false;
+    }
+
+    groups.clear();
+    names.clear();
+    column_groups.clear();
+    size_t at = 0;
+    for (uint32_t i = 0 ; i < header.groups + header.columns ; ++i){
+        if ( at >= header.text_size ){
+            std::cerr << "EventReader: Bad names in '" << filename << "'" << std::endl;
+            Close();
+            return false;
+        }
+        const std::string name = &text[at];
+        at += name.size() + 1;
+        if ( i < header.groups ){
+            groups.push_back( name );
+            continue;
+        }
+        const int32_t g = table[i - header.groups];
+        if ( g < -1 || g >= int32_t(header.groups) ){
+            std::cerr << "EventReader: Bad hit group of column '" << name << "' in '" << filename << "'" << std::endl;
+            Close();
+            return false;
+        }
+        names.push_back( name );
+        column_groups.push_back( g );
+    }
+
+    selected.assign(names.size(), true);
+    counts.assign(groups.size(), std::vector<uint32_t>());
+    data.assign(names.size(), std::vector<float>());
+    return true;
+}
+
+// ########################################################################
+
+int EventReader::FindColumn(const std::string& name) const
+{
+    for (size_t c = 0 ; c < names.size() ; ++c){
+        if ( names[c] == name )
+            return c;
+    }
+    return -1;
+}
+
+// ########################################################################
+
+int EventReader::Next()
+{
+    events = 0;
+    if ( !file )
+        return -1;
+
+    EventChunkHeader header;
+    if ( std::fread(&header, sizeof(header), 1, file) != 1 )
+        return std::feof(file) ? 0 : -1;
+    if ( !ReadArrays(header) ){
+        std::cerr << "EventReader: Bad chunk in '" << filename << "'" << std::endl;
+        return -1;
+    }
+    events = header.events;
+    return 1;
+}
+
+// ########################################################################
+
+bool EventReader::ReadArrays(const EventChunkHeader& header)
+{
+    // Chunks are written with about 64k events.
+    if ( header.events > ( 1 << 24 ) )
+        return false;
+
+    // The counts come first, and give the size of each column.
+    uint64_t left = header.size;
+    std::vector<uint64_t> hits( groups.size(), 0 );
+    for (size_t g = 0 ; g < groups.size() ; ++g){
+        std::vector<uint32_t>& c = counts[g];
+        if ( left < uint64_t(header.events)*sizeof(uint32_t) )
+            return false;
+        c.resize( header.events );
+        if ( header.events > 0 && std::fread(&c[0], sizeof(uint32_t), c.size(), file) != c.size() )
+            return false;
+        left -= c.size()*sizeof(uint32_t);
+        for (size_t i = 0 ; i < c.size() ; ++i)
+            hits[g] += c[i];
+    }
+    for (size_t c = 0 ; c < names.size() ; ++c){
+        const uint64_t n = ( column_groups[c] < 0 ) ? header.events : hits[column_groups[c]];
+        if ( left < n*sizeof(float) )
+            return false;
+        left -= n*sizeof(float);
+        std::vector<float>& d = data[c];
+        if ( !selected[c] ){
+            d.clear();
+            if ( std::fseek(file, n*sizeof(float), SEEK_CUR) != 0 )
+                return false;
+            continue;
+        }
+        d.resize( n );
+        if ( n > 0 && std::fread(&d[0], sizeof(float), n, file) != n )
+            return false;
+    }
+    return left == 0;
+}
@@ -0,0 +1,164 @@
+/*!
+ * \file EventWriter.cpp
+ * \brief Implementation of EventWriter.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "EventWriter.h"
+
+#include "EventColumns.h"
+#include "EventFormat.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+// ########################################################################
+
+EventWriter::EventWriter()
+    : file( 0 )
+    , error( false )
+    , mismatch( false )
+    , rows( 0 )
+    , queue( max_waiting )
+{
+    chunk.events = 0;
+}
+
+// ########################################################################
+
+EventWriter::~EventWriter()
+{
+    Flush();
+    if ( file )
+        std::fclose( file );
+}
+
+// ########################################################################
+
+bool EventWriter::Open(const std::string& f, const EventColumns& columns)
+{
+    filename = f;
+    names = columns.GetNames();
+    column_groups = columns.GetColumnGroups();
+    const std::vector<std::string>& groups = columns.GetGroups();
+    chunk.counts.assign(groups.size(), std::vector<uint32_t>());
+    chunk.data.assign(names.size(), std::vector<float>());
+
+    // The column groups and the names, each padded to 8 bytes.
+    std::vector<char> table( ( names.size()*sizeof(int32_t) + 7 ) & ~size_t(7), 0 );
+    for (size_t c = 0 ; c < names.size() ; ++c){
+        const int32_t g = column_groups[c];
+        std::memcpy(&table[c*sizeof(g)], &g, sizeof(g));
+    }
+    std::vector<char> text;
+    for (size_t g = 0 ; g < groups.size() ; ++g)
+        text.insert(text.end(), groups[g].c_str(), groups[g].c_str() + groups[g].size() + 1);
+    for (size_t c = 0 ; c < names.size() ; ++c)
+        text.insert(text.end(), names[c].c_str(), names[c].c_str() + names[c].size() + 1);
+    text.resize( ( text.size() + 7 ) & ~size_t(7), 0 );
+
+    EventFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "OCLEVTS", 8);
+    header.version = event_version;
+    header.byte_order = event_byte_order;
+    header.groups = groups.size();
+    header.columns = names.size();
+    header.text_size = text.size();
+
+    file = std::fopen(filename.c_str(), "wb");
+    if ( !file
+         || std::fwrite(&header, sizeof(header), 1, file) != 1
+         || ( !table.empty() && std::fwrite(&table[0], 1, table.size(), file) != table.size() )
+         || ( !text.empty() && std::fwrite(&text[0], 1, text.size(), file) != text.size() ) )
+    {
+        std::cerr << "EventWriter: Could not create '" << filename << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ########################################################################
+
+void EventWriter::Write(EventColumns& columns)
+{
+    if ( columns.GetRows() == 0 )
+        return;
+    if ( columns.GetNames() != names || columns.GetColumnGroups() != column_groups ){
+        if ( !mismatch )
+            std::cerr << "\nEventWriter: The columns have changed since '" << filename << "' was opened" << std::endl;
+        mismatch = true;
+        columns.Clear();
+        return;
+    }
+
+    for (size_t g = 0 ; g < chunk.counts.size() ; ++g){
+        const std::vector<uint32_t>& src = columns.GetCounts(g);
+        chunk.counts[g].insert(chunk.counts[g].end(), src.begin(), src.end());
+    }
+    for (size_t c = 0 ; c < chunk.data.size() ; ++c){
+        const std::vector<float>& src = columns.GetData(c);
+        chunk.data[c].insert(chunk.data[c].end(), src.begin(), src.end());
+    }
+    chunk.events += columns.GetRows();
+    rows += columns.GetRows();
+    columns.Clear();
+    if ( chunk.events >= chunk_events )
+        Post();
+}
+
+// ########################################################################
+
+void EventWriter::Post()
+{
+    std::shared_ptr<Chunk> job = std::make_shared<Chunk>( std::move(chunk) );
+    chunk.events = 0;
+    chunk.counts.assign(job->counts.size(), std::vector<uint32_t>());
+    chunk.data.assign(job->data.size(), std::vector<float>());
+    queue.Post( [this, job]() {
+            const bool ok = WriteChunk( *job );
+            if ( !ok && !error )
+                std::cerr << "\nEventWriter: Could not write '" << filename << "'" << std::endl;
+            error = error || !ok;
+        } );
+}
+
+// ########################################################################
+
+bool EventWriter::Flush()
+{
+    if ( chunk.events > 0 )
+        Post();
+    queue.Wait();
+    if ( file && std::fflush( file ) != 0 )
+        error = true;
+    return file && !error && !mismatch;
+}
+
+// ########################################################################
+
+bool EventWriter::WriteChunk(const Chunk& job)
+{
+    EventChunkHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.events = job.events;
+    for (size_t g = 0 ; g < job.counts.size() ; ++g)
+        header.size += job.counts[g].size()*sizeof(uint32_t);
+    for (size_t c = 0 ; c < job.data.size() ; ++c)
+        header.size += job.data[c].size()*sizeof(float);
+
+    if ( !file || std::fwrite(&header, sizeof(header), 1, file) != 1 )
+        return false;
+    for (size_t g = 0 ; g < job.counts.size() ; ++g){
+        const std::vector<uint32_t>& a = job.counts[g];
+        if ( std::fwrite(&a[0], sizeof(uint32_t), a.size(), file) != a.size() )
+            return false;
+    }
+    for (size_t c = 0 ; c < job.data.size() ; ++c){
+        const std::vector<float>& a = job.data[c];
+        if ( !a.empty() && std::fwrite(&a[0], sizeof(float), a.size(), file) != a.size() )
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,298 @@
+/*!
+ * \file LiveServer.cpp
+ * \brief Implementation of LiveServer.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "LiveServer.h"
+
+#include "BinaryWriter.h"
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+#include "Histogram3D.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ########################################################################
+
+//! Fill in the address of a socket.
+/*! \return false if the path is too long.
+ */
+static bool SocketAddress(const std::string& path, struct sockaddr_un& addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( path.empty() || path.size() >= sizeof(addr.sun_path) )
+        return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// ########################################################################
+
+//! Send all of a buffer.
+/*! \return true if all was sent.
+ */
+static bool SendAll(int fd, const char* data, size_t size)
+{
+    while ( size > 0 ){
+        const ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if ( n <= 0 )
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// ########################################################################
+
+LiveServer::LiveServer(const std::string& p)
+    : path( p )
+    , listen_fd( -1 )
+    , cancel( false )
+{
+    struct sockaddr_un addr;
+    if ( !SocketAddress(path, addr) ){
+        std::cerr << "LiveServer: Socket path '" << path << "' is empty or too long" << std::endl;
+        return;
+    }
+
+    // Only replace what is a socket already, e.g. left by an earlier run.
+    struct stat st;
+    if ( lstat(path.c_str(), &st) == 0 ){
+        if ( !S_ISSOCK(st.st_mode) ){
+            std::cerr << "LiveServer: '" << path << "' exists and is not a socket" << std::endl;
+            return;
+        }
+        unlink(path.c_str());
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+         || listen(listen_fd, 8) != 0 )
+    {
+        std::cerr << "LiveServer: Could not listen on '" << path << "': " << std::strerror(errno) << std::endl;
+        if ( listen_fd >= 0 )
+            close(listen_fd);
+        listen_fd = -1;
+        return;
+    }
+    thread = std::thread( &LiveServer::Loop, this );
+}
+
+// ########################################################################
+
+LiveServer::~LiveServer()
+{
+    if ( listen_fd < 0 )
+        return;
+    cancel = true;
+    thread.join();
+    close(listen_fd);
+    unlink(path.c_str());
+}
+
+// ########################################################################
+
+void LiveServer::Publish(std::unique_ptr<Histograms> snapshot)
+{
+    std::shared_ptr<Snapshot> s( new Snapshot );
+    s->histograms = std::move(snapshot);
+    s->time = std::chrono::steady_clock::now();
+
+    // Let the server thread delete the previous snapshot.
+    std::atomic_store(&retired, std::atomic_exchange(&current, s));
+}
+
+// ########################################################################
+
+void LiveServer::Loop()
+{
+    while ( !cancel ){
+        std::atomic_store(&retired, std::shared_ptr<Snapshot>());
+
+        // Wake up now and then to see if the server is stopped.
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        if ( poll(&pfd, 1, 100) <= 0 )
+            continue;
+        const int fd = accept(listen_fd, 0, 0);
+        if ( fd < 0 )
+            continue;
+        Serve(fd);
+        close(fd);
+    }
+}
+
+// ########################################################################
+
+void LiveServer::Serve(int fd)
+{
+    // A client that does not send its request in time is dropped.
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char c;
+    while ( request.size() < 1024 && recv(fd, &c, 1, 0) == 1 && c != '\n' )
+        request += c;
+
+    std::string reply;
+    std::shared_ptr<Snapshot> snapshot = std::atomic_load(&current);
+    bool ok = false;
+    if ( !snapshot )
+        reply = "no histograms published yet";
+    else
+        ok = Answer(*snapshot, request, reply);
+
+    std::ostringstream head;
+    if ( ok )
+        head << "ok " << reply.size() << '\n';
+    else
+        head << "error " << reply << '\n';
+    const std::string h = head.str();
+    if ( SendAll(fd, h.data(), h.size()) && ok )
+        SendAll(fd, reply.data(), reply.size());
+}
+
+// ########################################################################
+
+bool LiveServer::Answer(Snapshot& snapshot, const std::string& request, std::string& reply)
+{
+    Histograms& histograms = *snapshot.histograms;
+    std::istringstream icmd( request );
+    std::string cmd, name;
+    icmd >> cmd >> name;
+
+    if ( cmd == "list" ){
+        std::ostringstream out;
+        out << "# snapshot " << std::chrono::duration<double>( std::chrono::steady_clock::now() - snapshot.time ).count()
+            << " s old\n";
+        for (size_t i = 0 ; i < histograms.GetAll1D().size() ; ++i){
+            const Histogram1D& h = *histograms.GetAll1D()[i];
+            out << h.GetName() << " 1D " << h.GetAxisX().GetBinCount() << ' ' << h.GetEntries() << '\n';
+        }
+        for (size_t i = 0 ; i < histograms.GetAll2D().size() ; ++i){
+            const Histogram2D& h = *histograms.GetAll2D()[i];
+            out << h.GetName() << " 2D " << h.GetAxisX().GetBinCount() << ' ' << h.GetAxisY().GetBinCount()
+                << ' ' << h.GetEntries() << '\n';
+        }
+        for (size_t i = 0 ; i < histograms.GetAll3D().size() ; ++i){
+            const Histogram3D& h = *histograms.GetAll3D()[i];
+            out << h.GetName() << " 3D " << h.GetAxisX().GetBinCount() << ' ' << h.GetAxisY().GetBinCount()
+                << ' ' << h.GetAxisZ().GetBinCount() << ' ' << h.GetEntries() << '\n';
+        }
+        reply = out.str();
+        return true;
+    } else if ( cmd == "all" || cmd == "get" ){
+        if ( cmd == "get" && !histograms.Find1D(name) && !histograms.Find2D(name) && !histograms.Find3D(name) ){
+            reply = "no histogram named '" + name + "'";
+            return false;
+        }
+        std::ostringstream out;
+        BinaryWriter::Write( histograms, out, true, cmd == "get" ? name : "" );
+        reply = out.str();
+        return true;
+    } else if ( cmd == "px" || cmd == "py" ){
+        Histogram2Dp h = histograms.Find2D(name);
+        if ( !h ){
+            reply = "no 2D histogram named '" + name + "'";
+            return false;
+        }
+        const bool px = ( cmd == "px" );
+        const Axis& axis = px ? h->GetAxisX() : h->GetAxisY();
+        const Axis& other = px ? h->GetAxisY() : h->GetAxisX();
+
+        // The bins of the other axis to add up.
+        Axis::index_t first = 1, last = other.GetBinCount();
+        double low, high;
+        if ( icmd >> low >> high ){
+            first = other.FindBin(low);
+            last = other.FindBin(high);
+            if ( last > first && other.GetLeft() + (last-1)*other.GetBinWidth() >= high )
+                last -= 1;
+        }
+
+        std::vector<double> sums( axis.GetBinCountAll(), 0.0 );
+        for (Axis::index_t j = first ; j <= last ; ++j){
+            for (Axis::index_t i = 0 ; i < axis.GetBinCountAll() ; ++i)
+                sums[i] += px ? h->GetBinContent(i, j) : h->GetBinContent(j, i);
+        }
+
+        Histograms projection;
+        Histogram1Dp p = projection.Create1D( name + "_" + cmd, h->GetTitle() + " (" + cmd + ")",
+                                              axis.GetBinCount(), axis.GetLeft(), axis.GetRight(),
+                                              axis.GetTitle(), BinDouble );
+        double total = 0;
+        for (Axis::index_t i = 0 ; i < axis.GetBinCountAll() ; ++i){
+            if ( sums[i] != 0 )
+                p->FillBin(i, sums[i]);
+            total += sums[i];
+        }
+        p->SetEntries( int(total + 0.5) );
+
+        std::ostringstream out;
+        BinaryWriter::Write( projection, out );
+        reply = out.str();
+        return true;
+    }
+    reply = "unknown request '" + request + "', expected list, get, all, px or py";
+    return false;
+}
+
+// ########################################################################
+
+bool LiveServer::Request(const std::string& path, const std::string& request, std::string& reply)
+{
+    struct sockaddr_un addr;
+    if ( !SocketAddress(path, addr) ){
+        reply = "socket path '" + path + "' is empty or too long";
+        return false;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ){
+        reply = "could not connect to '" + path + "': " + std::strerror(errno);
+        if ( fd >= 0 )
+            close(fd);
+        return false;
+    }
+
+    const std::string line = request + '\n';
+    std::string answer;
+    if ( SendAll(fd, line.data(), line.size()) ){
+        std::vector<char> buf( 1 << 16 );
+        ssize_t n;
+        while ( ( n = recv(fd, &buf[0], buf.size(), 0) ) > 0 )
+            answer.append(&buf[0], n);
+    }
+    close(fd);
+
+    const size_t eol = answer.find('\n');
+    if ( eol == std::string::npos ){
+        reply = "no answer from '" + path + "'";
+        return false;
+    }
+    if ( answer.compare(0, 6, "error ") == 0 ){
+        reply = answer.substr(6, eol - 6);
+        return false;
+    }
+    const unsigned long size = std::strtoul(answer.c_str() + 3, 0, 10);
+    if ( answer.compare(0, 3, "ok ") != 0 || answer.size() - eol - 1 != size ){
+        reply = "incomplete answer from '" + path + "'";
+        return false;
+    }
+    reply = answer.substr(eol + 1);
+    return true;
+}
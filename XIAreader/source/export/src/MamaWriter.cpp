@@ -11,8 +11,13 @@
 #include "Histogram1D.h"
 #include "Histogram2D.h"
 #include "IOPrintf.h"
+#include "RunParallel.h"
 
+#include <atomic>
+#include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <time.h>
@@ -25,7 +30,8 @@ static std::string datetime()
 {
     char tmp[64];
     time_t now = time(0);
-    size_t s = strftime(tmp, sizeof(tmp), "%d-%b-%y %H:%M:%S", localtime(&now));
+    struct tm local;
+    size_t s = strftime(tmp, sizeof(tmp), "%d-%b-%y %H:%M:%S", localtime_r(&now, &local));
     tmp[s] = '\0';
     return tmp;
 }
@@ -77,34 +83,162 @@ static void spectrum_write_header(std::ostream& fp, const std::string& comment,
 
 // ########################################################################
 
-int MamaWriter::Write(std::ofstream& fp, Histogram1Dp h)
+//! Append an integer in decimal, like std::ostream does.
+static void append_int(std::string& out, long long v)
 {
-    const Axis& xax = h->GetAxisX();
-    float cal[3] = { (float)xax.GetLeft(), (float)xax.GetBinWidth(), 0 };
-    spectrum_write_header(fp, h->GetTitle(), xax.GetBinCount(), -1, cal);
-    for(int i=0; i<xax.GetBinCount(); i++)
-        fp << h->GetBinContent(i+1) << ' ';
-    fp << "\n!IDEND=\n\n" << std::flush;
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    unsigned long long u = ( v < 0 ) ? 0ULL - (unsigned long long)v : v;
+    do {
+        *--p = char('0' + u % 10);
+        u /= 10;
+    } while( u );
+    if( v < 0 )
+        *--p = '-';
+    out.append(p, tmp + sizeof(tmp) - p);
+}
 
-    return ( !fp ) ? -1 : 0;
+// ########################################################################
+
+//! Append a bin content and a space.
+/*! Integer bins are written as integers, other bins like std::ostream
+ *  writes a double with the default format. Whole numbers below 10^6
+ *  look the same in both, and are written without snprintf().
+ */
+static inline void append_bin(std::string& out, double c, bool integer)
+{
+    if( integer ) {
+        append_int(out, (long long)c);
+    } else if( c > -1e6 && c < 1e6 && c == double((long long)c) && !( c == 0 && std::signbit(c) ) ) {
+        append_int(out, (long long)c);
+    } else {
+        char tmp[32];
+        const int n = snprintf(tmp, sizeof(tmp), "%g", c);
+        out.append(tmp, n);
+    }
+    out += ' ';
 }
 
 // ########################################################################
 
-int MamaWriter::Write(std::ofstream& fp, Histogram2Dp h)
+//! Get the contents of all bins, including the under- and overflow bins.
+template<class H>
+static void copy_bins(H& h, size_t count, std::vector<double>& bins)
 {
-    const Axis& xax = h->GetAxisX(), yax = h->GetAxisY();
+    bins.resize(count);
+    h.CopyBins(&bins[0]);
+}
+
+// ########################################################################
+
+//! Format a 1D histogram as MAMA spectrum.
+static void format(std::string& out, Histogram1D& h)
+{
+    const Axis& xax = h.GetAxisX();
+    // spectrum_write_header looks at all six coefficients.
+    float cal[6] = { (float)xax.GetLeft(), (float)xax.GetBinWidth(), 0, 0, 0, 0 };
+    std::ostringstream header;
+    spectrum_write_header(header, h.GetTitle(), xax.GetBinCount(), -1, cal);
+    out = header.str();
+
+    std::vector<double> bins;
+    copy_bins(h, xax.GetBinCountAll(), bins);
+    const bool integer = BinTypeIsInteger(h.GetBinType());
+    out.reserve(out.size() + 12*xax.GetBinCount() + 16);
+    for(int i=0; i<xax.GetBinCount(); i++)
+        append_bin(out, bins[i+1], integer);
+    out += "\n!IDEND=\n\n";
+}
+
+// ########################################################################
+
+//! Format a 2D histogram as MAMA matrix.
+static void format(std::string& out, Histogram2D& h)
+{
+    const Axis& xax = h.GetAxisX(), yax = h.GetAxisY();
     float cal[6] = {
         (float)xax.GetLeft(), (float)xax.GetBinWidth(), 0,
         (float)yax.GetLeft(), (float)yax.GetBinWidth(), 0
     };
-    spectrum_write_header(fp, h->GetTitle(), xax.GetBinCount(), yax.GetBinCount(), cal);
+    std::ostringstream header;
+    spectrum_write_header(header, h.GetTitle(), xax.GetBinCount(), yax.GetBinCount(), cal);
+    out = header.str();
+
+    std::vector<double> bins;
+    const size_t xcount = xax.GetBinCountAll();
+    copy_bins(h, xcount*yax.GetBinCountAll(), bins);
+    const bool integer = BinTypeIsInteger(h.GetBinType());
+    out.reserve(out.size() + ( 4*xax.GetBinCount() + 1 )*yax.GetBinCount() + 16);
     for(int j=0; j<yax.GetBinCount(); ++j) {
+        const double* row = &bins[(j+1)*xcount + 1];
         for(int i=0; i<xax.GetBinCount(); ++i)
-            fp << h->GetBinContent(i+1, j+1) << ' ';
-        fp << '\n';
+            append_bin(out, row[i], integer);
+        out += '\n';
+    }
+    out += "!IDEND=\n\n";
+}
+
+// ########################################################################
+
+int MamaWriter::Write(std::ofstream& fp, Histogram1Dp h)
+{
+    std::string out;
+    format(out, *h);
+    fp.write(out.data(), out.size());
+    fp.flush();
+
+    return ( !fp ) ? -1 : 0;
+}
+
+// ########################################################################
+
+int MamaWriter::Write(std::ofstream& fp, Histogram2Dp h)
+{
+    std::string out;
+    format(out, *h);
+    fp.write(out.data(), out.size());
+    fp.flush();
+
+    return ( !fp ) ? -1 : 0;
+}
+
+// ########################################################################
+
+//! Format a histogram and write it into its own file.
+/*! \return 0 if okay, <0 if error
+ */
+template<class H>
+static int write_file(H& h, const std::string& directory)
+{
+    std::string out;
+    format(out, h);
+    const std::string filename = directory + "/" + h.GetName();
+    std::ofstream fp( filename.c_str(), std::ios::binary );
+    fp.write(out.data(), out.size());
+    fp.close();
+    if( !fp ) {
+        std::cerr << "MamaWriter: Problem writing '" << filename << "'" << std::endl;
+        return -1;
     }
-    fp << "!IDEND=\n\n" << std::flush;
-    
     return 0;
 }
+
+// ########################################################################
+
+int MamaWriter::WriteAll(const std::vector<Histogram1Dp>& list1d,
+                         const std::vector<Histogram2Dp>& list2d,
+                         const std::string& directory)
+{
+    std::atomic<int> bad( 0 );
+    std::vector<std::function<void()> > jobs;
+    for(size_t i=0; i<list2d.size(); ++i) {
+        Histogram2Dp h = list2d[i];
+        jobs.push_back( [h, &directory, &bad]() { if( write_file(*h, directory) < 0 ) ++bad; } );
+    }
+    for(size_t i=0; i<list1d.size(); ++i) {
+        Histogram1Dp h = list1d[i];
+        jobs.push_back( [h, &directory, &bad]() { if( write_file(*h, directory) < 0 ) ++bad; } );
+    }
+    RunParallel( jobs );
+    return bad;
+}
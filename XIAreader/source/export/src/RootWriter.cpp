@@ -10,9 +10,39 @@
 #include <TFile.h>
 #include <TH1.h>
 #include <TH2.h>
+#include <TH3.h>
+#include <THnSparse.h>
 
 #include "Histogram1D.h"
 #include "Histogram2D.h"
+#include "Histogram3D.h"
+#include "RunParallel.h"
+
+#include <functional>
+#include <vector>
+
+// ########################################################################
+
+//! Copy the bins of a histogram straight into the array of a ROOT histogram.
+template<class H>
+static void CopyBins(H& h, TH1* r)
+{
+    if( TArrayD* a = dynamic_cast<TArrayD*>(r) )
+        h.CopyBins( a->GetArray() );
+    else if( TArrayF* a = dynamic_cast<TArrayF*>(r) )
+        h.CopyBins( a->GetArray() );
+    else if( TArrayI* a = dynamic_cast<TArrayI*>(r) )
+        h.CopyBins( a->GetArray() );
+}
+
+// ########################################################################
+
+//! Whether bins of a type are written as double, as ROOT has no 64 bit
+//! integer histograms and 32 bit unsigned counts overflow Int_t.
+static bool RootDouble(BinType type)
+{
+    return type == BinDouble || type == BinInt64 || type == BinUInt32;
+}
 
 // ########################################################################
 
@@ -21,13 +51,43 @@ void RootWriter::Write( Histograms& histograms,
 {
     TFile outfile( filename.c_str(), "recreate" );
 
-    Histograms::list1d_t list1d = histograms.GetAll1D();
-    for( Histograms::list1d_t::iterator it = list1d.begin(); it != list1d.end(); ++it )
-        CreateTH1( *it );
+    // ROOT objects are created here, in the directory of the file; only
+    // the bins are copied on other threads. The largest histograms are
+    // started first.
+    std::vector<std::function<void()> > copies;
+
+    const Histograms::list3d_t& list3d = histograms.GetAll3D();
+    for( Histograms::list3d_t::const_iterator it = list3d.begin(); it != list3d.end(); ++it ) {
+        if( (*it)->GetStorage() != SparseStorage ) {
+            Histogram3Dp h = *it;
+            TH3p r = NewTH3( h );
+            copies.push_back( [h, r]() { CopyTH3( h, r ); } );
+        }
+    }
+
+    const Histograms::list2d_t& list2d = histograms.GetAll2D();
+    for( Histograms::list2d_t::const_iterator it = list2d.begin(); it != list2d.end(); ++it ) {
+        Histogram2Dp h = *it;
+        TH2p r = NewTH2( h );
+        copies.push_back( [h, r]() { CopyTH2( h, r ); } );
+    }
 
-    Histograms::list2d_t list2d = histograms.GetAll2D();
-    for( Histograms::list2d_t::iterator it = list2d.begin(); it != list2d.end(); ++it )
-        CreateTH2( *it );
+    const Histograms::list1d_t& list1d = histograms.GetAll1D();
+    for( Histograms::list1d_t::const_iterator it = list1d.begin(); it != list1d.end(); ++it ) {
+        Histogram1Dp h = *it;
+        TH1p r = NewTH1( h );
+        copies.push_back( [h, r]() { CopyTH1( h, r ); } );
+    }
+
+    RunParallel( copies );
+
+    for( Histograms::list3d_t::const_iterator it = list3d.begin(); it != list3d.end(); ++it ) {
+        if( (*it)->GetStorage() == SparseStorage ) {
+            THnSparse* sparse = CreateTHnSparse( *it );
+            sparse->Write();
+            delete sparse;
+        }
+    }
 
     outfile.Write();
     outfile.Close();
@@ -36,11 +96,28 @@ void RootWriter::Write( Histograms& histograms,
 // ########################################################################
 
 TH1p RootWriter::CreateTH1(Histogram1Dp h)
+{
+    TH1p r = NewTH1( h );
+    CopyTH1( h, r );
+    return r;
+}
+
+// ########################################################################
+
+TH1p RootWriter::NewTH1(const Histogram1Dp& h)
 {
     const Axis& xax = h->GetAxisX();
     const int channels = xax.GetBinCount();
-    TH1* r = new TH1I( h->GetName().c_str(), h->GetTitle().c_str(),
-                       channels, xax.GetLeft(), xax.GetRight() );
+    TH1* r;
+    if( RootDouble(h->GetBinType()) )
+        r = new TH1D( h->GetName().c_str(), h->GetTitle().c_str(),
+                      channels, xax.GetLeft(), xax.GetRight() );
+    else if( h->GetBinType() == BinUInt16 )
+        r = new TH1I( h->GetName().c_str(), h->GetTitle().c_str(),
+                      channels, xax.GetLeft(), xax.GetRight() );
+    else
+        r = new TH1F( h->GetName().c_str(), h->GetTitle().c_str(),
+                      channels, xax.GetLeft(), xax.GetRight() );
 
     TAxis* rxax = r->GetXaxis();
     rxax->SetTitle(xax.GetTitle().c_str());
@@ -57,23 +134,46 @@ TH1p RootWriter::CreateTH1(Histogram1Dp h)
 #endif // ROOT1D_YTITLE
     ryax->SetLabelSize(0.03);
 
-    for(int i=0; i<channels+2; ++i)
-        r->SetBinContent(i, h->GetBinContent(i));
-    r->SetEntries( h->GetEntries() );
-
     return r;
 }
 
 // ########################################################################
 
+void RootWriter::CopyTH1(const Histogram1Dp& h, TH1p r)
+{
+    CopyBins( *h, r );
+    r->SetEntries( h->GetEntries() );
+}
+
+// ########################################################################
+
 TH2* RootWriter::CreateTH2(Histogram2Dp h)
+{
+    TH2p mat = NewTH2( h );
+    CopyTH2( h, mat );
+    return mat;
+}
+
+// ########################################################################
+
+TH2p RootWriter::NewTH2(const Histogram2Dp& h)
 {
     const Axis& xax = h->GetAxisX(), yax = h->GetAxisY();
     const int xchannels = xax.GetBinCount();
     const int ychannels = yax.GetBinCount();
-    TH2* mat = new TH2F( h->GetName().c_str(), h->GetTitle().c_str(),
-                         xchannels, xax.GetLeft(), xax.GetRight(),
-                         ychannels, yax.GetLeft(), yax.GetRight() );
+    TH2* mat;
+    if( RootDouble(h->GetBinType()) )
+        mat = new TH2D( h->GetName().c_str(), h->GetTitle().c_str(),
+                        xchannels, xax.GetLeft(), xax.GetRight(),
+                        ychannels, yax.GetLeft(), yax.GetRight() );
+    else if( h->GetBinType() == BinUInt16 )
+        mat = new TH2I( h->GetName().c_str(), h->GetTitle().c_str(),
+                        xchannels, xax.GetLeft(), xax.GetRight(),
+                        ychannels, yax.GetLeft(), yax.GetRight() );
+    else
+        mat = new TH2F( h->GetName().c_str(), h->GetTitle().c_str(),
+                        xchannels, xax.GetLeft(), xax.GetRight(),
+                        ychannels, yax.GetLeft(), yax.GetRight() );
     mat->SetOption( "colz" );
     mat->SetContour( 64 );
 
@@ -91,10 +191,94 @@ TH2* RootWriter::CreateTH2(Histogram2Dp h)
     TAxis* zax = mat->GetZaxis();
     zax->SetLabelSize(0.025);
 
-    for(int iy=0; iy<ychannels+2; ++iy)
-        for(int ix=0; ix<xchannels+2; ++ix)
-            mat->SetBinContent(ix, iy, h->GetBinContent(ix, iy));
+    return mat;
+}
+
+// ########################################################################
+
+void RootWriter::CopyTH2(const Histogram2Dp& h, TH2p mat)
+{
+    CopyBins( *h, mat );
     mat->SetEntries( h->GetEntries() );
+}
 
-    return mat;
+// ########################################################################
+
+TH3* RootWriter::CreateTH3(Histogram3Dp h)
+{
+    TH3p cube = NewTH3( h );
+    CopyTH3( h, cube );
+    return cube;
+}
+
+// ########################################################################
+
+TH3p RootWriter::NewTH3(const Histogram3Dp& h)
+{
+    const Axis& xax = h->GetAxisX(), yax = h->GetAxisY(), zax = h->GetAxisZ();
+    TH3* cube;
+    if( RootDouble(h->GetBinType()) )
+        cube = new TH3D( h->GetName().c_str(), h->GetTitle().c_str(),
+                         xax.GetBinCount(), xax.GetLeft(), xax.GetRight(),
+                         yax.GetBinCount(), yax.GetLeft(), yax.GetRight(),
+                         zax.GetBinCount(), zax.GetLeft(), zax.GetRight() );
+    else if( h->GetBinType() == BinUInt16 )
+        cube = new TH3I( h->GetName().c_str(), h->GetTitle().c_str(),
+                         xax.GetBinCount(), xax.GetLeft(), xax.GetRight(),
+                         yax.GetBinCount(), yax.GetLeft(), yax.GetRight(),
+                         zax.GetBinCount(), zax.GetLeft(), zax.GetRight() );
+    else
+        cube = new TH3F( h->GetName().c_str(), h->GetTitle().c_str(),
+                         xax.GetBinCount(), xax.GetLeft(), xax.GetRight(),
+                         yax.GetBinCount(), yax.GetLeft(), yax.GetRight(),
+                         zax.GetBinCount(), zax.GetLeft(), zax.GetRight() );
+
+    cube->GetXaxis()->SetTitle(xax.GetTitle().c_str());
+    cube->GetYaxis()->SetTitle(yax.GetTitle().c_str());
+    cube->GetZaxis()->SetTitle(zax.GetTitle().c_str());
+
+    return cube;
+}
+
+// ########################################################################
+
+void RootWriter::CopyTH3(const Histogram3Dp& h, TH3p cube)
+{
+    h->ForEachFilled([cube](Axis::index_t x, Axis::index_t y, Axis::index_t z, double c)
+                     { cube->SetBinContent(x, y, z, c); });
+    cube->SetEntries( h->GetEntries() );
+}
+
+// ########################################################################
+
+THnSparse* RootWriter::CreateTHnSparse(Histogram3Dp h)
+{
+    const Axis* axes[3] = { &h->GetAxisX(), &h->GetAxisY(), &h->GetAxisZ() };
+    Int_t bins[3];
+    Double_t left[3], right[3];
+    for(int d=0; d<3; ++d) {
+        bins[d] = axes[d]->GetBinCount();
+        left[d] = axes[d]->GetLeft();
+        right[d] = axes[d]->GetRight();
+    }
+
+    THnSparse* sparse;
+    if( RootDouble(h->GetBinType()) )
+        sparse = new THnSparseD( h->GetName().c_str(), h->GetTitle().c_str(), 3, bins, left, right );
+    else if( h->GetBinType() == BinUInt16 )
+        sparse = new THnSparseI( h->GetName().c_str(), h->GetTitle().c_str(), 3, bins, left, right );
+    else
+        sparse = new THnSparseF( h->GetName().c_str(), h->GetTitle().c_str(), 3, bins, left, right );
+
+    for(int d=0; d<3; ++d)
+        sparse->GetAxis(d)->SetTitle(axes[d]->GetTitle().c_str());
+
+    h->ForEachFilled([sparse](Axis::index_t x, Axis::index_t y, Axis::index_t z, double c)
+                     {
+                         const Int_t bin[3] = { Int_t(x), Int_t(y), Int_t(z) };
+                         sparse->SetBinContent(bin, c);
+                     });
+    sparse->SetEntries( h->GetEntries() );
+
+    return sparse;
 }
@@ -0,0 +1,308 @@
+/*!
+ * \file ShmPublisher.cpp
+ * \brief Implementation of ShmPublisher.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "ShmPublisher.h"
+
+#include "ShmFormat.h"
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ########################################################################
+
+//! Copy a string into a fixed size field, cutting it if needed.
+template<size_t N>
+static void CopyText(char (&dst)[N], const std::string& src)
+{
+    const size_t n = std::min(src.size(), N-1);
+    std::memcpy(dst, src.c_str(), n);
+    dst[n] = 0;
+}
+
+// ########################################################################
+
+//! Copy the bins of a histogram as values of type E.
+template<typename E, class H>
+static void CopyAs(H& h, void* bins)
+{
+    h.CopyBins( static_cast<E*>(bins) );
+}
+
+// ########################################################################
+
+//! Copy the bins of a histogram with the element type of its segment.
+template<class H>
+static void CopyBins(H& h, uint32_t element, void* bins)
+{
+    switch ( element ){
+    case BinUInt32: CopyAs<uint32_t>(h, bins);  break;
+    case BinInt64:  CopyAs<long long>(h, bins); break;
+    case BinFloat:  CopyAs<float>(h, bins);     break;
+    default:        CopyAs<double>(h, bins);    break;
+    }
+}
+
+// ########################################################################
+
+//! Get the bins of a histogram read from a segment, stored as values of type E.
+template<typename E>
+static double BinValue(const std::vector<char>& bins, uint64_t i)
+{
+    return reinterpret_cast<const E*>(&bins[0])[i];
+}
+
+// ########################################################################
+
+ShmPublisher::ShmPublisher(const std::string& p, double min_interval)
+    : prefix( p )
+    , min_ticks( SortStats::tick_t( std::max(0.0, min_interval)*SortStats::TicksPerSecond() ) )
+    , next_due( 0 )
+{
+}
+
+// ########################################################################
+
+ShmPublisher::~ShmPublisher()
+{
+    for (size_t i = 0 ; i < segments.size() ; ++i)
+        munmap(segments[i].header, segments[i].size);
+}
+
+// ########################################################################
+
+bool ShmPublisher::Add(Histogram1Dp h)
+{
+    Segment s;
+    s.h1 = h;
+    return Create(s, *h, 1, h->GetBinType(), h->GetAxisX(), 0);
+}
+
+// ########################################################################
+
+bool ShmPublisher::Add(Histogram2Dp h)
+{
+    Segment s;
+    s.h2 = h;
+    return Create(s, *h, 2, h->GetBinType(), h->GetAxisX(), &h->GetAxisY());
+}
+
+// ########################################################################
+
+bool ShmPublisher::Create(Segment& s, const Named& h, int dimension, BinType type,
+                          const Axis& xaxis, const Axis* yaxis)
+{
+    s.name = "/" + prefix + h.GetName();
+    for (size_t i = 0 ; i < segments.size() ; ++i){
+        if ( segments[i].name == s.name )
+            return true;
+    }
+    s.next = 0;
+
+    const uint32_t element = ( type == BinUInt16 ) ? BinUInt32 : type;
+    const uint32_t header_size = ( sizeof(ShmHeader) + 63 ) & ~63u;
+    const uint64_t nbins = xaxis.GetBinCountAll()*( yaxis ? yaxis->GetBinCountAll() : 1 );
+    s.size = header_size + nbins*BinTypeSize(BinType(element));
+
+    // A segment left by an earlier run is replaced rather than reused, so
+    // the new one starts with zero bins and takes no memory until filled.
+    shm_unlink(s.name.c_str());
+    const int fd = shm_open(s.name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if ( fd < 0 || ftruncate(fd, s.size) != 0 ){
+        std::cerr << "ShmPublisher: Could not create '" << s.name << "': " << std::strerror(errno) << std::endl;
+        if ( fd >= 0 )
+            close(fd);
+        return false;
+    }
+    void* map = mmap(0, s.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ){
+        std::cerr << "ShmPublisher: Could not map '" << s.name << "': " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    s.header = static_cast<ShmHeader*>(map);
+    ShmHeader& hd = *s.header;
+    hd.version = shm_version;
+    hd.header_size = header_size;
+    hd.sequence = 0;
+    hd.entries = 0;
+    hd.dimension = dimension;
+    hd.bin_type = type;
+    hd.element = element;
+    hd.reserved = 0;
+    hd.bins[0] = xaxis.GetBinCountAll();
+    hd.left[0] = xaxis.GetLeft();
+    hd.right[0] = xaxis.GetRight();
+    hd.bins[1] = yaxis ? yaxis->GetBinCountAll() : 1;
+    hd.left[1] = yaxis ? yaxis->GetLeft() : 0;
+    hd.right[1] = yaxis ? yaxis->GetRight() : 0;
+    hd.update_time = 0;
+    CopyText(hd.name, h.GetName());
+    CopyText(hd.title, h.GetTitle());
+    CopyText(hd.axis_title[0], xaxis.GetTitle());
+    CopyText(hd.axis_title[1], yaxis ? yaxis->GetTitle() : "");
+
+    // A viewer may open the segment already; the magic comes last.
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(hd.magic, "OCLSHM\0", 8);
+
+    segments.push_back( s );
+    next_due = 0;
+    return true;
+}
+
+// ########################################################################
+
+void ShmPublisher::Copy(Segment& s)
+{
+    ShmHeader& hd = *s.header;
+    volatile uint64_t& sequence = hd.sequence;
+    const uint64_t seq = sequence;
+
+    sequence = seq + 1;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    void* bins = reinterpret_cast<char*>(s.header) + hd.header_size;
+    if ( s.h1 ){
+        CopyBins(*s.h1, hd.element, bins);
+        hd.entries = s.h1->GetEntries();
+    } else {
+        CopyBins(*s.h2, hd.element, bins);
+        hd.entries = s.h2->GetEntries();
+    }
+    hd.update_time = std::chrono::duration<double>( std::chrono::system_clock::now().time_since_epoch() ).count();
+
+    std::atomic_thread_fence(std::memory_order_release);
+    sequence = seq + 2;
+}
+
+// ########################################################################
+
+void ShmPublisher::Update(bool all)
+{
+    SortStats::tick_t now = SortStats::Now();
+    next_due = SortStats::tick_t(-1);
+    for (size_t i = 0 ; i < segments.size() ; ++i){
+        Segment& s = segments[i];
+        if ( all || now >= s.next ){
+            // The entries do not tell if the bins changed, e.g. after an
+            // Add() or a reset, so a histogram is copied whenever due.
+            Copy(s);
+            const SortStats::tick_t done = SortStats::Now();
+            s.next = done + std::max(min_ticks, 50*( done - now ));
+            now = done;
+        }
+        next_due = std::min(next_due, s.next);
+    }
+}
+
+// ########################################################################
+
+void ShmPublisher::Unlink()
+{
+    for (size_t i = 0 ; i < segments.size() ; ++i){
+        munmap(segments[i].header, segments[i].size);
+        shm_unlink(segments[i].name.c_str());
+    }
+    segments.clear();
+}
+
+// ########################################################################
+
+bool ShmPublisher::Read(const std::string& name, Histograms& histograms)
+{
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    struct stat st;
+    if ( fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(ShmHeader) ){
+        std::cerr << "ShmPublisher: Could not open '" << name << "'" << std::endl;
+        if ( fd >= 0 )
+            close(fd);
+        return false;
+    }
+    const size_t size = st.st_size;
+    void* map = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ){
+        std::cerr << "ShmPublisher: Could not map '" << name << "'" << std::endl;
+        return false;
+    }
+
+    const ShmHeader& hd = *static_cast<const ShmHeader*>(map);
+    const volatile uint64_t& sequence = hd.sequence;
+    ShmHeader header;
+    std::vector<char> bins;
+    bool ok = false;
+    for (int attempt = 0 ; attempt < 1000 && !ok ; ++attempt){
+        const uint64_t seq = sequence;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::memcpy(&header, &hd, sizeof(header));
+        const uint64_t count = header.bins[0]*header.bins[1];
+        const size_t esize = ( header.element == BinUInt32 || header.element == BinFloat ) ? 4 : 8;
+        if ( std::memcmp(header.magic, "OCLSHM", 7) != 0 || header.version != shm_version
+             || header.dimension < 1 || header.dimension > 2 || header.bin_type > BinDouble
+             || header.header_size < sizeof(ShmHeader) || header.header_size + count*esize > size )
+        {
+            break;
+        }
+        bins.resize( count*esize );
+        std::memcpy(&bins[0], static_cast<const char*>(map) + header.header_size, bins.size());
+        std::atomic_thread_fence(std::memory_order_acquire);
+        ok = ( seq & 1 ) == 0 && seq == sequence;
+        if ( !ok )
+            usleep(1000);
+    }
+    munmap(map, size);
+    if ( !ok ){
+        std::cerr << "ShmPublisher: '" << name << "' is not a histogram segment, or is always being written" << std::endl;
+        return false;
+    }
+
+    header.name[sizeof(header.name)-1] = 0;
+    header.title[sizeof(header.title)-1] = 0;
+    header.axis_title[0][sizeof(header.axis_title[0])-1] = 0;
+    header.axis_title[1][sizeof(header.axis_title[1])-1] = 0;
+
+    double (*value)(const std::vector<char>&, uint64_t) =
+        ( header.element == BinUInt32 ) ? BinValue<uint32_t>
+        : ( header.element == BinInt64 ) ? BinValue<long long>
+        : ( header.element == BinFloat ) ? BinValue<float> : BinValue<double>;
+    const uint64_t nx = header.bins[0], ny = header.bins[1];
+    if ( header.dimension == 1 ){
+        Histogram1Dp h = histograms.Create1D(header.name, header.title, nx-2, header.left[0], header.right[0],
+                                             header.axis_title[0], BinType(header.bin_type));
+        for (uint64_t x = 0 ; x < nx ; ++x){
+            const double c = value(bins, x);
+            if ( c != 0 )
+                h->FillBin(x, c);
+        }
+        h->SetEntries( header.entries );
+    } else {
+        Histogram2Dp h = histograms.Create2D(header.name, header.title, nx-2, header.left[0], header.right[0],
+                                             header.axis_title[0], ny-2, header.left[1], header.right[1],
+                                             header.axis_title[1], DenseStorage, BinType(header.bin_type));
+        for (uint64_t y = 0 ; y < ny ; ++y){
+            for (uint64_t x = 0 ; x < nx ; ++x){
+                const double c = value(bins, x + nx*y);
+                if ( c != 0 )
+                    h->SetBinContent(x, y, c);
+            }
+        }
+        h->SetEntries( header.entries );
+    }
+    return true;
+}
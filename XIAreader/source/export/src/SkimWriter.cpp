@@ -0,0 +1,130 @@
+/*!
+ * \file SkimWriter.cpp
+ * \brief Implementation of SkimWriter.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "SkimWriter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+// ########################################################################
+
+SkimWriter::SkimWriter()
+    : file( 0 )
+    , error( false )
+    , kept( 0 )
+    , seen( 0 )
+    , queue( max_waiting )
+{
+    chunk.reserve( 4*chunk_hits );
+}
+
+// ########################################################################
+
+SkimWriter::~SkimWriter()
+{
+    Flush();
+    if ( file )
+        std::fclose( file );
+}
+
+// ########################################################################
+
+bool SkimWriter::Open(const std::string& f)
+{
+    filename = f;
+    file = std::fopen(filename.c_str(), "wb");
+    if ( !file ){
+        std::cerr << "SkimWriter: Could not create '" << filename << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ########################################################################
+
+void SkimWriter::Write(const WordBuffer& buffer, const std::vector<char>& keep)
+{
+    const int size = std::min<int>(buffer.GetSize(), keep.size());
+    for (int i = 0 ; i < size ; ++i){
+        if ( !keep[i] )
+            continue;
+        const size_t n = chunk.size();
+        chunk.resize( n + 4 );
+        Encode(buffer[i], &chunk[n]);
+        kept += 1;
+        if ( chunk.size() >= 4*chunk_hits )
+            Post();
+    }
+    seen += buffer.GetSize();
+}
+
+// ########################################################################
+
+void SkimWriter::Post()
+{
+    std::shared_ptr<std::vector<uint32_t> > job = std::make_shared<std::vector<uint32_t> >( std::move(chunk) );
+    chunk = std::vector<uint32_t>();
+    chunk.reserve( 4*chunk_hits );
+    queue.Post( [this, job]() {
+            const bool ok = file && std::fwrite(&(*job)[0], sizeof(uint32_t), job->size(), file) == job->size();
+            if ( !ok && !error )
+                std::cerr << "\nSkimWriter: Could not write '" << filename << "'" << std::endl;
+            error = error || !ok;
+        } );
+}
+
+// ########################################################################
+
+bool SkimWriter::Flush()
+{
+    if ( !chunk.empty() )
+        Post();
+    queue.Wait();
+    if ( file && std::fflush( file ) != 0 )
+        error = true;
+    return file && !error;
+}
+
+// ########################################################################
+
+void SkimWriter::SelectTrigger(const WordBuffer& buffer, DetectorType trigger, int64_t window, std::vector<char>& keep)
+{
+    const int size = buffer.GetSize();
+    keep.assign(size, 0);
+
+    // The hits up to 'end' are selected already by an earlier trigger.
+    int end = 0;
+    for (int i = 0 ; i < size ; ++i){
+        if ( GetDetector(buffer[i].address).type != trigger )
+            continue;
+        const int64_t t = buffer[i].timestamp;
+        keep[i] = 1;
+        for (int j = i ; j > 0 && !keep[j-1] && std::llabs(buffer[j-1].timestamp - t) <= window ; --j)
+            keep[j-1] = 1;
+        for (int j = std::max(i, end-1) ; j < size - 1 && std::llabs(buffer[j+1].timestamp - t) <= window ; ++j){
+            keep[j+1] = 1;
+            end = j + 2;
+        }
+        end = std::max(end, i + 1);
+    }
+}
+
+// ########################################################################
+
+void SkimWriter::Encode(const word_t& hit, uint32_t* words)
+{
+    // The inverse of FileReader::ReadEvent; the timestamps there are
+    // multiplied to ns depending on the sampling frequency.
+    const int64_t tick = ( GetSamplingFrequency(hit.address) == f250MHz ) ? 8 : 10;
+    const uint64_t timestamp = hit.timestamp / tick;
+
+    words[0] = ( hit.finishcode ? 0x80000000 : 0 ) | ( 4u << 17 ) | ( 4u << 12 ) | ( hit.address & 0x0FFF );
+    words[1] = uint32_t( timestamp );
+    words[2] = uint32_t( ( timestamp >> 32 ) & 0xFFFF ) | ( uint32_t(hit.cfddata) << 16 );
+    words[3] = hit.adcdata;
+}
@@ -0,0 +1,49 @@
+/*!
+ * \file SnapshotWriter.cpp
+ * \brief Implementation of SnapshotWriter.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "SnapshotWriter.h"
+
+#include <TROOT.h>
+
+#include "Histograms.h"
+#include "RootWriter.h"
+
+#include <iostream>
+
+// ########################################################################
+
+SnapshotWriter::SnapshotWriter()
+    : queue( 1 )
+{
+    // The sorting may create or write ROOT objects while a snapshot is
+    // written.
+    ROOT::EnableThreadSafety();
+}
+
+// ########################################################################
+
+void SnapshotWriter::Post(std::unique_ptr<Histograms> snapshot, const std::string& filename)
+{
+    std::shared_ptr<Histograms> histograms( std::move(snapshot) );
+    queue.Post( [histograms, filename]() {
+            RootWriter::Write( *histograms, filename );
+            std::cout << "\nexport: wrote snapshot into '" << filename << "'" << std::endl;
+        } );
+}
+
+// ########################################################################
+
+bool SnapshotWriter::Busy()
+{
+    return queue.Busy();
+}
+
+// ########################################################################
+
+void SnapshotWriter::Wait()
+{
+    queue.Wait();
+}
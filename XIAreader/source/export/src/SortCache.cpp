@@ -0,0 +1,127 @@
+/*!
+ * \file SortCache.cpp
+ * \brief Implementation of SortCache.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "SortCache.h"
+
+#include "BinaryReader.h"
+#include "BinaryWriter.h"
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <sys/stat.h>
+
+//! The number of bytes hashed at each end of a file.
+static const size_t sample_size = 1024*1024;
+
+// ########################################################################
+
+SortCache::SortCache(const std::string& d)
+    : directory( d )
+{
+}
+
+// ########################################################################
+
+SortCache::hash_t SortCache::Hash(const void* data, size_t size, hash_t h)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0 ; i < size ; ++i){
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// ########################################################################
+
+SortCache::hash_t SortCache::Hash(const std::string& text, hash_t h)
+{
+    const uint64_t size = text.size();
+    h = Hash(&size, sizeof(size), h);
+    return Hash(text.data(), text.size(), h);
+}
+
+// ########################################################################
+
+bool SortCache::HashFile(const std::string& filename, hash_t& h)
+{
+    struct stat st;
+    if ( stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode) )
+        return false;
+    const uint64_t size = st.st_size;
+    const uint64_t mtime = uint64_t(st.st_mtim.tv_sec)*1000000000ULL + st.st_mtim.tv_nsec;
+    h = Hash(&size, sizeof(size), h);
+    h = Hash(&mtime, sizeof(mtime), h);
+
+    FILE* file = std::fopen(filename.c_str(), "rb");
+    if ( !file )
+        return false;
+    std::vector<char> sample( std::min<uint64_t>(size, sample_size) );
+    bool ok = sample.empty() || std::fread(&sample[0], 1, sample.size(), file) == sample.size();
+    h = Hash(sample.data(), sample.size(), h);
+    if ( ok && size > sample_size ){
+        const uint64_t tail = std::min<uint64_t>(size - sample_size, sample_size);
+        sample.resize( tail );
+        ok = std::fseek(file, long(size - tail), SEEK_SET) == 0
+            && std::fread(&sample[0], 1, sample.size(), file) == sample.size();
+        h = Hash(sample.data(), sample.size(), h);
+    }
+    std::fclose(file);
+    return ok;
+}
+
+// ########################################################################
+
+std::string SortCache::Filename(hash_t key, const std::string& routine) const
+{
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(key));
+    return directory + "/" + hex + "." + routine + ".bin";
+}
+
+// ########################################################################
+
+bool SortCache::Load(hash_t key, const std::vector<std::pair<std::string, Histograms*> >& routines) const
+{
+    // Open and check all files before adding any, so that nothing is
+    // added unless all of it can be, and the data file is not sorted
+    // again on top of a part added from the cache.
+    std::vector<std::unique_ptr<BinaryReader> > readers;
+    for (size_t r = 0 ; r < routines.size() ; ++r){
+        const std::string filename = Filename(key, routines[r].first);
+        struct stat st;
+        if ( stat(filename.c_str(), &st) != 0 )
+            return false;
+        readers.push_back( std::unique_ptr<BinaryReader>( new BinaryReader() ) );
+        if ( !readers.back()->Open(filename) || !readers.back()->Fits( *routines[r].second ) )
+            return false;
+    }
+    for (size_t r = 0 ; r < routines.size() ; ++r){
+        if ( !readers[r]->AddTo( *routines[r].second ) ){
+            std::cerr << "SortCache: Could not add '" << Filename(key, routines[r].first) << "'" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// ########################################################################
+
+bool SortCache::Store(hash_t key, const std::string& routine, Histograms& histograms) const
+{
+    // Written under another name first, so no other run reads half a file.
+    const std::string filename = Filename(key, routine);
+    const std::string tmp = filename + ".tmp";
+    if ( !BinaryWriter::Write(histograms, tmp) || std::rename(tmp.c_str(), filename.c_str()) != 0 ){
+        std::cerr << "SortCache: Could not write '" << filename << "'" << std::endl;
+        std::remove( tmp.c_str() );
+        return false;
+    }
+    return true;
+}
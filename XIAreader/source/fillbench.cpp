@@ -0,0 +1,439 @@
+/*!
+ * \file fillbench.cpp
+ * \brief Measure the time per fill of the histogram classes.
+ * \details Run like
+ *  <pre>
+ *  fillbench [options]
+ *  </pre>
+ *  Fills histograms of each size, bin type and storage with values from
+ *  a few typical distributions, and prints the time per fill and, where
+ *  the kernel allows reading the hardware counters, the cache misses per
+ *  fill. Each histogram is filled twice with the same values and only
+ *  the second pass is measured, so that pages and sparse tiles are
+ *  already allocated, as in a long sorting run. For the shared path the
+ *  time is the wall time divided by all fills of all threads.
+ *
+ *  The fill paths measured are
+ *  <pre>
+ *  fill     Fill(), through the fill buffer if the histogram has one
+ *  bin      FindBin() and FillBin(), as used by FillPlan
+ *  shared   Fill() on stages from NewStage() in several threads (2D only)
+ *  </pre>
+ *  The distributions are
+ *  <pre>
+ *  uniform  all bins equally likely
+ *  peaks    narrow Gaussian peaks on an exponential background
+ *  banana   a curved band across the matrix, like Delta-E vs. E (2D only)
+ *  sparse   a few small spots, leaving most bins empty
+ *  </pre>
+ *  The fill buffers (H1D_USE_BUFFER, H2D_USE_BUFFER) and USE_ROWS are
+ *  chosen when compiling; to compare those, change the defines in the
+ *  headers and build fillbench again.
+ *
+ *  Options, with defaults; the lists are separated by commas, and an
+ *  empty list selects everything:
+ *  <pre>
+ *  --fills 2000000      fills per measurement
+ *  --seed 1             seed of the random numbers
+ *  --threads 4          threads for the shared path
+ *  --dims ""            1, 2
+ *  --sizes ""           1k, 16k, 256k, 4M, 16M bins
+ *  --dists ""           uniform, peaks, banana, sparse
+ *  --types ""           bin types as named by BinTypeName()
+ *  --storages ""        dense, sparse, tiled, symmetric
+ *  --paths ""           fill, bin, shared
+ *  </pre>
+ * \copyright GNU Public License v. 3
+ */
+
+#include "Histograms.h"
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// ########################################################################
+
+//! Settings of the benchmark.
+struct BenchSettings {
+    long long fills;        //!< Fills per measurement.
+    unsigned int seed;      //!< Seed of the random numbers.
+    int threads;            //!< Threads for the shared path.
+    std::string dims;       //!< Dimensions to measure.
+    std::string sizes;      //!< Sizes to measure.
+    std::string dists;      //!< Distributions to measure.
+    std::string types;      //!< Bin types to measure.
+    std::string storages;   //!< Storages to measure.
+    std::string paths;      //!< Fill paths to measure.
+};
+
+//! A histogram size.
+struct BenchSize {
+    const char* name;       //!< Name for options and output.
+    int bins1d;             //!< Bins of a 1D histogram.
+    int bins2d;             //!< Bins on each axis of a 2D histogram.
+};
+
+static const BenchSize sizes[] = {
+    { "1k",   1 << 10,   32 },
+    { "16k",  1 << 14,  128 },
+    { "256k", 1 << 18,  512 },
+    { "4M",   1 << 22, 2048 },
+    { "16M",  1 << 24, 4096 }
+};
+
+static const char* const dist_names[] = { "uniform", "peaks", "banana", "sparse" };
+static const char* const storage_names[] = { "dense", "sparse", "tiled", "symmetric" };
+static const char* const path_names[] = { "fill", "bin", "shared" };
+
+// ########################################################################
+
+//! Check if a name is in a list of names separated by commas.
+/*! \return true if it is, or if the list is empty.
+ */
+static bool Selected(const std::string& list, const std::string& name)
+{
+    if ( list.empty() )
+        return true;
+    const std::string padded = "," + list + ",";
+    return padded.find( "," + name + "," ) != std::string::npos;
+}
+
+// ########################################################################
+
+//! Counts cache misses of this thread and the threads it starts.
+/*! Uses the perf_event_open() system call; where that is not allowed,
+ *  e.g. in containers or with a high perf_event_paranoid, nothing is
+ *  counted and Available() is false.
+ */
+class MissCounter {
+public:
+    //! Open the counter.
+    MissCounter()
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    //! Close the counter.
+    ~MissCounter()
+        { if ( fd >= 0 ) close(fd); }
+
+    //! Check if the counter could be opened.
+    /*! \return true if misses are counted.
+     */
+    bool Available() const
+        { return fd >= 0; }
+
+    //! Start counting from zero.
+    void Start()
+    {
+        if ( fd < 0 )
+            return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    //! Stop counting.
+    /*! \return the misses since Start(), including those of threads
+     *  started and joined since.
+     */
+    uint64_t Stop()
+    {
+        uint64_t count = 0;
+        if ( fd < 0 )
+            return 0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if ( read(fd, &count, sizeof(count)) != sizeof(count) )
+            return 0;
+        return count;
+    }
+
+private:
+    //! The counter, or -1.
+    int fd;
+};
+
+// ########################################################################
+
+//! Values to fill, in units of bins.
+struct BenchValues {
+    std::vector<Axis::bin_t> x; //!< The x values.
+    std::vector<Axis::bin_t> y; //!< The y values, empty for 1D.
+};
+
+//! Draw values from one of the distributions.
+static void MakeValues(BenchValues& v,          /*!< Filled with the values. */
+                       const std::string& dist, /*!< The distribution. */
+                       int dim,                 /*!< 1 or 2. */
+                       double n,                /*!< Bins on each axis. */
+                       long long count,         /*!< Number of values. */
+                       unsigned int seed        /*!< Seed of the random numbers. */)
+{
+    std::mt19937_64 rng( seed );
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> gauss(0, 1);
+    std::exponential_distribution<double> background( 4/n );
+
+    // Peak and spot positions, the same for x and y.
+    std::vector<double> peaks( 30 ), spots( 16 );
+    for (size_t p = 0 ; p < peaks.size() ; ++p)
+        peaks[p] = n*( 0.02 + 0.96*uniform(rng) );
+    for (size_t p = 0 ; p < spots.size() ; ++p)
+        spots[p] = n*uniform(rng);
+    const double width = std::max(0.5, n/1000);
+
+    auto peak = [&]() -> double {
+        if ( uniform(rng) < 0.8 )
+            return peaks[size_t(uniform(rng)*peaks.size()) % peaks.size()] + width*gauss(rng);
+        return background(rng);
+    };
+
+    v.x.resize( count );
+    v.y.resize( dim == 2 ? count : 0 );
+    for (long long i = 0 ; i < count ; ++i){
+        if ( dist == "uniform" ){
+            v.x[i] = n*uniform(rng);
+            if ( dim == 2 )
+                v.y[i] = n*uniform(rng);
+        } else if ( dist == "peaks" ){
+            v.x[i] = peak();
+            if ( dim == 2 )
+                v.y[i] = peak();
+        } else if ( dist == "banana" ){
+            const double x = n*( 0.05 + 0.9*uniform(rng) );
+            v.x[i] = x;
+            v.y[i] = n*( 0.85*std::exp(-1.5*x/n) + 0.005*gauss(rng) );
+        } else {
+            const size_t s = size_t(uniform(rng)*spots.size()) % spots.size();
+            v.x[i] = spots[s] + 0.5*gauss(rng);
+            if ( dim == 2 )
+                v.y[i] = spots[(s*7 + 3) % spots.size()] + 0.5*gauss(rng);
+        }
+    }
+}
+
+// ########################################################################
+
+//! Fill a 1D histogram with all values.
+static void Fill1D(Histogram1Dp h, const BenchValues& v, const std::string& path)
+{
+    const size_t n = v.x.size();
+    if ( path == "fill" ){
+        for (size_t i = 0 ; i < n ; ++i)
+            h->Fill( v.x[i] );
+    } else {
+        const Axis& xaxis = h->GetAxisX();
+        for (size_t i = 0 ; i < n ; ++i)
+            h->FillBin( xaxis.FindBin(v.x[i]) );
+    }
+    h->GetBinContent(0); // adds the buffered fills
+}
+
+// ########################################################################
+
+//! Fill a 2D histogram with some of the values.
+static void Fill2D(Histogram2D* h, const BenchValues& v, const std::string& path,
+                   size_t begin, size_t end)
+{
+    if ( path == "bin" ){
+        const Axis& xaxis = h->GetAxisX();
+        const Axis& yaxis = h->GetAxisY();
+        for (size_t i = begin ; i < end ; ++i)
+            h->FillBin( xaxis.FindBin(v.x[i]), yaxis.FindBin(v.y[i]) );
+    } else {
+        for (size_t i = begin ; i < end ; ++i)
+            h->Fill( v.x[i], v.y[i] );
+    }
+    h->Flush();
+}
+
+// ########################################################################
+
+//! Fill a 2D histogram with all values, from several threads for the shared path.
+static void Fill2D(Histogram2Dp h, const BenchValues& v, const std::string& path, int threads)
+{
+    const size_t n = v.x.size();
+    if ( path != "shared" ){
+        Fill2D(h.get(), v, path, 0, n);
+        return;
+    }
+
+    std::vector<Histogram2Dp> stages;
+    std::vector<std::thread> workers;
+    for (int t = 0 ; t < threads ; ++t)
+        stages.push_back( h->NewStage() );
+    for (int t = 0 ; t < threads ; ++t)
+        workers.push_back( std::thread( [&, t]() {
+                    Fill2D(stages[t].get(), v, "fill", n*t/threads, n*(t+1)/threads);
+                } ) );
+    for (int t = 0 ; t < threads ; ++t)
+        workers[t].join();
+}
+
+// ########################################################################
+
+//! Print one measurement.
+static void Report(int dim, const char* size, const std::string& dist, BinType type,
+                   const char* storage, const std::string& path,
+                   double seconds, uint64_t misses, long long fills, bool counted)
+{
+    char line[160];
+    std::snprintf(line, sizeof(line), "%dD %-5s %-8s %-6s %-10s %-7s %9.2f",
+                  dim, size, dist.c_str(), BinTypeName(type), storage, path.c_str(), 1e9*seconds/fills);
+    std::cout << line;
+    if ( counted ){
+        std::snprintf(line, sizeof(line), " %12.3f", double(misses)/fills);
+        std::cout << line;
+    } else {
+        std::cout << "            -";
+    }
+    std::cout << std::endl;
+}
+
+// ########################################################################
+
+//! Read the value of an option.
+/*! \return true if the option was known and its value could be read.
+ */
+static bool SetOption(BenchSettings& s, const std::string& name, const char* value)
+{
+    if ( name == "--dims" )          s.dims = value;
+    else if ( name == "--sizes" )    s.sizes = value;
+    else if ( name == "--dists" )    s.dists = value;
+    else if ( name == "--types" )    s.types = value;
+    else if ( name == "--storages" ) s.storages = value;
+    else if ( name == "--paths" )    s.paths = value;
+    else {
+        char* end = 0;
+        const double v = std::strtod(value, &end);
+        if ( end == value || *end != 0 || v < 1 )
+            return false;
+        if ( name == "--fills" )        s.fills = (long long)v;
+        else if ( name == "--seed" )    s.seed = (unsigned int)v;
+        else if ( name == "--threads" ) s.threads = int(v);
+        else return false;
+    }
+    return true;
+}
+
+// ########################################################################
+
+int main(int argc, char* argv[])
+{
+    BenchSettings s = { 2000000, 1, 4, "", "", "", "", "", "" };
+    bool ok = true;
+    for (int i = 1 ; i < argc && ok ; i += 2)
+        ok = ( i+1 < argc && SetOption(s, argv[i], argv[i+1]) );
+    if ( !ok ){
+        std::cerr << "Run like: " << argv[0] << " [--fills n] [--seed n] [--threads n]"
+                  << " [--dims list] [--sizes list] [--dists list] [--types list]"
+                  << " [--storages list] [--paths list]" << std::endl;
+        return 1;
+    }
+
+    MissCounter misses;
+    std::cout << "# fill buffers: 1D "
+#ifdef H1D_USE_BUFFER
+              << "yes"
+#else
+              << "no"
+#endif
+              << ", 2D "
+#ifdef H2D_USE_BUFFER
+              << "yes"
+#else
+              << "no"
+#endif
+              << "; USE_ROWS "
+#ifdef USE_ROWS
+              << "yes"
+#else
+              << "no"
+#endif
+              << "; cache misses " << ( misses.Available() ? "counted" : "not available" ) << '\n'
+              << "#  size  dist     type   storage    path    ns/fill  misses/fill" << std::endl;
+
+    for (int dim = 1 ; dim <= 2 ; ++dim){
+        if ( !Selected(s.dims, dim == 1 ? "1" : "2") )
+            continue;
+        for (const BenchSize& size : sizes){
+            if ( !Selected(s.sizes, size.name) )
+                continue;
+            const int n = ( dim == 1 ) ? size.bins1d : size.bins2d;
+            for (const std::string dist : dist_names){
+                if ( !Selected(s.dists, dist) || ( dim == 1 && dist == "banana" ) )
+                    continue;
+                BenchValues values;
+                MakeValues(values, dist, dim, n, s.fills, s.seed);
+
+                for (int t = BinUInt16 ; t <= BinDouble ; ++t){
+                    const BinType type = BinType(t);
+                    if ( !Selected(s.types, BinTypeName(type)) )
+                        continue;
+                    for (int st = DenseStorage ; st <= SymmetricStorage ; ++st){
+                        const char* storage = ( dim == 1 ) ? "-" : storage_names[st];
+                        if ( dim == 1 ? st > DenseStorage : !Selected(s.storages, storage) )
+                            continue;
+                        for (const std::string path : path_names){
+                            if ( !Selected(s.paths, path) || ( dim == 1 && path == "shared" ) )
+                                continue;
+
+                            Histograms histograms;
+                            Histogram1Dp h1;
+                            Histogram2Dp h2;
+                            if ( dim == 1 ){
+                                h1 = histograms.Create1D("h", "h", n, 0, n, "x", type);
+                            } else {
+                                h2 = histograms.Create2D("m", "m", n, 0, n, "x", n, 0, n, "y",
+                                                         HistogramStorage(st), type);
+                                if ( path == "shared" )
+                                    h2->Share();
+                            }
+
+                            std::chrono::steady_clock::time_point start;
+                            for (int pass = 0 ; pass < 2 ; ++pass){
+                                start = std::chrono::steady_clock::now();
+                                if ( pass == 1 )
+                                    misses.Start();
+                                if ( dim == 1 )
+                                    Fill1D(h1, values, path);
+                                else
+                                    Fill2D(h2, values, path, s.threads);
+                            }
+                            const uint64_t m = misses.Stop();
+                            const double seconds = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start ).count();
+                            Report(dim, size.name, dist, type, storage, path,
+                                   seconds, m, s.fills, misses.Available());
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*!
+ * \file histtool.cpp
+ * \brief Add up, list and convert native binary histogram files.
+ * \details Run like
+ *  <pre>
+ *  histtool list &lt;file&gt;...
+ *  histtool merge &lt;output&gt; &lt;file&gt;...
+ *  histtool root &lt;output.root&gt; &lt;file&gt;...
+ *  histtool mama &lt;histogram&gt; &lt;output.m&gt; &lt;file&gt;...
+ *  histtool live &lt;socket&gt; &lt;request&gt;...
+ *  histtool shm &lt;output&gt; &lt;segment&gt;...
+ *  </pre>
+ *  'merge', 'root' and 'mama' add up the histograms of all input files,
+ *  e.g. from sorting jobs run in parallel on parts of the data, and
+ *  write the sum as a binary, ROOT or MAMA file. 'live' sends a request
+ *  to a running sort started with 'live &lt;socket&gt;' in the batch file
+ *  (see LiveServer) and writes the answer to standard output. 'shm'
+ *  reads histograms published in shared memory (see ShmPublisher) into
+ *  a binary file.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "BinaryReader.h"
+#include "BinaryWriter.h"
+#include "LiveServer.h"
+#include "MamaWriter.h"
+#include "RootWriter.h"
+#include "ShmPublisher.h"
+
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+#include "Histogram3D.h"
+
+#include <fstream>
+#include <iostream>
+
+// ########################################################################
+
+//! Print the histograms in a file.
+/*! \return true if the file could be read.
+ */
+static bool List(const std::string& filename)
+{
+    BinaryReader reader;
+    if ( !reader.Open(filename) )
+        return false;
+
+    static const char* encodings[] = { "raw", "zero runs", "pairs" };
+    std::cout << filename << ": " << reader.GetCount() << " histograms" << std::endl;
+    for (size_t i = 0 ; i < reader.GetCount() ; ++i){
+        const BinaryChunkHeader& h = reader.GetHeader(i);
+        std::cout << "  " << reader.GetName(i) << " " << h.dimension << "D "
+                  << BinTypeName(BinType(h.bin_type));
+        for (unsigned int d = 0 ; d < h.dimension ; ++d)
+            std::cout << ( d == 0 ? " " : " x " ) << h.bins[d]-2;
+        std::cout << " bins, " << h.entries << " entries, "
+                  << encodings[h.encoding] << " " << h.size << " bytes" << std::endl;
+    }
+    return true;
+}
+
+// ########################################################################
+
+//! Add up the histograms of several files.
+/*! \return true if all files could be read and added.
+ */
+static bool Sum(Histograms& histograms, int nfiles, char* files[])
+{
+    bool ok = true;
+    for (int f = 0 ; f < nfiles ; ++f){
+        BinaryReader reader;
+        ok = reader.Open(files[f]) && reader.AddTo(histograms) && ok;
+    }
+    return ok;
+}
+
+// ########################################################################
+
+int main(int argc, char* argv[])
+{
+    const std::string cmd = ( argc > 1 ) ? argv[1] : "";
+
+    if ( cmd == "list" && argc > 2 ){
+        bool ok = true;
+        for (int f = 2 ; f < argc ; ++f)
+            ok = List(argv[f]) && ok;
+        return ok ? 0 : 1;
+    } else if ( ( cmd == "merge" || cmd == "root" ) && argc > 3 ){
+        Histograms histograms;
+        if ( !Sum(histograms, argc-3, argv+3) )
+            return 1;
+        if ( cmd == "root" ){
+            RootWriter::Write(histograms, argv[2]);
+            return 0;
+        }
+        return BinaryWriter::Write(histograms, argv[2]) ? 0 : 1;
+    } else if ( cmd == "mama" && argc > 4 ){
+        Histograms histograms;
+        if ( !Sum(histograms, argc-4, argv+4) )
+            return 1;
+        Histogram1Dp h = histograms.Find1D(argv[2]);
+        Histogram2Dp m = histograms.Find2D(argv[2]);
+        if ( !h && !m ){
+            std::cerr << "histtool mama: No 1D or 2D histogram named '" << argv[2] << "'" << std::endl;
+            return 1;
+        }
+        std::ofstream mama_out( argv[3] );
+        if ( h )
+            MamaWriter::Write(mama_out, h);
+        else
+            MamaWriter::Write(mama_out, m);
+        mama_out.close();
+        if ( !mama_out ){
+            std::cerr << "histtool mama: Problem writing '" << argv[3] << "'" << std::endl;
+            return 1;
+        }
+        return 0;
+    } else if ( cmd == "live" && argc > 3 ){
+        std::string request = argv[3], reply;
+        for (int a = 4 ; a < argc ; ++a)
+            request += std::string(" ") + argv[a];
+        if ( !LiveServer::Request(argv[2], request, reply) ){
+            std::cerr << "histtool live: " << reply << std::endl;
+            return 1;
+        }
+        std::cout.write(reply.data(), reply.size());
+        return std::cout.flush() ? 0 : 1;
+    } else if ( cmd == "shm" && argc > 3 ){
+        Histograms histograms;
+        for (int a = 3 ; a < argc ; ++a){
+            if ( !ShmPublisher::Read(argv[a], histograms) )
+                return 1;
+        }
+        return BinaryWriter::Write(histograms, argv[2]) ? 0 : 1;
+    }
+
+    std::cerr << "Run like:\n"
+              << "  " << argv[0] << " list <file>...\n"
+              << "  " << argv[0] << " merge <output> <file>...\n"
+              << "  " << argv[0] << " root <output.root> <file>...\n"
+              << "  " << argv[0] << " mama <histogram> <output.m> <file>...\n"
+              << "  " << argv[0] << " live <socket> <request>...\n"
+              << "  " << argv[0] << " shm <output> <segment>..." << std::endl;
+    return 1;
+}
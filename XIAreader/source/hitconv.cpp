@@ -0,0 +1,56 @@
+/*!
+ * \file hitconv.cpp
+ * \brief Convert XIA list mode files into decoded hit files.
+ * \details Run like
+ *  <pre>
+ *  hitconv &lt;list mode file&gt; &lt;decoded hit file&gt;
+ *  </pre>
+ *  The list mode file is read in buffers as when sorting it, and each
+ *  buffer is written as a block of the decoded hit file (see HitFormat.h),
+ *  which can then be sorted with 'data decoded &lt;file&gt;'. The same file is
+ *  written by XIAreader with the 'decode' batch command.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "FileReader.h"
+#include "HitWriter.h"
+#include "WordBuffer.h"
+
+#include <iostream>
+
+// ########################################################################
+
+int main(int argc, char* argv[])
+{
+    if ( argc != 3 ){
+        std::cerr << "Run like: " << argv[0] << " <list mode file> <decoded hit file>" << std::endl;
+        return 1;
+    }
+
+    FileReader reader;
+    if ( !reader.Open(argv[1]) ){
+        std::cerr << "hitconv: Could not open '" << argv[1] << "'" << std::endl;
+        return 1;
+    }
+    HitWriter writer;
+    if ( !writer.Open(argv[2]) )
+        return 1;
+
+    // As in sorting, the hits after the last full buffer are left out.
+    WordBuffer buffer;
+    long long buffers = 0;
+    int r;
+    while ( ( r = reader.Read(buffer.GetBuffer(), buffer.GetSize()) ) > 0 ){
+        if ( !writer.Write(buffer) )
+            return 1;
+        buffers += 1;
+    }
+    if ( r < 0 ){
+        std::cerr << "hitconv: Error reading buffer " << buffers << " of '" << argv[1] << "'" << std::endl;
+        return 1;
+    }
+    if ( !writer.Close() )
+        return 1;
+    std::cout << "hitconv: Wrote " << buffers << " buffers into '" << argv[2] << "'" << std::endl;
+    return 0;
+}
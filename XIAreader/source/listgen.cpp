@@ -0,0 +1,329 @@
+/*!
+ * \file listgen.cpp
+ * \brief Write synthetic XIA list mode files, e.g. for benchmarks.
+ * \details Run like
+ *  <pre>
+ *  listgen [options] &lt;output&gt;
+ *  </pre>
+ *  Each event is a particle in one of the E detectors, usually with a
+ *  hit in a Delta-E segment of the same telescope, and some LaBr hits
+ *  around it. Uncorrelated LaBr singles are added in between. The
+ *  addresses, detector types and sampling frequencies are taken from
+ *  experimentsetup.c, so the files can be sorted like real data. The
+ *  same options and seed always give the same file.
+ *
+ *  Options, with defaults:
+ *  <pre>
+ *  --events 1000000     number of particle events
+ *  --seed 1             seed of the random numbers
+ *  --rate 20000         particle events per second
+ *  --labr 1.5           mean number of LaBr hits per particle event
+ *  --singles 50000      uncorrelated LaBr hits per second
+ *  --de 0.95            probability of a Delta-E hit per particle
+ *  --guard 0.02         probability of a guard ring hit per particle
+ *  --ppac 0             probability of a PPAC hit per particle
+ *  --trace 0            trace length in samples written with each hit
+ *  --disorder 0         hits may come up to this many ns out of order
+ *  </pre>
+ * \copyright GNU Public License v. 3
+ */
+
+#include "experimentsetup.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+// ########################################################################
+
+//! Settings of the generator.
+struct GenSettings {
+    long long events;       //!< Number of particle events.
+    unsigned int seed;      //!< Seed of the random numbers.
+    double rate;            //!< Particle events per second.
+    double labr;            //!< Mean number of LaBr hits per particle event.
+    double singles;         //!< Uncorrelated LaBr hits per second.
+    double de;              //!< Probability of a Delta-E hit.
+    double guard;           //!< Probability of a guard ring hit.
+    double ppac;            //!< Probability of a PPAC hit.
+    int trace;              //!< Trace length in samples.
+    double disorder;        //!< Maximum time a hit may come late, in ns.
+};
+
+// ########################################################################
+
+//! One hit to be written.
+struct GenHit {
+    int64_t time;           //!< Time in ns.
+    double key;             //!< Position in the output, time with disorder.
+    uint16_t address;       //!< ADC address.
+    uint16_t energy;        //!< ADC value.
+
+    //! Order for the priority queue: earliest key on top.
+    bool operator<(const GenHit& other) const
+        { return key > other.key; }
+};
+
+// ########################################################################
+
+//! Addresses of each detector type, from experimentsetup.c.
+struct AddressMap {
+    std::vector<uint16_t> labr;                 //!< All LaBr detectors.
+    std::vector<uint16_t> e;                    //!< E detector of each telescope.
+    std::vector<std::vector<uint16_t> > de;     //!< Delta-E segments of each telescope.
+    std::vector<std::vector<uint16_t> > guard;  //!< Guard rings of each telescope.
+    std::vector<uint16_t> ppac;                 //!< All PPACs.
+
+    AddressMap()
+        : e( NUM_SI_E_DET, 0xFFFF )
+        , de( NUM_SI_E_DET )
+        , guard( NUM_SI_E_DET )
+        {
+            for (uint16_t a = 0 ; a < TOTAL_NUMBER_OF_ADDRESSES ; ++a){
+                const DetectorInfo_t d = GetDetector(a);
+                const bool tel_ok = ( d.telNum >= 0 && d.telNum < NUM_SI_E_DET );
+                if ( d.type == ::labr )
+                    labr.push_back( a );
+                else if ( d.type == ::eDet && d.detectorNum >= 0 && d.detectorNum < NUM_SI_E_DET )
+                    e[d.detectorNum] = a;
+                else if ( d.type == ::deDet && tel_ok )
+                    de[d.telNum].push_back( a );
+                else if ( d.type == ::eGuard && tel_ok )
+                    guard[d.telNum].push_back( a );
+                else if ( d.type == ::ppac )
+                    ppac.push_back( a );
+            }
+        }
+};
+
+// ########################################################################
+
+//! Get the length of a timestamp tick, like FileReader.
+/*! \return ns per tick.
+ */
+static int TickLength(uint16_t address)
+{
+    return ( GetSamplingFrequency(address) == f250MHz ) ? 8 : 10;
+}
+
+// ########################################################################
+
+//! Writes hits in the XIA list mode format with a large buffer.
+class ListWriter {
+public:
+    ListWriter(std::FILE* f, int trace_length)
+        : file( f ), trace( trace_length ), hits( 0 ), words( 0 ), ok( true )
+        {
+            // A pulse shape, scaled by the energy of each hit.
+            for (int i = 0 ; i < trace ; ++i){
+                const double t = i - trace/4;
+                shape.push_back( t < 0 ? 0 : ( 1 - std::exp(-t/4) )*std::exp(-t/60) );
+            }
+        }
+
+    ~ListWriter()
+        { Flush(); }
+
+    //! Add one hit.
+    void Write(const GenHit& h, uint16_t cfd)
+        {
+            const uint32_t length = 4 + ( trace + 1 )/2;
+            const int64_t ts = h.time / TickLength(h.address);
+            buf.push_back( ( length << 17 ) | ( 4 << 12 ) | ( h.address & 0xFFF ) );
+            buf.push_back( uint32_t(ts) );
+            buf.push_back( uint32_t( ( ts >> 32 ) & 0xFFFF ) | ( uint32_t(cfd) << 16 ) );
+            buf.push_back( h.energy | ( uint32_t(trace & 0x7FFF) << 16 ) );
+            for (int i = 0 ; i < trace ; i += 2){
+                const uint32_t s0 = Sample(i, h.energy), s1 = ( i+1 < trace ) ? Sample(i+1, h.energy) : 0;
+                buf.push_back( s0 | ( s1 << 16 ) );
+            }
+            hits += 1;
+            if ( buf.size() >= ( 1 << 20 ) )
+                Flush();
+        }
+
+    //! Write the buffered words.
+    void Flush()
+        {
+            if ( !buf.empty() && std::fwrite(&buf[0], sizeof(uint32_t), buf.size(), file) != buf.size() )
+                ok = false;
+            words += buf.size();
+            buf.clear();
+        }
+
+    //! Number of hits written.
+    long long GetHits() const { return hits; }
+
+    //! Number of words written.
+    long long GetWords() const { return words; }
+
+    //! Whether all writes succeeded.
+    bool IsOk() const { return ok; }
+
+private:
+    //! One trace sample, on a baseline of 1000.
+    uint32_t Sample(int i, uint16_t energy) const
+        { return std::min(0x3FFF, 1000 + int( shape[i]*energy/4 )); }
+
+    std::FILE* file;
+    const int trace;
+    std::vector<double> shape;
+    std::vector<uint32_t> buf;
+    long long hits, words;
+    bool ok;
+};
+
+// ########################################################################
+
+//! Read the value of an option.
+/*! \return true if the option was known and its value could be read.
+ */
+static bool SetOption(GenSettings& s, const std::string& name, const char* value)
+{
+    char* end = 0;
+    const double v = std::strtod(value, &end);
+    if ( end == value || *end != 0 || v < 0 )
+        return false;
+
+    if ( name == "--events" )        s.events = (long long)v;
+    else if ( name == "--seed" )     s.seed = (unsigned int)v;
+    else if ( name == "--rate" )     s.rate = v;
+    else if ( name == "--labr" )     s.labr = v;
+    else if ( name == "--singles" )  s.singles = v;
+    else if ( name == "--de" )       s.de = v;
+    else if ( name == "--guard" )    s.guard = v;
+    else if ( name == "--ppac" )     s.ppac = v;
+    else if ( name == "--trace" )    s.trace = std::min(int(v), 0x7FFF);
+    else if ( name == "--disorder" ) s.disorder = v;
+    else return false;
+    return s.rate > 0 && s.de <= 1 && s.guard <= 1 && s.ppac <= 1;
+}
+
+// ########################################################################
+
+int main(int argc, char* argv[])
+{
+    GenSettings s = { 1000000, 1, 20000, 1.5, 50000, 0.95, 0.02, 0, 0, 0 };
+    std::string output;
+    for (int i = 1 ; i < argc ; ++i){
+        const std::string a = argv[i];
+        if ( a.compare(0, 2, "--") == 0 && i+1 < argc && SetOption(s, a, argv[i+1]) ){
+            ++i;
+        } else if ( a.compare(0, 2, "--") != 0 && output.empty() ){
+            output = a;
+        } else {
+            output.clear();
+            break;
+        }
+    }
+    if ( output.empty() ){
+        std::cerr << "Run like: " << argv[0] << " [--events n] [--seed n] [--rate Hz] [--labr mean]"
+                  << " [--singles Hz] [--de p] [--guard p] [--ppac p] [--trace samples]"
+                  << " [--disorder ns] <output>" << std::endl;
+        return 1;
+    }
+
+    const AddressMap map;
+    if ( map.labr.empty() || map.e[0] == 0xFFFF ){
+        std::cerr << "listgen: experimentsetup.c has no LaBr or E detectors" << std::endl;
+        return 1;
+    }
+
+    std::FILE* file = std::fopen(output.c_str(), "wb");
+    if ( !file ){
+        std::cerr << "listgen: Could not open '" << output << "'" << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 rng( s.seed );
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::exponential_distribution<double> next_event( s.rate*1e-9 );
+    std::exponential_distribution<double> next_single( s.singles > 0 ? s.singles*1e-9 : 1 );
+    std::poisson_distribution<int> n_labr( s.labr > 0 ? s.labr : 1 );
+    std::normal_distribution<double> gauss(0, 1);
+    std::uniform_int_distribution<int> cfd(1, 0x1FFF);
+
+    // Gamma lines and a continuum, in ADC channels.
+    static const double lines[] = { 1200, 2700, 4400, 7800 };
+    auto gamma = [&]() -> uint16_t {
+        double e;
+        if ( uniform(rng) < 0.6 ){
+            const double l = lines[int(uniform(rng)*4) & 3];
+            e = l*( 1 + 0.015*gauss(rng) );
+        } else {
+            e = -3000*std::log(1 - uniform(rng));
+        }
+        return uint16_t( std::max(1.0, std::min(65535.0, e)) );
+    };
+
+    std::priority_queue<GenHit> pending;
+    ListWriter writer( file, s.trace );
+    auto add = [&](int64_t t, uint16_t address, double energy) {
+        if ( address == 0xFFFF || t < 0 )
+            return;
+        GenHit h;
+        h.time = t;
+        h.key = t + s.disorder*uniform(rng);
+        h.address = address;
+        h.energy = uint16_t( std::max(1.0, std::min(65535.0, energy)) );
+        pending.push( h );
+    };
+
+    // Hits are written once no later event can come before them; LaBr
+    // hits come up to 500 ns before the particle.
+    const double early = 600;
+    double t = 10000, t_single = ( s.singles > 0 ) ? next_single(rng) : -1;
+    for (long long ev = 0 ; ev < s.events ; ++ev){
+        t += next_event(rng);
+
+        while ( t_single >= 0 && t_single < t ){
+            add( int64_t(t_single), map.labr[int(uniform(rng)*map.labr.size()) % map.labr.size()], gamma() );
+            t_single += next_single(rng);
+        }
+
+        const int tel = int(uniform(rng)*NUM_SI_E_DET) % NUM_SI_E_DET;
+        const int64_t t0 = int64_t(t);
+        const double e = 1000 + 14000*uniform(rng);
+        add( t0, map.e[tel], e );
+        if ( !map.de[tel].empty() && uniform(rng) < s.de ){
+            const int seg = int(uniform(rng)*map.de[tel].size()) % map.de[tel].size();
+            add( t0 + 40 + int64_t(8*gauss(rng)), map.de[tel][seg], 4e6/( e + 1000 )*( 1 + 0.05*gauss(rng) ) );
+        }
+        if ( !map.guard[tel].empty() && uniform(rng) < s.guard )
+            add( t0 + 20, map.guard[tel][0], 200 + 2000*uniform(rng) );
+        if ( !map.ppac.empty() && uniform(rng) < s.ppac )
+            add( t0 + 100 + int64_t(5*gauss(rng)), map.ppac[int(uniform(rng)*map.ppac.size()) % map.ppac.size()],
+                 500 + 1000*uniform(rng) );
+        const int nl = ( s.labr > 0 ) ? n_labr(rng) : 0;
+        for (int l = 0 ; l < nl ; ++l){
+            const double dt = ( uniform(rng) < 0.9 ) ? -300 + 10*gauss(rng) : -500 + 1000*uniform(rng);
+            add( t0 + int64_t(dt), map.labr[int(uniform(rng)*map.labr.size()) % map.labr.size()], gamma() );
+        }
+
+        while ( !pending.empty() && pending.top().key < t - early ){
+            writer.Write( pending.top(), cfd(rng) );
+            pending.pop();
+        }
+    }
+    while ( !pending.empty() ){
+        writer.Write( pending.top(), cfd(rng) );
+        pending.pop();
+    }
+    writer.Flush();
+
+    const bool ok = writer.IsOk() && std::fclose(file) == 0;
+    if ( !ok ){
+        std::cerr << "listgen: Problem writing '" << output << "'" << std::endl;
+        return 1;
+    }
+    std::cout << "listgen: " << s.events << " events, " << writer.GetHits() << " hits, "
+              << writer.GetWords()*4 << " bytes, " << t*1e-9 << " s of data into '" << output << "'" << std::endl;
+    return 0;
+}
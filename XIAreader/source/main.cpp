@@ -25,7 +25,13 @@
 
 #include "UserSort.h"
 
+//! Create a new instance of the sorting routine.
+static UserRoutine* NewUserSort()
+{
+    return new UserSort();
+}
+
 int main(int argc, char* argv[])
 {
-    return OfflineSorting::Run(new UserSort(), argc, argv);
+    return OfflineSorting::Run(NewUserSort, argc, argv);
 }
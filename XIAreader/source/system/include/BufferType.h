@@ -36,6 +36,10 @@ public:
 	T* GetBuffer()
 		{ return buffer; }
 
+	//! Give read access to the data.
+	const T* GetBuffer() const
+		{ return buffer; }
+
 	//! Get the buffer size.
 	/*! \return the number of elements in the buffer.
 	 */
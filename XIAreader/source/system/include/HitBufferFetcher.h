@@ -0,0 +1,39 @@
+// -*- c++ -*-
+
+#ifndef HitBufferFetcher_H_
+#define HitBufferFetcher_H_ 1
+
+#include "FileBufferFetcher.h"
+#include "HitReader.h"
+#include "WordBuffer.h"
+
+#include <string>
+
+/*!
+ * \class HitBufferFetcher
+ * \brief Fetches buffers from decoded hit files.
+ * \details As STFileBufferFetcher, reading with a HitReader. Decoding a
+ *  block is little more than copying it, so there is no prefetch thread.
+ * \copyright GNU Public License v. 3
+ */
+class HitBufferFetcher : public FileBufferFetcher {
+public:
+    //! Calls the reader to open a file.
+    Status Open(const std::string& filename,    /*!< File to read.                  */
+                int bufnum=0                    /*!< First buffer no. to read from. */)
+        { return reader.Open(filename.c_str(), bufnum*buffer.GetSize()) ? OKAY : ERROR; }
+
+    //! Calls the reader to fetch a buffer.
+    /*! \return Pointer to the buffer that have been read.
+     */
+    const WordBuffer* Next(Status& state    /*!< Result of the reading process. */);
+
+private:
+    //! Implementation of the actual reading.
+    HitReader reader;
+
+    //! The buffer used to store the hits in.
+    WordBuffer buffer;
+};
+
+#endif /* HitBufferFetcher_H_ */
@@ -0,0 +1,58 @@
+// -*- c++ -*-
+
+#ifndef HitFormat_H_
+#define HitFormat_H_ 1
+
+#include <stdint.h>
+
+/*! \file HitFormat.h
+ *  \brief Layout of the decoded hit files.
+ *
+ *  A decoded hit file holds the hits of a list mode file as decoded by
+ *  FileReader, so it can be sorted again without parsing the XIA headers.
+ *  It starts with a HitFileHeader, followed by blocks. Each block is a
+ *  HitBlockHeader and the hits of one buffer stored as columns, in the
+ *  order of the list mode file:
+ *
+ *  - the address of each hit, as uint16_t;
+ *  - the ADC value of each hit, as uint16_t;
+ *  - the raw CFD word of each hit, as uint16_t;
+ *  - the HitFlags of each hit, one byte each;
+ *  - the timestamp in ns of each hit, as the difference to the hit
+ *    before, or to zero for the first hit of the block, zigzag encoded
+ *    (0, -1, 1, -2, ... as 0, 1, 2, 3, ...) and stored as a varint of
+ *    7 bits per byte, the lowest first, with the high bit set in all but
+ *    the last byte.
+ *
+ *  The CFD correction depends only on the CFD word and the sampling
+ *  frequency, so it is looked up in a table when reading. Numbers are
+ *  stored in the byte order of the machine writing the file, which is
+ *  checked with the byte_order field.
+ */
+
+//! The version written into new files.
+enum { hit_version = 1 };
+
+//! The value of HitFileHeader::byte_order as written.
+enum { hit_byte_order = 0x01020304 };
+
+//! Flags stored for each hit.
+enum HitFlags {
+    HitCfdFail = 1,     //!< The CFD failed, see word_t::cfdfail.
+    HitFinishCode = 2   //!< Pile-up, see word_t::finishcode.
+};
+
+//! The start of a decoded hit file.
+struct HitFileHeader {
+    char magic[8];          //!< "OCLHITS" and a zero byte.
+    uint32_t version;       //!< The file format version.
+    uint32_t byte_order;    //!< hit_byte_order, as written.
+};
+
+//! The start of a block of hits.
+struct HitBlockHeader {
+    uint32_t hits;          //!< The number of hits in the block.
+    uint32_t size;          //!< Bytes of columns after this header.
+};
+
+#endif /* HitFormat_H_ */
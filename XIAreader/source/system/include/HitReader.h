@@ -0,0 +1,77 @@
+// -*- c++ -*-
+
+#ifndef HitReader_H_
+#define HitReader_H_ 1
+
+#include "WordBuffer.h"
+
+#include <cstdio>
+#include <vector>
+
+/*!
+ * \class HitReader
+ * \brief Reads hits from decoded hit files.
+ * \details See HitFormat.h for the layout. Has the same interface as
+ *  FileReader, and gives the same hits as FileReader gave when the file
+ *  was written, without parsing headers or computing CFD corrections.
+ * \copyright GNU Public License v. 3
+ */
+class HitReader {
+public:
+    //! Create a reader without a file.
+    HitReader();
+
+    //! Close the file, if open.
+    ~HitReader();
+
+    //! Open a file.
+    /*! \return true if the file is a decoded hit file and the position could be reached.
+     */
+    bool Open(const char* filename,   /*!< Name of the file to open. */
+              int seekpos=0           /*!< The number of hits to skip. */);
+
+    //! Read hits from the file.
+    /*! \return 1 if the buffer was filled, 0 if the end of the file was
+     *  reached first or -1 if an error was encountered.
+     */
+    int Read(word_t* buffer,  /*!< Buffer to put the hits. */
+             int size         /*!< How many hits to read. */);
+
+    //! Retrieve the error flag.
+    /*! \return The error flag.
+     */
+    bool IsError() const
+        { return errorflag; }
+
+private:
+    //! Read and decode the next block.
+    /*! \return 1 if a block was read, 0 at the end of the file and -1 on errors.
+     */
+    int ReadBlock();
+
+    //! Close the file.
+    void Close();
+
+    //! The open file, or 0.
+    std::FILE* file;
+
+    //! Whether an error was encountered.
+    bool errorflag;
+
+    //! The hits of the current block.
+    std::vector<word_t> hits;
+
+    //! The next hit of the current block to give out.
+    size_t next;
+
+    //! The columns of the current block.
+    std::vector<unsigned char> block;
+
+    //! CFD corrections for each CFD word and sampling frequency.
+    std::vector<double> cfd_correction;
+
+    //! The sampling frequency of each address.
+    std::vector<unsigned char> frequency;
+};
+
+#endif /* HitReader_H_ */
@@ -0,0 +1,71 @@
+// -*- c++ -*-
+
+#ifndef HitWriter_H_
+#define HitWriter_H_ 1
+
+#include "WordBuffer.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*!
+ * \class HitWriter
+ * \brief Writes buffers of decoded hits into a decoded hit file.
+ * \details See HitFormat.h for the layout. Each buffer becomes one block,
+ *  so a file sorted from the decoded hits gets the same buffers and
+ *  events as the list mode file. The file is written under a temporary
+ *  name and only gets its name in Close(), so an unfinished file is never
+ *  taken for a complete one.
+ * \copyright GNU Public License v. 3
+ */
+class HitWriter {
+public:
+    //! Create a writer without a file.
+    HitWriter();
+
+    //! Remove the file if it was not closed.
+    ~HitWriter();
+
+    //! Create a file.
+    /*! \return true if the file could be created.
+     */
+    bool Open(const std::string& filename /*!< The output file, replaced by Close(). */);
+
+    //! Get the name of the output file.
+    /*! \return the filename.
+     */
+    const std::string& GetFilename() const
+        { return filename; }
+
+    //! Add a buffer of hits as one block.
+    /*! \return true if written without errors.
+     */
+    bool Write(const WordBuffer& buffer /*!< The hits. */);
+
+    //! Finish the file and give it its name.
+    /*! \return true if the file is complete.
+     */
+    bool Close();
+
+    //! Remove the unfinished file.
+    void Discard();
+
+private:
+    //! The output file.
+    std::string filename;
+
+    //! The file being written, named filename with ".tmp" appended.
+    std::FILE* file;
+
+    //! Whether writing has failed.
+    bool error;
+
+    //! The columns of the block being encoded.
+    std::vector<unsigned char> block;
+
+    //! Buffer of the output file.
+    std::vector<char> stdio_buffer;
+};
+
+#endif /* HitWriter_H_ */
@@ -0,0 +1,78 @@
+// -*- c++ -*-
+
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H 1
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*!
+ * \class JobQueue
+ * \brief Runs jobs one at a time on a background thread.
+ * \details The jobs run in the order they are posted, without holding
+ *  the lock, so the sorting can post the next while one is written. A
+ *  job is deleted when it has run, before the next one starts, so a
+ *  job holding e.g. a snapshot of the histograms releases it early.
+ *  At most a given number of jobs wait while another runs, which limits
+ *  the memory held by the jobs if the disk falls behind.
+ * \copyright GNU Public License v. 3
+ */
+class JobQueue {
+public:
+    //! A job to run.
+    typedef std::function<void()> job_t;
+
+    //! Start the thread.
+    JobQueue(size_t max_waiting /*!< The number of jobs that may wait while another runs. */);
+
+    //! Run the jobs posted and stop the thread.
+    ~JobQueue();
+
+    //! Run a job in the background.
+    /*! Blocks while max_waiting jobs are waiting.
+     */
+    void Post(job_t job /*!< The job. */);
+
+    //! Run a job in the background instead of those waiting.
+    /*! The jobs waiting are deleted without running, so this never blocks.
+     */
+    void Replace(job_t job /*!< The job. */);
+
+    //! Check if jobs are waiting or running.
+    /*! \return true if Post() might block.
+     */
+    bool Busy();
+
+    //! Wait until all jobs posted have run.
+    void Wait();
+
+private:
+    //! The main loop of the thread.
+    void Loop();
+
+    //! The number of jobs that may wait while another runs.
+    const size_t max_waiting;
+
+    //! Jobs waiting to run.
+    std::deque<job_t> jobs;
+
+    //! Whether a job is running.
+    bool running;
+
+    //! Flag set to stop the thread.
+    bool cancel;
+
+    //! Synchronizes access to jobs, running and cancel.
+    std::mutex mutex;
+
+    //! Signals that a job has been posted or has run.
+    std::condition_variable cond;
+
+    //! The thread object.
+    std::thread thread;
+};
+
+#endif /* JOBQUEUE_H */
@@ -63,6 +63,12 @@ public:
 	 */
 	const WordBuffer* Next(Status& state);
 
+	//! Get how often sorting and reading had to wait for each other.
+	/*! Counted since the file was opened.
+	 */
+	void GetWaits(unsigned long& empty,	/*!< Set to the number of times Next() had to wait for data. */
+				  unsigned long& full	/*!< Set to the number of times reading waited for a free buffer. */);
+
 	//! Set the buffer template.
     void SetBuffer(WordBuffer *buf)
 		{ template_buffer.reset( buf ); }
@@ -0,0 +1,15 @@
+// -*- c++ -*-
+
+#ifndef RUNPARALLEL_H
+#define RUNPARALLEL_H 1
+
+#include <functional>
+#include <vector>
+
+//! Run independent jobs on up to one thread per core.
+/*! The jobs are taken in order by the next free thread; the calling
+ *  thread takes part. Returns when all jobs are done.
+ */
+void RunParallel(const std::vector<std::function<void()> >& jobs /*!< The jobs to run. */);
+
+#endif /* RUNPARALLEL_H */
@@ -0,0 +1,144 @@
+// -*- c++ -*-
+
+#ifndef SORTSTATS_H
+#define SORTSTATS_H 1
+
+#include <iosfwd>
+#include <string>
+#include <stdint.h>
+
+/*!
+ * \class SortStats
+ * \brief Time spent in each stage of sorting, and related counters.
+ * \details The stages are timed with the time stamp counter where there
+ *  is one, and with std::chrono::steady_clock elsewhere; reading either
+ *  takes a few ns, so the timing can stay on for every event. Each
+ *  sorting thread keeps its own SortStats, which are added up for the
+ *  reports. Times of stages run in several threads are summed over the
+ *  threads and may add up to more than the wall time.
+ * \copyright GNU Public License v. 3
+ */
+class SortStats {
+public:
+    //! Clock ticks, see Now().
+    typedef uint64_t tick_t;
+
+    //! Stages timed.
+    enum Stage {
+        Read,       //!< Waiting for the next buffer from the file.
+        Unpack,     //!< Building events from the buffer.
+        Sort,       //!< UserRoutine::Sort(), including histogram flushes.
+        Flush,      //!< Adding buffered fills to the histogram bins.
+        Threads,    //!< Handing buffers to and waiting for sorting threads.
+        Export,     //!< Writing histograms.
+        StageCount  //!< Number of stages.
+    };
+
+    //! Counts histogram flushes made by the current thread.
+    /*! Create one at the start of a flush; the time until it is
+     *  destroyed is counted for the thread, and picked up by
+     *  TakeFlushes(). Flushes without fills are not counted.
+     */
+    class FlushTimer {
+    public:
+        FlushTimer(unsigned int fills /*!< Number of fills flushed. */)
+            : start( fills > 0 ? Now() : 0 ) { }
+        ~FlushTimer();
+    private:
+        const tick_t start;
+    };
+
+    //! Start with all counters zero.
+    SortStats() { Reset(); }
+
+    //! Set all counters to zero.
+    void Reset();
+
+    //! Read the clock.
+    /*! \return the current time in ticks.
+     */
+    static inline tick_t Now();
+
+    //! Ticks per second of Now().
+    /*! \return the rate, measured since the program started.
+     */
+    static double TicksPerSecond();
+
+    //! Add time spent in a stage.
+    void Add(Stage s,       /*!< The stage. */
+             tick_t ticks   /*!< Ticks spent, usually a difference of Now(). */)
+        { stage_ticks[s] += ticks; stage_calls[s] += 1; }
+
+    //! Move the flushes counted by FlushTimer in this thread into these stats.
+    void TakeFlushes();
+
+    //! Add another set of stats.
+    SortStats& operator+=(const SortStats& other);
+
+    //! Get the time spent in a stage.
+    /*! \return the time in seconds.
+     */
+    double GetSeconds(Stage s /*!< The stage. */) const
+        { return stage_ticks[s] / TicksPerSecond(); }
+
+    //! Print a report.
+    /*! The stages run for every buffer or event also show the hits and
+     *  events per second spent in them.
+     */
+    void Print(std::ostream& out,           /*!< Where to print. */
+               const std::string& title     /*!< Printed at the start. */) const;
+
+    //! Write as JSON object.
+    void WriteJSON(std::ostream& out,       /*!< Where to write. */
+                   const std::string& indent /*!< Put before each line but the first. */) const;
+
+    //! Ticks spent in each stage.
+    tick_t stage_ticks[StageCount];
+
+    //! Number of times each stage was timed.
+    uint64_t stage_calls[StageCount];
+
+    //! Wall time, in seconds.
+    double seconds;
+
+    //! Buffers sorted.
+    uint64_t buffers;
+
+    //! Buffers with errors.
+    uint64_t bad_buffers;
+
+    //! Events built.
+    uint64_t events;
+
+    //! Data words in the buffers.
+    uint64_t words;
+
+    //! Number of times the sorting waited for the file reading thread.
+    uint64_t read_waits;
+
+    //! Number of times the file reading thread waited for the sorting.
+    uint64_t reader_waits;
+
+    //! Name of each stage, for reports.
+    static const char* const stage_names[StageCount];
+};
+
+// ########################################################################
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+SortStats::tick_t SortStats::Now()
+{
+    return __rdtsc();
+}
+#else
+#include <chrono>
+
+SortStats::tick_t SortStats::Now()
+{
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+#endif
+
+#endif /* SORTSTATS_H */
@@ -15,8 +15,9 @@ inline int seek(std::FILE* stream, int offset)
     while ( moved < offset ){
         if ( std::fread(&head, sizeof(uint32_t), 1, stream) != 1 ) // Error while reading.
             return 1;
+        // The length is in words and includes the header word read.
         length =  ( head & 0x3FFE0000 ) >> 17;
-        if ( std::fseek(stream, length, SEEK_CUR) != 0 )
+        if ( length < 1 || std::fseek(stream, sizeof(uint32_t)*(length - 1), SEEK_CUR) != 0 )
             return 1;
         ++moved;
     }
@@ -0,0 +1,21 @@
+/*!
+ * \file HitBufferFetcher.cpp
+ * \brief Implementation of HitBufferFetcher.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "HitBufferFetcher.h"
+
+// ########################################################################
+
+const WordBuffer* HitBufferFetcher::Next(Status& state)
+{
+    const int i = reader.Read( buffer.GetBuffer(), buffer.GetSize() );
+    if ( i > 0 )
+        state = OKAY;
+    else if ( i == 0 )
+        state = END;
+    else
+        state = ERROR;
+    return &buffer;
+}
@@ -0,0 +1,179 @@
+/*!
+ * \file HitReader.cpp
+ * \brief Implementation of HitReader.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "HitReader.h"
+
+#include "HitFormat.h"
+#include "experimentsetup.h"
+#include "XIA_CFD.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+//! The number of addresses, 12 bits.
+static const int address_count = 0x1000;
+
+//! The number of CFD words, 16 bits.
+static const int cfd_count = 0x10000;
+
+// ########################################################################
+
+HitReader::HitReader()
+    : file( 0 )
+    , errorflag( false )
+    , next( 0 )
+    , cfd_correction( 4*cfd_count, 0 )
+    , frequency( address_count )
+{
+    // As computed by FileReader for each hit.
+    char fail;
+    for (int c = 0 ; c < cfd_count ; ++c){
+        cfd_correction[f100MHz*cfd_count + c] = XIA_CFD_Fraction_100MHz(c, &fail);
+        cfd_correction[f250MHz*cfd_count + c] = XIA_CFD_Fraction_250MHz(c, &fail);
+        cfd_correction[f500MHz*cfd_count + c] = XIA_CFD_Fraction_500MHz(c, &fail);
+    }
+    for (int a = 0 ; a < address_count ; ++a)
+        frequency[a] = GetSamplingFrequency(a);
+}
+
+// ########################################################################
+
+HitReader::~HitReader()
+{
+    Close();
+}
+
+// ########################################################################
+
+void HitReader::Close()
+{
+    if ( file ){
+        std::fclose( file );
+        file = 0;
+    }
+    hits.clear();
+    next = 0;
+}
+
+// ########################################################################
+
+bool HitReader::Open(const char* filename, int seekpos)
+{
+    Close();
+    errorflag = true;
+    file = std::fopen(filename, "rb");
+    if ( !file )
+        return false;
+
+    HitFileHeader header;
+    if ( std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, "OCLHITS", 8) != 0
+         || header.version != hit_version || header.byte_order != hit_byte_order )
+    {
+        std::cerr << "HitReader: '" << filename << "' is not a decoded hit file" << std::endl;
+        Close();
+        return false;
+    }
+
+    // Whole blocks are skipped without decoding them.
+    while ( seekpos > 0 ){
+        HitBlockHeader block_header;
+        if ( std::fread(&block_header, sizeof(block_header), 1, file) != 1 )
+            return false;
+        if ( int(block_header.hits) <= seekpos ){
+            if ( std::fseek(file, block_header.size, SEEK_CUR) != 0 )
+                return false;
+            seekpos -= block_header.hits;
+        } else {
+            if ( std::fseek(file, -long(sizeof(block_header)), SEEK_CUR) != 0 || ReadBlock() <= 0 )
+                return false;
+            next = seekpos;
+            seekpos = 0;
+        }
+    }
+    errorflag = false;
+    return true;
+}
+
+// ########################################################################
+
+int HitReader::Read(word_t* buffer, int size)
+{
+    if ( errorflag || !file )
+        return -1;
+
+    int have = 0;
+    while ( have < size ){
+        if ( next >= hits.size() ){
+            const int r = ReadBlock();
+            if ( r <= 0 ){
+                errorflag = ( r < 0 );
+                if ( !errorflag )
+                    Close();
+                return errorflag ? -1 : 0;
+            }
+        }
+        const int n = std::min<size_t>( size - have, hits.size() - next );
+        std::memcpy(buffer + have, &hits[next], n*sizeof(word_t));
+        have += n;
+        next += n;
+    }
+    return 1;
+}
+
+// ########################################################################
+
+int HitReader::ReadBlock()
+{
+    HitBlockHeader header;
+    if ( std::fread(&header, sizeof(header), 1, file) != 1 )
+        return std::feof(file) ? 0 : -1;
+
+    // Each hit takes 7 bytes and 1 to 10 bytes for the timestamp.
+    const uint64_t n = header.hits;
+    if ( n == 0 || n > ( 1 << 24 ) || header.size < 8*n || header.size > 17*n ){
+        std::cerr << "\nHitReader: Bad block of " << n << " hits" << std::endl;
+        return -1;
+    }
+    block.resize( header.size );
+    if ( std::fread(&block[0], 1, block.size(), file) != block.size() )
+        return -1;
+
+    hits.resize( n );
+    next = 0;
+    const uint16_t* address = reinterpret_cast<const uint16_t*>( &block[0] );
+    const uint16_t* adcdata = address + n;
+    const uint16_t* cfddata = adcdata + n;
+    const unsigned char* flags = reinterpret_cast<const unsigned char*>( cfddata + n );
+    const unsigned char* ts = flags + n;
+    const unsigned char* end = &block[0] + block.size();
+
+    int64_t timestamp = 0;
+    for (uint64_t i = 0 ; i < n ; ++i){
+        word_t& hit = hits[i];
+        hit.address = address[i];
+        hit.adcdata = adcdata[i];
+        hit.cfddata = cfddata[i];
+        hit.cfdfail = ( flags[i] & HitCfdFail ) ? 1 : 0;
+        hit.finishcode = ( flags[i] & HitFinishCode ) ? 1 : 0;
+        hit.cfdcorr = cfd_correction[frequency[hit.address & 0x0FFF]*cfd_count + hit.cfddata];
+
+        uint64_t zigzag = 0;
+        for (int shift = 0 ; ; shift += 7){
+            if ( ts >= end || shift > 63 ){
+                std::cerr << "\nHitReader: Bad timestamps in block of " << n << " hits" << std::endl;
+                return -1;
+            }
+            const unsigned char byte = *ts++;
+            zigzag |= uint64_t( byte & 0x7F ) << shift;
+            if ( !( byte & 0x80 ) )
+                break;
+        }
+        timestamp += int64_t( zigzag >> 1 ) ^ -int64_t( zigzag & 1 );
+        hit.timestamp = timestamp;
+    }
+    return 1;
+}
@@ -0,0 +1,133 @@
+/*!
+ * \file HitWriter.cpp
+ * \brief Implementation of HitWriter.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "HitWriter.h"
+
+#include "HitFormat.h"
+
+#include <cstring>
+#include <iostream>
+
+// ########################################################################
+
+//! Append a column of 16 bit values taken from the hits.
+template<uint16_t word_t::*member>
+static void PutColumn(std::vector<unsigned char>& block, const WordBuffer& buffer)
+{
+    const int n = buffer.GetSize();
+    const size_t at = block.size();
+    block.resize( at + n*sizeof(uint16_t) );
+    uint16_t* column = reinterpret_cast<uint16_t*>( &block[at] );
+    const word_t* hits = buffer.GetBuffer();
+    for (int i = 0 ; i < n ; ++i)
+        column[i] = hits[i].*member;
+}
+
+// ########################################################################
+
+HitWriter::HitWriter()
+    : file( 0 )
+    , error( false )
+{
+}
+
+// ########################################################################
+
+HitWriter::~HitWriter()
+{
+    Discard();
+}
+
+// ########################################################################
+
+bool HitWriter::Open(const std::string& f)
+{
+    Discard();
+    filename = f;
+    error = false;
+    const std::string tmp = filename + ".tmp";
+    file = std::fopen(tmp.c_str(), "wb");
+    if ( !file ){
+        std::cerr << "HitWriter: Could not create '" << tmp << "'" << std::endl;
+        return false;
+    }
+    stdio_buffer.resize( 1 << 20 );
+    std::setvbuf(file, &stdio_buffer[0], _IOFBF, stdio_buffer.size());
+
+    HitFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "OCLHITS", 8);
+    header.version = hit_version;
+    header.byte_order = hit_byte_order;
+    error = std::fwrite(&header, sizeof(header), 1, file) != 1;
+    return !error;
+}
+
+// ########################################################################
+
+bool HitWriter::Write(const WordBuffer& buffer)
+{
+    if ( !file || error )
+        return false;
+
+    const int n = buffer.GetSize();
+    block.clear();
+    block.reserve( n*12 );
+    PutColumn<&word_t::address>(block, buffer);
+    PutColumn<&word_t::adcdata>(block, buffer);
+    PutColumn<&word_t::cfddata>(block, buffer);
+
+    const word_t* hits = buffer.GetBuffer();
+    for (int i = 0 ; i < n ; ++i)
+        block.push_back( ( hits[i].cfdfail ? HitCfdFail : 0 ) | ( hits[i].finishcode ? HitFinishCode : 0 ) );
+
+    int64_t last = 0;
+    for (int i = 0 ; i < n ; ++i){
+        const int64_t diff = hits[i].timestamp - last;
+        last = hits[i].timestamp;
+        uint64_t zigzag = ( uint64_t(diff) << 1 ) ^ uint64_t( diff >> 63 );
+        while ( zigzag >= 0x80 ){
+            block.push_back( ( zigzag & 0x7F ) | 0x80 );
+            zigzag >>= 7;
+        }
+        block.push_back( zigzag );
+    }
+
+    HitBlockHeader header = { uint32_t(n), uint32_t(block.size()) };
+    error = std::fwrite(&header, sizeof(header), 1, file) != 1
+        || std::fwrite(&block[0], 1, block.size(), file) != block.size();
+    if ( error )
+        std::cerr << "\nHitWriter: Could not write '" << filename << ".tmp'" << std::endl;
+    return !error;
+}
+
+// ########################################################################
+
+bool HitWriter::Close()
+{
+    if ( !file )
+        return false;
+    const std::string tmp = filename + ".tmp";
+    error = ( std::fclose(file) != 0 ) || error;
+    file = 0;
+    if ( error || std::rename(tmp.c_str(), filename.c_str()) != 0 ){
+        std::cerr << "HitWriter: Could not write '" << filename << "'" << std::endl;
+        std::remove( tmp.c_str() );
+        return false;
+    }
+    return true;
+}
+
+// ########################################################################
+
+void HitWriter::Discard()
+{
+    if ( !file )
+        return;
+    std::fclose(file);
+    file = 0;
+    std::remove( ( filename + ".tmp" ).c_str() );
+}
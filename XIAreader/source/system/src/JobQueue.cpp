@@ -0,0 +1,98 @@
+/*!
+ * \file JobQueue.cpp
+ * \brief Implementation of JobQueue.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "JobQueue.h"
+
+// ########################################################################
+
+JobQueue::JobQueue(size_t m)
+    : max_waiting( m )
+    , running( false )
+    , cancel( false )
+{
+    thread = std::thread( &JobQueue::Loop, this );
+}
+
+// ########################################################################
+
+JobQueue::~JobQueue()
+{
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        cancel = true;
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+// ########################################################################
+
+void JobQueue::Post(job_t job)
+{
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( jobs.size() >= max_waiting )
+        cond.wait( lock );
+    jobs.push_back( std::move(job) );
+    cond.notify_all();
+}
+
+// ########################################################################
+
+void JobQueue::Replace(job_t job)
+{
+    std::deque<job_t> old;
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        old.swap( jobs );
+        jobs.push_back( std::move(job) );
+    }
+    cond.notify_all();
+    // The jobs replaced are deleted here, without the lock.
+}
+
+// ########################################################################
+
+bool JobQueue::Busy()
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    return running || !jobs.empty();
+}
+
+// ########################################################################
+
+void JobQueue::Wait()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( running || !jobs.empty() )
+        cond.wait( lock );
+}
+
+// ########################################################################
+
+void JobQueue::Loop()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( true ){
+        while ( !cancel && jobs.empty() )
+            cond.wait( lock );
+        if ( jobs.empty() )
+            return;
+
+        job_t job = std::move( jobs.front() );
+        jobs.pop_front();
+        running = true;
+        cond.notify_all();
+
+        lock.unlock();
+        job();
+        job = job_t();
+        lock.lock();
+
+        running = false;
+        cond.notify_all();
+    }
+}
@@ -187,6 +187,9 @@ public:
 	//! Stop the thread.
 	void Stop();
 
+	//! Get how often each thread had to wait for the other.
+	void GetWaits(unsigned long& empty, unsigned long& full);
+
 private:
 	//! The main loop of the thread.
 	void StartReading();
@@ -223,12 +226,20 @@ private:
 
 	//! Flag that reading the file is finished. Only written by the prefetched thread.
 	bool finished;	
+
+	//! Number of times the main thread found no buffer ready.
+	unsigned long empty_waits;
+
+	//! Number of times the thread found no buffer free.
+	unsigned long full_waits;
 };
 
 PrefetchThread::PrefetchThread(FileReader* rdr, WordBuffer* template_buffer)
 	: reader( rdr )
 	, cancel( false )
 	, finished( false )
+	, empty_waits( 0 )
+	, full_waits( 0 )
 {
 	pthread_cond_init( &cond_full,  0 );
 	pthread_cond_init( &cond_avail, 0 );
@@ -255,6 +266,8 @@ void PrefetchThread::ReadingEnds()
 WordBuffer* PrefetchThread::ReadingBegins()
 {
 	PThreadMutexLock lock( mutex );
+	if ( !finished && readRing.Empty() )
+		empty_waits += 1;
     while ( true ) {
 		if ( finished && readRing.Empty() )
 			return 0;
@@ -272,6 +285,8 @@ void PrefetchThread::StartReading()
 		WordBuffer* buffer = 0;
         { // Critical section
 			PThreadMutexLock lock( mutex );
+			if ( !cancel && !finished && writeRing.Full() )
+				full_waits += 1;
 			while ( !cancel && !finished && writeRing.Full() )
 				mutex.Wait( &cond_full );
 			if ( cancel || finished )
@@ -314,6 +329,13 @@ void PrefetchThread::Stop()
 	pthread_join( thread, NULL );
 }
 
+void PrefetchThread::GetWaits(unsigned long& empty, unsigned long& full)
+{
+	PThreadMutexLock lock( mutex );
+	empty = empty_waits;
+	full = full_waits;
+}
+
 PrefetchThread::~PrefetchThread()
 {
 	pthread_cond_destroy( &cond_full );
@@ -352,6 +374,15 @@ const WordBuffer* MTFileBufferFetcher::Next(Status& state)
 	return b;
 }
 
+void MTFileBufferFetcher::GetWaits(unsigned long& empty, unsigned long& full)
+{
+	if ( prefetch ){
+		prefetch->GetWaits(empty, full);
+	} else {
+		empty = full = 0;
+	}
+}
+
 BufferFetcher::Status MTFileBufferFetcher::Open(const std::string& filename, int bufnum)
 {
 	StopPrefetching();
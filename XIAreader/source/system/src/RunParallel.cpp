@@ -0,0 +1,25 @@
+
+#include "RunParallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// ########################################################################
+
+void RunParallel(const std::vector<std::function<void()> >& jobs)
+{
+    std::atomic<size_t> next( 0 );
+    auto work = [&jobs, &next]() {
+        for(size_t j = next++; j < jobs.size(); j = next++)
+            jobs[j]();
+    };
+
+    const size_t n = std::min<size_t>( std::max(1u, std::thread::hardware_concurrency()), jobs.size() );
+    std::vector<std::thread> threads;
+    for(size_t t=1; t<n; ++t)
+        threads.push_back( std::thread( work ) );
+    work();
+    for(size_t t=0; t<threads.size(); ++t)
+        threads[t].join();
+}
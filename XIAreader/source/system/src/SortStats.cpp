@@ -0,0 +1,153 @@
+/*!
+ * \file SortStats.cpp
+ * \brief Implementation of SortStats.
+ * \copyright GNU Public License v. 3
+ */
+
+#include "SortStats.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+const char* const SortStats::stage_names[SortStats::StageCount] = {
+    "read", "unpack", "sort", "flush", "threads", "export"
+};
+
+//! Flushes counted in each thread, see SortStats::FlushTimer.
+struct FlushCounts {
+    SortStats::tick_t ticks;
+    uint64_t calls;
+};
+static thread_local FlushCounts flush_counts = { 0, 0 };
+
+//! Clock readings at the start of the program, to measure the tick rate.
+static const SortStats::tick_t origin_ticks = SortStats::Now();
+static const std::chrono::steady_clock::time_point origin_time = std::chrono::steady_clock::now();
+
+// ########################################################################
+
+SortStats::FlushTimer::~FlushTimer()
+{
+    if ( start == 0 )
+        return;
+    flush_counts.ticks += Now() - start;
+    flush_counts.calls += 1;
+}
+
+// ########################################################################
+
+void SortStats::Reset()
+{
+    for (int s = 0 ; s < StageCount ; ++s){
+        stage_ticks[s] = 0;
+        stage_calls[s] = 0;
+    }
+    seconds = 0;
+    buffers = bad_buffers = events = words = 0;
+    read_waits = reader_waits = 0;
+}
+
+// ########################################################################
+
+double SortStats::TicksPerSecond()
+{
+    const tick_t ticks = Now() - origin_ticks;
+    const double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - origin_time ).count();
+    return ( ticks > 0 && elapsed > 0 ) ? ticks / elapsed : 1e9;
+}
+
+// ########################################################################
+
+void SortStats::TakeFlushes()
+{
+    stage_ticks[Flush] += flush_counts.ticks;
+    stage_calls[Flush] += flush_counts.calls;
+    flush_counts.ticks = 0;
+    flush_counts.calls = 0;
+}
+
+// ########################################################################
+
+SortStats& SortStats::operator+=(const SortStats& other)
+{
+    for (int s = 0 ; s < StageCount ; ++s){
+        stage_ticks[s] += other.stage_ticks[s];
+        stage_calls[s] += other.stage_calls[s];
+    }
+    seconds += other.seconds;
+    buffers += other.buffers;
+    bad_buffers += other.bad_buffers;
+    events += other.events;
+    words += other.words;
+    read_waits += other.read_waits;
+    reader_waits += other.reader_waits;
+    return *this;
+}
+
+// ########################################################################
+
+void SortStats::Print(std::ostream& out, const std::string& title) const
+{
+    const double tps = TicksPerSecond();
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+
+    out << title << ": " << buffers << " buffers (" << bad_buffers << " bad), "
+        << events << " events in " << seconds << " s";
+    if ( seconds > 0 )
+        out << ", " << std::setprecision(3) << std::scientific
+            << buffers/seconds << " buffers/s, " << words/seconds << " hits/s"
+            << std::fixed << std::setprecision(2);
+    out << '\n';
+    for (int s = 0 ; s < StageCount ; ++s){
+        if ( stage_calls[s] == 0 )
+            continue;
+        const double t = stage_ticks[s] / tps;
+        out << "  " << std::left << std::setw(8) << stage_names[s] << std::right
+            << std::setw(10) << t << " s";
+        if ( seconds > 0 )
+            out << std::setw(8) << 100*t/seconds << " %";
+        if ( ( s == Read || s == Unpack || s == Sort ) && t > 0 )
+            out << std::setprecision(3) << std::scientific
+                << "  " << words/t << " hits/s, " << events/t << " events/s"
+                << std::fixed << std::setprecision(2);
+        if ( s == Flush )
+            out << "  " << stage_calls[s] << " flushes";
+        else if ( s == Read )
+            out << ", waited for data " << read_waits << " times, reader waited for room " << reader_waits << " times";
+        out << '\n';
+    }
+    out << std::flush;
+
+    out.flags( flags );
+    out.precision( precision );
+}
+
+// ########################################################################
+
+void SortStats::WriteJSON(std::ostream& out, const std::string& indent) const
+{
+    const double tps = TicksPerSecond();
+    const std::streamsize precision = out.precision( 9 );
+
+    out << "{\n"
+        << indent << "  \"seconds\": " << seconds << ",\n"
+        << indent << "  \"buffers\": " << buffers << ",\n"
+        << indent << "  \"bad_buffers\": " << bad_buffers << ",\n"
+        << indent << "  \"events\": " << events << ",\n"
+        << indent << "  \"hits\": " << words << ",\n"
+        << indent << "  \"read_waits\": " << read_waits << ",\n"
+        << indent << "  \"reader_waits\": " << reader_waits << ",\n"
+        << indent << "  \"stages\": {";
+    for (int s = 0 ; s < StageCount ; ++s){
+        out << ( s == 0 ? "\n" : ",\n" )
+            << indent << "    \"" << stage_names[s] << "\": { \"seconds\": " << stage_ticks[s] / tps
+            << ", \"calls\": " << stage_calls[s] << " }";
+    }
+    out << '\n' << indent << "  }\n"
+        << indent << '}';
+
+    out.precision( precision );
+}
@@ -0,0 +1,121 @@
+/* -*- c++ -*-
+ * BinContent.h
+ *
+ * Arithmetic on histogram bins of the types listed in BinType.
+ */
+
+#ifndef BINCONTENT_H_
+#define BINCONTENT_H_
+
+#include "Histograms.h"
+
+#include <map>
+#include <type_traits>
+
+//! Bin contents that did not fit in their bin, by linear bin number.
+typedef std::map<Axis::index_t, long long> spill_t;
+
+// ########################################################################
+
+//! Add, get and set the content of a bin of type T.
+/*! Floating point bins take the weight as is; integer bins take the
+ *  weight truncated to a whole number. The spill map and the linear bin
+ *  number are only used by uint16_t bins.
+ */
+template<typename T, bool integer = std::is_integral<T>::value>
+struct BinContent {
+    //! Add to a bin.
+    static void Add(T& bin, double weight, spill_t&, Axis::index_t)
+        { bin += T(weight); }
+
+    //! Get the content of a bin.
+    /*! \return the bin content.
+     */
+    static double Get(const T& bin, const spill_t&, Axis::index_t)
+        { return bin; }
+
+    //! Set the content of a bin.
+    static void Set(T& bin, double c, spill_t&, Axis::index_t)
+        { bin = T(c); }
+
+    //! Get a weight as it is added to a bin.
+    /*! Weights for the same bin may then be summed before adding.
+     *
+     * \return the weight.
+     */
+    static double Weight(double weight)
+        { return weight; }
+};
+
+// ########################################################################
+
+//! Integer bins, wrapping like the bin type.
+template<typename T>
+struct BinContent<T, true> {
+    static void Add(T& bin, double weight, spill_t&, Axis::index_t)
+        { bin += T(static_cast<long long>(weight)); }
+
+    static double Get(const T& bin, const spill_t&, Axis::index_t)
+        { return bin; }
+
+    static void Set(T& bin, double c, spill_t&, Axis::index_t)
+        { bin = T(static_cast<long long>(c)); }
+
+    static double Weight(double weight)
+        { return double(static_cast<long long>(weight)); }
+};
+
+// ########################################################################
+
+//! 16 bit bins with overflow spill.
+/*! A bin holding 0xFFFF is saturated, and the counts above that are
+ *  kept in the spill map. The map is only looked at for saturated bins.
+ *  Contents below zero are not representable and are set to zero.
+ */
+template<>
+struct BinContent<uint16_t, true> {
+    enum { saturated = 0xFFFF };
+
+    static void Add(uint16_t& bin, double weight, spill_t& spill, Axis::index_t key)
+        {
+            const long long w = static_cast<long long>(weight);
+            if( bin != saturated ) {
+                const long long c = bin + w;
+                if( c >= 0 && c < saturated )
+                    bin = uint16_t(c);
+                else
+                    Set(bin, c, spill, key);
+            } else {
+                Set(bin, Get(bin, spill, key) + w, spill, key);
+            }
+        }
+
+    static double Get(const uint16_t& bin, const spill_t& spill, Axis::index_t key)
+        {
+            if( bin != saturated )
+                return bin;
+            spill_t::const_iterator it = spill.find(key);
+            return saturated + ( it != spill.end() ? it->second : 0 );
+        }
+
+    static double Weight(double weight)
+        { return double(static_cast<long long>(weight)); }
+
+    static void Set(uint16_t& bin, double c, spill_t& spill, Axis::index_t key)
+        {
+            const long long n = static_cast<long long>(c);
+            if( n < saturated ) {
+                if( bin == saturated )
+                    spill.erase(key);
+                bin = uint16_t( n > 0 ? n : 0 );
+            } else {
+                bin = saturated;
+                if( n > saturated )
+                    spill[key] = n - saturated;
+                else
+                    spill.erase(key);
+            }
+        }
+};
+
+#endif /* BINCONTENT_H_ */
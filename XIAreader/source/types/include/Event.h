@@ -63,6 +63,8 @@ struct Event {
 
     int length;  //! Total length of the event (in no. of words)
 
+    int start;   //! Index of the first word of the event in the buffer.
+
 
     word_t trigger;     //! This is the word that "triggers" the event.
 
@@ -111,6 +113,7 @@ struct Event {
 
         // Resetting event length.
         length = 0;
+        start = 0;
     }
 
 };
@@ -0,0 +1,128 @@
+// -*- c++ -*-
+
+#ifndef EventColumns_H_
+#define EventColumns_H_ 1
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*!
+ * \class EventColumns
+ * \brief Values of selected variables for each event, stored as columns.
+ * \details Filled by the sorting routine, one row per event, e.g. by the
+ *  'columns' command of FillPlan. A column holds one value per event or,
+ *  if it belongs to a hit group, any number of values per event; the
+ *  number of values of each event is then stored once for the group.
+ *  The rows are taken by EventWriter after each buffer, so a routine
+ *  never holds more than the rows of one buffer.
+ * \copyright GNU Public License v. 3
+ */
+class EventColumns {
+public:
+    //! Create without columns, not enabled.
+    EventColumns() : enabled( false ), rows( 0 ) { }
+
+    //! Set the columns, dropping all rows.
+    void Declare(const std::vector<std::string>& groups,  /*!< Names of the hit groups. */
+                 const std::vector<std::string>& names,   /*!< Name of each column. */
+                 const std::vector<int>& column_groups    /*!< Hit group of each column, -1 for one value per event. */);
+
+    //! Check whether any columns are declared.
+    /*! \return true if there are no columns.
+     */
+    bool Empty() const
+        { return names.empty(); }
+
+    //! Set whether rows shall be added, i.e. whether anyone takes them.
+    void SetEnabled(bool on /*!< Whether rows are added. */)
+        { enabled = on; }
+
+    //! Check whether rows shall be added.
+    /*! \return true if enabled.
+     */
+    bool IsEnabled() const
+        { return enabled; }
+
+    //! Add the value of a per-event column to the current row.
+    void Add(int column,    /*!< The column. */
+             double value   /*!< The value. */)
+        { data[column].push_back( float(value) ); }
+
+    //! Add the values of a per-hit column to the current row.
+    void Add(int column,            /*!< The column. */
+             const double* values,  /*!< The value of each hit. */
+             int n                  /*!< The number of hits, as given to AddCount(). */);
+
+    //! Add the number of hits of a group to the current row.
+    void AddCount(int group,    /*!< The hit group. */
+                  uint32_t n    /*!< The number of hits. */)
+        { counts[group].push_back( n ); }
+
+    //! Complete the current row, after all columns and counts are added.
+    void EndRow()
+        { rows += 1; }
+
+    //! Drop all rows, keeping the columns.
+    void Clear();
+
+    //! Get the names of the hit groups.
+    /*! \return the names.
+     */
+    const std::vector<std::string>& GetGroups() const
+        { return groups; }
+
+    //! Get the names of the columns.
+    /*! \return the names.
+     */
+    const std::vector<std::string>& GetNames() const
+        { return names; }
+
+    //! Get the hit group of each column.
+    /*! \return the group of each column, -1 for per-event columns.
+     */
+    const std::vector<int>& GetColumnGroups() const
+        { return column_groups; }
+
+    //! Get the number of rows.
+    /*! \return the number of rows added since Clear().
+     */
+    uint32_t GetRows() const
+        { return rows; }
+
+    //! Get the values of a column.
+    /*! \return the values of all rows.
+     */
+    const std::vector<float>& GetData(int column /*!< The column. */) const
+        { return data[column]; }
+
+    //! Get the number of hits of a group in each row.
+    /*! \return the counts of all rows.
+     */
+    const std::vector<uint32_t>& GetCounts(int group /*!< The hit group. */) const
+        { return counts[group]; }
+
+private:
+    //! Names of the hit groups.
+    std::vector<std::string> groups;
+
+    //! Names of the columns.
+    std::vector<std::string> names;
+
+    //! Hit group of each column, -1 for per-event columns.
+    std::vector<int> column_groups;
+
+    //! Whether rows shall be added.
+    bool enabled;
+
+    //! The number of rows.
+    uint32_t rows;
+
+    //! Values of each column.
+    std::vector<std::vector<float> > data;
+
+    //! Hits of each group in each row.
+    std::vector<std::vector<uint32_t> > counts;
+};
+
+#endif /* EventColumns_H_ */
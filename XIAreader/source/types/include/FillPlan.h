@@ -0,0 +1,245 @@
+// -*- c++ -*-
+
+#ifndef FillPlan_H_
+#define FillPlan_H_ 1
+
+#include "EventColumns.h"
+#include "Histograms.h"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// ########################################################################
+
+//! Histograms, variables and gates declared in the batch file.
+/*! The sorting routine registers the variables it can provide with
+ *  Define() and sets their values for each event. Variables named
+ *  "group.name" (e.g. "labr.E") hold one value per hit; all variables of
+ *  a group share the hit index. Other variables hold one value per event.
+ *
+ *  The batch file may then declare
+ *  <pre>
+ *  variable &lt;name&gt; &lt;bins&gt; &lt;low&gt; &lt;high&gt; [&lt;source&gt; [&lt;scale&gt; [&lt;offset&gt;]]]
+ *  gate &lt;name&gt; &lt;variable&gt; &lt;low&gt; &lt;high&gt; [&lt;variable&gt; &lt;low&gt; &lt;high&gt;]*
+ *  hist1d &lt;name&gt; x=&lt;variable&gt;[:&lt;bins&gt;:&lt;low&gt;:&lt;high&gt;] [gate=&lt;gate&gt;] [weight=&lt;w&gt;] [type=&lt;type&gt;]
+ *  hist2d &lt;name&gt; x=&lt;variable&gt;[...] y=&lt;variable&gt;[...] [gate=&lt;gate&gt;] [weight=&lt;w&gt;] [type=&lt;type&gt;] [storage=dense|sparse|tiled]
+ *  columns &lt;variable&gt;... [gate=&lt;gate&gt;]
+ *  </pre>
+ *  'variable' gives the default binning of a variable, or defines a new
+ *  variable as scale*source+offset. A gate is passed if all its variables
+ *  are within [low, high). The bin type is one of the names from
+ *  BinTypeName(). 'columns' selects the variables written as event
+ *  columns while the EventColumns are enabled; an event is written if all
+ *  its per-event variables are set and the per-event gate is passed.
+ *
+ *  The declarations are compiled into a flat plan the first time Fill()
+ *  is called after a change. Derived variables, bin numbers and gates are
+ *  evaluated once per event (or hit) and shared by all histograms using
+ *  them, which are then filled by bin number in one loop.
+ */
+class FillPlan {
+public:
+    //! Construct an empty plan.
+    FillPlan(Histograms& histograms,    /*!< Where declared histograms are created. */
+             EventColumns& columns      /*!< Where the rows of the selected columns are added. */);
+
+    //! Register a variable provided by the sorting routine.
+    /*! \return the variable number to use with Set().
+     */
+    int Define(const std::string& name /*!< Name, "group.name" for per-hit variables. */);
+
+    //! Handle a declaration from the batch file.
+    /*! \return true if the command was understood and accepted.
+     */
+    bool Command(const std::string& name, /*!< The command, e.g. "hist2d". */
+                 std::istream& icmd       /*!< The rest of the command line. */);
+
+    //! Check if a command is handled by the plan.
+    /*! \return true for 'variable', 'gate', 'hist1d', 'hist2d' and 'columns'.
+     */
+    static bool IsCommand(const std::string& name /*!< The command name. */);
+
+    //! Check whether any histograms have been declared or columns are written.
+    /*! \return true if Fill() has nothing to do.
+     */
+    bool Empty() const
+        { return hists.empty() && !WritesColumns(); }
+
+    //! Forget the values of the previous event.
+    void Clear();
+
+    //! Set the value of a per-event variable.
+    void Set(int var,    /*!< Variable number from Define(). */
+             double value /*!< The value for this event. */)
+        { values[var][0] = value; valid[var] = true; }
+
+    //! Set the values of a per-hit variable.
+    /*! All variables of a group must be given the same number of hits.
+     */
+    void Set(int var,              /*!< Variable number from Define(). */
+             const double* values, /*!< The value for each hit. */
+             int n                 /*!< Number of hits. */);
+
+    //! Fill all declared histograms with the current event, and add its columns.
+    void Fill();
+
+private:
+    //! A named value, per event or per hit.
+    struct Variable {
+        std::string name;       //!< Full name of the variable.
+        int group;              //!< Hit group, or -1 for per-event variables.
+        int source;             //!< Source variable if derived, else -1.
+        double scale;           //!< Scale applied to the source.
+        double offset;          //!< Offset added after scaling.
+        Axis::index_t bins;     //!< Default number of bins, 0 if not given.
+        Axis::bin_t low;        //!< Default lower edge.
+        Axis::bin_t high;       //!< Default upper edge.
+    };
+
+    //! One window of a gate.
+    struct Condition {
+        int var;                //!< Variable to test.
+        double low;             //!< Lower limit, inclusive.
+        double high;            //!< Upper limit, exclusive.
+    };
+
+    //! A set of windows that must all be passed.
+    struct Gate {
+        std::string name;               //!< Name of the gate.
+        int group;                      //!< Hit group, or -1 for per-event gates.
+        std::vector<Condition> conds;   //!< The windows.
+    };
+
+    //! Bin numbers for one variable and axis, shared by all users.
+    struct Binning {
+        int var;                            //!< Variable binned.
+        const Axis* axis;                   //!< Axis of the first histogram using it.
+        std::vector<Axis::index_t> bins;    //!< Bin number per hit.
+    };
+
+    //! A declared histogram.
+    struct Hist {
+        HistogramHandle handle; //!< The histogram, in the 1D or 2D pool.
+        bool is2d;              //!< Whether the histogram is 2D.
+        int xvar, yvar;         //!< Variables on the axes, yvar -1 for 1D.
+        int gate;               //!< Gate to pass, -1 if none.
+        double weight;          //!< Weight of each fill.
+        int group;              //!< Hit group looped over, -1 for per-event.
+        int xbin, ybin;         //!< Binning numbers, set by Compile().
+    };
+
+    //! Find a variable by name.
+    /*! \return the variable number, or -1 if not known.
+     */
+    int FindVariable(const std::string& name) const;
+
+    //! Find a gate by name.
+    /*! \return the gate number, or -1 if not known.
+     */
+    int FindGate(const std::string& name) const;
+
+    //! Find or create the hit group of a variable name.
+    /*! \return the group number, or -1 for per-event names.
+     */
+    int GroupOf(const std::string& name);
+
+    //! Add a variable.
+    /*! \return the new variable number.
+     */
+    int AddVariable(const std::string& name, int source, double scale, double offset);
+
+    //! Merge the hit groups of two variables or gates.
+    /*! \return the combined group, or -2 if they are different hit groups.
+     */
+    static int Combine(int group_a, int group_b);
+
+    //! Parse an axis specification 'x=var[:bins:low:high]'.
+    /*! \return true if the variable is known and has a binning.
+     */
+    bool ParseAxis(const std::string& spec, int& var, Axis::index_t& bins,
+                   Axis::bin_t& low, Axis::bin_t& high);
+
+    //! Check whether rows are added to the event columns.
+    bool WritesColumns() const
+        { return !column_vars.empty() && columns.IsEnabled(); }
+
+    //! Add the current event to the event columns, if selected.
+    void FillColumns();
+
+    //! Handle 'variable' commands.
+    bool variable_command(std::istream& icmd);
+
+    //! Handle 'gate' commands.
+    bool gate_command(std::istream& icmd);
+
+    //! Handle 'hist1d' and 'hist2d' commands.
+    bool hist_command(std::istream& icmd, bool is2d);
+
+    //! Handle 'columns' commands.
+    bool columns_command(std::istream& icmd);
+
+    //! Build the binning table for the declared histograms.
+    void Compile();
+
+    //! Find or add a binning of a variable on an axis.
+    /*! \return the binning number.
+     */
+    int AddBinning(int var, const Axis& axis);
+
+    //! Get the index of hit i in a variable.
+    /*! Per-event variables have only one value.
+     */
+    int Index(int var, int i) const
+        { return variables[var].group < 0 ? 0 : i; }
+
+    //! Evaluate derived variables, bins and gates for a group.
+    void Evaluate(int group /*!< Hit group, or -1 for per-event values. */);
+
+    //! Where histograms are created.
+    Histograms& histograms;
+
+    //! All variables, in order of definition.
+    std::vector<Variable> variables;
+
+    //! Names of the hit groups.
+    std::vector<std::string> groups;
+
+    //! Number of hits in each group for the current event.
+    std::vector<int> hits;
+
+    //! All gates.
+    std::vector<Gate> gates;
+
+    //! All histograms.
+    std::vector<Hist> hists;
+
+    //! Values of each variable for the current event.
+    std::vector<std::vector<double> > values;
+
+    //! Whether each variable has been set for this event.
+    std::vector<bool> valid;
+
+    //! Gate results per hit for the current event.
+    std::vector<std::vector<char> > passed;
+
+    //! Shared bin numbers.
+    std::vector<Binning> binnings;
+
+    //! Where the rows of the selected columns are added.
+    EventColumns& columns;
+
+    //! Variables written as event columns.
+    std::vector<int> column_vars;
+
+    //! Hit group of each group of the event columns.
+    std::vector<int> column_groups;
+
+    //! Per-event gate for writing an event, -1 if none.
+    int column_gate;
+
+    //! Whether Compile() must be called before the next Fill().
+    bool dirty;
+};
+
+#endif /* FillPlan_H_ */
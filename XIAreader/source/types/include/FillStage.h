@@ -0,0 +1,164 @@
+/* -*- c++ -*-
+ * FillStage.h
+ *
+ * Fills collected by one thread for a histogram shared between threads.
+ */
+
+#ifndef FILLSTAGE_H_
+#define FILLSTAGE_H_
+
+#include "Histograms.h"
+
+#include <mutex>
+#include <vector>
+
+//! Sort storage positions, and optionally weights, by position.
+/*! LSD radix sort with 8 bit digits, only as many passes as needed
+ *  for max_index. On return, index and weight point to the sorted
+ *  arrays, which are either the input or the temporary arrays. If
+ *  weight is 0, only the positions are sorted.
+ *
+ *  Instantiated for uint32_t and uint64_t positions.
+ */
+template<typename K>
+void SortByIndex(K* &index,          /*!< The positions, set to the sorted positions. */
+                 double* &weight,    /*!< The weights or 0, set to the sorted weights. */
+                 K* index_tmp,       /*!< Space for n positions. */
+                 double* weight_tmp, /*!< Space for n weights. */
+                 unsigned int n,     /*!< The number of positions. */
+                 K max_index         /*!< The highest position present. */);
+
+// ########################################################################
+
+//! Locks for the bins of a histogram filled from several threads.
+/*! Storage positions are taken in stripes of 4096; the stripes are
+ *  spread over a fixed number of locks.
+ */
+class StripeLocks {
+public:
+    //! Create the locks.
+    StripeLocks(bool single /*!< Use one lock for all bins, e.g. when they share a spill map. */)
+        : mask( single ? 0 : stripe_count-1 ) { }
+
+    //! Get the lock for a storage position.
+    /*! \return the lock to hold while changing the bin.
+     */
+    std::mutex& For(Axis::index_t i)
+        { return stripes[(i >> stripe_bits) & mask]; }
+
+    //! The lock for the entry count.
+    std::mutex entries;
+
+private:
+    //! Number of bits of the position within a stripe.
+    enum { stripe_bits = 12 };
+
+    //! Number of locks.
+    enum { stripe_count = 64 };
+
+    //! The locks.
+    std::mutex stripes[stripe_count];
+
+    //! Mask to get the lock number from the stripe number.
+    const Axis::index_t mask;
+};
+
+// ########################################################################
+
+//! Fills waiting to be added to a shared histogram.
+/*! Each thread collects storage positions and weights in its own stage.
+ *  Commit() sorts them by position, adds the weight for each position
+ *  once, and takes the lock of a stripe once for each run of positions
+ *  in it.
+ */
+class FillStage {
+public:
+    //! Create an empty stage.
+    FillStage();
+
+    //! Stage a fill.
+    void Add(Axis::index_t i, /*!< The storage position. */
+             double weight    /*!< The weight, as added to the bin. */)
+        {
+            index[n] = i; this->weight[n] = weight;
+            max_index = ( uint64_t(i) > max_index ) ? uint64_t(i) : max_index;
+            ++n;
+        }
+
+    //! Check if the stage must be committed before the next Add().
+    /*! \return true if the stage is full.
+     */
+    bool Full() const
+        { return n >= stage_max; }
+
+    //! Check if there are fills to commit.
+    /*! \return true if the stage is empty.
+     */
+    bool Empty() const
+        { return n == 0; }
+
+    //! Drop all staged fills.
+    void Clear()
+        { n = 0; max_index = 0; }
+
+    //! Add the staged fills to the bins and clear the stage.
+    /*! add(i, w) is called once for each storage position i, with the
+     *  lock for i held.
+     *
+     * \return the number of fills committed.
+     */
+    template<typename F>
+    unsigned int Commit(StripeLocks& locks, /*!< The locks of the shared histogram. */
+                        F add               /*!< Adds a weight to a bin. */);
+
+    //! The number of fills a stage can hold.
+    enum { stage_max = 4096 };
+
+private:
+    //! Sort the fills and combine equal positions.
+    /*! \return the number of different positions.
+     */
+    unsigned int Combine();
+
+    //! The staged positions, and space for sorting them.
+    std::vector<uint64_t> index, index_tmp;
+
+    //! The staged weights, and space for sorting them.
+    std::vector<double> weight, weight_tmp;
+
+    //! The sorted positions and weights after Combine().
+    uint64_t* sorted_index;
+    double* sorted_weight;
+
+    //! The number of staged fills.
+    unsigned int n;
+
+    //! The highest staged position.
+    uint64_t max_index;
+};
+
+// ########################################################################
+
+template<typename F>
+unsigned int FillStage::Commit(StripeLocks& locks, F add)
+{
+    const unsigned int fills = n;
+    const unsigned int m = Combine();
+    std::mutex* held = 0;
+    for(unsigned int i=0; i<m; ++i) {
+        std::mutex* lock = &locks.For(sorted_index[i]);
+        if( lock != held ) {
+            if( held )
+                held->unlock();
+            lock->lock();
+            held = lock;
+        }
+        add(Axis::index_t(sorted_index[i]), sorted_weight[i]);
+    }
+    if( held )
+        held->unlock();
+    Clear();
+    return fills;
+}
+
+#endif /* FILLSTAGE_H_ */
@@ -8,50 +8,74 @@
 #define HISTOGRAM1D_H_
 
 #include "Histograms.h"
+#include "BinContent.h"
 
 #define H1D_USE_BUFFER 1
-#ifdef H1D_USE_BUFFER
+
 #include <vector>
-#endif
 
 // ########################################################################
 
 //! A one-dimensional histogram.
+/*! This holds the axis, the entry count and the fill buffer; the bins
+ *  are kept by Histogram1DT, which is created with the bin type chosen
+ *  for the histogram.
+ */
 class Histogram1D : public Named {
 public:
-    //! The type used to count in each bin.
-    typedef long long data_t;
-
-    //! Construct a 1D histogram.
-    Histogram1D( const std::string& name,  /*!< The name of the new histogram. */
-                 const std::string& title, /*!< The title of teh new histogram. */
-                 Axis::index_t channels,   /*!< The number of regular bins. */
-                 Axis::bin_t left,         /*!< The lower edge of the lowest bin.  */
-                 Axis::bin_t right,        /*!< The upper edge of the highest bin. */
-                 const std::string& xtitle /*!< The title of the x axis. */);
-
     //! Deallocate memory.
-    ~Histogram1D();
+    virtual ~Histogram1D();
+
+    //! Get the type used to count in the bins.
+    /*! \return the bin type.
+     */
+    virtual BinType GetBinType() const = 0;
 
     //! Add another histogram.
-    void Add(const Histogram1Dp other, data_t scale);
+    virtual void Add(const Histogram1Dp other, double scale) = 0;
 
     //! Increment a histogram bin.
     void Fill(Axis::bin_t x,  /*!< The x axis value. */
-              data_t weight=1 /*!< How much to add to the corresponding bin content. */)
+              double weight=1 /*!< How much to add to the corresponding bin content. */)
         {
 #ifdef H1D_USE_BUFFER
-            buffer.push_back(buf_t(x, weight));
-            if( buffer.size()>=buffer_max ) FlushBuffer();
+            buffer_x[buffer_n] = x; buffer_w[buffer_n] = weight;
+            if( ++buffer_n>=buffer_max ) FlushBuffer();
 #else
             FillDirect(x, weight);
 #endif /* H1D_USE_BUFFER */
         }
 
+    //! Increment a histogram bin given by its bin number.
+    /*! Bypasses the buffer and the bin search; the bin must be valid,
+     *  e.g. from GetAxisX().FindBin().
+     */
+    virtual void FillBin(Axis::index_t bin, /*!< The bin to increment. */
+                         double weight=1    /*!< How much to add to the bin content. */) = 0;
+
     //! Get the contents of a bin.
     /*! \return The bin content.
      */
-    data_t GetBinContent(Axis::index_t bin /*!< The bin to look at. */);
+    virtual double GetBinContent(Axis::index_t bin /*!< The bin to look at. */) = 0;
+
+    //! Copy all bin contents into an array.
+    /*! The bins, including the under- and overflow bins, are copied in
+     *  order, as in the arrays of ROOT histograms. The fill buffer is
+     *  flushed once.
+     */
+    virtual void CopyBins(int* dst /*!< Space for GetAxisX().GetBinCountAll() bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(float* dst /*!< Space for all bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(double* dst /*!< Space for all bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(uint32_t* dst /*!< Space for all bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(long long* dst /*!< Space for all bins. */) = 0;
 
     //! Get the x axis of the histogram.
     /*! \return The histogram's x axis.
@@ -65,17 +89,42 @@ public:
     int GetEntries() const
         { return entries; }
 
+    //! Set the number of entries, e.g. for a copy of another histogram.
+    void SetEntries(int n /*!< The entry count. */)
+        { entries = n; }
+
     //! Clear all bins of the histogram.
-    void Reset();
+    virtual void Reset() = 0;
+
+    //! Add all buffered fills to the bins.
+    void Flush()
+        {
+#ifdef H1D_USE_BUFFER
+            FlushBuffer();
+#endif /* H1D_USE_BUFFER */
+        }
+
+protected:
+    //! Construct a 1D histogram.
+    Histogram1D( const std::string& name,  /*!< The name of the new histogram. */
+                 const std::string& title, /*!< The title of teh new histogram. */
+                 Axis::index_t channels,   /*!< The number of regular bins. */
+                 Axis::bin_t left,         /*!< The lower edge of the lowest bin.  */
+                 Axis::bin_t right,        /*!< The upper edge of the highest bin. */
+                 const std::string& xtitle /*!< The title of the x axis. */);
+
+    //! Check that another histogram has the same name and axis.
+    /*! \return true if the other histogram can be added to this one.
+     */
+    bool IsCompatible(const Histogram1Dp other) const;
 
-private:
     //! Increment a histogram bin directly, bypassing the buffer.
-    void FillDirect(Axis::bin_t x,  /*!< The x axis value. */
-                    data_t weight=1 /*!< How much to add to the corresponding bin content. */);
+    virtual void FillDirect(Axis::bin_t x,  /*!< The x axis value. */
+                            double weight=1 /*!< How much to add to the corresponding bin content. */) = 0;
 
 #ifdef H1D_USE_BUFFER
     //! Flush the data buffer.
-    void FlushBuffer();
+    virtual void FlushBuffer() = 0;
 #endif /* H1D_USE_BUFFER */
 
     //! The x axis of the histogram;
@@ -84,20 +133,85 @@ private:
     //! The number of entries in the histogram.
     int entries;
 
-    //! The bin contents, including the overflow bins.
-    data_t *data;
-
 #ifdef H1D_USE_BUFFER
-    struct buf_t {
-        Axis::bin_t x;
-        data_t w;
-        buf_t(Axis::bin_t xx, data_t ww) : x(xx), w(ww) { }
-    };
-    typedef std::vector<buf_t> buffer_t;
-    buffer_t buffer;
+    //! The buffered x values.
+    std::vector<Axis::bin_t> buffer_x;
+
+    //! The buffered weights.
+    std::vector<double> buffer_w;
+
+    //! The number of buffered fills.
+    unsigned int buffer_n;
+
     static const unsigned int buffer_max = 16384;
 
+    //! How many buffered values are binned at a time when flushing.
+    enum { flush_chunk = 512 };
+#endif /* H1D_USE_BUFFER */
+};
+
+// ########################################################################
+
+//! A one-dimensional histogram with bins of type T.
+/*! Instantiated for the types listed in BinType.
+ */
+template<typename T>
+class Histogram1DT : public Histogram1D {
+public:
+    //! The type used to count in each bin.
+    typedef T data_t;
+
+    //! Construct a 1D histogram.
+    Histogram1DT( const std::string& name,  /*!< The name of the new histogram. */
+                  const std::string& title, /*!< The title of teh new histogram. */
+                  Axis::index_t channels,   /*!< The number of regular bins. */
+                  Axis::bin_t left,         /*!< The lower edge of the lowest bin.  */
+                  Axis::bin_t right,        /*!< The upper edge of the highest bin. */
+                  const std::string& xtitle /*!< The title of the x axis. */);
+
+    BinType GetBinType() const
+        { return BinTypeOf<T>::value; }
+
+    void Add(const Histogram1Dp other, double scale);
+
+    void FillBin(Axis::index_t bin, double weight=1)
+        { BinContent<T>::Add(data[bin], weight, spill, bin); entries += 1; }
+
+    double GetBinContent(Axis::index_t bin);
+
+    void CopyBins(int* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(float* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(double* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(uint32_t* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(long long* dst)
+        { CopyBinsTo(dst); }
+
+    void Reset();
+
+private:
+    void FillDirect(Axis::bin_t x, double weight=1);
+
+    //! Copy all bin contents into an array of type D.
+    template<typename D>
+    void CopyBinsTo(D* dst);
+
+#ifdef H1D_USE_BUFFER
+    void FlushBuffer();
 #endif /* H1D_USE_BUFFER */
+
+    //! The bin contents, including the overflow bins.
+    std::vector<T> data;
+
+    //! Counts that did not fit in their bin.
+    spill_t spill;
 };
 
 #endif /* HISTOGRAM1D_H_ */
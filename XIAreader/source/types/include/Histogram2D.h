@@ -9,59 +9,101 @@
 #define HISTOGRAM2D_H_
 
 #include "Histograms.h"
+#include "BinContent.h"
+#include "FillStage.h"
 
 //#define USE_ROWS 1
 #define H2D_USE_BUFFER 1
-#ifdef H2D_USE_BUFFER
+
+#include <utility>
 #include <vector>
-#endif
 
 //! A two-dimensional histogram.
+/*! This holds the axes, the entry count and the fill buffer; the bins
+ *  are kept by Histogram2DT, which is created with the bin type chosen
+ *  for the histogram.
+ *
+ *  With SparseStorage the bins are grouped in tiles of
+ *  tile_size x tile_size bins, and a tile is only allocated when one of
+ *  its bins is filled. Bins in tiles never filled read as zero.
+ *
+ *  TiledStorage uses the same tiles, but allocates all of them in one
+ *  array when the histogram is created. Neighbouring bins in both x and
+ *  y are then close in memory, which helps fills that follow diagonals
+ *  or bands across the matrix.
+ *
+ *  SymmetricStorage keeps only the bins with x <= y, for matrices like
+ *  gamma-gamma coincidences where each pair is filled once in either
+ *  order. A fill of (x, y) goes to the bin of (min, max), and a fill on
+ *  the diagonal counts twice, so reading the bins gives the full matrix
+ *  as if each pair had been filled in both orders.
+ *
+ *  A histogram can be shared between threads with Share(). Each other
+ *  thread then fills it through its own stage from NewStage().
+ */
 class Histogram2D : public Named {
 public:
-    //! The type used to count in each bin.
-    typedef float data_t;
-
-    //! Construct a 2D histogram.
-    Histogram2D( const std::string& name,   /*!< The name of the new histogram. */
-                 const std::string& title,  /*!< The title of teh new histogram. */
-                 Axis::index_t xchannels,   /*!< The number of regular bins on the x axis. */
-                 Axis::bin_t xleft,         /*!< The lower edge of the lowest bin on the x axis. */
-                 Axis::bin_t xright,        /*!< The upper edge of the highest bin on the x axis. */
-                 const std::string& xtitle, /*!< The title of the x axis. */
-                 Axis::index_t ychannels,   /*!< The number of regular bins on the y axis. */
-                 Axis::bin_t yleft,         /*!< The lower edge of the lowest bin on the y axis. */
-                 Axis::bin_t yright,        /*!< The upper edge of the highest bin on the y axis. */
-                 const std::string& ytitle  /*!< The title of the y axis. */);
-
     //! Deallocate memory.
-    ~Histogram2D();
+    virtual ~Histogram2D();
+
+    //! Get the type used to count in the bins.
+    /*! \return the bin type.
+     */
+    virtual BinType GetBinType() const = 0;
 
     //! Add another histogram.
-    void Add(const Histogram2Dp other, data_t scale);
+    virtual void Add(const Histogram2Dp other, double scale) = 0;
 
     //! Increment a histogram bin.
     void Fill(Axis::bin_t x,  /*!< The x axis value. */
               Axis::bin_t y,  /*!< The y axis value. */
-              data_t weight=1 /*!< How much to add to the corresponding bin content. */)
+              double weight=1 /*!< How much to add to the corresponding bin content. */)
         {
 #ifdef H2D_USE_BUFFER
-            buffer.push_back(buf_t(x, y, weight)); if( buffer.size()>=buffer_max ) FlushBuffer();
+            buffer_x[buffer_n] = x; buffer_y[buffer_n] = y; buffer_w[buffer_n] = weight;
+            if( ++buffer_n>=buffer_max ) FlushBuffer();
 #else
             FillDirect(x, y, weight);
 #endif /* H2D_USE_BUFFER */
         }
 
+    //! Increment a histogram bin given by its bin numbers.
+    /*! Bypasses the buffer and the bin search; the bins must be valid,
+     *  e.g. from GetAxisX().FindBin().
+     */
+    virtual void FillBin(Axis::index_t xbin, /*!< The x bin to increment. */
+                         Axis::index_t ybin, /*!< The y bin to increment. */
+                         double weight=1     /*!< How much to add to the bin content. */) = 0;
+
     //! Get the contents of a bin.
     /*! \return The bin content.
      */
-    data_t GetBinContent(Axis::index_t xbin /*!< The x bin to look at. */,
-                         Axis::index_t ybin /*!< The y bin to look at. */);
+    virtual double GetBinContent(Axis::index_t xbin /*!< The x bin to look at. */,
+                                 Axis::index_t ybin /*!< The y bin to look at. */) = 0;
 
     //! Set the contents of a bin.
-    void SetBinContent(Axis::index_t xbin /*!< The x bin to look at.   */,
-                       Axis::index_t ybin /*!< The y bin to look at.   */,
-                       data_t c           /*!< The bin content.        */);
+    virtual void SetBinContent(Axis::index_t xbin /*!< The x bin to look at.   */,
+                               Axis::index_t ybin /*!< The y bin to look at.   */,
+                               double c           /*!< The bin content.        */) = 0;
+
+    //! Copy all bin contents into an array.
+    /*! The bins, including the under- and overflow bins, are copied in
+     *  the order of the arrays of ROOT histograms, x bin x + y bin y
+     *  times GetAxisX().GetBinCountAll(). Fills are flushed once.
+     */
+    virtual void CopyBins(int* dst /*!< Space for all bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(float* dst /*!< Space for all bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(double* dst /*!< Space for all bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(uint32_t* dst /*!< Space for all bins. */) = 0;
+
+    //! Copy all bin contents into an array, see CopyBins(int*).
+    virtual void CopyBins(long long* dst /*!< Space for all bins. */) = 0;
 
     //! Get the x axis of the histogram.
     /*! \return The histogram's x axis.
@@ -81,18 +123,83 @@ public:
     int GetEntries() const
         { return entries; }
 
+    //! Set the number of entries, e.g. for a copy of another histogram.
+    void SetEntries(int n /*!< The entry count. */)
+        { entries = n; }
+
+    //! Get how the bin contents are stored.
+    /*! \return the storage mode given when the histogram was created.
+     */
+    HistogramStorage GetStorage() const
+        { return storage; }
+
     //! Clear all bins of the histogram.
-    void Reset();
+    /*! With SparseStorage, all tiles are released.
+     */
+    virtual void Reset() = 0;
+
+    //! Allow the histogram to be filled from several threads.
+    /*! Fills on the histogram itself are then staged like those on the
+     *  stages from NewStage(), and added with the lock of their stripe
+     *  of bins held. Reading, setting, adding and resetting the
+     *  histogram must still be done while no thread is filling it.
+     */
+    virtual void Share() = 0;
+
+    //! Check whether the histogram may be filled from several threads.
+    /*! \return true after Share(), and for stages.
+     */
+    virtual bool IsShared() const = 0;
+
+    //! Create a stage for filling this histogram from another thread.
+    /*! The stage has the name and axes of this histogram, but no bins;
+     *  reading it gives the contents of this histogram.
+     *
+     * \return the new stage, or 0 if the histogram is not shared.
+     */
+    virtual Histogram2Dp NewStage() = 0;
+
+    //! Get the histogram a stage fills.
+    /*! \return the shared histogram, or 0 if this is not a stage.
+     */
+    virtual Histogram2D* GetShared()
+        { return 0; }
+
+    //! Add all buffered and staged fills to the bins.
+    void Flush()
+        {
+#ifdef H2D_USE_BUFFER
+            FlushBuffer();
+#endif /* H2D_USE_BUFFER */
+        }
+
+protected:
+    //! Construct a 2D histogram.
+    Histogram2D( const std::string& name,   /*!< The name of the new histogram. */
+                 const std::string& title,  /*!< The title of teh new histogram. */
+                 Axis::index_t xchannels,   /*!< The number of regular bins on the x axis. */
+                 Axis::bin_t xleft,         /*!< The lower edge of the lowest bin on the x axis. */
+                 Axis::bin_t xright,        /*!< The upper edge of the highest bin on the x axis. */
+                 const std::string& xtitle, /*!< The title of the x axis. */
+                 Axis::index_t ychannels,   /*!< The number of regular bins on the y axis. */
+                 Axis::bin_t yleft,         /*!< The lower edge of the lowest bin on the y axis. */
+                 Axis::bin_t yright,        /*!< The upper edge of the highest bin on the y axis. */
+                 const std::string& ytitle, /*!< The title of the y axis. */
+                 HistogramStorage storage   /*!< How to store the bin contents. */);
+
+    //! Check that another histogram has the same name and axes.
+    /*! \return true if the other histogram can be added to this one.
+     */
+    bool IsCompatible(const Histogram2Dp other) const;
 
-private:
     //! Increment a histogram bin directly, bypassing the buffer.
-    void FillDirect(Axis::bin_t x,  /*!< The x axis value. */
-                    Axis::bin_t y,  /*!< The y axis value. */
-                    data_t weight=1 /*!< How much to add to the corresponding bin content. */);
+    virtual void FillDirect(Axis::bin_t x,  /*!< The x axis value. */
+                            Axis::bin_t y,  /*!< The y axis value. */
+                            double weight=1 /*!< How much to add to the corresponding bin content. */) = 0;
 
 #ifdef H2D_USE_BUFFER
     //! Flush the data buffer.
-    void FlushBuffer();
+    virtual void FlushBuffer() = 0;
 #endif /* H2D_USE_BUFFER */
 
     //! The x axis of the histogram;
@@ -104,23 +211,339 @@ private:
     //! The number of entries in the histogram.
     int entries;
 
-#ifndef USE_ROWS
-    //! The bin contents, including the overflow bins.
-    data_t *data;
-#else
-    data_t **rows;
+    //! How the bin contents are stored.
+    const HistogramStorage storage;
+
+#ifdef H2D_USE_BUFFER
+    //! The buffered x values.
+    std::vector<Axis::bin_t> buffer_x;
+
+    //! The buffered y values.
+    std::vector<Axis::bin_t> buffer_y;
+
+    //! The buffered weights.
+    std::vector<double> buffer_w;
+
+    //! The number of buffered fills.
+    unsigned int buffer_n;
+
+    static const unsigned int buffer_max = 4096;
+
+    //! How many buffered values are binned at a time when flushing.
+    enum { flush_chunk = 512 };
+
+    //! Flushes with fewer entries are not sorted by bin.
+    enum { sort_min = 64 };
+
+    //! Matrices smaller than this many bytes are not sorted by bin.
+    /*! Sorting only pays off when the bins do not fit in the cache.
+     */
+    enum { sort_bytes = 64 << 20 };
+#endif /* H2D_USE_BUFFER */
+};
+
+// ########################################################################
+
+template<typename T>
+class Histogram2DStage;
+
+//! A two-dimensional histogram with bins of type T.
+/*! Instantiated for the types listed in BinType.
+ */
+template<typename T>
+class Histogram2DT : public Histogram2D {
+public:
+    //! The type used to count in each bin.
+    typedef T data_t;
+
+    //! Construct a 2D histogram.
+    Histogram2DT( const std::string& name,   /*!< The name of the new histogram. */
+                  const std::string& title,  /*!< The title of teh new histogram. */
+                  Axis::index_t xchannels,   /*!< The number of regular bins on the x axis. */
+                  Axis::bin_t xleft,         /*!< The lower edge of the lowest bin on the x axis. */
+                  Axis::bin_t xright,        /*!< The upper edge of the highest bin on the x axis. */
+                  const std::string& xtitle, /*!< The title of the x axis. */
+                  Axis::index_t ychannels,   /*!< The number of regular bins on the y axis. */
+                  Axis::bin_t yleft,         /*!< The lower edge of the lowest bin on the y axis. */
+                  Axis::bin_t yright,        /*!< The upper edge of the highest bin on the y axis. */
+                  const std::string& ytitle, /*!< The title of the y axis. */
+                  HistogramStorage storage=DenseStorage /*!< How to store the bin contents. */);
+
+    //! Deallocate memory.
+    ~Histogram2DT();
+
+    BinType GetBinType() const
+        { return BinTypeOf<T>::value; }
+
+    void Add(const Histogram2Dp other, double scale);
+
+    void FillBin(Axis::index_t xbin, Axis::index_t ybin, double weight=1)
+        {
+            if( sharing )
+                Stage(sharing->stage, Index(xbin, ybin), PairWeight(xbin, ybin, weight));
+            else {
+                AddAt(Index(xbin, ybin), PairWeight(xbin, ybin, weight));
+                entries += 1;
+            }
+        }
+
+    double GetBinContent(Axis::index_t xbin, Axis::index_t ybin);
+
+    void SetBinContent(Axis::index_t xbin, Axis::index_t ybin, double c);
+
+    void CopyBins(int* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(float* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(double* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(uint32_t* dst)
+        { CopyBinsTo(dst); }
+
+    void CopyBins(long long* dst)
+        { CopyBinsTo(dst); }
+
+    void Reset();
+
+    void Share();
+
+    bool IsShared() const
+        { return sharing != 0; }
+
+    Histogram2Dp NewStage();
+
+private:
+    friend class Histogram2DStage<T>;
+
+    void FillDirect(Axis::bin_t x, Axis::bin_t y, double weight=1);
+
+#ifdef H2D_USE_BUFFER
+    void FlushBuffer();
+#endif /* H2D_USE_BUFFER */
+
+    //! Copy all bin contents into an array of type D.
+    /*! Dense bins are copied in one pass over the storage; the other
+     *  storage modes are copied bin by bin.
+     */
+    template<typename D>
+    void CopyBinsTo(D* dst);
+
+    //! Get the position of a bin in the storage.
+    /*! For SparseStorage and TiledStorage this is the tile number times
+     *  the tile area plus the position within the tile. For
+     *  SymmetricStorage the bins with x <= y are stored row by row, and
+     *  (x, y) and (y, x) have the same position. The position is also
+     *  the key in the spill map.
+     *
+     * \return the storage position.
+     */
+    Axis::index_t Index(Axis::index_t xbin, Axis::index_t ybin) const
+        {
+            if( storage == SymmetricStorage ) {
+                if( xbin > ybin )
+                    std::swap(xbin, ybin);
+                return ybin*(ybin+1)/2 + xbin;
+            }
+            if( storage != DenseStorage )
+                return (((ybin>>tile_bits)*tiles_x + (xbin>>tile_bits)) << (2*tile_bits))
+                    + ((ybin&tile_mask)<<tile_bits) + (xbin&tile_mask);
+            return xaxis.GetBinCountAll()*ybin + xbin;
+        }
+
+    //! Get the weight to add for a fill of a bin.
+    /*! With SymmetricStorage a fill on the diagonal is added twice, as
+     *  a full matrix filled with both orders of the pair would get it.
+     *
+     * \return the weight to add at Index(xbin, ybin).
+     */
+    double PairWeight(Axis::index_t xbin, Axis::index_t ybin, double weight) const
+        { return ( storage == SymmetricStorage && xbin == ybin ) ? 2*weight : weight; }
+
+    //! Get a reference to a bin by storage position, allocating its tile if needed.
+    /*! \return the bin content.
+     */
+    T& At(Axis::index_t i)
+        {
+            if( storage == SparseStorage ) {
+                T* &tile = tiles[i >> (2*tile_bits)];
+                if( !tile )
+                    tile = NewTile();
+                return tile[i & tile_area_mask];
+            }
+#ifdef USE_ROWS
+            if( storage == DenseStorage )
+                return rows[i/xaxis.GetBinCountAll()][i%xaxis.GetBinCountAll()];
 #endif
+            return data[i];
+        }
+
+    //! Get a reference to a bin, allocating its tile if needed.
+    /*! \return the bin content.
+     */
+    T& Bin(Axis::index_t xbin, Axis::index_t ybin)
+        { return At(Index(xbin, ybin)); }
+
+    //! Get the content of a bin without allocating anything.
+    /*! \return the bin content, 0 for bins in tiles not allocated.
+     */
+    double Content(Axis::index_t xbin, Axis::index_t ybin) const;
+
+    //! Add to a bin given by its storage position.
+    void AddAt(Axis::index_t i, double weight)
+        { BinContent<T>::Add(At(i), weight, spill, i); }
+
+    //! Get the number of storage positions.
+    /*! \return one more than the highest value Index() can return.
+     */
+    Axis::index_t IndexCount() const
+        {
+            if( storage == SymmetricStorage )
+                return yaxis.GetBinCountAll()*(yaxis.GetBinCountAll()+1)/2;
+            return ( storage == DenseStorage ) ? xaxis.GetBinCountAll()*yaxis.GetBinCountAll()
+                                               : tiles_x*tiles_y << (2*tile_bits);
+        }
+
+    //! Stage one fill for a shared histogram, committing the stage when full.
+    void Stage(FillStage& stage, Axis::index_t i, double weight)
+        {
+            stage.Add(i, BinContent<T>::Weight(weight));
+            if( stage.Full() )
+                Commit(stage);
+        }
 
 #ifdef H2D_USE_BUFFER
-    struct buf_t {
-        Axis::bin_t x, y;
-        data_t w;
-        buf_t(Axis::bin_t xx, Axis::bin_t yy, data_t ww) : x(xx), y(yy), w(ww) { }
+    //! Stage buffered fills for a shared histogram.
+    void Stage(FillStage& stage,       /*!< Where to stage the fills. */
+               const Axis::bin_t* x,   /*!< The x values. */
+               const Axis::bin_t* y,   /*!< The y values. */
+               const double* weight,   /*!< The weights. */
+               unsigned int n          /*!< The number of fills. */);
+#endif /* H2D_USE_BUFFER */
+
+    //! Add the fills of a stage to the bins of a shared histogram.
+    void Commit(FillStage& stage);
+
+    //! Allocate a tile with all bins set to zero.
+    /*! \return the new tile.
+     */
+    T* NewTile();
+
+    //! Release all tiles.
+    void DeleteTiles();
+
+    //! Number of bits of the bin number within a tile.
+    enum { tile_bits = 6 };
+
+    //! The number of bins along each side of a tile.
+    enum { tile_size = 1 << tile_bits };
+
+    //! Mask to get the bin number within a tile.
+    enum { tile_mask = tile_size - 1 };
+
+    //! Mask to get the position within a tile from a storage position.
+    enum { tile_area_mask = tile_size*tile_size - 1 };
+
+    //! The number of tiles along the x axis, 0 without tiles.
+    Axis::index_t tiles_x;
+
+    //! The number of tiles along the y axis.
+    Axis::index_t tiles_y;
+
+    //! The tiles, row by row, 0 if not allocated (SparseStorage only).
+    std::vector<T*> tiles;
+
+    //! The bin contents, including the overflow bins, by storage position.
+    /*! 0 with SparseStorage, and with DenseStorage if USE_ROWS is set.
+     */
+    T *data;
+
+#ifdef USE_ROWS
+    T **rows;
+#endif
+
+    //! Counts that did not fit in their bin.
+    spill_t spill;
+
+    //! What is needed to fill the histogram from several threads.
+    struct Sharing {
+        Sharing(bool single) : locks( single ) { }
+        StripeLocks locks;      //!< Locks for the bins and the entry count.
+        FillStage stage;        //!< Fills made on the histogram itself.
     };
-    typedef std::vector<buf_t> buffer_t;
-    buffer_t buffer;
-    static const unsigned int buffer_max = 4096;
+
+    //! Set by Share(), 0 if the histogram is only filled by one thread.
+    std::unique_ptr<Sharing> sharing;
+};
+
+// ########################################################################
+
+//! Fills a shared Histogram2DT from one thread.
+/*! Fills are binned and staged in the stage, and added to the shared
+ *  histogram when the stage is full or flushed.
+ */
+template<typename T>
+class Histogram2DStage : public Histogram2D {
+public:
+    //! Create a stage for a shared histogram.
+    Histogram2DStage(Histogram2DT<T>& shared /*!< The histogram to fill, must be shared. */);
+
+    BinType GetBinType() const
+        { return BinTypeOf<T>::value; }
+
+    void Add(const Histogram2Dp other, double scale);
+
+    void FillBin(Axis::index_t xbin, Axis::index_t ybin, double weight=1)
+        { shared.Stage(stage, shared.Index(xbin, ybin), shared.PairWeight(xbin, ybin, weight)); }
+
+    double GetBinContent(Axis::index_t xbin, Axis::index_t ybin);
+
+    void SetBinContent(Axis::index_t xbin, Axis::index_t ybin, double c);
+
+    void CopyBins(int* dst)
+        { Flush(); shared.CopyBins(dst); }
+
+    void CopyBins(float* dst)
+        { Flush(); shared.CopyBins(dst); }
+
+    void CopyBins(double* dst)
+        { Flush(); shared.CopyBins(dst); }
+
+    void CopyBins(uint32_t* dst)
+        { Flush(); shared.CopyBins(dst); }
+
+    void CopyBins(long long* dst)
+        { Flush(); shared.CopyBins(dst); }
+
+    //! Drop the staged fills; the shared histogram is not changed.
+    void Reset();
+
+    void Share()
+        { }
+
+    bool IsShared() const
+        { return true; }
+
+    Histogram2Dp NewStage()
+        { return shared.NewStage(); }
+
+    Histogram2D* GetShared()
+        { return &shared; }
+
+private:
+    void FillDirect(Axis::bin_t x, Axis::bin_t y, double weight=1);
+
+#ifdef H2D_USE_BUFFER
+    void FlushBuffer();
 #endif /* H2D_USE_BUFFER */
+
+    //! The histogram filled.
+    Histogram2DT<T>& shared;
+
+    //! The fills not yet added to the shared histogram.
+    FillStage stage;
 };
 
 #endif /* HISTOGRAM2D_H_ */
@@ -4,52 +4,60 @@
 #define HISTOGRAM3D_H_
 
 #include "Histograms.h"
+#include "BinContent.h"
+#include "FillStage.h"
 
-//#define USE_CUBE 1
 #define H3D_USE_BUFFER 1
 
-
-#ifdef H3D_USE_BUFFER
+#include <functional>
+#include <unordered_map>
 #include <vector>
-#endif // H3D_USE_BUFFER
 
 //! A three-dimensional histogram.
+/*! This holds the axes, the entry count and the fill buffer; the bins
+ *  are kept by Histogram3DT, which is created with the bin type chosen
+ *  for the histogram.
+ *
+ *  With SparseStorage the bins are grouped in cubic tiles of
+ *  tile_size^3 bins, kept in a hash map by tile number. A tile is only
+ *  allocated when one of its bins is filled, so a cube that would not
+ *  fit in memory as one array only costs memory for the regions that
+ *  are filled. TiledStorage uses the same tiles, allocated in one array.
+ *
+ *  A histogram can be shared between threads with Share(). Each other
+ *  thread then fills it through its own stage from NewStage().
+ */
 class Histogram3D : public Named {
 public:
+	//! Destructor, deallocates memory.
+	virtual ~Histogram3D();
 
-	//! The type used to count in each bin.
-	typedef float data_t;
+	//! Get the type used to count in the bins.
+	/*! \return the bin type.
+	 */
+	virtual BinType GetBinType() const = 0;
 
-	//! Construct a 3D histogram.
-	Histogram3D( const std::string& name,	/*!< The name of the new histogram.						*/
-				 const std::string& title,	/*!< The title of the new histogram.					*/
-                 Axis::index_t xchannels,	/*!< The number of regular bins on the x axis.			*/
-				 Axis::bin_t xleft,			/*!< The lower edge of the lowest bin on the x axis.	*/
-				 Axis::bin_t xright,		/*!< The upper edge of the highest bin on the x axis.	*/
-				 const std::string& xtitle,	/*!< The title of the x axis.							*/
-                 Axis::index_t ychannels,	/*!< The number of regular bins on the y axis.			*/
-				 Axis::bin_t yleft,			/*!< The lower edge of the lowest bin on the y axis.	*/
-				 Axis::bin_t yright,		/*!< The upper edge of the highest bin on the y axis.	*/
-				 const std::string& ytitle,	/*!< The title of the y axis.							*/
-                 Axis::index_t zchannels,	/*!< The number of regular bins on the z axis.			*/
-				 Axis::bin_t zleft,			/*!< The lower edge of the lowest bin on the z axis.	*/
-				 Axis::bin_t zright,		/*!< The upper edge of the highest bin on the z axis.	*/
-				 const std::string& ztitle	/*!< The title of the z axis.							*/);
+	//! Add another histogram.
+	virtual void Add(const Histogram3Dp other, double scale) = 0;
 
-	//! Destructor, deallocates memory.
-	~Histogram3D();
+	//! Called with the x, y and z bin numbers and the content of a bin.
+	typedef std::function<void(Axis::index_t, Axis::index_t, Axis::index_t, double)> BinVisitor;
 
-	//! Add another histogram.
-	void Add(const Histogram3Dp other, data_t scale);
+	//! Call a function for each bin with a content other than zero.
+	/*! Bins are visited in no particular order. With SparseStorage only
+	 *  the allocated tiles are looked at.
+	 */
+	virtual void ForEachFilled(const BinVisitor& visit /*!< Called for each bin. */) = 0;
 
 	//! Increment a histogram bin.
 	void Fill(Axis::bin_t x,	/*!< The x axis value.									*/
 			  Axis::bin_t y,	/*!< The y axis value.									*/
 			  Axis::bin_t z,	/*!< The z axis value.									*/
-			  data_t weight=1	/*!< How much to add to the corresponding bin content.	*/)
+			  double weight=1	/*!< How much to add to the corresponding bin content.	*/)
 		{
 		#ifdef H3D_USE_BUFFER
-			buffer.push_back(buf_t(x, y, z, weight)); if ( buffer.size() >= buffer_max ) FlushBuffer();
+			buffer_x[buffer_n] = x; buffer_y[buffer_n] = y; buffer_z[buffer_n] = z; buffer_w[buffer_n] = weight;
+			if ( ++buffer_n >= buffer_max ) FlushBuffer();
 		#else
 			FillDirect(x, y, z, weight);
 		#endif // H3D_USE_BUFFER
@@ -58,15 +66,15 @@ public:
 	//! Get the contents of a bin.
 	/*! \return The bin content.
 	 */
-	data_t GetBinContent(Axis::index_t xbin,	/*!< The x bin to look at.	*/
-						 Axis::index_t ybin,	/*!< The y bin to look at.	*/
-						 Axis::index_t zbin		/*!< The z bin to look at.	*/);
+	virtual double GetBinContent(Axis::index_t xbin,	/*!< The x bin to look at.	*/
+								 Axis::index_t ybin,	/*!< The y bin to look at.	*/
+								 Axis::index_t zbin		/*!< The z bin to look at.	*/) = 0;
 
 	//! Set the contents of a bin.
-	void SetBinContent(Axis::index_t xbin,	/*!< The x bin to look at.		*/
-					   Axis::index_t ybin,	/*!< The y bin to look at.		*/
-					   Axis::index_t zbin,	/*!< The z bin to look at.		*/
-					   data_t c				/*!< \return The bin content.	*/);
+	virtual void SetBinContent(Axis::index_t xbin,	/*!< The x bin to look at.		*/
+							   Axis::index_t ybin,	/*!< The y bin to look at.		*/
+							   Axis::index_t zbin,	/*!< The z bin to look at.		*/
+							   double c				/*!< \return The bin content.	*/) = 0;
 
 	//! Get the x axis of the histogram.
     /*! \return The histogram's x axis.
@@ -92,19 +100,85 @@ public:
 	int GetEntries() const
 		{ return entries; }
 
+	//! Set the number of entries, e.g. for a copy of another histogram.
+	void SetEntries(int n /*!< The entry count. */)
+		{ entries = n; }
+
+	//! Get how the bin contents are stored.
+	/*! \return the storage mode given when the histogram was created.
+	 */
+	HistogramStorage GetStorage() const
+		{ return storage; }
+
 	//! Clear all bins in the histogram.
-	void Reset();
+	/*! With SparseStorage, all tiles are released.
+	 */
+	virtual void Reset() = 0;
+
+	//! Allow the histogram to be filled from several threads.
+	/*! Fills on the histogram itself are then staged like those on the
+	 *  stages from NewStage(), and added with the lock of their stripe
+	 *  of bins held. Reading, setting, adding and resetting the
+	 *  histogram must still be done while no thread is filling it.
+	 */
+	virtual void Share() = 0;
+
+	//! Check whether the histogram may be filled from several threads.
+	/*! \return true after Share(), and for stages.
+	 */
+	virtual bool IsShared() const = 0;
+
+	//! Create a stage for filling this histogram from another thread.
+	/*! \return the new stage, or 0 if the histogram is not shared.
+	 */
+	virtual Histogram3Dp NewStage() = 0;
+
+	//! Get the histogram a stage fills.
+	/*! \return the shared histogram, or 0 if this is not a stage.
+	 */
+	virtual Histogram3D* GetShared()
+		{ return 0; }
+
+	//! Add all buffered and staged fills to the bins.
+	void Flush()
+		{
+		#ifdef H3D_USE_BUFFER
+			FlushBuffer();
+		#endif // H3D_USE_BUFFER
+		}
+
+protected:
+	//! Construct a 3D histogram.
+	Histogram3D( const std::string& name,	/*!< The name of the new histogram.						*/
+				 const std::string& title,	/*!< The title of the new histogram.					*/
+                 Axis::index_t xchannels,	/*!< The number of regular bins on the x axis.			*/
+				 Axis::bin_t xleft,			/*!< The lower edge of the lowest bin on the x axis.	*/
+				 Axis::bin_t xright,		/*!< The upper edge of the highest bin on the x axis.	*/
+				 const std::string& xtitle,	/*!< The title of the x axis.							*/
+                 Axis::index_t ychannels,	/*!< The number of regular bins on the y axis.			*/
+				 Axis::bin_t yleft,			/*!< The lower edge of the lowest bin on the y axis.	*/
+				 Axis::bin_t yright,		/*!< The upper edge of the highest bin on the y axis.	*/
+				 const std::string& ytitle,	/*!< The title of the y axis.							*/
+                 Axis::index_t zchannels,	/*!< The number of regular bins on the z axis.			*/
+				 Axis::bin_t zleft,			/*!< The lower edge of the lowest bin on the z axis.	*/
+				 Axis::bin_t zright,		/*!< The upper edge of the highest bin on the z axis.	*/
+				 const std::string& ztitle,	/*!< The title of the z axis.							*/
+				 HistogramStorage storage	/*!< How to store the bin contents.						*/);
+
+	//! Check that another histogram has the same name and axes.
+	/*! \return true if the other histogram can be added to this one.
+	 */
+	bool IsCompatible(const Histogram3Dp other) const;
 
-private:
 	//! Increment a histogram bin directly, bypassing the buffer.
-	void FillDirect(Axis::bin_t x,	/*!< The x axis value.						*/
-					Axis::bin_t y,	/*!< The y axis value.						*/
-					Axis::bin_t z,	/*!< The z axis value.						*/
-					data_t weight=1	/*!< How much to add to the bin content.	*/);
+	virtual void FillDirect(Axis::bin_t x,	/*!< The x axis value.						*/
+							Axis::bin_t y,	/*!< The y axis value.						*/
+							Axis::bin_t z,	/*!< The z axis value.						*/
+							double weight=1	/*!< How much to add to the bin content.	*/) = 0;
 
 #ifdef H3D_USE_BUFFER
 	//! Flush the data buffer.
-	void FlushBuffer();
+	virtual void FlushBuffer() = 0;
 #endif // H3D_USE_BUFFER
 
 	//! The x axis of the histogram.
@@ -119,24 +193,264 @@ private:
 	//! The number of entries in the histogram.
 	int entries;
 
-#ifndef USE_CUBE
-	//! The bin contents, including the overflow bins.
-	data_t *data;
-#else
-	data_t ***cube;
-#endif // USE_ROWS
+	//! How the bin contents are stored.
+	const HistogramStorage storage;
 
 #ifdef H3D_USE_BUFFER
-	struct buf_t {
-		Axis::bin_t x, y, z;
-		data_t w;
-		buf_t(Axis::bin_t xx, Axis::bin_t yy, Axis::bin_t zz, data_t ww) : x(xx), y(yy), z(zz), w(ww) { }
-	};
-	typedef std::vector<buf_t> buffer_t;
-	buffer_t buffer;
+	//! The buffered x, y and z values.
+	std::vector<Axis::bin_t> buffer_x, buffer_y, buffer_z;
+
+	//! The buffered weights.
+	std::vector<double> buffer_w;
+
+	//! The number of buffered fills.
+	unsigned int buffer_n;
+
 	static const unsigned int buffer_max = 4096;
+
+	//! How many buffered values are binned at a time when flushing.
+	enum { flush_chunk = 512 };
 #endif // H3D_USE_BUFFER
 };
 
+// ########################################################################
+
+template<typename T>
+class Histogram3DStage;
+
+//! A three-dimensional histogram with bins of type T.
+/*! Instantiated for the types listed in BinType.
+ */
+template<typename T>
+class Histogram3DT : public Histogram3D {
+public:
+	//! The type used to count in each bin.
+	typedef T data_t;
+
+	//! Construct a 3D histogram.
+	Histogram3DT( const std::string& name,	/*!< The name of the new histogram.						*/
+				  const std::string& title,	/*!< The title of the new histogram.					*/
+                  Axis::index_t xchannels,	/*!< The number of regular bins on the x axis.			*/
+				  Axis::bin_t xleft,		/*!< The lower edge of the lowest bin on the x axis.	*/
+				  Axis::bin_t xright,		/*!< The upper edge of the highest bin on the x axis.	*/
+				  const std::string& xtitle,/*!< The title of the x axis.							*/
+                  Axis::index_t ychannels,	/*!< The number of regular bins on the y axis.			*/
+				  Axis::bin_t yleft,		/*!< The lower edge of the lowest bin on the y axis.	*/
+				  Axis::bin_t yright,		/*!< The upper edge of the highest bin on the y axis.	*/
+				  const std::string& ytitle,/*!< The title of the y axis.							*/
+                  Axis::index_t zchannels,	/*!< The number of regular bins on the z axis.			*/
+				  Axis::bin_t zleft,		/*!< The lower edge of the lowest bin on the z axis.	*/
+				  Axis::bin_t zright,		/*!< The upper edge of the highest bin on the z axis.	*/
+				  const std::string& ztitle,/*!< The title of the z axis.							*/
+				  HistogramStorage storage=DenseStorage /*!< How to store the bin contents.		*/);
+
+	//! Deallocate memory.
+	~Histogram3DT();
+
+	BinType GetBinType() const
+		{ return BinTypeOf<T>::value; }
+
+	void Add(const Histogram3Dp other, double scale);
+
+	void ForEachFilled(const BinVisitor& visit);
+
+	double GetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin);
+
+	void SetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin, double c);
+
+	void Reset();
+
+	void Share();
+
+	bool IsShared() const
+		{ return sharing != 0; }
+
+	Histogram3Dp NewStage();
+
+private:
+	friend class Histogram3DStage<T>;
+
+	void FillDirect(Axis::bin_t x, Axis::bin_t y, Axis::bin_t z, double weight=1);
+
+#ifdef H3D_USE_BUFFER
+	void FlushBuffer();
+#endif // H3D_USE_BUFFER
+
+	//! Get the position of a bin in the storage.
+	/*! For SparseStorage and TiledStorage this is the tile number times
+	 *  the tile volume plus the position within the tile. The position
+	 *  is also the key in the spill map.
+	 *
+	 * \return the storage position.
+	 */
+	Axis::index_t Index(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin) const
+		{
+			if ( storage != DenseStorage )
+				return ((((zbin>>tile_bits)*tiles_y + (ybin>>tile_bits))*tiles_x + (xbin>>tile_bits)) << (3*tile_bits))
+					+ ((((zbin&tile_mask)<<tile_bits) + (ybin&tile_mask))<<tile_bits) + (xbin&tile_mask);
+			return xaxis.GetBinCountAll()*(yaxis.GetBinCountAll()*zbin + ybin) + xbin;
+		}
+
+	//! Get a reference to a bin by storage position, allocating its tile if needed.
+	/*! The last tile used is remembered, as consecutive fills often
+	 *  fall in the same tile.
+	 *
+	 * \return the bin content.
+	 */
+	T& At(Axis::index_t i)
+		{
+			if ( storage == SparseStorage ) {
+				const Axis::index_t t = i >> (3*tile_bits);
+				if ( t != last_tile ) {
+					T* &tile = tiles[t];
+					if ( !tile )
+						tile = NewTile();
+					last_tile = t;
+					last_data = tile;
+				}
+				return last_data[i & tile_volume_mask];
+			}
+			return data[i];
+		}
+
+	//! Get the content of a bin without allocating anything.
+	/*! \return the bin content, 0 for bins in tiles not allocated.
+	 */
+	double Content(Axis::index_t i /*!< The storage position. */) const;
+
+	//! Add to a bin given by its storage position.
+	void AddAt(Axis::index_t i, double weight)
+		{ BinContent<T>::Add(At(i), weight, spill, i); }
+
+	//! Get the number of storage positions.
+	/*! \return one more than the highest value Index() can return.
+	 */
+	Axis::index_t IndexCount() const
+		{ return ( storage == DenseStorage ) ? xaxis.GetBinCountAll()*yaxis.GetBinCountAll()*zaxis.GetBinCountAll()
+											 : tiles_x*tiles_y*tiles_z << (3*tile_bits); }
+
+	//! Stage one fill for a shared histogram, committing the stage when full.
+	void Stage(FillStage& stage, Axis::index_t i, double weight)
+		{
+			stage.Add(i, BinContent<T>::Weight(weight));
+			if ( stage.Full() )
+				Commit(stage);
+		}
+
+#ifdef H3D_USE_BUFFER
+	//! Stage buffered fills for a shared histogram.
+	void Stage(FillStage& stage,		/*!< Where to stage the fills.	*/
+			   const Axis::bin_t* x,	/*!< The x values.				*/
+			   const Axis::bin_t* y,	/*!< The y values.				*/
+			   const Axis::bin_t* z,	/*!< The z values.				*/
+			   const double* weight,	/*!< The weights.				*/
+			   unsigned int n			/*!< The number of fills.		*/);
+#endif // H3D_USE_BUFFER
+
+	//! Add the fills of a stage to the bins of a shared histogram.
+	void Commit(FillStage& stage);
+
+	//! Allocate a tile with all bins set to zero.
+	/*! \return the new tile.
+	 */
+	T* NewTile();
+
+	//! Release all tiles.
+	void DeleteTiles();
+
+	//! Number of bits of the bin number within a tile.
+	enum { tile_bits = 4 };
+
+	//! The number of bins along each side of a tile.
+	enum { tile_size = 1 << tile_bits };
+
+	//! Mask to get the bin number within a tile.
+	enum { tile_mask = tile_size - 1 };
+
+	//! Mask to get the position within a tile from a storage position.
+	enum { tile_volume_mask = tile_size*tile_size*tile_size - 1 };
+
+	//! The number of tiles along the x, y and z axes.
+	Axis::index_t tiles_x, tiles_y, tiles_z;
+
+	//! The allocated tiles by tile number (SparseStorage only).
+	std::unordered_map<Axis::index_t, T*> tiles;
+
+	//! The number of the tile last used by At(), -1 if none.
+	Axis::index_t last_tile;
+
+	//! The tile last used by At().
+	T* last_data;
+
+	//! The bin contents, including the overflow bins, by storage position.
+	/*! Empty with SparseStorage.
+	 */
+	std::vector<T> data;
+
+	//! Counts that did not fit in their bin.
+	spill_t spill;
+
+	//! What is needed to fill the histogram from several threads.
+	struct Sharing {
+		Sharing(bool single) : locks( single ) { }
+		StripeLocks locks;		//!< Locks for the bins and the entry count.
+		FillStage stage;		//!< Fills made on the histogram itself.
+	};
+
+	//! Set by Share(), 0 if the histogram is only filled by one thread.
+	std::unique_ptr<Sharing> sharing;
+};
+
+// ########################################################################
+
+//! Fills a shared Histogram3DT from one thread.
+/*! Fills are binned and staged in the stage, and added to the shared
+ *  histogram when the stage is full or flushed.
+ */
+template<typename T>
+class Histogram3DStage : public Histogram3D {
+public:
+	//! Create a stage for a shared histogram.
+	Histogram3DStage(Histogram3DT<T>& shared /*!< The histogram to fill, must be shared. */);
+
+	BinType GetBinType() const
+		{ return BinTypeOf<T>::value; }
+
+	void Add(const Histogram3Dp other, double scale);
+
+	void ForEachFilled(const BinVisitor& visit);
+
+	double GetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin);
+
+	void SetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin, double c);
+
+	//! Drop the staged fills; the shared histogram is not changed.
+	void Reset();
+
+	void Share()
+		{ }
+
+	bool IsShared() const
+		{ return true; }
+
+	Histogram3Dp NewStage()
+		{ return shared.NewStage(); }
+
+	Histogram3D* GetShared()
+		{ return &shared; }
+
+private:
+	void FillDirect(Axis::bin_t x, Axis::bin_t y, Axis::bin_t z, double weight=1);
+
+#ifdef H3D_USE_BUFFER
+	void FlushBuffer();
+#endif // H3D_USE_BUFFER
+
+	//! The histogram filled.
+	Histogram3DT<T>& shared;
+
+	//! The fills not yet added to the shared histogram.
+	FillStage stage;
+};
 
 #endif // HISTOGRAM3D_H_
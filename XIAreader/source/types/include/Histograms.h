@@ -8,7 +8,10 @@
 #define HISTOGRAMS_H_
 
 #include <map>
+#include <set>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 #include <cmath>
@@ -100,19 +103,30 @@ public:
         { return channels2; }
 
     //! Find a bin number.
-    /*! \return The number of the bin.
+    /*! The bin is found by multiplying with the reciprocal bin width,
+     *  and clamped to the under- and overflow bins without branching.
+     *  If the bin width is not a power of two, values within rounding
+     *  of a bin edge may end up in the neighbouring bin.
+     *
+     * \return The number of the bin.
      */
     index_t FindBin(bin_t x) const
-        {   index_t bin;
-            if( x < left )
-                bin = 0;
-            else if( x < right )
-                bin = 1 + std::floor((x-left)/binwidth);
-            else
-                bin = channels2-1;
-            return bin;
+        {   bin_t t = (x - left)*inv_binwidth;
+            t = ( t < last ) ? t : last; // also NaN goes to overflow
+            t = ( t > -1 ) ? t : -1;
+            index_t bin = index_t(t);
+            bin -= ( t < bin );          // round down for -1 < t < 0
+            return bin + 1;
         }
 
+    //! Find the bin numbers of many values.
+    /*! Same as calling FindBin() for each value, written so that the
+     *  compiler can vectorise it.
+     */
+    void FindBins(const bin_t* x,   /*!< The values to look up. */
+                  index_t* bins,    /*!< Where to store the bin numbers. */
+                  size_t n          /*!< The number of values. */) const;
+
 private:
     //! The number of bins including the overflow bins.
     index_t channels2;
@@ -125,11 +139,65 @@ private:
 
     //! The width of a bin.
     bin_t binwidth;
+
+    //! One over the width of a bin.
+    bin_t inv_binwidth;
+
+    //! The number of regular bins as bin_t, the highest value FindBin() clamps to.
+    bin_t last;
 };
 
 // ########################################################################
 // ########################################################################
 
+//! How the bin contents of a histogram are kept in memory.
+enum HistogramStorage {
+    DenseStorage,   //!< All bins in one array, allocated when the histogram is created.
+    SparseStorage,  //!< Tiles of bins, each allocated when one of its bins is first filled.
+    TiledStorage,   //!< All bins in one array, allocated when the histogram is created, tile by tile.
+    SymmetricStorage //!< Only the bins with x <= y, for matrices where (x, y) and (y, x) count the same.
+};
+
+//! The type used to count in the bins of a histogram.
+enum BinType {
+    BinUInt16,  //!< 16 bit unsigned, bins above 65534 spill into a separate map.
+    BinUInt32,  //!< 32 bit unsigned.
+    BinInt64,   //!< 64 bit signed.
+    BinFloat,   //!< Single precision floating point.
+    BinDouble   //!< Double precision floating point.
+};
+
+//! Map a C++ type to its BinType.
+template<typename T> struct BinTypeOf;
+template<> struct BinTypeOf<uint16_t>  { static const BinType value = BinUInt16; };
+template<> struct BinTypeOf<uint32_t>  { static const BinType value = BinUInt32; };
+template<> struct BinTypeOf<long long> { static const BinType value = BinInt64;  };
+template<> struct BinTypeOf<float>     { static const BinType value = BinFloat;  };
+template<> struct BinTypeOf<double>    { static const BinType value = BinDouble; };
+
+//! Get the name of a bin type.
+/*! \return "uint16", "uint32", "int64", "float" or "double".
+ */
+const char* BinTypeName(BinType type);
+
+//! Find a bin type from its name.
+/*! \return true if the name is known.
+ */
+bool BinTypeFromName(const std::string& name, /*!< The name as given by BinTypeName(). */
+                     BinType& type            /*!< Set to the bin type if found. */);
+
+//! Check if a bin type counts in whole numbers.
+/*! \return true for the integer bin types.
+ */
+inline bool BinTypeIsInteger(BinType type)
+    { return type != BinFloat && type != BinDouble; }
+
+//! Get the memory used for one bin of a type.
+/*! \return the size of a bin in bytes.
+ */
+inline size_t BinTypeSize(BinType type)
+    { return ( type == BinUInt16 ) ? 2 : ( type == BinUInt32 || type == BinFloat ) ? 4 : 8; }
+
 class Histogram1D;
 class Histogram2D;
 class Histogram3D;
@@ -138,7 +206,87 @@ typedef std::shared_ptr<Histogram1D> Histogram1Dp;
 typedef std::shared_ptr<Histogram2D> Histogram2Dp;
 typedef std::shared_ptr<Histogram3D> Histogram3Dp;
 
+//! A number identifying a histogram in its HistogramPool.
+typedef unsigned int HistogramHandle;
+
+//! The handle returned when a histogram is not found.
+const HistogramHandle NoHistogram = ~0u;
+
+//! The histograms of one dimension in a set, in order of creation.
+/*! Each histogram gets a handle, its position in the pool, which stays
+ *  valid as long as the set exists. Get() is then a plain array access.
+ *  A name index gives the handle of a histogram from its name.
+ */
+template<class H>
+class HistogramPool {
+public:
+    //! Shared pointer to a histogram in the pool.
+    typedef std::shared_ptr<H> pointer_t;
+
+    //! The histograms, indexed by handle.
+    typedef std::vector<pointer_t> list_t;
+
+    //! Add a histogram.
+    /*! A histogram with the same name is replaced, and the new one
+     *  gets its handle.
+     *
+     * \return the handle of the histogram.
+     */
+    HistogramHandle Add(const std::string& name, /*!< The name of the histogram. */
+                        const pointer_t& h       /*!< The histogram. */)
+        {
+            std::pair<typename index_t::iterator, bool> ins = index.insert( std::make_pair( name, HistogramHandle(pool.size()) ) );
+            if( ins.second )
+                pool.push_back( h );
+            else
+                pool[ins.first->second] = h;
+            return ins.first->second;
+        }
+
+    //! Find a histogram by name.
+    /*! \return the handle, or NoHistogram if not found.
+     */
+    HistogramHandle Find(const std::string& name /*!< The name of the histogram. */) const
+        {
+            typename index_t::const_iterator it = index.find( name );
+            return ( it != index.end() ) ? it->second : NoHistogram;
+        }
+
+    //! Get a histogram by handle.
+    /*! \return the histogram; the pool keeps it alive.
+     */
+    H* Get(HistogramHandle handle /*!< A handle from Add() or Find(). */) const
+        { return pool[handle].get(); }
+
+    //! Get a shared pointer to a histogram by handle.
+    /*! \return the histogram, or 0 for NoHistogram.
+     */
+    pointer_t Share(HistogramHandle handle /*!< A handle from Add() or Find(), or NoHistogram. */) const
+        { return ( handle != NoHistogram ) ? pool[handle] : pointer_t(); }
+
+    //! Get all histograms.
+    /*! \return the histograms, indexed by handle.
+     */
+    const list_t& All() const
+        { return pool; }
+
+private:
+    //! Type of the name index.
+    typedef std::unordered_map<std::string, HistogramHandle> index_t;
+
+    //! The histograms, indexed by handle.
+    list_t pool;
+
+    //! The handle of each histogram by name.
+    index_t index;
+};
+
 //! A set of histograms.
+/*! The histograms of each dimension are kept in a HistogramPool. Code
+ *  filling many histograms per event can look up their handles once with
+ *  Handle1D() etc. and fill through Get1D() etc., without a name lookup
+ *  or shared pointer copy.
+ */
 class Histograms {
 public:
     //! A list of 1D histograms.
@@ -150,10 +298,12 @@ public:
     //! A list of 3D histograms.
     typedef std::vector<Histogram3Dp> list3d_t;
 
+    //! Create an empty set of histograms.
+    Histograms();
+
     //! Deletes all histograms.
     ~Histograms();
 
-    
     //! Create a 1D histogram.
     /*! It will be added to this set of histograms and deleted when the set is destroyed.
      *
@@ -164,10 +314,13 @@ public:
                            Axis::index_t channels,   /*!< The number of regular bins. */
                            Axis::bin_t left,         /*!< The lower edge of the lowest bin.  */
                            Axis::bin_t right,        /*!< The upper edge of the highest bin. */
-                           const std::string& xtitle /*!< The title of the x axis. */);
+                           const std::string& xtitle, /*!< The title of the x axis. */
+                           BinType type=BinInt64     /*!< The type used to count in the bins. */);
 
     //! Create a 2D histogram.
     /*! It will be added to this set of histograms and deleted when the set is destroyed.
+     *  SymmetricStorage needs the same x and y axes; if they differ,
+     *  an error is printed and DenseStorage is used.
      *
      * \return the new histogram.
      */
@@ -180,10 +333,13 @@ public:
                            Axis::index_t ychannels,   /*!< The number of regular bins on the y axis. */
                            Axis::bin_t yleft,         /*!< The lower edge of the lowest bin on the y axis. */
                            Axis::bin_t yright,        /*!< The upper edge of the highest bin on the y axis. */
-                           const std::string& ytitle  /*!< The title of the y axis. */);
+                           const std::string& ytitle, /*!< The title of the y axis. */
+                           HistogramStorage storage=DenseStorage, /*!< How to store the bin contents. */
+                           BinType type=BinFloat      /*!< The type used to count in the bins. */);
 
     //! Create a 3D histogram.
     /*! It will be added to this set of histograms and deleted when the set is destroyed.
+     *  SymmetricStorage is not available for 3D histograms.
      *
      * \return the new histogram.
      */
@@ -200,16 +356,63 @@ public:
                            Axis::index_t zchannels,   /*!< The number of regular bins on the y axis. */
                            Axis::bin_t zleft,         /*!< The lower edge of the lowest bin on the y axis. */
                            Axis::bin_t zright,        /*!< The upper edge of the highest bin on the y axis. */
-                           const std::string& ztitle  /*!< The title of the y axis. */);
+                           const std::string& ztitle, /*!< The title of the y axis. */
+                           HistogramStorage storage=DenseStorage, /*!< How to store the bin contents. */
+                           BinType type=BinFloat      /*!< The type used to count in the bins. */);
 
     //! Get a list of all 1D histograms.
-    list1d_t GetAll1D();
+    /*! \return the histograms, in order of creation.
+     */
+    const list1d_t& GetAll1D() const
+        { return pool1d.All(); }
 
     //! Get a list of all 2D histograms.
-    list2d_t GetAll2D();
+    /*! \return the histograms, in order of creation.
+     */
+    const list2d_t& GetAll2D() const
+        { return pool2d.All(); }
 
     //! Get a list of all 3D histograms.
-    list3d_t GetAll3D();
+    /*! \return the histograms, in order of creation.
+     */
+    const list3d_t& GetAll3D() const
+        { return pool3d.All(); }
+
+    //! Find the handle of a 1D histogram.
+    /*! \return the handle, or NoHistogram if not found.
+     */
+    HistogramHandle Handle1D( const std::string& name /*!< The name of the histogram to search. */) const
+        { return pool1d.Find( name ); }
+
+    //! Find the handle of a 2D histogram.
+    /*! \return the handle, or NoHistogram if not found.
+     */
+    HistogramHandle Handle2D( const std::string& name /*!< The name of the histogram to search. */) const
+        { return pool2d.Find( name ); }
+
+    //! Find the handle of a 3D histogram.
+    /*! \return the handle, or NoHistogram if not found.
+     */
+    HistogramHandle Handle3D( const std::string& name /*!< The name of the histogram to search. */) const
+        { return pool3d.Find( name ); }
+
+    //! Get a 1D histogram by handle.
+    /*! \return the histogram, owned by this set.
+     */
+    Histogram1D* Get1D( HistogramHandle handle /*!< A handle from Handle1D(). */) const
+        { return pool1d.Get( handle ); }
+
+    //! Get a 2D histogram by handle.
+    /*! \return the histogram, owned by this set.
+     */
+    Histogram2D* Get2D( HistogramHandle handle /*!< A handle from Handle2D(). */) const
+        { return pool2d.Get( handle ); }
+
+    //! Get a 3D histogram by handle.
+    /*! \return the histogram, owned by this set.
+     */
+    Histogram3D* Get3D( HistogramHandle handle /*!< A handle from Handle3D(). */) const
+        { return pool3d.Get( handle ); }
 
     //! Call Reset() on all histograms.
     void ResetAll();
@@ -217,40 +420,93 @@ public:
     //! Find a specific 1D histogram.
     /*! \return the histogram, or 0 if not found.
      */
-    Histogram1Dp Find1D( const std::string& name /*!< The name of the histogram to search. */);
+    Histogram1Dp Find1D( const std::string& name /*!< The name of the histogram to search. */) const
+        { return pool1d.Share( pool1d.Find( name ) ); }
 
     //! Find a specific 2D histogram.
     /*! \return the histogram, or 0 if not found.
      */
-    Histogram2Dp Find2D( const std::string& name /*!< The name of the histogram to search. */);
+    Histogram2Dp Find2D( const std::string& name /*!< The name of the histogram to search. */) const
+        { return pool2d.Share( pool2d.Find( name ) ); }
 
     //! Find a specific 3D histogram.
     /*! \return the histogram, or 0 if not found.
      */
-    Histogram3Dp Find3D( const std::string& name /*!< The name of the histogram to search. */);
+    Histogram3Dp Find3D( const std::string& name /*!< The name of the histogram to search. */) const
+        { return pool3d.Share( pool3d.Find( name ) ); }
+
+    //! Copy all histograms into a new set.
+    /*! The copies have the same names, axes, storage and bin type, and
+     *  the same contents and entry counts; buffered fills are flushed
+     *  first. Must be called while no thread is filling this set.
+     *
+     * \return the new set.
+     */
+    std::unique_ptr<Histograms> Snapshot(bool filled_only=false /*!< Leave out histograms without entries. */);
 
     //! Add all the histograms from other to this set's histograms.
-    /*! For each of the histograms of this set, add the contents of the same histogram in other. */
+    /*! For each of the histograms of this set, add the contents and
+     *  entries of the same histogram in other.
+     */
     void Merge(Histograms& other /*!< The set of histograms to add. */);
 
+    //! Make this set a companion of another set, for another thread.
+    /*! Used by a second instance of a sorting routine, sorting other
+     *  buffers than the first one. Histograms created afterwards that
+     *  are shared in primary are created as stages filling the histogram
+     *  in primary; the others are created as separate copies, which are
+     *  added to primary by Collect().
+     */
+    void Share(Histograms& primary /*!< The set of the first instance. */);
+
+    //! Decide which histograms are shared with the companion sets.
+    /*! Each histogram not shared needs one copy for each companion. The
+     *  2D and 3D histograms are taken from the smallest, and are copied
+     *  as long as the copies fit in the budget; the rest are shared.
+     *  Histograms created later are decided when the first companion
+     *  creates them. 1D histograms are always copied.
+     */
+    void PlanSharing(int copies,    /*!< The number of companion sets. */
+                     size_t* budget /*!< Bytes left for copies, reduced for each histogram copied. */);
+
+    //! Add the copies in this companion set to the primary set.
+    /*! The copies are reset, and the stages for shared histograms are
+     *  flushed. Must be called while no thread is filling either set.
+     */
+    void Collect();
+
 private:
-    //! Type for the map of histogram names to 1D histograms.
-    typedef std::map<std::string, Histogram1Dp> map1d_t;
+    //! Decide whether a histogram of this set is shared, if not done before.
+    void Plan(Histogram2Dp h /*!< The histogram to decide for. */);
+
+    //! Decide whether a histogram of this set is shared, if not done before.
+    void Plan(Histogram3Dp h /*!< The histogram to decide for. */);
+
+    //! Take the memory for copies of a histogram from the budget.
+    /*! \return true if the copies fit in the budget.
+     */
+    bool Afford(size_t bytes /*!< The size of one copy. */);
+
+    //! The primary set if this is a companion set, else 0.
+    Histograms* primary;
+
+    //! The number of companion sets.
+    int copies;
 
-    //! The map of histogram names to 1D histograms.
-    map1d_t map1d;
+    //! Bytes left for copies, 0 if PlanSharing() was not called.
+    size_t* budget;
 
-    //! Type for the map of histogram names to 2D histograms.
-    typedef std::map<std::string, Histogram2Dp> map2d_t;
+    //! Names of the histograms decided to be shared or copied.
+    std::set<std::string> planned;
 
-    //! The map of histogram names to 2D histograms.
-    map2d_t map2d;
+    //! The 1D histograms.
+    HistogramPool<Histogram1D> pool1d;
 
-    //! Type for the map of histogram names to 3D histograms.
-    typedef std::map<std::string, Histogram3Dp> map3d_t;
+    //! The 2D histograms.
+    HistogramPool<Histogram2D> pool2d;
 
-    //! The map of histogram names to 3D histograms.
-    map3d_t map3d;
+    //! The 3D histograms.
+    HistogramPool<Histogram3D> pool3d;
 };
 
 #endif /* HISTOGRAMS_H_ */
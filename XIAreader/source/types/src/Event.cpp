@@ -8,6 +8,7 @@
 void Event::PackEvent(const WordBuffer *buffer, int start, int stop)
 {
     length = stop - start;
+    this->start = start;
     DetectorInfo_t dinfo;
     for (int i = start ; i < stop ; ++i){
         dinfo = GetDetector((*buffer)[i].address);
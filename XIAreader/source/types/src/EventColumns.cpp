@@ -0,0 +1,35 @@
+
+#include "EventColumns.h"
+
+// ########################################################################
+
+void EventColumns::Declare(const std::vector<std::string>& g, const std::vector<std::string>& n,
+                           const std::vector<int>& cg)
+{
+    groups = g;
+    names = n;
+    column_groups = cg;
+    data.assign(names.size(), std::vector<float>());
+    counts.assign(groups.size(), std::vector<uint32_t>());
+    rows = 0;
+}
+
+// ########################################################################
+
+void EventColumns::Add(int column, const double* values, int n)
+{
+    std::vector<float>& d = data[column];
+    for (int i = 0 ; i < n ; ++i)
+        d.push_back( float(values[i]) );
+}
+
+// ########################################################################
+
+void EventColumns::Clear()
+{
+    for (size_t c = 0 ; c < data.size() ; ++c)
+        data[c].clear();
+    for (size_t g = 0 ; g < counts.size() ; ++g)
+        counts[g].clear();
+    rows = 0;
+}
@@ -0,0 +1,556 @@
+
+#include "FillPlan.h"
+
+#include "Histogram1D.h"
+#include "Histogram2D.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+// ########################################################################
+
+FillPlan::FillPlan(Histograms& h, EventColumns& c)
+    : histograms( h )
+    , columns( c )
+    , column_gate( -1 )
+    , dirty( false )
+{
+}
+
+// ########################################################################
+
+bool FillPlan::IsCommand(const std::string& name)
+{
+    return name == "variable" || name == "gate" || name == "hist1d" || name == "hist2d" || name == "columns";
+}
+
+// ########################################################################
+
+int FillPlan::FindVariable(const std::string& name) const
+{
+    for (size_t i = 0 ; i < variables.size() ; ++i){
+        if ( variables[i].name == name )
+            return i;
+    }
+    return -1;
+}
+
+// ########################################################################
+
+int FillPlan::FindGate(const std::string& name) const
+{
+    for (size_t i = 0 ; i < gates.size() ; ++i){
+        if ( gates[i].name == name )
+            return i;
+    }
+    return -1;
+}
+
+// ########################################################################
+
+int FillPlan::GroupOf(const std::string& name)
+{
+    size_t dot = name.find('.');
+    if ( dot == std::string::npos )
+        return -1;
+
+    const std::string group = name.substr(0, dot);
+    for (size_t i = 0 ; i < groups.size() ; ++i){
+        if ( groups[i] == group )
+            return i;
+    }
+    groups.push_back( group );
+    hits.push_back( 0 );
+    return groups.size() - 1;
+}
+
+// ########################################################################
+
+int FillPlan::Combine(int a, int b)
+{
+    if ( a < 0 )
+        return b;
+    if ( b < 0 || a == b )
+        return a;
+    return -2;
+}
+
+// ########################################################################
+
+int FillPlan::AddVariable(const std::string& name, int source, double scale, double offset)
+{
+    Variable v = { name, GroupOf(name), source, scale, offset, 0, 0, 0 };
+    variables.push_back( v );
+    values.push_back( std::vector<double>(1, 0) );
+    valid.push_back( false );
+    return variables.size() - 1;
+}
+
+// ########################################################################
+
+int FillPlan::Define(const std::string& name)
+{
+    int var = FindVariable(name);
+    return ( var >= 0 ) ? var : AddVariable(name, -1, 1, 0);
+}
+
+// ########################################################################
+
+bool FillPlan::Command(const std::string& name, std::istream& icmd)
+{
+    bool ok = false;
+    if ( name == "variable" )
+        ok = variable_command(icmd);
+    else if ( name == "gate" )
+        ok = gate_command(icmd);
+    else if ( name == "hist1d" )
+        ok = hist_command(icmd, false);
+    else if ( name == "hist2d" )
+        ok = hist_command(icmd, true);
+    else if ( name == "columns" )
+        ok = columns_command(icmd);
+    dirty = dirty || ok;
+    return ok;
+}
+
+// ########################################################################
+
+bool FillPlan::variable_command(std::istream& icmd)
+{
+    std::string name, source;
+    Axis::index_t bins = 0;
+    Axis::bin_t low = 0, high = 0;
+    double scale = 1, offset = 0;
+
+    icmd >> name >> bins >> low >> high;
+    if ( !icmd || bins <= 0 || high <= low ){
+        std::cerr << "variable: Expected 'variable <name> <bins> <low> <high> [<source> [<scale> [<offset>]]]'" << std::endl;
+        return false;
+    }
+
+    int var = FindVariable(name);
+    if ( icmd >> source ){
+        if ( !(icmd >> scale) )
+            scale = 1;
+        else if ( !(icmd >> offset) )
+            offset = 0;
+
+        int src = FindVariable(source);
+        if ( src < 0 ){
+            std::cerr << "variable: Unknown source variable '" << source << "'" << std::endl;
+            return false;
+        }
+        if ( var >= 0 ){
+            std::cerr << "variable: Variable '" << name << "' already defined" << std::endl;
+            return false;
+        }
+        if ( GroupOf(name) != variables[src].group ){
+            std::cerr << "variable: '" << name << "' must be in the same hit group as '" << source << "'" << std::endl;
+            return false;
+        }
+        var = AddVariable(name, src, scale, offset);
+    } else if ( var < 0 ){
+        std::cerr << "variable: Unknown variable '" << name << "'" << std::endl;
+        return false;
+    }
+
+    variables[var].bins = bins;
+    variables[var].low = low;
+    variables[var].high = high;
+    return true;
+}
+
+// ########################################################################
+
+bool FillPlan::gate_command(std::istream& icmd)
+{
+    Gate gate;
+    icmd >> gate.name;
+    if ( gate.name.empty() || FindGate(gate.name) >= 0 ){
+        std::cerr << "gate: Missing or duplicate gate name '" << gate.name << "'" << std::endl;
+        return false;
+    }
+
+    gate.group = -1;
+    std::string varname;
+    while ( icmd >> varname ){
+        Condition c;
+        c.var = FindVariable(varname);
+        if ( c.var < 0 ){
+            std::cerr << "gate: Unknown variable '" << varname << "'" << std::endl;
+            return false;
+        }
+        if ( !(icmd >> c.low >> c.high) ){
+            std::cerr << "gate: Expected '<variable> <low> <high>' in gate '" << gate.name << "'" << std::endl;
+            return false;
+        }
+        gate.group = Combine(gate.group, variables[c.var].group);
+        if ( gate.group == -2 ){
+            std::cerr << "gate: Gate '" << gate.name << "' mixes different hit groups" << std::endl;
+            return false;
+        }
+        gate.conds.push_back( c );
+    }
+    if ( gate.conds.empty() ){
+        std::cerr << "gate: Gate '" << gate.name << "' has no conditions" << std::endl;
+        return false;
+    }
+    gates.push_back( gate );
+    passed.push_back( std::vector<char>(1, 0) );
+    return true;
+}
+
+// ########################################################################
+
+bool FillPlan::ParseAxis(const std::string& spec, int& var, Axis::index_t& bins,
+                         Axis::bin_t& low, Axis::bin_t& high)
+{
+    std::string tmp = spec;
+    for (size_t i = 0 ; i < tmp.size() ; ++i){
+        if ( tmp[i] == ':' )
+            tmp[i] = ' ';
+    }
+    std::istringstream ispec(tmp);
+    std::string varname;
+    ispec >> varname;
+
+    var = FindVariable(varname);
+    if ( var < 0 ){
+        std::cerr << "hist: Unknown variable '" << varname << "'" << std::endl;
+        return false;
+    }
+
+    bins = variables[var].bins;
+    low = variables[var].low;
+    high = variables[var].high;
+    Axis::index_t b;
+    Axis::bin_t l, h;
+    if ( ispec >> b >> l >> h ){
+        bins = b;
+        low = l;
+        high = h;
+    }
+    if ( bins <= 0 || high <= low ){
+        std::cerr << "hist: No binning for variable '" << varname << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ########################################################################
+
+bool FillPlan::hist_command(std::istream& icmd, bool is2d)
+{
+    Hist hist;
+    hist.is2d = is2d;
+    hist.xvar = hist.yvar = hist.gate = -1;
+    hist.weight = 1;
+    hist.xbin = hist.ybin = -1;
+
+    std::string name, tok;
+    icmd >> name;
+    if ( name.empty() || histograms.Handle1D(name) != NoHistogram || histograms.Handle2D(name) != NoHistogram ){
+        std::cerr << "hist: Missing or duplicate histogram name '" << name << "'" << std::endl;
+        return false;
+    }
+
+    std::string xspec, yspec;
+    HistogramStorage storage = DenseStorage;
+    BinType type = is2d ? BinFloat : BinInt64;
+    while ( icmd >> tok ){
+        size_t eq = tok.find('=');
+        std::string key = tok.substr(0, eq), val = ( eq == std::string::npos ) ? "" : tok.substr(eq+1);
+        if ( key == "x" ){
+            xspec = val;
+        } else if ( key == "y" && is2d ){
+            yspec = val;
+        } else if ( key == "gate" ){
+            hist.gate = FindGate(val);
+            if ( hist.gate < 0 ){
+                std::cerr << "hist: Unknown gate '" << val << "'" << std::endl;
+                return false;
+            }
+        } else if ( key == "weight" ){
+            hist.weight = std::atof(val.c_str());
+        } else if ( key == "storage" && is2d && ( val == "dense" || val == "sparse" || val == "tiled" ) ){
+            storage = ( val == "sparse" ) ? SparseStorage : ( val == "tiled" ) ? TiledStorage : DenseStorage;
+        } else if ( key == "type" ){
+            if ( !BinTypeFromName(val, type) ){
+                std::cerr << "hist: Unknown bin type '" << val << "'" << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "hist: Do not understand '" << tok << "'" << std::endl;
+            return false;
+        }
+    }
+
+    Axis::index_t xbins, ybins;
+    Axis::bin_t xlow, xhigh, ylow, yhigh;
+    if ( xspec.empty() || !ParseAxis(xspec, hist.xvar, xbins, xlow, xhigh) )
+        return false;
+    if ( is2d && ( yspec.empty() || !ParseAxis(yspec, hist.yvar, ybins, ylow, yhigh) ) )
+        return false;
+
+    hist.group = variables[hist.xvar].group;
+    if ( is2d )
+        hist.group = Combine(hist.group, variables[hist.yvar].group);
+    if ( hist.gate >= 0 && hist.group != -2 )
+        hist.group = Combine(hist.group, gates[hist.gate].group);
+    if ( hist.group == -2 ){
+        std::cerr << "hist: Histogram '" << name << "' mixes different hit groups" << std::endl;
+        return false;
+    }
+
+    if ( is2d ){
+        histograms.Create2D(name, name, xbins, xlow, xhigh, variables[hist.xvar].name,
+                            ybins, ylow, yhigh, variables[hist.yvar].name, storage, type);
+        hist.handle = histograms.Handle2D(name);
+    } else {
+        histograms.Create1D(name, name, xbins, xlow, xhigh, variables[hist.xvar].name, type);
+        hist.handle = histograms.Handle1D(name);
+    }
+    hists.push_back( hist );
+    return true;
+}
+
+// ########################################################################
+
+bool FillPlan::columns_command(std::istream& icmd)
+{
+    std::vector<int> vars, var_groups;
+    std::vector<std::string> group_names, names;
+    std::vector<int> plan_groups;
+    int gate = -1;
+
+    std::string tok;
+    while ( icmd >> tok ){
+        if ( tok.compare(0, 5, "gate=") == 0 ){
+            gate = FindGate(tok.substr(5));
+            if ( gate < 0 ){
+                std::cerr << "columns: Unknown gate '" << tok.substr(5) << "'" << std::endl;
+                return false;
+            }
+            if ( gates[gate].group >= 0 ){
+                std::cerr << "columns: Gate '" << tok.substr(5) << "' is not per event" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        const int var = FindVariable(tok);
+        if ( var < 0 ){
+            std::cerr << "columns: Unknown variable '" << tok << "'" << std::endl;
+            return false;
+        }
+        int group = -1;
+        if ( variables[var].group >= 0 ){
+            const int pg = variables[var].group;
+            group = std::find(plan_groups.begin(), plan_groups.end(), pg) - plan_groups.begin();
+            if ( group == int(plan_groups.size()) ){
+                plan_groups.push_back( pg );
+                group_names.push_back( groups[pg] );
+            }
+        }
+        vars.push_back( var );
+        names.push_back( tok );
+        var_groups.push_back( group );
+    }
+    if ( vars.empty() ){
+        std::cerr << "columns: Expected 'columns <variable>... [gate=<gate>]'" << std::endl;
+        return false;
+    }
+
+    column_vars = vars;
+    column_groups = plan_groups;
+    column_gate = gate;
+    columns.Declare(group_names, names, var_groups);
+    return true;
+}
+
+// ########################################################################
+
+int FillPlan::AddBinning(int var, const Axis& axis)
+{
+    for (size_t i = 0 ; i < binnings.size() ; ++i){
+        const Axis& a = *binnings[i].axis;
+        if ( binnings[i].var == var && a.GetBinCount() == axis.GetBinCount()
+             && a.GetLeft() == axis.GetLeft() && a.GetRight() == axis.GetRight() )
+            return i;
+    }
+    Binning b = { var, &axis, std::vector<Axis::index_t>(1, 0) };
+    binnings.push_back( b );
+    return binnings.size() - 1;
+}
+
+// ########################################################################
+
+void FillPlan::Compile()
+{
+    binnings.clear();
+    for (size_t i = 0 ; i < hists.size() ; ++i){
+        Hist& h = hists[i];
+        if ( h.is2d ){
+            const Histogram2D* h2 = histograms.Get2D(h.handle);
+            h.xbin = AddBinning(h.xvar, h2->GetAxisX());
+            h.ybin = AddBinning(h.yvar, h2->GetAxisY());
+        } else {
+            h.xbin = AddBinning(h.xvar, histograms.Get1D(h.handle)->GetAxisX());
+        }
+    }
+    dirty = false;
+}
+
+// ########################################################################
+
+void FillPlan::Clear()
+{
+    for (size_t i = 0 ; i < valid.size() ; ++i)
+        valid[i] = false;
+    for (size_t i = 0 ; i < hits.size() ; ++i)
+        hits[i] = 0;
+}
+
+// ########################################################################
+
+void FillPlan::Set(int var, const double* v, int n)
+{
+    values[var].assign(v, v+n);
+    valid[var] = true;
+    hits[variables[var].group] = n;
+}
+
+// ########################################################################
+
+void FillPlan::Evaluate(int group)
+{
+    const int n = ( group < 0 ) ? 1 : hits[group];
+
+    // Derived variables, in order of definition so they may be chained.
+    for (size_t v = 0 ; v < variables.size() ; ++v){
+        const Variable& var = variables[v];
+        if ( var.group != group )
+            continue;
+        if ( var.source < 0 ){
+            // A hit variable not set for this event reads as zero.
+            if ( group >= 0 && !valid[v] )
+                values[v].assign(n, 0);
+            continue;
+        }
+        if ( group < 0 && !(valid[v] = valid[var.source]) )
+            continue;
+        const std::vector<double>& src = values[var.source];
+        std::vector<double>& dst = values[v];
+        dst.resize(n);
+        for (int i = 0 ; i < n ; ++i)
+            dst[i] = var.scale*src[i] + var.offset;
+    }
+
+    // Bin numbers shared by all histograms.
+    for (size_t b = 0 ; b < binnings.size() ; ++b){
+        Binning& bn = binnings[b];
+        if ( variables[bn.var].group != group || ( group < 0 && !valid[bn.var] ) )
+            continue;
+        const std::vector<double>& src = values[bn.var];
+        bn.bins.resize(n);
+        if ( n > 0 )
+            bn.axis->FindBins(&src[0], &bn.bins[0], n);
+    }
+
+    // Gates, which may combine per-event and per-hit windows.
+    for (size_t g = 0 ; g < gates.size() ; ++g){
+        const Gate& gate = gates[g];
+        if ( gate.group != group )
+            continue;
+        std::vector<char>& p = passed[g];
+        p.assign(n, 1);
+        for (size_t c = 0 ; c < gate.conds.size() ; ++c){
+            const Condition& cond = gate.conds[c];
+            if ( variables[cond.var].group < 0 && !valid[cond.var] ){
+                p.assign(n, 0);
+                break;
+            }
+            const std::vector<double>& src = values[cond.var];
+            for (int i = 0 ; i < n ; ++i){
+                const double x = src[Index(cond.var, i)];
+                p[i] &= ( x >= cond.low && x < cond.high );
+            }
+        }
+    }
+}
+
+// ########################################################################
+
+void FillPlan::FillColumns()
+{
+    if ( column_gate >= 0 && !passed[column_gate][0] )
+        return;
+    for (size_t c = 0 ; c < column_vars.size() ; ++c){
+        if ( variables[column_vars[c]].group < 0 && !valid[column_vars[c]] )
+            return;
+    }
+
+    for (size_t g = 0 ; g < column_groups.size() ; ++g)
+        columns.AddCount(g, hits[column_groups[g]]);
+    for (size_t c = 0 ; c < column_vars.size() ; ++c){
+        const int var = column_vars[c];
+        const int group = variables[var].group;
+        if ( group < 0 )
+            columns.Add(c, values[var][0]);
+        else if ( hits[group] > 0 )
+            columns.Add(c, &values[var][0], hits[group]);
+    }
+    columns.EndRow();
+}
+
+// ########################################################################
+
+void FillPlan::Fill()
+{
+    if ( Empty() )
+        return;
+    if ( dirty )
+        Compile();
+
+    Evaluate(-1);
+    for (int g = 0 ; g < int(groups.size()) ; ++g){
+        if ( hits[g] > 0 )
+            Evaluate(g);
+    }
+
+    for (size_t k = 0 ; k < hists.size() ; ++k){
+        const Hist& h = hists[k];
+
+        // Per-event inputs of the histogram must have been set.
+        if ( variables[h.xvar].group < 0 && !valid[h.xvar] )
+            continue;
+        if ( h.yvar >= 0 && variables[h.yvar].group < 0 && !valid[h.yvar] )
+            continue;
+
+        const int n = ( h.group < 0 ) ? 1 : hits[h.group];
+        const Axis::index_t* xb = &binnings[h.xbin].bins[0];
+        const int xs = ( variables[h.xvar].group < 0 ) ? 0 : 1;
+        const char* gp = ( h.gate >= 0 ) ? &passed[h.gate][0] : 0;
+        const int gs = ( h.gate >= 0 && gates[h.gate].group >= 0 ) ? 1 : 0;
+
+        if ( h.is2d ){
+            Histogram2D* h2 = histograms.Get2D(h.handle);
+            const Axis::index_t* yb = &binnings[h.ybin].bins[0];
+            const int ys = ( variables[h.yvar].group < 0 ) ? 0 : 1;
+            for (int i = 0 ; i < n ; ++i){
+                if ( !gp || gp[gs*i] )
+                    h2->FillBin(xb[xs*i], yb[ys*i], h.weight);
+            }
+        } else {
+            Histogram1D* h1 = histograms.Get1D(h.handle);
+            for (int i = 0 ; i < n ; ++i){
+                if ( !gp || gp[gs*i] )
+                    h1->FillBin(xb[xs*i], h.weight);
+            }
+        }
+    }
+
+    if ( WritesColumns() )
+        FillColumns();
+}
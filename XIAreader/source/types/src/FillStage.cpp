@@ -0,0 +1,71 @@
+#include "FillStage.h"
+
+#include <algorithm>
+
+enum { radix_bits = 8, radix_size = 1 << radix_bits, radix_mask = radix_size - 1 };
+
+// ########################################################################
+
+template<typename K>
+void SortByIndex(K* &index, double* &weight, K* index_tmp, double* weight_tmp,
+                 unsigned int n, K max_index)
+{
+    for(unsigned int shift=0; shift<8*sizeof(K) && (max_index >> shift) > 0; shift += radix_bits) {
+        unsigned int count[radix_size+1] = { 0 };
+        for(unsigned int i=0; i<n; ++i)
+            ++count[((index[i] >> shift) & radix_mask) + 1];
+        for(int d=0; d<radix_size; ++d)
+            count[d+1] += count[d];
+        if( weight ) {
+            for(unsigned int i=0; i<n; ++i) {
+                const unsigned int p = count[(index[i] >> shift) & radix_mask]++;
+                index_tmp[p] = index[i];
+                weight_tmp[p] = weight[i];
+            }
+            std::swap(weight, weight_tmp);
+        } else {
+            for(unsigned int i=0; i<n; ++i)
+                index_tmp[count[(index[i] >> shift) & radix_mask]++] = index[i];
+        }
+        std::swap(index, index_tmp);
+    }
+}
+
+template void SortByIndex<uint32_t>(uint32_t*&, double*&, uint32_t*, double*, unsigned int, uint32_t);
+template void SortByIndex<uint64_t>(uint64_t*&, double*&, uint64_t*, double*, unsigned int, uint64_t);
+
+// ########################################################################
+// ########################################################################
+
+FillStage::FillStage()
+    : index( stage_max )
+    , index_tmp( stage_max )
+    , weight( stage_max )
+    , weight_tmp( stage_max )
+    , sorted_index( 0 )
+    , sorted_weight( 0 )
+    , n( 0 )
+    , max_index( 0 )
+{
+}
+
+// ########################################################################
+
+unsigned int FillStage::Combine()
+{
+    sorted_index = &index[0];
+    sorted_weight = &weight[0];
+    SortByIndex(sorted_index, sorted_weight, &index_tmp[0], &weight_tmp[0], n, max_index);
+
+    unsigned int m = 0;
+    for(unsigned int i=0; i<n; ++i) {
+        if( m > 0 && sorted_index[m-1] == sorted_index[i] ) {
+            sorted_weight[m-1] += sorted_weight[i];
+        } else {
+            sorted_index[m] = sorted_index[i];
+            sorted_weight[m] = sorted_weight[i];
+            ++m;
+        }
+    }
+    return m;
+}
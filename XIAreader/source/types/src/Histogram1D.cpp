@@ -6,7 +6,9 @@
  */
 
 #include "Histogram1D.h"
+#include "SortStats.h"
 
+#include <algorithm>
 #include <iostream>
 
 #ifdef H1D_USE_BUFFER
@@ -19,52 +21,72 @@ Histogram1D::Histogram1D( const std::string& name, const std::string& title,
                           Axis::index_t c, Axis::bin_t l, Axis::bin_t r, const std::string& xt )
     : Named( name, title )
     , xaxis( name+"_xaxis", c, l, r, xt )
-    , data( 0 )
-{
+    , entries( 0 )
 #ifdef H1D_USE_BUFFER
-    buffer.reserve(buffer_max);
+    , buffer_x( buffer_max )
+    , buffer_w( buffer_max )
+    , buffer_n( 0 )
 #endif /* H1D_USE_BUFFER */
-
-    data = new data_t[xaxis.GetBinCountAll()];
-    Reset();
+{
 }
 
 // ########################################################################
 
 Histogram1D::~Histogram1D()
 {
-    delete data;
 }
 
 // ########################################################################
 
-void Histogram1D::Add(const Histogram1Dp other, data_t scale)
+bool Histogram1D::IsCompatible(const Histogram1Dp other) const
+{
+    return other
+        && other->GetName() == GetName()
+        && other->GetAxisX().GetLeft() == xaxis.GetLeft()
+        && other->GetAxisX().GetRight() == xaxis.GetRight()
+        && other->GetAxisX().GetBinCount() == xaxis.GetBinCount();
+}
+
+// ########################################################################
+// ########################################################################
+
+template<typename T>
+Histogram1DT<T>::Histogram1DT( const std::string& name, const std::string& title,
+                               Axis::index_t c, Axis::bin_t l, Axis::bin_t r, const std::string& xt )
+    : Histogram1D( name, title, c, l, r, xt )
+    , data( xaxis.GetBinCountAll(), T(0) )
+{
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram1DT<T>::Add(const Histogram1Dp other, double scale)
 {
-    if( !other 
-        || other->GetName() != GetName()
-        || other->GetAxisX().GetLeft() != xaxis.GetLeft()
-        || other->GetAxisX().GetRight() != xaxis.GetRight()
-        || other->GetAxisX().GetBinCount() != xaxis.GetBinCount() )
+    if( !IsCompatible(other) )
         return;
 
 #ifdef H1D_USE_BUFFER
-    other->FlushBuffer();
     FlushBuffer();
-#endif /* H2D_USE_BUFFER */
+#endif /* H1D_USE_BUFFER */
 
-    for(int i=0; i<xaxis.GetBinCountAll(); ++i)
-        data[i] += scale * other->data[i];
+    for(int i=0; i<xaxis.GetBinCountAll(); ++i) {
+        const double c = other->GetBinContent(i);
+        if( c != 0 )
+            BinContent<T>::Add(data[i], scale * c, spill, i);
+    }
 }
 
 // ########################################################################
 
-Histogram1D::data_t Histogram1D::GetBinContent(Axis::index_t bin)
+template<typename T>
+double Histogram1DT<T>::GetBinContent(Axis::index_t bin)
 {
 #ifdef H1D_USE_BUFFER
     FlushBuffer();
 #endif /* H1D_USE_BUFFER */
     if( bin>=0 && bin<xaxis.GetBinCountAll() ) {
-        return data[bin];
+        return BinContent<T>::Get(data[bin], spill, bin);
     } else {
         return 0;
     }
@@ -72,34 +94,64 @@ Histogram1D::data_t Histogram1D::GetBinContent(Axis::index_t bin)
 
 // ########################################################################
 
-void Histogram1D::FillDirect(Axis::bin_t x, data_t weight)
+template<typename T>
+template<typename D>
+void Histogram1DT<T>::CopyBinsTo(D* dst)
+{
+#ifdef H1D_USE_BUFFER
+    FlushBuffer();
+#endif /* H1D_USE_BUFFER */
+    const Axis::index_t count = xaxis.GetBinCountAll();
+    for(Axis::index_t i=0; i<count; ++i)
+        dst[i] = D(BinContent<T>::Get(data[i], spill, i));
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram1DT<T>::FillDirect(Axis::bin_t x, double weight)
 {
     entries += 1;
-    data[xaxis.FindBin( x )] += weight;
+    const Axis::index_t bin = xaxis.FindBin( x );
+    BinContent<T>::Add(data[bin], weight, spill, bin);
 }
 
 // ########################################################################
 
 #ifdef H1D_USE_BUFFER
-void Histogram1D::FlushBuffer()
+template<typename T>
+void Histogram1DT<T>::FlushBuffer()
 {
-    if( !buffer.empty() ) {
-        for(buffer_t::const_iterator it=buffer.begin(); it<buffer.end(); ++it)
-            FillDirect(it->x, it->w);
-        buffer.clear();
+    const SortStats::FlushTimer timer( buffer_n );
+    Axis::index_t bins[flush_chunk];
+    for(unsigned int i=0; i<buffer_n; i+=flush_chunk) {
+        const unsigned int n = std::min(buffer_n-i, (unsigned int)flush_chunk);
+        xaxis.FindBins(&buffer_x[i], bins, n);
+        for(unsigned int j=0; j<n; ++j)
+            BinContent<T>::Add(data[bins[j]], buffer_w[i+j], spill, bins[j]);
     }
+    entries += buffer_n;
+    buffer_n = 0;
 }
 #endif /* H1D_USE_BUFFER */
 
 // ########################################################################
 
-void Histogram1D::Reset()
+template<typename T>
+void Histogram1DT<T>::Reset()
 {
 #ifdef H1D_USE_BUFFER
-    buffer.clear();
+    buffer_n = 0;
 #endif /* H1D_USE_BUFFER */
-    for(int i=0; i<xaxis.GetBinCountAll(); ++i)
-        data[i] = 0;
+    std::fill(data.begin(), data.end(), T(0));
+    spill.clear();
     entries = 0;
 }
 
+// ########################################################################
+
+template class Histogram1DT<uint16_t>;
+template class Histogram1DT<uint32_t>;
+template class Histogram1DT<long long>;
+template class Histogram1DT<float>;
+template class Histogram1DT<double>;
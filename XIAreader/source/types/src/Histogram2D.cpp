@@ -4,160 +4,518 @@
  */
 
 #include "Histogram2D.h"
+#include "FillStage.h"
+#include "SortStats.h"
 
+#include <algorithm>
 #include <iostream>
 
 #ifdef H2D_USE_BUFFER
 const unsigned int Histogram2D::buffer_max;
+
+//! Work space for sorting a fill buffer, one for each thread.
+struct FlushScratch {
+    std::vector<uint32_t> index, index_tmp;
+    std::vector<double> weight, weight_tmp;
+
+    void Resize(unsigned int n)
+        {
+            if( index.size() < n ) {
+                index.resize(n); index_tmp.resize(n);
+                weight.resize(n); weight_tmp.resize(n);
+            }
+        }
+};
+static thread_local FlushScratch flush_scratch;
 #endif /* H2D_USE_BUFFER */
 
 // ########################################################################
 
 Histogram2D::Histogram2D( const std::string& name, const std::string& title,
                           Axis::index_t ch1, Axis::bin_t l1, Axis::bin_t r1, const std::string& xt,
-                          Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& yt)
+                          Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& yt,
+                          HistogramStorage st)
     : Named( name, title )
     , xaxis( name+"_xaxis", ch1, l1, r1, xt )
     , yaxis( name+"_yaxis", ch2, l2, r2, yt )
-#ifndef USE_ROWS
+    , entries( 0 )
+    , storage( st )
+#ifdef H2D_USE_BUFFER
+    , buffer_x( buffer_max )
+    , buffer_y( buffer_max )
+    , buffer_w( buffer_max )
+    , buffer_n( 0 )
+#endif /* H2D_USE_BUFFER */
+{
+}
+
+// ########################################################################
+
+Histogram2D::~Histogram2D()
+{
+}
+
+// ########################################################################
+
+bool Histogram2D::IsCompatible(const Histogram2Dp other) const
+{
+    return other
+        && other->GetName() == GetName()
+        && other->GetAxisX().GetLeft() == xaxis.GetLeft()
+        && other->GetAxisX().GetRight() == xaxis.GetRight()
+        && other->GetAxisX().GetBinCount() == xaxis.GetBinCount()
+        && other->GetAxisY().GetLeft() == yaxis.GetLeft()
+        && other->GetAxisY().GetRight() == yaxis.GetRight()
+        && other->GetAxisY().GetBinCount() == yaxis.GetBinCount();
+}
+
+// ########################################################################
+// ########################################################################
+
+template<typename T>
+Histogram2DT<T>::Histogram2DT( const std::string& name, const std::string& title,
+                               Axis::index_t ch1, Axis::bin_t l1, Axis::bin_t r1, const std::string& xt,
+                               Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& yt,
+                               HistogramStorage st)
+    : Histogram2D( name, title, ch1, l1, r1, xt, ch2, l2, r2, yt, st )
+    , tiles_x( 0 )
+    , tiles_y( 0 )
     , data( 0 )
-#else
+#ifdef USE_ROWS
     , rows( 0 )
 #endif
 {
-#ifdef H2D_USE_BUFFER
-    buffer.reserve(buffer_max);
-#endif /* H2D_USE_BUFFER */
-
-#ifndef USE_ROWS
-    data = new data_t[xaxis.GetBinCountAll()*yaxis.GetBinCountAll()];
-#else
-    rows = new data_t*[yaxis.GetBinCountAll()];
-    for(int y=0; y<yaxis.GetBinCountAll(); ++y)
-        rows[y] = new data_t[xaxis.GetBinCountAll()];
+    if( storage == SparseStorage || storage == TiledStorage ) {
+        tiles_x = (xaxis.GetBinCountAll() + tile_size - 1) >> tile_bits;
+        tiles_y = (yaxis.GetBinCountAll() + tile_size - 1) >> tile_bits;
+    }
+    if( storage == SparseStorage ) {
+        tiles.resize(tiles_x*tiles_y, 0);
+    } else {
+#ifdef USE_ROWS
+        if( storage == DenseStorage ) {
+            rows = new T*[yaxis.GetBinCountAll()];
+            for(int y=0; y<yaxis.GetBinCountAll(); ++y)
+                rows[y] = new T[xaxis.GetBinCountAll()];
+        } else
 #endif
+        data = new T[IndexCount()];
+    }
     Reset();
 }
 
 // ########################################################################
 
-Histogram2D::~Histogram2D()
+template<typename T>
+Histogram2DT<T>::~Histogram2DT()
 {
-#ifndef USE_ROWS
-    delete data;
-#else
-    for(int y=0; y<yaxis.GetBinCountAll(); ++y)
-        delete rows[y];
-    delete rows;
+    DeleteTiles();
+    delete[] data;
+#ifdef USE_ROWS
+    if( rows ) {
+        for(int y=0; y<yaxis.GetBinCountAll(); ++y)
+            delete[] rows[y];
+        delete[] rows;
+    }
 #endif
 }
 
 // ########################################################################
 
-void Histogram2D::Add(const Histogram2Dp other, data_t scale)
+template<typename T>
+void Histogram2DT<T>::Add(const Histogram2Dp other, double scale)
 {
-    if( !other 
-        || other->GetName() != GetName()
-        || other->GetAxisX().GetLeft() != xaxis.GetLeft()
-        || other->GetAxisX().GetRight() != xaxis.GetRight()
-        || other->GetAxisX().GetBinCount() != xaxis.GetBinCount()
-        || other->GetAxisY().GetLeft() != yaxis.GetLeft()
-        || other->GetAxisY().GetRight() != yaxis.GetRight()
-        || other->GetAxisY().GetBinCount() != yaxis.GetBinCount() )
+    if( !IsCompatible(other) )
         return;
 
 #ifdef H2D_USE_BUFFER
-    other->FlushBuffer();
     FlushBuffer();
 #endif /* H2D_USE_BUFFER */
 
-#ifndef USE_ROWS
-    for(int i=0; i<xaxis.GetBinCountAll()*yaxis.GetBinCountAll(); ++i)
-        data[i] += scale * other->data[i];
-#else
-    for(int y=0; y<yaxis.GetBinCountAll(); ++y )
-        for(int x=0; x<xaxis.GetBinCountAll(); ++x )
-            rows[y][x] += scale*other->rows[y][x];
-#endif
+    Histogram2DT<T>* same = dynamic_cast<Histogram2DT<T>*>(other.get());
+    if( same && same != this && BinTypeOf<T>::value != BinUInt16 ) {
+#ifdef H2D_USE_BUFFER
+        same->FlushBuffer();
+#endif /* H2D_USE_BUFFER */
+        if( storage == SparseStorage && same->storage == SparseStorage ) {
+            // Same axes give the same tiles; only add those filled in 'other'.
+            for(size_t t=0; t<tiles.size(); ++t) {
+                const T* src = same->tiles[t];
+                if( !src )
+                    continue;
+                if( !tiles[t] )
+                    tiles[t] = NewTile();
+                T* dst = tiles[t];
+                for(int i=0; i<tile_size*tile_size; ++i)
+                    BinContent<T>::Add(dst[i], scale * src[i], spill, 0);
+            }
+            return;
+        }
+        if( data && same->data && storage == same->storage ) {
+            const Axis::index_t count = IndexCount();
+            for(Axis::index_t i=0; i<count; ++i)
+                BinContent<T>::Add(data[i], scale * same->data[i], spill, i);
+            return;
+        }
+    }
+
+    // A symmetric matrix gets each pair of bins from one side of 'other'.
+    for(int y=0; y<yaxis.GetBinCountAll(); ++y ) {
+        const int xend = ( storage == SymmetricStorage ) ? y+1 : xaxis.GetBinCountAll();
+        for(int x=0; x<xend; ++x ) {
+            const double c = other->GetBinContent(x, y);
+            if( c != 0 )
+                AddAt(Index(x, y), scale * c);
+        }
+    }
 }
 
 // ########################################################################
 
-Histogram2D::data_t Histogram2D::GetBinContent(Axis::index_t xbin, Axis::index_t ybin)
+template<typename T>
+double Histogram2DT<T>::GetBinContent(Axis::index_t xbin, Axis::index_t ybin)
 {
 #ifdef H2D_USE_BUFFER
-    if( !buffer.empty() )
+    if( buffer_n > 0 || ( sharing && !sharing->stage.Empty() ) )
         FlushBuffer();
 #endif /* H2D_USE_BUFFER */
 
-    if( xbin>=0 && xbin<xaxis.GetBinCountAll() && ybin>=0 && ybin<yaxis.GetBinCountAll() ) {
-#ifndef USE_ROWS
-        return data[xaxis.GetBinCountAll()*ybin + xbin];
-#else
-        return rows[ybin][xbin];
-#endif
-    } else
+    if( xbin>=0 && xbin<xaxis.GetBinCountAll() && ybin>=0 && ybin<yaxis.GetBinCountAll() )
+        return Content(xbin, ybin);
+    else
         return 0;
 }
 
 // ########################################################################
 
-void Histogram2D::SetBinContent(Axis::index_t xbin, Axis::index_t ybin, data_t c)
+template<typename T>
+void Histogram2DT<T>::SetBinContent(Axis::index_t xbin, Axis::index_t ybin, double c)
 {
 #ifdef H2D_USE_BUFFER
-    if( !buffer.empty() )
+    if( buffer_n > 0 || ( sharing && !sharing->stage.Empty() ) )
         FlushBuffer();
 #endif /* H2D_USE_BUFFER */
 
     if( xbin>=0 && xbin<xaxis.GetBinCountAll() && ybin>=0 && ybin<yaxis.GetBinCountAll() ) {
-#ifndef USE_ROWS
-        data[xaxis.GetBinCountAll()*ybin + xbin] = c;
-#else
-        rows[ybin][xbin] = c;
-#endif
+        // Do not allocate a tile just to store a zero.
+        if( c != 0 || Content(xbin, ybin) != 0 )
+            BinContent<T>::Set(Bin(xbin, ybin), c, spill, Index(xbin, ybin));
     }
 }
 
 // ########################################################################
 
-void Histogram2D::FillDirect(Axis::bin_t x, Axis::bin_t y, data_t weight)
+template<typename T>
+void Histogram2DT<T>::FillDirect(Axis::bin_t x, Axis::bin_t y, double weight)
 {
     const int xbin = xaxis.FindBin( x );
     const int ybin = yaxis.FindBin( y );
-#ifndef USE_ROWS
-    data[xaxis.GetBinCountAll()*ybin + xbin] += weight;
-#else
-    rows[ybin][xbin] += weight;
-#endif
-    entries += 1;
+    FillBin(xbin, ybin, weight);
 }
 
 // ########################################################################
 
 #ifdef H2D_USE_BUFFER
-void Histogram2D::FlushBuffer()
+template<typename T>
+void Histogram2DT<T>::FlushBuffer()
 {
-    if( !buffer.empty() ) {
-        for(buffer_t::const_iterator it=buffer.begin(); it<buffer.end(); ++it)
-            FillDirect(it->x, it->y, it->w);
-        buffer.clear();
+    const SortStats::FlushTimer timer( buffer_n );
+    if( sharing ) {
+        Stage(sharing->stage, &buffer_x[0], &buffer_y[0], &buffer_w[0], buffer_n);
+        buffer_n = 0;
+        Commit(sharing->stage);
+        return;
+    }
+
+    if( buffer_n == 0 )
+        return;
+
+    // Matrices that fit in the cache: add the fills as they come.
+    const Axis::index_t count = IndexCount();
+    if( buffer_n < sort_min || count*Axis::index_t(sizeof(T)) < sort_bytes || count > 0xFFFFFFFFLL ) {
+        Axis::index_t xbins[flush_chunk], ybins[flush_chunk];
+        for(unsigned int i=0; i<buffer_n; i+=flush_chunk) {
+            const unsigned int n = std::min(buffer_n-i, (unsigned int)flush_chunk);
+            xaxis.FindBins(&buffer_x[i], xbins, n);
+            yaxis.FindBins(&buffer_y[i], ybins, n);
+            for(unsigned int j=0; j<n; ++j)
+                AddAt(Index(xbins[j], ybins[j]), PairWeight(xbins[j], ybins[j], buffer_w[i+j]));
+        }
+        entries += buffer_n;
+        buffer_n = 0;
+        return;
+    }
+
+    // Storage position and weight of each buffered fill.
+    FlushScratch& f = flush_scratch;
+    f.Resize(buffer_n);
+    bool same_weight = true;
+    const double w0 = BinContent<T>::Weight(buffer_w[0]);
+    Axis::index_t xbins[flush_chunk], ybins[flush_chunk];
+    for(unsigned int i=0; i<buffer_n; i+=flush_chunk) {
+        const unsigned int n = std::min(buffer_n-i, (unsigned int)flush_chunk);
+        xaxis.FindBins(&buffer_x[i], xbins, n);
+        yaxis.FindBins(&buffer_y[i], ybins, n);
+        for(unsigned int j=0; j<n; ++j) {
+            f.index[i+j] = uint32_t(Index(xbins[j], ybins[j]));
+            f.weight[i+j] = BinContent<T>::Weight(PairWeight(xbins[j], ybins[j], buffer_w[i+j]));
+            same_weight &= ( f.weight[i+j] == w0 );
+        }
+    }
+
+    // Sort by storage position and add to each bin once, so the writes
+    // go through memory in order. With equal weights, which is the
+    // usual case, only the positions need to be moved.
+    uint32_t* index = &f.index[0];
+    double* weight = same_weight ? 0 : &f.weight[0];
+    SortByIndex(index, weight, &f.index_tmp[0], &f.weight_tmp[0], buffer_n, uint32_t(count-1));
+    for(unsigned int i=0; i<buffer_n; ) {
+        const uint32_t k = index[i];
+        const unsigned int first = i;
+        double w = 0;
+        if( weight ) {
+            do {
+                w += weight[i++];
+            } while( i<buffer_n && index[i] == k );
+        } else {
+            do {
+                ++i;
+            } while( i<buffer_n && index[i] == k );
+            w = w0*(i - first);
+        }
+        AddAt(k, w);
     }
+    entries += buffer_n;
+    buffer_n = 0;
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DT<T>::Stage(FillStage& stage, const Axis::bin_t* x, const Axis::bin_t* y,
+                            const double* weight, unsigned int n)
+{
+    Axis::index_t xbins[flush_chunk], ybins[flush_chunk];
+    for(unsigned int i=0; i<n; i+=flush_chunk) {
+        const unsigned int m = std::min(n-i, (unsigned int)flush_chunk);
+        xaxis.FindBins(x+i, xbins, m);
+        yaxis.FindBins(y+i, ybins, m);
+        for(unsigned int j=0; j<m; ++j)
+            Stage(stage, Index(xbins[j], ybins[j]), PairWeight(xbins[j], ybins[j], weight[i+j]));
+    }
+}
+#endif /* H2D_USE_BUFFER */
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DT<T>::Commit(FillStage& stage)
+{
+    const unsigned int n = stage.Commit(sharing->locks,
+                                        [this](Axis::index_t i, double w) { AddAt(i, w); });
+    std::lock_guard<std::mutex> lock( sharing->locks.entries );
+    entries += n;
 }
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DT<T>::Share()
+{
+    if( sharing )
+        return;
+#ifdef H2D_USE_BUFFER
+    FlushBuffer();
 #endif /* H2D_USE_BUFFER */
+    // The spill map of 16 bit bins is common to all bins.
+    sharing.reset(new Sharing(BinTypeOf<T>::value == BinUInt16));
+}
 
 // ########################################################################
 
-void Histogram2D::Reset()
+template<typename T>
+Histogram2Dp Histogram2DT<T>::NewStage()
+{
+    if( !sharing )
+        return Histogram2Dp();
+    return Histogram2Dp(new Histogram2DStage<T>(*this));
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DT<T>::Reset()
 {
 #ifdef H2D_USE_BUFFER
-    buffer.clear();
+    buffer_n = 0;
 #endif /* H2D_USE_BUFFER */
-    for(int y=0; y<yaxis.GetBinCountAll(); ++y )
-        for(int x=0; x<xaxis.GetBinCountAll(); ++x )
-            SetBinContent( x, y, 0 );
+    if( sharing )
+        sharing->stage.Clear();
+    if( storage == SparseStorage ) {
+        DeleteTiles();
+    } else if( data ) {
+        std::fill(data, data + IndexCount(), T(0));
+    } else {
+#ifdef USE_ROWS
+        for(int y=0; y<yaxis.GetBinCountAll(); ++y )
+            std::fill(rows[y], rows[y] + xaxis.GetBinCountAll(), T(0));
+#endif
+    }
+    spill.clear();
     entries = 0;
 }
 
+// ########################################################################
+
+template<typename T>
+template<typename D>
+void Histogram2DT<T>::CopyBinsTo(D* dst)
+{
+#ifdef H2D_USE_BUFFER
+    if( buffer_n > 0 || ( sharing && !sharing->stage.Empty() ) )
+        FlushBuffer();
+#endif /* H2D_USE_BUFFER */
+
+    const Axis::index_t xcount = xaxis.GetBinCountAll(), ycount = yaxis.GetBinCountAll();
+    if( storage == DenseStorage && data ) {
+        const Axis::index_t count = xcount*ycount;
+        for(Axis::index_t i=0; i<count; ++i)
+            dst[i] = D(BinContent<T>::Get(data[i], spill, i));
+        return;
+    }
+    for(Axis::index_t y=0; y<ycount; ++y) {
+        D* row = dst + y*xcount;
+        for(Axis::index_t x=0; x<xcount; ++x)
+            row[x] = D(Content(x, y));
+    }
+}
+
+// ########################################################################
+
+template<typename T>
+double Histogram2DT<T>::Content(Axis::index_t xbin, Axis::index_t ybin) const
+{
+    const Axis::index_t i = Index(xbin, ybin);
+    if( storage == SparseStorage ) {
+        const T* tile = tiles[i >> (2*tile_bits)];
+        return tile ? BinContent<T>::Get(tile[i & tile_area_mask], spill, i) : 0;
+    }
+#ifdef USE_ROWS
+    if( !data )
+        return BinContent<T>::Get(rows[ybin][xbin], spill, i);
+#endif
+    return BinContent<T>::Get(data[i], spill, i);
+}
+
+// ########################################################################
+
+template<typename T>
+T* Histogram2DT<T>::NewTile()
+{
+    T* tile = new T[tile_size*tile_size];
+    std::fill(tile, tile + tile_size*tile_size, T(0));
+    return tile;
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DT<T>::DeleteTiles()
+{
+    for(size_t t=0; t<tiles.size(); ++t) {
+        delete[] tiles[t];
+        tiles[t] = 0;
+    }
+}
+
+// ########################################################################
+
+template class Histogram2DT<uint16_t>;
+template class Histogram2DT<uint32_t>;
+template class Histogram2DT<long long>;
+template class Histogram2DT<float>;
+template class Histogram2DT<double>;
+
+// ########################################################################
+// ########################################################################
+
+template<typename T>
+Histogram2DStage<T>::Histogram2DStage(Histogram2DT<T>& sh)
+    : Histogram2D( sh.GetName(), sh.GetTitle(),
+                   sh.xaxis.GetBinCount(), sh.xaxis.GetLeft(), sh.xaxis.GetRight(), sh.xaxis.GetTitle(),
+                   sh.yaxis.GetBinCount(), sh.yaxis.GetLeft(), sh.yaxis.GetRight(), sh.yaxis.GetTitle(),
+                   sh.storage )
+    , shared( sh )
+{
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DStage<T>::Add(const Histogram2Dp other, double scale)
+{
+    Flush();
+    shared.Add(other, scale);
+}
+
+// ########################################################################
+
+template<typename T>
+double Histogram2DStage<T>::GetBinContent(Axis::index_t xbin, Axis::index_t ybin)
+{
+    Flush();
+    return shared.GetBinContent(xbin, ybin);
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DStage<T>::SetBinContent(Axis::index_t xbin, Axis::index_t ybin, double c)
+{
+    Flush();
+    shared.SetBinContent(xbin, ybin, c);
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DStage<T>::Reset()
+{
+#ifdef H2D_USE_BUFFER
+    buffer_n = 0;
+#endif /* H2D_USE_BUFFER */
+    stage.Clear();
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram2DStage<T>::FillDirect(Axis::bin_t x, Axis::bin_t y, double weight)
+{
+    FillBin(xaxis.FindBin( x ), yaxis.FindBin( y ), weight);
+}
+
+// ########################################################################
+
+#ifdef H2D_USE_BUFFER
+template<typename T>
+void Histogram2DStage<T>::FlushBuffer()
+{
+    const SortStats::FlushTimer timer( buffer_n );
+    shared.Stage(stage, &buffer_x[0], &buffer_y[0], &buffer_w[0], buffer_n);
+    buffer_n = 0;
+    shared.Commit(stage);
+}
+#endif /* H2D_USE_BUFFER */
+
+// ########################################################################
+
+template class Histogram2DStage<uint16_t>;
+template class Histogram2DStage<uint32_t>;
+template class Histogram2DStage<long long>;
+template class Histogram2DStage<float>;
+template class Histogram2DStage<double>;
+
 // ########################################################################
 // ########################################################################
 
@@ -168,7 +526,7 @@ void Histogram2D::Reset()
 
 int main(int argc, char* argv[])
 {
-    Histogram2D h("ho", "hohoho", 10,0,10,"xho", 10,0,40, "yho");
+    Histogram2DT<float> h("ho", "hohoho", 10,0,10,"xho", 10,0,40, "yho");
     h.Fill( 3,20, 7);
     h.Fill( 4,19, 6);
     h.Fill( 5,-2,1 );
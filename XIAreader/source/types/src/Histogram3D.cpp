@@ -1,7 +1,9 @@
 
 
 #include "Histogram3D.h"
+#include "SortStats.h"
 
+#include <algorithm>
 #include <iostream>
 
 #ifdef H3D_USE_BUFFER
@@ -13,164 +15,444 @@ const unsigned int Histogram3D::buffer_max;
 Histogram3D::Histogram3D( const std::string& name, const std::string& title,
                           Axis::index_t ch1, Axis::bin_t l1, Axis::bin_t r1, const std::string& xt, 
                           Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& yt,
-                          Axis::index_t ch3, Axis::bin_t l3, Axis::bin_t r3, const std::string& zt)
+                          Axis::index_t ch3, Axis::bin_t l3, Axis::bin_t r3, const std::string& zt,
+                          HistogramStorage st)
     : Named( name, title )
     , xaxis( name+"_xaxis", ch1, l1, r1, xt )
     , yaxis( name+"_yaxis", ch2, l2, r2, yt )
     , zaxis( name+"_zaxis", ch3, l3, r3, zt )
-#ifndef USE_CUBE
-    , data( 0 )
-#else
-    , cube( 0 )
-#endif
-{
-#ifdef H2D_USE_BUFFER
-    buffer.reserve(buffer_max);
-#endif /* H2D_USE_BUFFER */
-
-#ifndef USE_CUBE
-    data = new data_t[xaxis.GetBinCountAll()*yaxis.GetBinCountAll()*zaxis.GetBinCountAll()];
-#else
-    cube = new data_t**[zaxis.GetBinCountAll()];
-    for(int z=0; z<zaxis.GetBinCountAll(); ++z){
-        cube[z] = new data_t*[yaxis.GetBinCountAll()];
-        for (int y=0; y<yaxis.GetBinCountAll(); ++y){
-        	cube[z][y] new data_t[xaxis.GetBinCountAll()];
-        }
-    }
-#endif
-    Reset();
+    , entries( 0 )
+    , storage( st )
+#ifdef H3D_USE_BUFFER
+    , buffer_x( buffer_max )
+    , buffer_y( buffer_max )
+    , buffer_z( buffer_max )
+    , buffer_w( buffer_max )
+    , buffer_n( 0 )
+#endif /* H3D_USE_BUFFER */
+{
 }
 
 // ########################################################################
 
 Histogram3D::~Histogram3D()
 {
-#ifndef USE_CUBE
-	delete data;
-#else
-	for (int z=0 ; z<zaxis.GetBinCountAll(); ++z){
-		for (int y=0; y<yaxis.GetBinCountAll(); ++y){
-			delete cube[z][y];
-		}
-		delete cube[z];
-	}
-	delete cube;
-#endif // USE_CUBE
-}
-
-// ########################################################################
-
-void Histogram3D::Add(const Histogram3Dp other, data_t scale)
-{
-    if( !other 
-        || other->GetName() != GetName()
-        || other->GetAxisX().GetLeft() != xaxis.GetLeft()
-        || other->GetAxisX().GetRight() != xaxis.GetRight()
-        || other->GetAxisX().GetBinCount() != xaxis.GetBinCount()
-        || other->GetAxisY().GetLeft() != yaxis.GetLeft()
-        || other->GetAxisY().GetRight() != yaxis.GetRight()
-        || other->GetAxisY().GetBinCount() != yaxis.GetBinCount()
-        || other->GetAxisZ().GetLeft() != zaxis.GetLeft()
-        || other->GetAxisZ().GetRight() != zaxis.GetRight()
-        || other->GetAxisZ().GetBinCount() != zaxis.GetBinCount() )
+}
+
+// ########################################################################
+
+bool Histogram3D::IsCompatible(const Histogram3Dp other) const
+{
+    return other
+        && other->GetName() == GetName()
+        && other->GetAxisX().GetLeft() == xaxis.GetLeft()
+        && other->GetAxisX().GetRight() == xaxis.GetRight()
+        && other->GetAxisX().GetBinCount() == xaxis.GetBinCount()
+        && other->GetAxisY().GetLeft() == yaxis.GetLeft()
+        && other->GetAxisY().GetRight() == yaxis.GetRight()
+        && other->GetAxisY().GetBinCount() == yaxis.GetBinCount()
+        && other->GetAxisZ().GetLeft() == zaxis.GetLeft()
+        && other->GetAxisZ().GetRight() == zaxis.GetRight()
+        && other->GetAxisZ().GetBinCount() == zaxis.GetBinCount();
+}
+
+// ########################################################################
+// ########################################################################
+
+template<typename T>
+Histogram3DT<T>::Histogram3DT( const std::string& name, const std::string& title,
+                               Axis::index_t ch1, Axis::bin_t l1, Axis::bin_t r1, const std::string& xt,
+                               Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& yt,
+                               Axis::index_t ch3, Axis::bin_t l3, Axis::bin_t r3, const std::string& zt,
+                               HistogramStorage st)
+    : Histogram3D( name, title, ch1, l1, r1, xt, ch2, l2, r2, yt, ch3, l3, r3, zt, st )
+    , tiles_x( 0 )
+    , tiles_y( 0 )
+    , tiles_z( 0 )
+    , last_tile( -1 )
+    , last_data( 0 )
+{
+    if( storage != DenseStorage ) {
+        tiles_x = (xaxis.GetBinCountAll() + tile_size - 1) >> tile_bits;
+        tiles_y = (yaxis.GetBinCountAll() + tile_size - 1) >> tile_bits;
+        tiles_z = (zaxis.GetBinCountAll() + tile_size - 1) >> tile_bits;
+    }
+    if( storage != SparseStorage )
+        data.resize(IndexCount(), T(0));
+}
+
+// ########################################################################
+
+template<typename T>
+Histogram3DT<T>::~Histogram3DT()
+{
+    DeleteTiles();
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DT<T>::Add(const Histogram3Dp other, double scale)
+{
+    if( !IsCompatible(other) )
         return;
 
 #ifdef H3D_USE_BUFFER
-    other->FlushBuffer();
     FlushBuffer();
 #endif /* H3D_USE_BUFFER */
 
-#ifndef USE_CUBE
-    for(int i=0; i<xaxis.GetBinCountAll()*yaxis.GetBinCountAll()*zaxis.GetBinCountAll(); ++i)
-        data[i] += scale * other->data[i];
-#else
-    for(int z=0; z<zaxis.GetBinCountAll(); ++z)
-	    for(int y=0; y<yaxis.GetBinCountAll(); ++y )
-    	    for(int x=0; x<xaxis.GetBinCountAll(); ++x )
-        	    cube[z][y][x] += scale*other->cube[z][y][x];
-#endif
+    Histogram3DT<T>* same = dynamic_cast<Histogram3DT<T>*>(other.get());
+    if( same && same != this && BinTypeOf<T>::value != BinUInt16 && storage == same->storage ) {
+#ifdef H3D_USE_BUFFER
+        same->FlushBuffer();
+#endif /* H3D_USE_BUFFER */
+        if( storage == SparseStorage ) {
+            // Same axes give the same tiles; only add those filled in 'other'.
+            const int volume = tile_size*tile_size*tile_size;
+            for(typename std::unordered_map<Axis::index_t, T*>::const_iterator it = same->tiles.begin();
+                it != same->tiles.end(); ++it) {
+                T* &dst = tiles[it->first];
+                if( !dst )
+                    dst = NewTile();
+                for(int i=0; i<volume; ++i)
+                    BinContent<T>::Add(dst[i], scale * it->second[i], spill, 0);
+            }
+            return;
+        }
+        for(size_t i=0; i<data.size(); ++i)
+            BinContent<T>::Add(data[i], scale * same->data[i], spill, i);
+        return;
+    }
+
+    other->ForEachFilled([this, scale](Axis::index_t x, Axis::index_t y, Axis::index_t z, double c)
+                         { AddAt(Index(x, y, z), scale * c); });
 }
 
 // ########################################################################
 
-Histogram3D::data_t Histogram3D::GetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin)
+template<typename T>
+void Histogram3DT<T>::ForEachFilled(const BinVisitor& visit)
 {
 #ifdef H3D_USE_BUFFER
-    if( !buffer.empty() )
+    if( buffer_n > 0 || ( sharing && !sharing->stage.Empty() ) )
         FlushBuffer();
 #endif /* H3D_USE_BUFFER */
 
-    if( xbin>=0 && xbin<xaxis.GetBinCountAll() && ybin>=0 && ybin<yaxis.GetBinCountAll() && zbin>=0 && zbin<zaxis.GetBinCountAll() ) {
-#ifndef USE_CUBE
-        return data[xaxis.GetBinCountAll()*yaxis.GetBinCountAll()*zbin + xaxis.GetBinCountAll()*ybin + xbin];
-#else
-        return cube[zbin][ybin][xbin];
-#endif
-    } else
+    const Axis::index_t nx = xaxis.GetBinCountAll(), ny = yaxis.GetBinCountAll(), nz = zaxis.GetBinCountAll();
+    if( storage != SparseStorage ) {
+        for(Axis::index_t z=0; z<nz; ++z) {
+            for(Axis::index_t y=0; y<ny; ++y ) {
+                for(Axis::index_t x=0; x<nx; ++x ) {
+                    const Axis::index_t i = Index(x, y, z);
+                    if( data[i] != T(0) )
+                        visit(x, y, z, BinContent<T>::Get(data[i], spill, i));
+                }
+            }
+        }
+        return;
+    }
+
+    for(typename std::unordered_map<Axis::index_t, T*>::const_iterator it = tiles.begin(); it != tiles.end(); ++it) {
+        const Axis::index_t x0 = (it->first % tiles_x) << tile_bits;
+        const Axis::index_t y0 = (it->first / tiles_x % tiles_y) << tile_bits;
+        const Axis::index_t z0 = (it->first / tiles_x / tiles_y) << tile_bits;
+        const T* tile = it->second;
+        for(Axis::index_t z=z0; z<std::min(z0+tile_size, nz); ++z) {
+            for(Axis::index_t y=y0; y<std::min(y0+tile_size, ny); ++y) {
+                for(Axis::index_t x=x0; x<std::min(x0+tile_size, nx); ++x) {
+                    const Axis::index_t i = Index(x, y, z);
+                    const T& bin = tile[i & tile_volume_mask];
+                    if( bin != T(0) )
+                        visit(x, y, z, BinContent<T>::Get(bin, spill, i));
+                }
+            }
+        }
+    }
+}
+
+// ########################################################################
+
+template<typename T>
+double Histogram3DT<T>::GetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin)
+{
+#ifdef H3D_USE_BUFFER
+    if( buffer_n > 0 || ( sharing && !sharing->stage.Empty() ) )
+        FlushBuffer();
+#endif /* H3D_USE_BUFFER */
+
+    if( xbin>=0 && xbin<xaxis.GetBinCountAll() && ybin>=0 && ybin<yaxis.GetBinCountAll() && zbin>=0 && zbin<zaxis.GetBinCountAll() )
+        return Content(Index(xbin, ybin, zbin));
+    else
         return 0;
 }
 
 // ########################################################################
 
-void Histogram3D::SetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin, data_t c)
+template<typename T>
+void Histogram3DT<T>::SetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin, double c)
 {
 #ifdef H3D_USE_BUFFER
-    if( !buffer.empty() )
+    if( buffer_n > 0 || ( sharing && !sharing->stage.Empty() ) )
         FlushBuffer();
 #endif /* H3D_USE_BUFFER */
 
     if( xbin>=0 && xbin<xaxis.GetBinCountAll() && ybin>=0 && ybin<yaxis.GetBinCountAll() && zbin>=0 && zbin<zaxis.GetBinCountAll() ) {
-#ifndef USE_CUBE
-        data[xaxis.GetBinCountAll()*yaxis.GetBinCountAll()*zbin + xaxis.GetBinCountAll()*ybin + xbin] = c;
-#else
-        cube[zbin][ybin][xbin] = c;
-#endif
+        const Axis::index_t i = Index(xbin, ybin, zbin);
+        // Do not allocate a tile just to store a zero.
+        if( c != 0 || Content(i) != 0 )
+            BinContent<T>::Set(At(i), c, spill, i);
     }
 }
 
 // ########################################################################
 
-void Histogram3D::FillDirect(Axis::bin_t x, Axis::bin_t y, Axis::bin_t z, data_t weight)
+template<typename T>
+void Histogram3DT<T>::FillDirect(Axis::bin_t x, Axis::bin_t y, Axis::bin_t z, double weight)
 {
-    const int xbin = xaxis.FindBin( x );
-    const int ybin = yaxis.FindBin( y );
-    const int zbin = zaxis.FindBin( z );
-#ifndef USE_CUBE
-    data[xaxis.GetBinCountAll()*yaxis.GetBinCountAll()*zbin + xaxis.GetBinCountAll()*ybin + xbin] += weight;
-#else
-    cube[zbin][ybin][xbin] += weight;
-#endif
-    entries += 1;
+    const Axis::index_t i = Index(xaxis.FindBin( x ), yaxis.FindBin( y ), zaxis.FindBin( z ));
+    if( sharing ) {
+        Stage(sharing->stage, i, weight);
+    } else {
+        AddAt(i, weight);
+        entries += 1;
+    }
 }
 
 // ########################################################################
 
 #ifdef H3D_USE_BUFFER
-void Histogram3D::FlushBuffer()
+template<typename T>
+void Histogram3DT<T>::FlushBuffer()
+{
+    const SortStats::FlushTimer timer( buffer_n );
+    if( sharing ) {
+        Stage(sharing->stage, &buffer_x[0], &buffer_y[0], &buffer_z[0], &buffer_w[0], buffer_n);
+        buffer_n = 0;
+        Commit(sharing->stage);
+        return;
+    }
+
+    Axis::index_t xbins[flush_chunk], ybins[flush_chunk], zbins[flush_chunk];
+    for(unsigned int i=0; i<buffer_n; i+=flush_chunk) {
+        const unsigned int n = std::min(buffer_n-i, (unsigned int)flush_chunk);
+        xaxis.FindBins(&buffer_x[i], xbins, n);
+        yaxis.FindBins(&buffer_y[i], ybins, n);
+        zaxis.FindBins(&buffer_z[i], zbins, n);
+        for(unsigned int j=0; j<n; ++j) {
+            const Axis::index_t k = Index(xbins[j], ybins[j], zbins[j]);
+            AddAt(k, buffer_w[i+j]);
+        }
+    }
+    entries += buffer_n;
+    buffer_n = 0;
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DT<T>::Stage(FillStage& stage, const Axis::bin_t* x, const Axis::bin_t* y,
+                            const Axis::bin_t* z, const double* weight, unsigned int n)
 {
-    if( !buffer.empty() ) {
-        for(buffer_t::const_iterator it=buffer.begin(); it<buffer.end(); ++it)
-            FillDirect(it->x, it->y, it->z, it->w);
-        buffer.clear();
+    Axis::index_t xbins[flush_chunk], ybins[flush_chunk], zbins[flush_chunk];
+    for(unsigned int i=0; i<n; i+=flush_chunk) {
+        const unsigned int m = std::min(n-i, (unsigned int)flush_chunk);
+        xaxis.FindBins(x+i, xbins, m);
+        yaxis.FindBins(y+i, ybins, m);
+        zaxis.FindBins(z+i, zbins, m);
+        for(unsigned int j=0; j<m; ++j)
+            Stage(stage, Index(xbins[j], ybins[j], zbins[j]), weight[i+j]);
     }
 }
 #endif /* H3D_USE_BUFFER */
 
 // ########################################################################
 
-void Histogram3D::Reset()
+template<typename T>
+void Histogram3DT<T>::Commit(FillStage& stage)
+{
+    const unsigned int n = stage.Commit(sharing->locks, [this](Axis::index_t i, double w)
+                                        { AddAt(i, w); });
+    std::lock_guard<std::mutex> lock( sharing->locks.entries );
+    entries += n;
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DT<T>::Share()
+{
+    if( sharing )
+        return;
+#ifdef H3D_USE_BUFFER
+    FlushBuffer();
+#endif /* H3D_USE_BUFFER */
+    // The spill map of 16 bit bins is common to all bins, and so is the
+    // tile map and last tile of SparseStorage.
+    sharing.reset(new Sharing(BinTypeOf<T>::value == BinUInt16 || storage == SparseStorage));
+}
+
+// ########################################################################
+
+template<typename T>
+Histogram3Dp Histogram3DT<T>::NewStage()
+{
+    if( !sharing )
+        return Histogram3Dp();
+    return Histogram3Dp(new Histogram3DStage<T>(*this));
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DT<T>::Reset()
 {
 #ifdef H3D_USE_BUFFER
-    buffer.clear();
+    buffer_n = 0;
 #endif /* H3D_USE_BUFFER */
-    for (int z=0; z<zaxis.GetBinCountAll(); ++z )
-    	for(int y=0; y<yaxis.GetBinCountAll(); ++y )
-        	for(int x=0; x<xaxis.GetBinCountAll(); ++x )
-            	SetBinContent( x, y, z, 0 );
+    if( sharing )
+        sharing->stage.Clear();
+    if( storage == SparseStorage )
+        DeleteTiles();
+    else
+        std::fill(data.begin(), data.end(), T(0));
+    spill.clear();
     entries = 0;
 }
 
+// ########################################################################
+
+template<typename T>
+double Histogram3DT<T>::Content(Axis::index_t i) const
+{
+    if( storage == SparseStorage ) {
+        typename std::unordered_map<Axis::index_t, T*>::const_iterator it = tiles.find(i >> (3*tile_bits));
+        return ( it != tiles.end() ) ? BinContent<T>::Get(it->second[i & tile_volume_mask], spill, i) : 0;
+    }
+    return BinContent<T>::Get(data[i], spill, i);
+}
+
+// ########################################################################
+
+template<typename T>
+T* Histogram3DT<T>::NewTile()
+{
+    const int volume = tile_size*tile_size*tile_size;
+    T* tile = new T[volume];
+    std::fill(tile, tile + volume, T(0));
+    return tile;
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DT<T>::DeleteTiles()
+{
+    for(typename std::unordered_map<Axis::index_t, T*>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+        delete[] it->second;
+    tiles.clear();
+    last_tile = -1;
+    last_data = 0;
+}
+
+// ########################################################################
+
+template class Histogram3DT<uint16_t>;
+template class Histogram3DT<uint32_t>;
+template class Histogram3DT<long long>;
+template class Histogram3DT<float>;
+template class Histogram3DT<double>;
+
+// ########################################################################
+// ########################################################################
+
+template<typename T>
+Histogram3DStage<T>::Histogram3DStage(Histogram3DT<T>& sh)
+    : Histogram3D( sh.GetName(), sh.GetTitle(),
+                   sh.xaxis.GetBinCount(), sh.xaxis.GetLeft(), sh.xaxis.GetRight(), sh.xaxis.GetTitle(),
+                   sh.yaxis.GetBinCount(), sh.yaxis.GetLeft(), sh.yaxis.GetRight(), sh.yaxis.GetTitle(),
+                   sh.zaxis.GetBinCount(), sh.zaxis.GetLeft(), sh.zaxis.GetRight(), sh.zaxis.GetTitle(),
+                   sh.storage )
+    , shared( sh )
+{
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DStage<T>::Add(const Histogram3Dp other, double scale)
+{
+    Flush();
+    shared.Add(other, scale);
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DStage<T>::ForEachFilled(const BinVisitor& visit)
+{
+    Flush();
+    shared.ForEachFilled(visit);
+}
+
+// ########################################################################
+
+template<typename T>
+double Histogram3DStage<T>::GetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin)
+{
+    Flush();
+    return shared.GetBinContent(xbin, ybin, zbin);
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DStage<T>::SetBinContent(Axis::index_t xbin, Axis::index_t ybin, Axis::index_t zbin, double c)
+{
+    Flush();
+    shared.SetBinContent(xbin, ybin, zbin, c);
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DStage<T>::Reset()
+{
+#ifdef H3D_USE_BUFFER
+    buffer_n = 0;
+#endif /* H3D_USE_BUFFER */
+    stage.Clear();
+}
+
+// ########################################################################
+
+template<typename T>
+void Histogram3DStage<T>::FillDirect(Axis::bin_t x, Axis::bin_t y, Axis::bin_t z, double weight)
+{
+    const Axis::index_t i = shared.Index(xaxis.FindBin( x ), yaxis.FindBin( y ), zaxis.FindBin( z ));
+    shared.Stage(stage, i, weight);
+}
+
+// ########################################################################
+
+#ifdef H3D_USE_BUFFER
+template<typename T>
+void Histogram3DStage<T>::FlushBuffer()
+{
+    const SortStats::FlushTimer timer( buffer_n );
+    shared.Stage(stage, &buffer_x[0], &buffer_y[0], &buffer_z[0], &buffer_w[0], buffer_n);
+    buffer_n = 0;
+    shared.Commit(stage);
+}
+#endif /* H3D_USE_BUFFER */
+
+// ########################################################################
+
+template class Histogram3DStage<uint16_t>;
+template class Histogram3DStage<uint32_t>;
+template class Histogram3DStage<long long>;
+template class Histogram3DStage<float>;
+template class Histogram3DStage<double>;
+
 // ########################################################################
 // ########################################################################
 
@@ -182,7 +464,7 @@ void Histogram3D::Reset()
 
 int main(int argc, char* argv[])
 {
-    Histogram3D h("ho", "hohoho", 10,0,10,"xho", 10,0,40, "yho", 10,0,20, "zho");
+    Histogram3DT<float> h("ho", "hohoho", 10,0,10,"xho", 10,0,40, "yho", 10,0,20, "zho");
     h.Fill( 3,20,10, 7);
     h.Fill( 4,19,3, 6);
     h.Fill( 5,-2,13,1 );
@@ -5,6 +5,7 @@
 #include "Histogram2D.h"
 #include "Histogram3D.h"
 
+#include <algorithm>
 #include <iostream>
 
 Named::Named( const std::string& nm, const std::string& ttl)
@@ -30,28 +31,79 @@ Axis::Axis(const std::string& name, index_t c, bin_t l, bin_t r, const std::stri
         std::cout << "zero binwidth for axis '" << name << "'" << std::endl;
     if ( binwidth < 0 )
         std::cout << "negative binwidth for axis '" << name << "'" << std::endl;
+    inv_binwidth = 1/binwidth;
+    last = channels2-2;
 }
 
 // ########################################################################
+
+void Axis::FindBins(const bin_t* x, index_t* bins, size_t n) const
+{
+    const bin_t l = left, inv = inv_binwidth, hi = last;
+    for(size_t i=0; i<n; ++i) {
+        bin_t t = (x[i] - l)*inv;
+        t = ( t < hi ) ? t : hi;
+        t = ( t > -1 ) ? t : -1;
+        index_t bin = index_t(t);
+        bin -= ( t < bin );
+        bins[i] = bin + 1;
+    }
+}
+
+// ########################################################################
+// ########################################################################
+
+static const char* bin_type_names[] = { "uint16", "uint32", "int64", "float", "double" };
+
+const char* BinTypeName(BinType type)
+{
+    return bin_type_names[type];
+}
+
+// ########################################################################
+
+bool BinTypeFromName(const std::string& name, BinType& type)
+{
+    for(int i=BinUInt16; i<=BinDouble; ++i) {
+        if( name == bin_type_names[i] ) {
+            type = BinType(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// ########################################################################
+// ########################################################################
+
+Histograms::Histograms()
+    : primary( 0 )
+    , copies( 0 )
+    , budget( 0 )
+{
+}
+
 // ########################################################################
 
 Histograms::~Histograms()
 {
-    /*
-    for( map1d_t::iterator it = map1d.begin(); it != map1d.end(); ++it )
-        delete it->second;
-    for( map2d_t::iterator it = map2d.begin(); it != map2d.end(); ++it )
-        delete it->second;
-        */
 }
 
 // ########################################################################
 
 Histogram1Dp Histograms::Create1D( const std::string& name, const std::string& title,
-                                   Axis::index_t c, Axis::bin_t l, Axis::bin_t r, const std::string& xtitle )
+                                   Axis::index_t c, Axis::bin_t l, Axis::bin_t r, const std::string& xtitle,
+                                   BinType type )
 {
-    Histogram1Dp h(new Histogram1D(name, title, c, l, r, xtitle));
-    map1d[ name ] = h;
+    Histogram1Dp h;
+    switch( type ) {
+    case BinUInt16: h.reset(new Histogram1DT<uint16_t>(name, title, c, l, r, xtitle));  break;
+    case BinUInt32: h.reset(new Histogram1DT<uint32_t>(name, title, c, l, r, xtitle));  break;
+    case BinInt64:  h.reset(new Histogram1DT<long long>(name, title, c, l, r, xtitle)); break;
+    case BinFloat:  h.reset(new Histogram1DT<float>(name, title, c, l, r, xtitle));     break;
+    case BinDouble: h.reset(new Histogram1DT<double>(name, title, c, l, r, xtitle));    break;
+    }
+    pool1d.Add( name, h );
     return h;
 }
 
@@ -59,10 +111,34 @@ Histogram1Dp Histograms::Create1D( const std::string& name, const std::string& t
 
 Histogram2Dp Histograms::Create2D( const std::string& name, const std::string& title,
                                    Axis::index_t ch1, Axis::bin_t l1, Axis::bin_t r1, const std::string& xtitle,
-                                   Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& ytitle)
+                                   Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& ytitle,
+                                   HistogramStorage storage, BinType type)
 {
-    Histogram2Dp h(new Histogram2D(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle));
-    map2d[ name ] = h;
+    if( storage == SymmetricStorage && ( ch1 != ch2 || l1 != l2 || r1 != r2 ) ) {
+        std::cerr << "Symmetric matrix '" << name << "' needs the same x and y axes, using dense storage." << std::endl;
+        storage = DenseStorage;
+    }
+
+    Histogram2Dp h;
+    if( primary ) {
+        Histogram2Dp p = primary->Find2D( name );
+        if( p ) {
+            primary->Plan( p );
+            if( p->IsShared() ) {
+                h = p->NewStage();
+                pool2d.Add( name, h );
+                return h;
+            }
+        }
+    }
+    switch( type ) {
+    case BinUInt16: h.reset(new Histogram2DT<uint16_t>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, storage));  break;
+    case BinUInt32: h.reset(new Histogram2DT<uint32_t>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, storage));  break;
+    case BinInt64:  h.reset(new Histogram2DT<long long>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, storage)); break;
+    case BinFloat:  h.reset(new Histogram2DT<float>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, storage));     break;
+    case BinDouble: h.reset(new Histogram2DT<double>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, storage));    break;
+    }
+    pool2d.Add( name, h );
     return h;
 }
 
@@ -71,10 +147,34 @@ Histogram2Dp Histograms::Create2D( const std::string& name, const std::string& t
 Histogram3Dp Histograms::Create3D( const std::string& name, const std::string& title,
                                    Axis::index_t ch1, Axis::bin_t l1, Axis::bin_t r1, const std::string& xtitle,
                                    Axis::index_t ch2, Axis::bin_t l2, Axis::bin_t r2, const std::string& ytitle,
-                                   Axis::index_t ch3, Axis::bin_t l3, Axis::bin_t r3, const std::string& ztitle)
+                                   Axis::index_t ch3, Axis::bin_t l3, Axis::bin_t r3, const std::string& ztitle,
+                                   HistogramStorage storage, BinType type)
 {
-    Histogram3Dp h(new Histogram3D(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle));
-    map3d[ name ] = h;
+    if( storage == SymmetricStorage ) {
+        std::cerr << "3D histogram '" << name << "' cannot be symmetric, using dense storage." << std::endl;
+        storage = DenseStorage;
+    }
+
+    Histogram3Dp h;
+    if( primary ) {
+        Histogram3Dp p = primary->Find3D( name );
+        if( p ) {
+            primary->Plan( p );
+            if( p->IsShared() ) {
+                h = p->NewStage();
+                pool3d.Add( name, h );
+                return h;
+            }
+        }
+    }
+    switch( type ) {
+    case BinUInt16: h.reset(new Histogram3DT<uint16_t>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle, storage));  break;
+    case BinUInt32: h.reset(new Histogram3DT<uint32_t>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle, storage));  break;
+    case BinInt64:  h.reset(new Histogram3DT<long long>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle, storage)); break;
+    case BinFloat:  h.reset(new Histogram3DT<float>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle, storage));     break;
+    case BinDouble: h.reset(new Histogram3DT<double>(name, title, ch1, l1, r1, xtitle, ch2, l2, r2, ytitle, ch3, l3, r3, ztitle, storage));    break;
+    }
+    pool3d.Add( name, h );
     return h;
 }
 
@@ -82,89 +182,229 @@ Histogram3Dp Histograms::Create3D( const std::string& name, const std::string& t
 
 void Histograms::ResetAll()
 {
-    for( map1d_t::iterator it = map1d.begin(); it != map1d.end(); ++it )
-        it->second->Reset();
-    for( map2d_t::iterator it = map2d.begin(); it != map2d.end(); ++it )
-        it->second->Reset();
+    const list1d_t& list1d = pool1d.All();
+    for( size_t i = 0; i < list1d.size(); ++i )
+        list1d[i]->Reset();
+    const list2d_t& list2d = pool2d.All();
+    for( size_t i = 0; i < list2d.size(); ++i )
+        list2d[i]->Reset();
+    const list3d_t& list3d = pool3d.All();
+    for( size_t i = 0; i < list3d.size(); ++i )
+        list3d[i]->Reset();
 }
 
 // ########################################################################
 
-Histogram1Dp Histograms::Find1D( const std::string& name )
+std::unique_ptr<Histograms> Histograms::Snapshot(bool filled_only)
 {
-    map1d_t::iterator it = map1d.find( name );
-    if( it != map1d.end() )
-        return it->second;
-    else
-        return 0;
+    std::unique_ptr<Histograms> copy( new Histograms() );
+
+    const list1d_t& list1d = pool1d.All();
+    for( size_t i = 0; i < list1d.size(); ++i ) {
+        const Histogram1Dp& h = list1d[i];
+        h->Flush();
+        if( filled_only && h->GetEntries() == 0 )
+            continue;
+        const Axis& x = h->GetAxisX();
+        Histogram1Dp c = copy->Create1D( h->GetName(), h->GetTitle(),
+                                         x.GetBinCount(), x.GetLeft(), x.GetRight(), x.GetTitle(),
+                                         h->GetBinType() );
+        c->Add( h, 1 );
+        c->SetEntries( h->GetEntries() );
+    }
+    const list2d_t& list2d = pool2d.All();
+    for( size_t i = 0; i < list2d.size(); ++i ) {
+        const Histogram2Dp& h = list2d[i];
+        h->Flush();
+        if( filled_only && h->GetEntries() == 0 )
+            continue;
+        const Axis& x = h->GetAxisX(), &y = h->GetAxisY();
+        Histogram2Dp c = copy->Create2D( h->GetName(), h->GetTitle(),
+                                         x.GetBinCount(), x.GetLeft(), x.GetRight(), x.GetTitle(),
+                                         y.GetBinCount(), y.GetLeft(), y.GetRight(), y.GetTitle(),
+                                         h->GetStorage(), h->GetBinType() );
+        c->Add( h, 1 );
+        c->SetEntries( h->GetEntries() );
+    }
+    const list3d_t& list3d = pool3d.All();
+    for( size_t i = 0; i < list3d.size(); ++i ) {
+        const Histogram3Dp& h = list3d[i];
+        h->Flush();
+        if( filled_only && h->GetEntries() == 0 )
+            continue;
+        const Axis& x = h->GetAxisX(), &y = h->GetAxisY(), &z = h->GetAxisZ();
+        Histogram3Dp c = copy->Create3D( h->GetName(), h->GetTitle(),
+                                         x.GetBinCount(), x.GetLeft(), x.GetRight(), x.GetTitle(),
+                                         y.GetBinCount(), y.GetLeft(), y.GetRight(), y.GetTitle(),
+                                         z.GetBinCount(), z.GetLeft(), z.GetRight(), z.GetTitle(),
+                                         h->GetStorage(), h->GetBinType() );
+        c->Add( h, 1 );
+        c->SetEntries( h->GetEntries() );
+    }
+    return copy;
 }
 
 // ########################################################################
 
-Histogram2Dp Histograms::Find2D( const std::string& name )
+void Histograms::Merge(Histograms& other)
 {
-    map2d_t::iterator it = map2d.find( name );
-    if( it != map2d.end() )
-        return it->second;
-    else
-        return 0;
+    const list1d_t& list1d = pool1d.All();
+    for( size_t i = 0; i < list1d.size(); ++i ) {
+        Histogram1Dp you = other.Find1D( list1d[i]->GetName() );
+        if( you ) {
+            list1d[i]->Add( you, 1 );
+            list1d[i]->SetEntries( list1d[i]->GetEntries() + you->GetEntries() );
+        }
+    }
+    const list2d_t& list2d = pool2d.All();
+    for( size_t i = 0; i < list2d.size(); ++i ) {
+        Histogram2Dp you = other.Find2D( list2d[i]->GetName() );
+        if( you ) {
+            list2d[i]->Add( you, 1 );
+            list2d[i]->SetEntries( list2d[i]->GetEntries() + you->GetEntries() );
+        }
+    }
+    const list3d_t& list3d = pool3d.All();
+    for( size_t i = 0; i < list3d.size(); ++i ) {
+        Histogram3Dp you = other.Find3D( list3d[i]->GetName() );
+        if( you ) {
+            list3d[i]->Add( you, 1 );
+            list3d[i]->SetEntries( list3d[i]->GetEntries() + you->GetEntries() );
+        }
+    }
 }
 
 // ########################################################################
 
-Histogram3Dp Histograms::Find3D( const std::string& name )
+void Histograms::Share(Histograms& p)
 {
-    map3d_t::iterator it = map3d.find( name );
-    if( it != map3d.end() )
-        return it->second;
-    else
-        return 0;
+    primary = &p;
 }
 
 // ########################################################################
 
-void Histograms::Merge(Histograms& other)
+//! Get the memory used by the bins of a histogram.
+/*! \return the size in bytes.
+ */
+static size_t bin_bytes(const Histogram2Dp& h)
 {
-    for( map1d_t::iterator it = map1d.begin(); it != map1d.end(); ++it ) {
-        Histogram1Dp me = it->second;
-        Histogram1Dp you = other.Find1D( me->GetName() );
-        if( you )
-            me->Add( you, 1 );
-    }
-    for( map2d_t::iterator it = map2d.begin(); it != map2d.end(); ++it ) {
-        Histogram2Dp me = it->second;
-        Histogram2Dp you = other.Find2D( me->GetName() );
-        if( you )
-            me->Add( you, 1 );
+    const size_t nx = h->GetAxisX().GetBinCountAll(), ny = h->GetAxisY().GetBinCountAll();
+    if( h->GetStorage() == SymmetricStorage )
+        return ny*(ny+1)/2 * BinTypeSize(h->GetBinType());
+    return nx * ny * BinTypeSize(h->GetBinType());
+}
+
+//! Get the memory used by the bins of a histogram.
+/*! With SparseStorage, this is the size with all tiles allocated.
+ *
+ * \return the size in bytes.
+ */
+static size_t bin_bytes(const Histogram3Dp& h)
+{
+    return size_t(h->GetAxisX().GetBinCountAll()) * h->GetAxisY().GetBinCountAll()
+        * h->GetAxisZ().GetBinCountAll() * BinTypeSize(h->GetBinType());
+}
+
+// ########################################################################
+
+void Histograms::PlanSharing(int c, size_t* b)
+{
+    copies = c;
+    budget = b;
+
+    // Copy the smallest histograms first.
+    std::vector<std::pair<size_t, std::string> > sizes;
+    const list2d_t& list2d = pool2d.All();
+    for( size_t i = 0; i < list2d.size(); ++i )
+        sizes.push_back( std::make_pair( bin_bytes(list2d[i]), list2d[i]->GetName() ) );
+    const list3d_t& list3d = pool3d.All();
+    for( size_t i = 0; i < list3d.size(); ++i )
+        sizes.push_back( std::make_pair( bin_bytes(list3d[i]), list3d[i]->GetName() ) );
+    std::sort( sizes.begin(), sizes.end() );
+
+    for( size_t i = 0; i < sizes.size(); ++i ) {
+        Histogram2Dp h2 = Find2D( sizes[i].second );
+        if( h2 )
+            Plan( h2 );
+        else
+            Plan( Find3D( sizes[i].second ) );
     }
 }
 
 // ########################################################################
 
-Histograms::list1d_t Histograms::GetAll1D()
+void Histograms::Plan(Histogram2Dp h)
+{
+    if( planned.insert( h->GetName() ).second && !Afford( bin_bytes(h) ) )
+        h->Share();
+}
+
+// ########################################################################
+
+void Histograms::Plan(Histogram3Dp h)
 {
-    list1d_t list1d;
-    for( map1d_t::iterator it = map1d.begin(); it != map1d.end(); ++it )
-        list1d.push_back( it->second );
-    return list1d;
+    if( planned.insert( h->GetName() ).second && !Afford( bin_bytes(h) ) )
+        h->Share();
 }
 
 // ########################################################################
 
-Histograms::list2d_t Histograms::GetAll2D()
+bool Histograms::Afford(size_t bytes)
 {
-    list2d_t list2d;
-    for( map2d_t::iterator it = map2d.begin(); it != map2d.end(); ++it )
-        list2d.push_back( it->second );
-    return list2d;
+    const size_t need = bytes * copies;
+    if( !budget || need > *budget )
+        return false;
+    *budget -= need;
+    return true;
 }
 
 // ########################################################################
 
-Histograms::list3d_t Histograms::GetAll3D()
+void Histograms::Collect()
 {
-    list3d_t list3d;
-    for( map3d_t::iterator it = map3d.begin(); it != map3d.end(); ++it )
-        list3d.push_back( it->second );
-    return list3d;
+    if( !primary )
+        return;
+
+    const list1d_t& list1d = pool1d.All();
+    for( size_t i = 0; i < list1d.size(); ++i ) {
+        Histogram1Dp p = primary->Find1D( list1d[i]->GetName() );
+        if( p ) {
+            p->Add( list1d[i], 1 );
+            p->SetEntries( p->GetEntries() + list1d[i]->GetEntries() );
+        }
+        list1d[i]->Reset();
+    }
+    const list2d_t& list2d = pool2d.All();
+    for( size_t i = 0; i < list2d.size(); ++i ) {
+        const Histogram2Dp& h = list2d[i];
+        if( h->GetShared() ) {
+            h->Flush();
+            h->GetShared()->Flush();
+        } else {
+            Histogram2Dp p = primary->Find2D( h->GetName() );
+            if( p ) {
+                p->Add( h, 1 );
+                p->SetEntries( p->GetEntries() + h->GetEntries() );
+            }
+            h->Reset();
+        }
+    }
+    const list3d_t& list3d = pool3d.All();
+    for( size_t i = 0; i < list3d.size(); ++i ) {
+        const Histogram3Dp& h = list3d[i];
+        if( h->GetShared() ) {
+            h->Flush();
+            h->GetShared()->Flush();
+        } else {
+            Histogram3Dp p = primary->Find3D( h->GetName() );
+            if( p ) {
+                p->Add( h, 1 );
+                p->SetEntries( p->GetEntries() + h->GetEntries() );
+            }
+            h->Reset();
+        }
+    }
 }
+
+
+
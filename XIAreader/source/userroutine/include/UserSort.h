@@ -32,6 +32,11 @@ public:
 
     bool Sort(const Event& event);
 
+    //! Keep events with a particle inside the thickness gate in a skim.
+    /*! \return true if the event sorted last passed 'thick_range'.
+     */
+    bool Skim() const { return particle_gate; }
+
     bool End();
 
     //! We have no user commands that needs to be set.
@@ -71,6 +76,23 @@ private:
                           const double &excitation, /*!< We need the reconstructed excitation energy    */
                           const Event &event        /*!< Event structure.                               */);
 
+    // A calibrated LaBr hit, for gamma-gamma coincidences and the batch file histograms.
+    struct LaBrHit {
+        double energy;      // Energy [keV]
+        double time;        // Time relative to the trigger [ns]
+        int detector;       // Detector number
+        const word_t *word; // The word of the hit
+    };
+
+    // Method for filling the gamma-gamma matrix with each pair of LaBr hits within the coincidence window.
+    void AnalyzeLaBrPairs(LaBrHit *hits,   /*!< The LaBr hits of the event, sorted by time on return  */
+                          int n             /*!< Number of hits                                         */);
+
+    // Method for filling the gamma-gamma-particle cube with each ordered pair of prompt gamma-rays.
+    void AnalyzeGammaGamma(const double *energy,      /*!< Energies of the prompt gamma-rays             */
+                           int n,                     /*!< Number of prompt gamma-rays                   */
+                           const double &excitation   /*!< We need the reconstructed excitation energy    */);
+
     // SINGLES histograms.
     Histogram1Dp energy_labr_raw[NUM_LABR_DETECTORS], energy_labr[NUM_LABR_DETECTORS];
     Histogram1Dp energy_dE_raw[NUM_SI_DE_DET], energy_dE[NUM_SI_DE_DET];
@@ -102,6 +124,13 @@ private:
     Histogram2Dp exgam_ppac, exgam_ppac_bg;
     Histogram2Dp exgam_veto_ppac, exgam_veto_ppac_bg;
 
+    // Gamma-ray - gamma-ray coincidence matrix, each pair filled once
+    Histogram2Dp gamgam;
+
+    // Gamma-ray - gamma-ray - particle coincidence cube, only with 'exgamgam on'.
+    // Only the filled tiles are allocated; as one array it would need 14 GB.
+    Histogram3Dp exgamgam;
+
     // Gain labr
     Parameter gain_labr;
 
@@ -148,6 +177,24 @@ private:
     // Time gates for the ppacs.
     Parameter ppac_time_cuts;
 
+    // Largest time difference [ns] between two LaBr hits in the gamma-gamma matrix.
+    Parameter labr_coinc_time;
+
+
+    // Variables available to histograms declared in the batch file.
+    int var_e, var_de, var_e_raw, var_de_raw, var_ring, var_pad, var_thick, var_etot, var_ex;
+    int var_labr_e, var_labr_t, var_labr_id;
+
+    // State of the random generator used for smoothing, one per instance
+    // and seeded from the instance number, so that routines sorted in
+    // parallel neither share nor repeat each other's sequence.
+    mutable unsigned short rand_state[3];
+
+    // Whether exgamgam is filled, set by 'exgamgam on|off'.
+    bool fill_exgamgam;
+
+    // Whether the event sorted last had a particle inside the thickness gate.
+    bool particle_gate;
 
     int n_fail_de, n_fail_e;
 
@@ -25,10 +25,13 @@
 #include "WordBuffer.h"
 #include "Histogram1D.h"
 #include "Histogram2D.h"
+#include "Histogram3D.h"
 #include "Histograms.h"
 #include "Event.h"
 
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <iostream>
 #include <cmath>
@@ -92,7 +95,31 @@ UserSort::UserSort()
     , thick_range    ( GetParameters(), "thick_range", 2      )
     , labr_time_cuts  ( GetParameters(), "labr_time_cuts", 2*2  )
     , ppac_time_cuts ( GetParameters(), "ppac_time_cuts", 2*2 )
+    , labr_coinc_time( GetParameters(), "labr_coinc_time", 1, 10 )
+    , fill_exgamgam( false )
+    , particle_gate( false )
 {
+    var_e       = plan.Define("e");
+    var_de      = plan.Define("de");
+    var_e_raw   = plan.Define("e_raw");
+    var_de_raw  = plan.Define("de_raw");
+    var_ring    = plan.Define("ring");
+    var_pad     = plan.Define("pad");
+    var_thick   = plan.Define("thick");
+    var_etot    = plan.Define("etot");
+    var_ex      = plan.Define("ex");
+    var_labr_e  = plan.Define("labr.E");
+    var_labr_t  = plan.Define("labr.T");
+    var_labr_id = plan.Define("labr.id");
+
+    // The first instance starts as drand48() without srand48(); the
+    // others, e.g. sorting in other threads, get their own sequences.
+    // Instances are created in the same order on every run.
+    static std::atomic<unsigned int> instances( 0 );
+    const unsigned int instance = instances++;
+    rand_state[0] = 0x330E;
+    rand_state[1] = 0xABCD ^ ( ( instance*0x9E37u ) & 0xFFFF );
+    rand_state[2] = 0x1234 ^ ( ( instance >> 16 ) & 0xFFFF );
 }
 
 
@@ -102,13 +129,13 @@ double UserSort::CalibrateE(const word_t &w) const
     switch ( info.type ) {
 
     case labr : {
-        return gain_labr[info.detectorNum]*(w.adcdata + drand48() - 0.5) + shift_labr[info.detectorNum];
+        return gain_labr[info.detectorNum]*(w.adcdata + erand48(rand_state) - 0.5) + shift_labr[info.detectorNum];
     }
     case deDet : {
-        return gain_dE[info.detectorNum]*(w.adcdata + drand48() - 0.5) + shift_dE[info.detectorNum];
+        return gain_dE[info.detectorNum]*(w.adcdata + erand48(rand_state) - 0.5) + shift_dE[info.detectorNum];
     }
     case eDet : {
-        return gain_E[info.detectorNum]*(w.adcdata + drand48() - 0.5) + shift_E[info.detectorNum];
+        return gain_E[info.detectorNum]*(w.adcdata + erand48(rand_state) - 0.5) + shift_E[info.detectorNum];
     }
     case ppac : {
         return w.adcdata;
@@ -219,6 +246,21 @@ bool UserSort::UserCommand(const std::string &cmd)
         }
     } else if ( name == "parameter" ){
         return GetParameters().SetAll(icmd);
+    } else if ( name == "exgamgam" ){
+        icmd >> tmp;
+        if ( tmp == "on" ){
+            // The cube is created the first time it is switched on.
+            if ( !exgamgam ){
+                tmp = "exgamgam";
+                exgamgam = Cube(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]", SparseStorage);
+            }
+            fill_exgamgam = true;
+        } else if ( tmp == "off" ){
+            fill_exgamgam = false;
+        } else {
+            std::cerr << __PRETTY_FUNCTION__ << ", exgamgam: Expected 'on' or 'off', not '" << tmp << "'" << std::endl;
+            return false;
+        }
     } else {
         return false;
     }
@@ -235,16 +277,16 @@ void UserSort::CreateSpectra()
 
         // Create energy spectra
         sprintf(tmp, "energy_raw_labr_%02d", i+1);
-        energy_labr_raw[i] = Spec(tmp, tmp, 32768, 0, 32768, "Energy [ch]");
+        energy_labr_raw[i] = Spec<uint32_t>(tmp, tmp, 32768, 0, 32768, "Energy [ch]");
 
         sprintf(tmp, "energy_labr_%02d", i+1);
         energy_labr[i] = Spec(tmp, tmp, 10000, 0, 10000, "Energy [keV]");
 
         sprintf(tmp, "energy_time_labr_%02d", i+1);
-        energy_time_labr[i] = Mat(tmp, tmp, 1000, 0, 16000, "LaBr energy [keV]", 2000, -100, 100, "Time difference [ns]");
+        energy_time_labr[i] = Mat(tmp, tmp, 1000, 0, 16000, "LaBr energy [keV]", 2000, -100, 100, "Time difference [ns]", SparseStorage);
 
         sprintf(tmp, "energy_time_labr_aboveSn_%02d", i+1);
-        energy_time_labr_above[i] = Mat(tmp, tmp, 1000, 0, 16000, "LaBr energy [keV]", 2000, -100, 100, "Time difference [ns]");
+        energy_time_labr_above[i] = Mat(tmp, tmp, 1000, 0, 16000, "LaBr energy [keV]", 2000, -100, 100, "Time difference [ns]", SparseStorage);
     }
 
     // Allocating the dE 'singles' spectra
@@ -252,7 +294,7 @@ void UserSort::CreateSpectra()
 
         // Create energy spectra
         sprintf(tmp, "energy_raw_dE_%02d", i);
-        energy_dE_raw[i] = Spec(tmp, tmp, 32768, 0, 32768, "Energy [ch]");
+        energy_dE_raw[i] = Spec<uint32_t>(tmp, tmp, 32768, 0, 32768, "Energy [ch]");
 
         sprintf(tmp, "energy_dE_%02d", i);
         energy_dE[i] = Spec(tmp, tmp, 10000, 0, 10000, "Energy [keV]");
@@ -263,7 +305,7 @@ void UserSort::CreateSpectra()
 
         // Create energy spectra
         sprintf(tmp, "energy_raw_E_%02d", i);
-        energy_E_raw[i] = Spec(tmp, tmp, 32768, 0, 32768, "Energy [ch]");
+        energy_E_raw[i] = Spec<uint32_t>(tmp, tmp, 32768, 0, 32768, "Energy [ch]");
 
         sprintf(tmp, "energy_E_%02d", i);
         energy_E[i] = Spec(tmp, tmp, 10000, 0, 10000, "Energy [keV]");
@@ -282,12 +324,12 @@ void UserSort::CreateSpectra()
             // Make the 'raw' ede spectrum.
             sprintf(tmp, "ede_raw_b%d_f%d", i, j);
             sprintf(tmp2, "E : DE raw, pad %d, ring %d", i, j);
-            ede_raw[i][j] = Mat(tmp, tmp2, 2048, 0, 32768, "Back energy [ch]", 2048, 0, 32768, "Front energy [ch]");
+            ede_raw[i][j] = Mat(tmp, tmp2, 2048, 0, 32768, "Back energy [ch]", 2048, 0, 32768, "Front energy [ch]", SparseStorage);
 
             // Make 'calibrated' ede spectrum.
             sprintf(tmp, "ede_b%d_f%d", i, j);
             sprintf(tmp2, "E : DE calibrated, pad %d, ring %d", i, j);
-            ede[i][j] = Mat(tmp, tmp2, 2000, 0, 20000, "Back energy [keV]", 500, 0, 5000, "Front energy [keV]");
+            ede[i][j] = Mat(tmp, tmp2, 2000, 0, 20000, "Back energy [keV]", 500, 0, 5000, "Front energy [keV]", SparseStorage);
 
             // Make total energy spectra.
             sprintf(tmp, "h_ede_b%d_f%d", i, j);
@@ -306,11 +348,11 @@ void UserSort::CreateSpectra()
 
         sprintf(tmp, "excitation_time_ppac_%d", i);
         sprintf(tmp2, "Excitation : ppac time, PPAC %d", i);
-        excitation_time_ppac[i] = Mat(tmp, tmp2, 2000, 0, 10000, "Excitation energy [keV]", 2000, -100, 100, "t_{PPAC} - t_{#Delta E} [ns]");
+        excitation_time_ppac[i] = Mat(tmp, tmp2, 2000, 0, 10000, "Excitation energy [keV]", 2000, -100, 100, "t_{PPAC} - t_{#Delta E} [ns]", SparseStorage);
 
         sprintf(tmp, "energy_time_ppac_%d", i);
         sprintf(tmp2, "LaBr energy : ppac time, PPAC %d", i);
-        energy_time_ppac[i] = Mat(tmp, tmp2, 2000, 0, 10000, "LaBr energy [keV]", 2000, -100, 100, "t_{PPAC} - t_{LaBr} [ns]");
+        energy_time_ppac[i] = Mat(tmp, tmp2, 2000, 0, 10000, "LaBr energy [keV]", 2000, -100, 100, "t_{PPAC} - t_{LaBr} [ns]", SparseStorage);
     }
 
     // Time spectra (except those 'listed')
@@ -328,11 +370,11 @@ void UserSort::CreateSpectra()
 
     sprintf(tmp, "energy_time_labr_all");
     sprintf(tmp2, "E_{LaBr} : t_{LaBr} - t_{dE ANY}, all");
-    energy_time_labr_all = Mat(tmp, tmp2, 2000, 0, 16000, "Energy LaBr [keV]", 2000, -50, 50, "t_{LaBr} - t_{DE} [ns]");
+    energy_time_labr_all = Mat(tmp, tmp2, 2000, 0, 16000, "Energy LaBr [keV]", 2000, -50, 50, "t_{LaBr} - t_{DE} [ns]", TiledStorage);
 
     sprintf(tmp, "ede_all");
     sprintf(tmp2, "E : DE, all");
-    ede_all = Mat(tmp, tmp2, 4000, 0, 20000, "Back energy [keV]", 1000, 0, 5000, "Front energy [keV]");
+    ede_all = Mat(tmp, tmp2, 4000, 0, 20000, "Back energy [keV]", 1000, 0, 5000, "Front energy [keV]", TiledStorage);
 
     sprintf(tmp, "ede_gate");
     sprintf(tmp2, "E : DE, after particle gate");
@@ -351,22 +393,28 @@ void UserSort::CreateSpectra()
     h_ex_all = Spec(tmp, tmp2, 20000, 0, 20000, "Excitation energy [keV]");
 
     sprintf(tmp, "exgam");
-    exgam = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]");
+    exgam = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]", TiledStorage);
 
     sprintf(tmp, "exgam_bg");
-    exgam_bg = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]");
+    exgam_bg = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]", TiledStorage);
 
     sprintf(tmp, "exgam_ppac");
-    exgam_ppac = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]");
+    exgam_ppac = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]", TiledStorage);
 
     sprintf(tmp, "exgam_ppac_bg");
-    exgam_ppac_bg = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]");
+    exgam_ppac_bg = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]", TiledStorage);
 
     sprintf(tmp, "exgam_veto_ppac");
-    exgam_veto_ppac = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]");
+    exgam_veto_ppac = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]", TiledStorage);
 
     sprintf(tmp, "exgam_veto_ppac_bg");
-    exgam_veto_ppac_bg = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]");
+    exgam_veto_ppac_bg = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1600, -1000, 15000, "Ex [keV]", TiledStorage);
+
+    // Only x <= y is stored; exports give the full matrix.
+    sprintf(tmp, "gamgam");
+    gamgam = Mat(tmp, tmp, 1500, 0, 15000, "LaBr [keV]", 1500, 0, 15000, "LaBr [keV]", SymmetricStorage);
+
+    // The cube exgamgam is created by the 'exgamgam on' command.
 
 
     n_fail_e = 0;
@@ -391,14 +439,27 @@ bool UserSort::Sort(const Event &event)
     word_t de_words[256]; // List of dE hits from pads in front of the trigger E word.
     int n_de_words=0;
 
+    LaBrHit labr_hits[NUM_LABR_DETECTORS*MAX_WORDS_PER_DET];
+    int n_labr_hits = 0;
+
+    plan.Clear();
+    particle_gate = false;
+
     // First fill some 'singles' spectra.
     for ( i = 0 ; i < NUM_LABR_DETECTORS ; ++i ){
         for ( j = 0 ; j < event.n_labr[i] ; ++j ){
             energy_labr_raw[i]->Fill(event.w_labr[i][j].adcdata);
             energy = CalibrateE(event.w_labr[i][j]);
             energy_labr[i]->Fill(energy);
+
+            LaBrHit &hit = labr_hits[n_labr_hits++];
+            hit.energy = energy;
+            hit.time = CalcTimediff(event.trigger, event.w_labr[i][j]);
+            hit.detector = i;
+            hit.word = &event.w_labr[i][j];
         }
     }
+    AnalyzeLaBrPairs(labr_hits, n_labr_hits);
 
     for ( i = 0 ; i < NUM_SI_DE_DET ; ++i ){
         for ( j = 0 ; j < event.n_dEdet[i] ; ++j ){
@@ -473,6 +534,29 @@ bool UserSort::Sort(const Event &event)
 
         ede[tel][ring]->Fill(e_energy, de_energy);
 
+        // Values for histograms declared in the batch file.
+        if ( !plan.Empty() ){
+            plan.Set(var_e, e_energy);
+            plan.Set(var_de, de_energy);
+            plan.Set(var_e_raw, e_word.adcdata);
+            plan.Set(var_de_raw, de_word.adcdata);
+            plan.Set(var_ring, ring);
+            plan.Set(var_pad, tel);
+
+            double labr_e[NUM_LABR_DETECTORS*MAX_WORDS_PER_DET];
+            double labr_t[NUM_LABR_DETECTORS*MAX_WORDS_PER_DET];
+            double labr_id[NUM_LABR_DETECTORS*MAX_WORDS_PER_DET];
+            // The energies calibrated for the singles, with the same dither.
+            for (int n = 0 ; n < n_labr_hits ; ++n){
+                labr_e[n] = labr_hits[n].energy;
+                labr_t[n] = CalcTimediff(de_word, *labr_hits[n].word);
+                labr_id[n] = labr_hits[n].detector;
+            }
+            plan.Set(var_labr_e, labr_e, n_labr_hits);
+            plan.Set(var_labr_t, labr_t, n_labr_hits);
+            plan.Set(var_labr_id, labr_id, n_labr_hits);
+        }
+
         // Seems like we may have some issues with the dE rings 6 & 7 (0-7). We will end our
         // sorting here if we have either 6 or 7.
         //if (ring == 6 || ring == 7)
@@ -483,9 +567,11 @@ bool UserSort::Sort(const Event &event)
         // Calculate 'apparent thickness'
         double thick = range.GetRange(e_energy + de_energy) - range.GetRange(e_energy);
         h_thick->Fill(thick);
+        plan.Set(var_thick, thick);
 
         // Check if correct particle.
         if ( thick >= thick_range[0] && thick <= thick_range[1] ){
+            particle_gate = true;
 
             ede_gate->Fill(e_energy, de_energy);
 
@@ -506,6 +592,8 @@ bool UserSort::Sort(const Event &event)
 
             h_ex[tel][ring]->Fill(ex);
             h_ex_all->Fill(ex);
+            plan.Set(var_etot, e_tot);
+            plan.Set(var_ex, ex);
 
             // Analyze gamma rays.
         #if FISSION
@@ -517,6 +605,7 @@ bool UserSort::Sort(const Event &event)
         }
     }
 
+    plan.Fill();
     return true;
 
 }
@@ -524,6 +613,8 @@ bool UserSort::Sort(const Event &event)
 
 void UserSort::AnalyzeGamma(const word_t &de_word, const double &excitation,const Event &event)
 {
+    double prompt_energy[NUM_LABR_DETECTORS*MAX_WORDS_PER_DET];
+    int n_prompt = 0;
 
     // We will loop over all gamma-rays.
     for (int i = 0 ; i < NUM_LABR_DETECTORS ; ++i){
@@ -544,6 +635,7 @@ void UserSort::AnalyzeGamma(const word_t &de_word, const double &excitation,cons
             switch ( CheckTimeStatus(tdiff, labr_time_cuts) ) {
                 case is_prompt : {
                     exgam->Fill(energy, excitation);
+                    prompt_energy[n_prompt++] = energy;
                     break;
                 }
                 case is_background : {
@@ -557,6 +649,7 @@ void UserSort::AnalyzeGamma(const word_t &de_word, const double &excitation,cons
             }
         }
     }
+    AnalyzeGammaGamma(prompt_energy, n_prompt, excitation);
 }
 
 void UserSort::AnalyzeGammaPPAC(const word_t &de_word, const double &excitation, const Event &event)
@@ -572,6 +665,9 @@ void UserSort::AnalyzeGammaPPAC(const word_t &de_word, const double &excitation,
         }
     }
 
+    double prompt_energy[NUM_LABR_DETECTORS*MAX_WORDS_PER_DET];
+    int n_prompt = 0;
+
     // Things with gamma
     for (int i = 0 ; i < NUM_LABR_DETECTORS ; ++i){
         for (int j = 0 ; j < event.n_labr[i] ; ++j){
@@ -613,6 +709,7 @@ void UserSort::AnalyzeGammaPPAC(const word_t &de_word, const double &excitation,
             switch ( CheckTimeStatus(tdiff, labr_time_cuts) ) {
                 case is_prompt : {
                     exgam->Fill(energy, excitation);
+                    prompt_energy[n_prompt++] = energy;
                     if (ppac_prompt)
                         exgam_ppac->Fill(energy, excitation);
                     else
@@ -637,6 +734,39 @@ void UserSort::AnalyzeGammaPPAC(const word_t &de_word, const double &excitation,
             }
         }
     }
+    AnalyzeGammaGamma(prompt_energy, n_prompt, excitation);
+}
+
+void UserSort::AnalyzeLaBrPairs(LaBrHit *hits, int n)
+{
+    if (n < 2)
+        return;
+
+    // With the hits in time order, the partners of a hit within the window
+    // follow it directly, and the search stops at the first one outside.
+    std::sort(hits, hits + n, [](const LaBrHit &a, const LaBrHit &b){ return a.time < b.time; });
+
+    const double window = labr_coinc_time[0];
+    for (int i = 0 ; i < n ; ++i){
+        for (int j = i + 1 ; j < n && hits[j].time - hits[i].time <= window ; ++j){
+            if (hits[i].detector != hits[j].detector)
+                gamgam->Fill(hits[i].energy, hits[j].energy);
+        }
+    }
+}
+
+void UserSort::AnalyzeGammaGamma(const double *energy, int n, const double &excitation)
+{
+    if ( !fill_exgamgam )
+        return;
+
+    // Each pair is filled in both orders, so the cube is symmetric in the two LaBr axes.
+    for (int i = 0 ; i < n ; ++i){
+        for (int j = 0 ; j < n ; ++j){
+            if (i != j)
+                exgamgam->Fill(energy[i], energy[j], excitation);
+        }
+    }
 }
 
 